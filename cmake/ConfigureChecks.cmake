@@ -10,6 +10,26 @@ if (ENABLE_LIBKRB5)
 check_include_file("krb5/krb5.h" HAVE_LIBKRB5)
 endif()
 check_include_file("inttypes.h" HAVE_INTTYPES_H)
+if (ENABLE_IO_URING)
+check_include_file("linux/io_uring.h" HAVE_IO_URING)
+if (NOT HAVE_IO_URING)
+message(FATAL_ERROR "ENABLE_IO_URING needs linux/io_uring.h")
+endif()
+endif()
+if (ENABLE_CRYPTO_THREADS)
+find_package(Threads)
+check_include_file("pthread.h" HAVE_CRYPTO_THREADS)
+if (NOT HAVE_CRYPTO_THREADS OR NOT CMAKE_USE_PTHREADS_INIT)
+message(FATAL_ERROR "ENABLE_CRYPTO_THREADS needs pthreads")
+endif()
+endif()
+if (ENABLE_OPENSSL)
+find_package(OpenSSL COMPONENTS Crypto)
+if (NOT OPENSSL_FOUND)
+message(FATAL_ERROR "ENABLE_OPENSSL needs OpenSSL libcrypto")
+endif()
+set(HAVE_OPENSSL 1)
+endif()
 check_include_file("netdb.h" HAVE_NETDB_H)
 check_include_file("netinet/in.h" HAVE_NETINET_IN_H)
 check_include_files("sys/types.h;netinet/tcp.h" HAVE_NETINET_TCP_H)
@@ -24,6 +44,7 @@ if(NOT PS4)
 check_include_file("sys/poll.h" HAVE_SYS_POLL_H)
 endif()
 check_include_file("sys/socket.h" HAVE_SYS_SOCKET_H)
+check_include_file("sys/eventfd.h" HAVE_SYS_EVENTFD_H)
 check_include_file("sys/stat.h" HAVE_SYS_STAT_H)
 check_include_file("sys/types.h" HAVE_SYS_TYPES_H)
 check_include_file("sys/uio.h" HAVE_SYS_UIO_H)
@@ -38,6 +59,10 @@ check_include_file("unistd.h" HAVE_UNISTD_H)
 check_include_file("errno.h" HAVE_ERRNO_H)
 check_include_file("stddef.h" STDC_HEADERS)
 
+include(CheckSymbolExists)
+check_symbol_exists(socketpair sys/socket.h HAVE_SOCKETPAIR)
+check_symbol_exists(clock_gettime time.h HAVE_CLOCK_GETTIME)
+
 include(CheckStructHasMember)
 check_struct_has_member("struct sockaddr" sa_len sys/socket.h HAVE_SOCKADDR_LEN)
 check_struct_has_member("struct sockaddr_storage" ss_family sys/socket.h HAVE_SOCKADDR_STORAGE)
@@ -18,6 +18,15 @@
 /* Whether we use gssapi_krb5 or not */
 #cmakedefine HAVE_LIBKRB5 "@HAVE_LIBKRB5@"
 
+/* Whether we build the io_uring transport backend */
+#cmakedefine HAVE_IO_URING "@HAVE_IO_URING@"
+
+/* Whether SMB3 encryption can use worker threads */
+#cmakedefine HAVE_CRYPTO_THREADS "@HAVE_CRYPTO_THREADS@"
+
+/* Whether the OpenSSL crypto provider is built */
+#cmakedefine HAVE_OPENSSL "@HAVE_OPENSSL@"
+
 /* Define to 1 if you have the <inttypes.h> header file. */
 #cmakedefine HAVE_INTTYPES_H "@HAVE_INTTYPES_H@"
 
@@ -66,6 +75,15 @@
 /* Define to 1 if you have the <sys/socket.h> header file. */
 #cmakedefine HAVE_SYS_SOCKET_H "@HAVE_SYS_SOCKET_H@"
 
+/* Define to 1 if you have the <sys/eventfd.h> header file. */
+#cmakedefine HAVE_SYS_EVENTFD_H "@HAVE_SYS_EVENTFD_H@"
+
+/* Define to 1 if you have the `socketpair' function. */
+#cmakedefine HAVE_SOCKETPAIR "@HAVE_SOCKETPAIR@"
+
+/* Define to 1 if you have the `clock_gettime' function. */
+#cmakedefine HAVE_CLOCK_GETTIME "@HAVE_CLOCK_GETTIME@"
+
 /* Define to 1 if you have the <sys/stat.h> header file. */
 #cmakedefine HAVE_SYS_STAT_H "@HAVE_SYS_STAT_H@"
 
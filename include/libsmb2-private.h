@@ -50,14 +50,30 @@ extern "C" {
 
 #define SMB2_SIGNATURE_SIZE 16
 #define SMB2_KEY_SIZE 16
+/* AES-256 ciphers use 32 byte encryption keys */
+#define SMB2_MAX_KEY_SIZE 32
 
 #define SMB2_MAX_VECTORS 256
 
+/* Most PDUs only need a handful of vectors so we keep a few inline
+ * and only switch to a heap allocated array of SMB2_MAX_VECTORS
+ * entries once those are used up.
+ * When we switch to the heap array the inline entries are moved there
+ * and cleared, so the pointer smb2_add_iovector() returns is only valid
+ * until the next vector is added. To get back to an entry later, keep
+ * its index and go through v->iov[].
+ */
+#define SMB2_INLINE_VECTORS 8
+
 struct smb2_io_vectors {
         size_t num_done;
         size_t total_size;
         int niov;
-        struct smb2_iovec iov[SMB2_MAX_VECTORS];
+        /* either inline_iov or a heap array of SMB2_MAX_VECTORS entries.
+         * NULL until the first vector is added.
+         */
+        struct smb2_iovec *iov;
+        struct smb2_iovec inline_iov[SMB2_INLINE_VECTORS];
 };
 
 struct smb2_async {
@@ -102,7 +118,8 @@ struct smb2_header {
  * States for SMB3 encryption:
  * 1: SMB2_RECV_SPL        SPL
  * 2: SMB2_RECV_HEADER     SMB3 Transform Header
- * 3: SMB2_RECV_TRFM       encrypted payload
+ * 3: SMB2_RECV_TRFM_HEAD  start of the encrypted payload
+ * 4: SMB2_RECV_TRFM       rest of the encrypted payload
  *
  * States for cancelled PDUs
  * This is used when we receive a reply for a PDU not in our waitlist.
@@ -118,6 +135,7 @@ enum smb2_recv_state {
         SMB2_RECV_FIXED,
         SMB2_RECV_VARIABLE,
         SMB2_RECV_PAD,
+        SMB2_RECV_TRFM_HEAD,
         SMB2_RECV_TRFM,
         SMB2_RECV_UNKNOWN,
 };
@@ -130,6 +148,39 @@ enum smb2_recv_state {
 #define MAX_CREDITS 1024
 #define SMB2_SALT_SIZE 32
 
+/* Number of buckets in the table we use to correlate replies with the
+ * requests in the waitqueue. Message ids are handed out sequentially so
+ * using the low bits as the hash spreads a full credit window evenly.
+ * Must be a power of two.
+ */
+#define SMB2_WAITQUEUE_HASH_SIZE MAX_CREDITS
+#define smb2_waitqueue_hash(mid) ((mid) & (SMB2_WAITQUEUE_HASH_SIZE - 1))
+
+/* Maximum number of freed PDUs we keep around per context for reuse. */
+#define SMB2_PDU_CACHE_SIZE 64
+
+/* Large enough for the fixed part of the READ, WRITE, CREATE, CLOSE and
+ * QUERY_INFO requests.
+ */
+#define SMB2_PDU_FIXED_SIZE 56
+
+/* Default size of the per-connection receive buffer. */
+#define SMB2_DEFAULT_RECV_BUFFER_SIZE (64 * 1024)
+
+struct smb2_pdu_queue {
+        struct smb2_pdu *head;
+        struct smb2_pdu *tail;
+};
+
+struct aes_key;                                                /* defined in aes.h */
+struct smb2_key;                                               /* defined in crypto.h */
+struct smb2_aead_ctx;                                          /* defined in crypto.h */
+struct smb3_rx_job;                                            /* defined in smb3-seal.c */
+struct smb3_seal_job;                                          /* defined in smb3-seal.c */
+struct smb2_crypto_pool;                                       /* defined in crypto-pool.c */
+struct smb2_read_ahead;                                        /* defined in read-ahead.c */
+struct smb2_write_behind;                                      /* defined in write-behind.c */
+
 struct sync_cb_data {
 	int is_finished;
 	int status;
@@ -190,10 +241,30 @@ struct smb2_context {
         uint8_t seal:1;
         uint8_t sign:1;
         uint8_t signing_key[SMB2_KEY_SIZE];
-        uint8_t serverin_key[SMB2_KEY_SIZE];
-        uint8_t serverout_key[SMB2_KEY_SIZE];
+        uint8_t serverin_key[SMB2_MAX_KEY_SIZE];
+        uint8_t serverout_key[SMB2_MAX_KEY_SIZE];
+        /* Expanded AES key schedules and crypto provider state for the
+         * keys above. They are allocated as one block, pointed to by
+         * signing_ks, once the keys are derived for SMB 3.x and are NULL
+         * before that.
+         */
+        struct smb2_key *signing_ks;
+        struct smb2_key *serverin_ks;
+        struct smb2_key *serverout_ks;
+        /* Nonce for the next PDU we seal, reset with the keys */
+        uint64_t nonce_counter;
+        /* Spare transmit buffer for sealed PDUs, see smb3_encrypt_pdu() */
+        uint8_t *crypt_buf;
+        size_t crypt_buf_size;
         uint8_t salt[SMB2_SALT_SIZE];
         uint16_t cypher;
+        /* Only offer/accept this cipher, 0 means any supported cipher */
+        uint16_t requested_cypher;
+        /* Negotiated with the SMB 3.1.1 signing capabilities context.
+         * Only AES-GMAC changes anything, otherwise the dialect decides
+         * between HMAC-SHA256 and AES-CMAC.
+         */
+        uint16_t signing_algorithm;
         uint8_t preauthhash[SMB2_PREAUTH_HASH_SIZE];
 
 
@@ -202,23 +273,72 @@ struct smb2_context {
         gss_cred_id_t cred_handle;
 #endif
         /*
-         * For handling received smb3 encrypted blobs
+         * For handling received smb3 encrypted blobs. enc lists where the
+         * decrypted payload is, normally in enc_buf but the data of a READ
+         * reply is decrypted in the buffer of the caller.
+         * See smb3_decrypt_head().
+         */
+        struct smb2_io_vectors enc;
+        uint8_t *enc_buf;
+        size_t enc_buf_size;
+        struct smb2_aead_ctx *dec_ctx;
+        /* Worker threads for large sealed PDUs, see
+         * smb2_set_crypto_threads(). Sealed PDUs that are received while
+         * earlier ones are still being decrypted there wait on the rx
+         * list, in the order they arrived.
          */
-        unsigned char *enc;
-        size_t enc_len;
-        int enc_pos;
+        struct smb2_crypto_pool *crypto_pool;
+        struct smb3_rx_job *rx_head;
+        struct smb3_rx_job *rx_tail;
+        /* See smb2_set_crypto_provider(), NULL for the built in one */
+        const struct smb2_crypto_provider *crypto;
 
         /*
          * For sending PDUs
          */
-        struct smb2_pdu *outqueue;
-        struct smb2_pdu *waitqueue;
+        struct smb2_pdu_queue outqueue;
+        struct smb2_pdu_queue waitqueue;
+        /* PDUs in the waitqueue, hashed by message id. The buckets
+         * are linked through pdu->hash_next/hash_prev.
+         */
+        struct smb2_pdu_queue waitqueue_hash[SMB2_WAITQUEUE_HASH_SIZE];
+        /* queued PDUs that have a timeout, oldest timeout first, linked
+         * through pdu->timeout_next/timeout_prev
+         */
+        struct smb2_pdu_queue timeouts;
+        /* freed PDUs kept for reuse, linked through pdu->next */
+        struct smb2_pdu *pdu_cache;
+        int pdu_cache_len;
+        struct smb2_pdu_cache_stats pdu_cache_stats;
+
+        /* hooks used for all allocations made on behalf of this context */
+        struct smb2_allocator allocator;
 
         /*
          * For receiving PDUs
          */
         struct smb2_io_vectors in;
         enum smb2_recv_state recv_state;
+        /* Data read from the socket that has not been consumed yet.
+         * See smb2_readv_from_socket().
+         */
+        uint8_t *recv_buf;
+        size_t recv_buf_size;
+        size_t recv_buf_pos;
+        size_t recv_buf_len;
+
+        /* Set while the context is serviced by an io_uring */
+        struct smb2_uring_conn *uring;
+        /* How we talk to the server, TCP unless changed with
+         * smb2_set_transport().
+         */
+        const struct smb2_transport *transport;
+        void *transport_opaque;
+        /* State of the current connection for transports that need
+         * more than the fd, transport_opaque is shared by all the
+         * contexts that use the transport.
+         */
+        void *transport_conn;
         /* SPL for the (compound) command we are currently reading */
         uint32_t spl;
         /* buffer to avoid having to malloc the header */
@@ -263,6 +383,17 @@ struct smb2_context {
         uint32_t max_write_size;
         uint16_t dialect;
 
+        /* see smb2_set_split_io() */
+        int split_io;
+        /* handles that read ahead, see smb2_set_read_ahead() */
+        struct smb2_read_ahead *read_aheads;
+        /* handles that buffer writes, see smb2_set_write_behind() */
+        struct smb2_write_behind *write_behinds;
+        /* largest server side copy the server took, 0 until one
+         * was refused, see smb2_copy_range_async()
+         */
+        uint32_t copy_max_batch;
+
         char error_string[MAX_ERROR_SIZE];
         int nterror;
 
@@ -289,6 +420,16 @@ typedef void (*smb2_free_payload)(struct smb2_context *smb2, void *payload);
 
 struct smb2_pdu {
         struct smb2_pdu *next;
+        struct smb2_pdu *prev;
+        /* the outqueue or waitqueue this PDU is linked on, if any */
+        struct smb2_pdu_queue *queue;
+        /* PDUs in the same smb2->waitqueue_hash bucket */
+        struct smb2_pdu *hash_next;
+        struct smb2_pdu *hash_prev;
+        /* PDUs on smb2->timeouts */
+        struct smb2_pdu *timeout_next;
+        struct smb2_pdu *timeout_prev;
+        uint8_t on_timeouts:1;
         struct smb2_header header;
 
         struct smb2_pdu *next_compound;
@@ -301,6 +442,11 @@ struct smb2_pdu {
 
         /* buffer to avoid having to malloc the headers */
         uint8_t hdr[SMB2_HEADER_SIZE];
+        /* buffer to avoid having to malloc the fixed part of the
+         * most common requests, see smb2_add_fixed_iovector()
+         */
+        uint8_t fixed[SMB2_PDU_FIXED_SIZE];
+        uint8_t fixed_used:1;
 
         /* pointer to the unmarshalled payload in a reply */
         void *payload;
@@ -329,6 +475,9 @@ struct smb2_pdu {
         uint8_t seal:1;
         uint32_t crypt_len;
         unsigned char *crypt;
+        size_t crypt_size;
+        /* set while crypt is being filled in on the crypto pool */
+        struct smb3_seal_job *seal_job;
         time_t timeout;
 };
 
@@ -354,7 +503,50 @@ struct smb2dir {
 void smb2_set_nterror(struct smb2_context *smb2, int nterror,
                     const char *error_string, ...);
 
+int smb3_update_preauth_hash(struct smb2_context *smb2, int niov,
+                             struct smb2_iovec *iov);
+
 void smb2_close_connecting_fds(struct smb2_context *smb2);
+void smb2_close_socket(struct smb2_context *smb2);
+
+extern const struct smb2_transport smb2_tcp_transport;
+
+/* In-process connections for smb2_serve_memory_transport(), see
+ * memory-transport.c
+ */
+int smb2_memory_transport_listen(struct smb2_memory_transport *mt,
+                                 int *out_fd);
+int smb2_memory_transport_accept(struct smb2_memory_transport *mt,
+                                 struct smb2_context **out_smb2);
+/* Drops the reference the context holds on its memory transport, if any */
+void smb2_memory_transport_release(struct smb2_context *smb2);
+
+/* Releases the crypto provider state of the signing and encryption keys */
+void smb2_free_keys(struct smb2_context *smb2);
+
+void smb2_derive_key(struct smb2_context *smb2,
+                     uint8_t *derivation_key, uint32_t derivation_key_len,
+                     uint32_t kdf_key_len,
+                     const char *label, uint32_t label_len,
+                     const char *context, uint32_t context_len,
+                     uint8_t *derived_key, uint32_t derived_key_len);
+/* Sets signing_key, serverin_key and serverout_key from the session key */
+void smb2_derive_session_keys(struct smb2_context *smb2,
+                              int cipher_key_size);
+
+void smb2_init_allocator(struct smb2_context *smb2);
+void *smb2_malloc(struct smb2_context *smb2, size_t size);
+void *smb2_calloc(struct smb2_context *smb2, size_t nmemb, size_t size);
+char *smb2_strdup(struct smb2_context *smb2, const char *s);
+void smb2_free(struct smb2_context *smb2, void *ptr);
+void smb2_free_cb(void *ptr);
+void smb2_call_free_cb(struct smb2_context *smb2, void (*free_cb)(void *),
+                       void *ptr);
+
+struct smb2_utf16 *smb2_ctx_utf8_to_utf16(struct smb2_context *smb2,
+                                          const char *utf8);
+const char *smb2_ctx_utf16_to_utf8(struct smb2_context *smb2,
+                                   const uint16_t *utf16, size_t utf16_len);
 
 void *smb2_alloc_init(struct smb2_context *smb2, size_t size);
 void *smb2_alloc_data(struct smb2_context *smb2, void *memctx, size_t size);
@@ -372,6 +564,9 @@ int smb2_disconnect_tree_id(struct smb2_context *smb2, uint32_t tree_id);
 struct smb2_pdu *smb2_allocate_pdu(struct smb2_context *smb2,
                                    enum smb2_command command,
                                    smb2_command_cb cb, void *cb_data);
+struct smb2_iovec *smb2_add_fixed_iovector(struct smb2_context *smb2,
+                                           struct smb2_pdu *pdu, size_t len);
+void smb2_free_pdu_cache(struct smb2_context *smb2);
 int smb2_process_payload_fixed(struct smb2_context *smb2,
                                struct smb2_pdu *pdu);
 int smb2_process_payload_variable(struct smb2_context *smb2,
@@ -379,6 +574,9 @@ int smb2_process_payload_variable(struct smb2_context *smb2,
 int smb2_get_fixed_size(struct smb2_context *smb2, struct smb2_pdu *pdu);
 
 struct smb2_pdu *smb2_find_pdu(struct smb2_context *smb2, uint64_t message_id);
+void smb2_outqueue_remove(struct smb2_context *smb2, struct smb2_pdu *pdu);
+void smb2_waitqueue_add(struct smb2_context *smb2, struct smb2_pdu *pdu);
+void smb2_waitqueue_remove(struct smb2_context *smb2, struct smb2_pdu *pdu);
 void smb2_free_iovector(struct smb2_context *smb2, struct smb2_io_vectors *v);
 
 void smb2_oplock_break_notify(struct smb2_context *smb2, int status, void *command_data, void *cb_data);
@@ -656,6 +854,43 @@ int dcerpc_pdu_direction(struct dcerpc_pdu *pdu);
 
 int dcerpc_align_3264(struct dcerpc_context *ctx, int offset);
 
+struct smb2fh {
+        smb2_command_cb cb;
+        void *cb_data;
+
+        smb2_file_id file_id;
+        int64_t offset;
+        int64_t end_of_file;
+
+        /* the lease that the handle was opened with, if any */
+        int has_lease;
+        smb2_lease_key lease_key;
+        /* see smb2_set_read_ahead() */
+        struct smb2_read_ahead *ra;
+        /* see smb2_set_write_behind() */
+        struct smb2_write_behind *wb;
+};
+
+/* Largest READ or WRITE that the credits we have allow */
+uint32_t smb2_max_io_size(struct smb2_context *smb2, uint32_t max_size);
+
+/* READ and WRITE that scatter/gather the data, see smb2-cmd-read.c
+ * and smb2-cmd-write.c
+ */
+struct smb2_pdu *smb2_cmd_readv_async(struct smb2_context *smb2,
+                                      struct smb2_read_request *req,
+                                      const struct iovec *iov, int iovcnt,
+                                      smb2_command_cb cb, void *cb_data);
+struct smb2_pdu *smb2_cmd_writev_async(struct smb2_context *smb2,
+                                       struct smb2_write_request *req,
+                                       const struct iovec *iov, int iovcnt,
+                                       smb2_command_cb cb, void *cb_data);
+
+int smb2_fh_break_matches(struct smb2fh *fh,
+                          struct smb2_oplock_or_lease_break_reply *rep);
+
+uint64_t smb2_monotonic_usec(void);
+
 struct connect_data;                                           /* defined in libsmb2.c */
 void free_c_data(struct smb2_context*, struct connect_data*);  /* defined in libsmb2.c */
 
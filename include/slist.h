@@ -49,6 +49,39 @@
 	   (*list) = head;					\
 	}
 
+/* Doubly linked list with a tail pointer, for queues where items are
+ * appended at the end and can be removed from anywhere in O(1).
+ * (queue) must have head and tail members and (item) must have next and
+ * prev members.
+ */
+#define SMB2_DLIST_ADD_END(queue, item) \
+	do {							\
+		(item)->next = NULL;				\
+		(item)->prev = (queue)->tail;			\
+		if ((queue)->tail) {				\
+			(queue)->tail->next = (item);		\
+		} else {					\
+			(queue)->head = (item);			\
+		}						\
+		(queue)->tail = (item);				\
+	} while (0);
+
+#define SMB2_DLIST_REMOVE(queue, item) \
+	do {							\
+		if ((item)->prev) {				\
+			(item)->prev->next = (item)->next;	\
+		} else {					\
+			(queue)->head = (item)->next;		\
+		}						\
+		if ((item)->next) {				\
+			(item)->next->prev = (item)->prev;	\
+		} else {					\
+			(queue)->tail = (item)->prev;		\
+		}						\
+		(item)->next = NULL;				\
+		(item)->prev = NULL;				\
+	} while (0);
+
 #define SMB2_LIST_LENGTH(list, length) \
 	do { \
 	    (length) = 0; \
@@ -155,6 +155,42 @@ void smb2_close_context(struct smb2_context *smb2);
  */
 void smb2_destroy_context(struct smb2_context *smb2);
 
+/*
+ * Memory allocation hooks.
+ * All memory that libsmb2 allocates internally goes through these hooks.
+ * opaque is passed unchanged to every hook.
+ */
+struct smb2_allocator {
+        void *(*malloc)(size_t size, void *opaque);
+        void *(*calloc)(size_t nmemb, size_t size, void *opaque);
+        void (*free)(void *ptr, void *opaque);
+        void *opaque;
+};
+
+/*
+ * Set the allocator to use.
+ *
+ * If smb2 is NULL this sets the global allocator which is used for the
+ * smb2_context structure itself, as the initial allocator of new contexts
+ * and for allocations that are not tied to a context.
+ * The global allocator must be set before any context is created and must
+ * not be changed while any context exists.
+ *
+ * If smb2 is not NULL this sets the allocator for all allocations made for
+ * that context. It must be called right after smb2_init_context(), before
+ * the context is connected or any command is queued.
+ *
+ * Passing NULL as allocator restores the default malloc()/calloc()/free().
+ *
+ * Returns:
+ *  0        : Success.
+ *  -EINVAL  : A hook is missing.
+ *  -EBUSY   : The context is already in use.
+ *  -ENOMEM  : Failed to move the context strings to the new allocator.
+ */
+int smb2_set_allocator(struct smb2_context *smb2,
+                       const struct smb2_allocator *allocator);
+
 /*
  * Get the list of currently allocated contexts
  */
@@ -166,6 +202,24 @@ struct smb2_context *smb2_active_contexts(void);
  */
 int smb2_context_active(struct smb2_context *smb2);
 
+/*
+ * Each context keeps a small cache of freed PDUs and the buffers for the
+ * fixed part of the most common requests so that they can be reused
+ * without going through malloc()/free().
+ * These counters show how effective that cache is.
+ */
+struct smb2_pdu_cache_stats {
+        /* PDUs taken from / not found in the cache */
+        uint64_t pdu_hits;
+        uint64_t pdu_misses;
+        /* request buffers served from the PDU / allocated separately */
+        uint64_t buf_hits;
+        uint64_t buf_misses;
+};
+
+void smb2_get_pdu_cache_stats(struct smb2_context *smb2,
+                              struct smb2_pdu_cache_stats *stats);
+
 /*
  * EVENT SYSTEM INTEGRATION
  * ========================
@@ -269,6 +323,310 @@ int smb2_service_fd(struct smb2_context *smb2, t_socket fd, int revents);
  */
 void smb2_set_timeout(struct smb2_context *smb2, int seconds);
 
+/*
+ * Set the size of the buffer used to receive data from the socket.
+ * Several replies can then be picked up with a single read from the
+ * socket while large READ payloads are still received directly into the
+ * buffer of the application.
+ * A size of 0 disables the buffer and reads only what is needed for the
+ * current reply.
+ *
+ * Default is 64kB.
+ *
+ * Returns:
+ *  0      : success.
+ * -EBUSY  : the buffer still holds data that has not been processed yet
+ *           or the context is attached to an io_uring.
+ */
+int smb2_set_recv_buffer_size(struct smb2_context *smb2, size_t size);
+
+/*
+ * Use <nthreads> worker threads to seal and unseal large PDUs of a sealed
+ * session, instead of doing all the AES work on the thread that calls
+ * smb2_service(). Several large READs or WRITEs that are in flight at the
+ * same time are then encrypted and decrypted in parallel.
+ * Replies are still processed, and callbacks still invoked, on the
+ * thread that calls smb2_service() and in the order they arrived.
+ * 0 stops the threads and does everything on the calling thread again.
+ *
+ * Only available when libsmb2 is built with --enable-crypto-threads
+ * (ENABLE_CRYPTO_THREADS for cmake), otherwise this fails with ENOSYS.
+ *
+ * Default is 0.
+ *
+ * Returns:
+ *  0      : success.
+ * -EBUSY  : PDUs are being sealed or unsealed on the current threads.
+ * -EINVAL : nthreads is negative.
+ * <0      : -errno, the threads could not be started.
+ */
+int smb2_set_crypto_threads(struct smb2_context *smb2, int nthreads);
+
+/*
+ * Crypto providers.
+ * A provider supplies its own implementation of the cryptographic
+ * primitives that SMB2/3 signing, encryption and NTLMSSP use, for example
+ * one that is optimized for the cpu. Anything the provider does not
+ * implement falls back to the implementation built into libsmb2: each
+ * function pointer may be NULL and each init function may return NULL.
+ *
+ * State returned by an init function is passed to the update functions
+ * and released by the final function. Operations on different state may
+ * be called from different threads at the same time, see
+ * smb2_set_crypto_threads().
+ *
+ * aead_init, hash_init and key_init get buf, SMB2_CRYPTO_STATE_SIZE bytes
+ * that are suitably aligned for any type and stay valid until the
+ * operation ends or the key is freed. A provider can keep its state there
+ * and return buf so that nothing needs to be allocated for each message.
+ *
+ * key_init is called once for each signing and encryption key when the
+ * keys of a session are derived, and key_free when they are discarded.
+ * It returns state that holds whatever can be prepared once for all the
+ * messages with the key, for example the expanded key, or NULL. That
+ * state is passed as key_state to aead_init and hash_init for the
+ * operations with the key and is NULL for all other operations. Several
+ * operations with the same key may be in progress at the same time.
+ */
+#define SMB2_CRYPTO_AES_CMAC     1
+#define SMB2_CRYPTO_AES_GMAC     2
+#define SMB2_CRYPTO_HMAC_SHA256  3
+#define SMB2_CRYPTO_SHA512       4
+#define SMB2_CRYPTO_MD4          5
+#define SMB2_CRYPTO_HMAC_MD5     6
+
+#define SMB2_CRYPTO_STATE_SIZE   256
+
+struct smb2_crypto_provider {
+        const char *name;
+        /*
+         * AES-CCM or AES-GCM, cipher is one of SMB2_ENCRYPTION_AES_*.
+         * The nonce is 11 bytes for CCM and 12 bytes for GCM, len is the
+         * total length of the data that is passed to aead_update.
+         * aead_update may be called with in == out.
+         * aead_final writes the 16 byte tag when encrypting, and checks it
+         * when decrypting. It returns 0 on success and -1 if the tag
+         * does not match.
+         * aead_free releases the state of an operation that is abandoned
+         * before aead_final.
+         */
+        void *(*aead_init)(void *key_state, void *buf, uint16_t cipher,
+                           const uint8_t *key, size_t key_len,
+                           const uint8_t *nonce,
+                           const uint8_t *aad, size_t aad_len,
+                           size_t len, int encrypt);
+        void (*aead_update)(void *state, const uint8_t *in, uint8_t *out,
+                            size_t len);
+        int (*aead_final)(void *state, uint8_t *tag);
+        void (*aead_free)(void *state);
+        /*
+         * Hashes and MACs, alg is one of SMB2_CRYPTO_*. The key is NULL
+         * for plain hashes, the AES key for CMAC and GMAC. nonce is the
+         * 12 byte GMAC nonce and NULL otherwise.
+         * hash_final writes the hash or the MAC: 16 bytes for the AES
+         * MACs, MD4 and HMAC-MD5, 32 for HMAC-SHA256 and 64 for SHA512.
+         */
+        void *(*hash_init)(void *key_state, void *buf, int alg,
+                           const uint8_t *key, size_t key_len,
+                           const uint8_t *nonce);
+        void (*hash_update)(void *state, const uint8_t *data, size_t len);
+        void (*hash_final)(void *state, uint8_t *out);
+        /* The per key state, both may be NULL */
+        void *(*key_init)(void *buf, const uint8_t *key, size_t key_len);
+        void (*key_free)(void *key_state);
+};
+
+/*
+ * Use the crypto provider for the context. The provider must stay valid
+ * for as long as the context uses it. Operations that are in progress
+ * finish with the provider that they were started with.
+ * Passing NULL selects the implementation built into libsmb2.
+ * Keys that are already derived keep the state of the provider that they
+ * were derived with, the new provider gets NULL as key_state for them.
+ *
+ * Default is NULL.
+ */
+void smb2_set_crypto_provider(struct smb2_context *smb2,
+                              const struct smb2_crypto_provider *provider);
+
+/*
+ * Returns the crypto provider of the context, NULL if the built in
+ * implementation is used.
+ */
+const struct smb2_crypto_provider *
+smb2_get_crypto_provider(struct smb2_context *smb2);
+
+/*
+ * A provider that uses the OpenSSL libcrypto.
+ * Only available when libsmb2 is built with --with-openssl (ENABLE_OPENSSL
+ * for cmake), otherwise this returns NULL.
+ */
+const struct smb2_crypto_provider *smb2_openssl_crypto_provider(void);
+
+/*
+ * io_uring backend.
+ * Only available on Linux when libsmb2 is built with --enable-io-uring
+ * (ENABLE_IO_URING for cmake), otherwise these functions fail with ENOSYS.
+ *
+ * Instead of polling the socket and calling smb2_service(), contexts can
+ * be attached to an io_uring. The sends and receives for all their PDUs are
+ * then submitted to the ring and smb2_service_uring() waits for and
+ * processes the completions. One ring can service many contexts.
+ */
+struct smb2_uring;
+
+/*
+ * Create a ring with room for <entries> submissions.
+ *
+ * Returns NULL and sets errno on failure.
+ */
+struct smb2_uring *smb2_uring_init(unsigned int entries);
+
+/*
+ * Detach all contexts from the ring and free it.
+ */
+void smb2_uring_destroy(struct smb2_uring *ring);
+
+/*
+ * Attach a context to the ring. This can be done before or after the
+ * context is connected. While attached the context must not be serviced
+ * with smb2_service().
+ *
+ * If servicing the context fails it is detached from the ring and cb is
+ * invoked with status -1, smb2_get_error() describes the failure.
+ * As when smb2_service() fails the context can then only be destroyed.
+ *
+ * Returns:
+ *  0      : success.
+ * -EBUSY  : the context is already attached to a ring.
+ * -EINVAL : the context does not use the TCP transport.
+ * -ENOMEM : out of memory.
+ */
+int smb2_uring_add_context(struct smb2_uring *ring, struct smb2_context *smb2,
+                           smb2_command_cb cb, void *cb_data);
+
+/*
+ * Detach a context from its ring. Any I/O in flight is cancelled.
+ * This is done automatically by smb2_destroy_context().
+ */
+int smb2_uring_remove_context(struct smb2_context *smb2);
+
+/*
+ * Submit the pending I/O of all contexts on the ring and process the
+ * completions. Waits up to <timeout> milliseconds for a completion,
+ * -1 waits forever and 0 does not wait at all.
+ * If you use timeouts with the async API you must make sure to call
+ * smb2_service_uring() at least once every second.
+ *
+ * Returns:
+ *  0      : success.
+ * <0      : -errno, the ring failed and can no longer be used.
+ */
+int smb2_service_uring(struct smb2_uring *ring, int timeout);
+
+/*
+ * Transport.
+ * By default libsmb2 talks to the server over TCP. An application can
+ * replace this with its own transport, for example to tunnel the
+ * connection or to run client and server in the same process.
+ * opaque is the pointer passed to smb2_set_transport().
+ *
+ * connect : Start connecting to <server>, the string that was passed to
+ *           smb2_connect_share() or smb2_connect_share_async().
+ *           On success set *fd to the descriptor the application should
+ *           poll and return 0. The fd must become writable once the
+ *           connection is established and readable whenever readv() has
+ *           data or the connection was closed.
+ *           On failure set the error with smb2_set_error() and return
+ *           -errno.
+ * readv   : Like readv(2). Returns the number of bytes read, 0 when the
+ *           connection was closed or -1 and sets errno. EAGAIN means there
+ *           is no data right now.
+ * writev  : Like writev(2). Returns the number of bytes written or -1 and
+ *           sets errno. EAGAIN means nothing can be written right now.
+ * close   : Close fd, which is either the fd returned by connect or, for
+ *           server contexts, the fd the context was created with.
+ */
+struct iovec;
+
+struct smb2_transport {
+        int (*connect)(struct smb2_context *smb2, const char *server,
+                       t_socket *fd, void *opaque);
+        ssize_t (*readv)(struct smb2_context *smb2, const struct iovec *iov,
+                         int iovcnt, void *opaque);
+        ssize_t (*writev)(struct smb2_context *smb2, const struct iovec *iov,
+                          int iovcnt, void *opaque);
+        void (*close)(struct smb2_context *smb2, t_socket fd, void *opaque);
+};
+
+/*
+ * Set the transport to use for the context. The transport must stay valid
+ * for as long as the context uses it.
+ * Passing NULL as transport restores TCP.
+ * A context with a transport other than TCP can not be attached to an
+ * io_uring.
+ *
+ * Returns:
+ *  0        : Success.
+ *  -EINVAL  : A function is missing.
+ *  -EBUSY   : The context is connected or connecting.
+ */
+int smb2_set_transport(struct smb2_context *smb2,
+                       const struct smb2_transport *transport, void *opaque);
+
+/*
+ * In-process memory transport.
+ * Connects client contexts directly to the server contexts of a
+ * smb2_serve_memory_transport() running in the same process, without any
+ * networking.
+ * The data is passed through buffers in memory and only a pollable fd
+ * (an eventfd where available) is used to signal that data is available.
+ * This is useful for measuring the CPU cost of libsmb2 itself and for
+ * tests that must not depend on the network.
+ *
+ * Like everything else in libsmb2 this is not thread safe, the client
+ * contexts have to be serviced from the same thread as the server. As
+ * smb2_serve_memory_transport() services every active context this happens
+ * automatically for clients that use the async API.
+ *
+ * Only available where the platform has eventfd() or socketpair(),
+ * otherwise smb2_memory_transport_init() fails with ENOSYS.
+ */
+struct smb2_memory_transport;
+
+/*
+ * Create a memory transport.
+ *
+ * Returns NULL and sets errno on failure.
+ */
+struct smb2_memory_transport *smb2_memory_transport_init(void);
+
+/*
+ * Free the memory transport. Connections that were already accepted by
+ * the server stay valid, client contexts that use the transport can no
+ * longer connect through it. The memory is released once the last of
+ * those contexts has been destroyed or given another transport.
+ */
+void smb2_memory_transport_destroy(struct smb2_memory_transport *mt);
+
+/*
+ * Make the client context connect through the memory transport.
+ * The server argument of smb2_connect_share*() is only used as the name
+ * of the server in the tree connect.
+ *
+ * Returns:
+ *  0        : Success.
+ *  -EBUSY   : The context is connected or connecting.
+ */
+int smb2_set_memory_transport(struct smb2_context *smb2,
+                              struct smb2_memory_transport *mt);
+
+/*
+ * Stop accepting connections. A smb2_serve_memory_transport() that serves
+ * this transport returns -ESHUTDOWN on its next iteration.
+ */
+void smb2_memory_transport_shutdown(struct smb2_memory_transport *mt);
+
 /*
  * Set passthrough-enable.  Passthrough allows command packers
  * and unpackers to keep the extra data on complex commands
@@ -358,6 +716,19 @@ void smb2_set_seal(struct smb2_context *smb2, int val);
  */
 void smb2_set_sign(struct smb2_context *smb2, int val);
 
+/*
+ * Restrict smb3 encryption to a single cipher, one of
+ * SMB2_ENCRYPTION_AES_128_CCM, SMB2_ENCRYPTION_AES_128_GCM,
+ * SMB2_ENCRYPTION_AES_256_CCM or SMB2_ENCRYPTION_AES_256_GCM.
+ * 0 : offer/accept any supported cipher. This is the default.
+ *
+ * The AES-256 ciphers and GCM require SMB 3.1.1. If encryption is enabled
+ * and the connection can not use the requested cipher it will fail.
+ *
+ * Returns 0 on success or -EINVAL for an unknown cipher.
+ */
+int smb2_set_cipher(struct smb2_context *smb2, uint16_t cipher);
+
 enum smb2_sec {
         SMB2_SEC_UNDEFINED = 0,
         SMB2_SEC_NTLMSSP,
@@ -928,6 +1299,169 @@ int smb2_pwrite_async(struct smb2_context *smb2, struct smb2fh *fh,
 int smb2_pwrite(struct smb2_context *smb2, struct smb2fh *fh,
                 const uint8_t *buf, uint32_t count, uint64_t offset);
 
+/*
+ * Async pread()/pwrite() of any size.
+ * The request is split into as many READ or WRITE PDUs as it takes, each
+ * one as large as max_read_size/max_write_size and the credits allow.
+ * All of them are queued at once and are sent as credits are granted.
+ * The callback is invoked once, after the last one has completed, with
+ * the same arguments as for smb2_pread_async()/smb2_pwrite_async().
+ *
+ * The status is the number of bytes that were transferred from the start
+ * of the buffer up to the first short segment, so end of file is
+ * reported as a short read. An error is only reported if nothing could
+ * be transferred.
+ * At most 2GB - 1 can be transferred in one call.
+ */
+int smb2_pread_split_async(struct smb2_context *smb2, struct smb2fh *fh,
+                           uint8_t *buf, uint32_t count, uint64_t offset,
+                           smb2_command_cb cb, void *cb_data);
+
+int smb2_pwrite_split_async(struct smb2_context *smb2, struct smb2fh *fh,
+                            const uint8_t *buf, uint32_t count,
+                            uint64_t offset,
+                            smb2_command_cb cb, void *cb_data);
+
+/*
+ * Async preadv()/pwritev().
+ * Like smb2_pread_split_async()/smb2_pwrite_split_async() but the data
+ * is scattered into or gathered from iovcnt buffers, in order, as if
+ * they were one buffer at offset. The data goes straight between the
+ * buffers and the socket, there is no copy into one contiguous buffer.
+ * The array of iovecs can be freed once the call returns, the buffers
+ * must stay until the callback is invoked.
+ *
+ * In the smb2_read_cb_data/smb2_write_cb_data that is passed to the
+ * callback, count is the total of the buffers and buf is only set if
+ * iovcnt is 1.
+ */
+int smb2_preadv_async(struct smb2_context *smb2, struct smb2fh *fh,
+                      const struct iovec *iov, int iovcnt, uint64_t offset,
+                      smb2_command_cb cb, void *cb_data);
+
+int smb2_pwritev_async(struct smb2_context *smb2, struct smb2fh *fh,
+                       const struct iovec *iov, int iovcnt, uint64_t offset,
+                       smb2_command_cb cb, void *cb_data);
+
+/*
+ * Sync preadv()/pwritev()
+ * Returns the number of bytes transferred or -errno.
+ */
+int smb2_preadv(struct smb2_context *smb2, struct smb2fh *fh,
+                const struct iovec *iov, int iovcnt, uint64_t offset);
+
+int smb2_pwritev(struct smb2_context *smb2, struct smb2fh *fh,
+                 const struct iovec *iov, int iovcnt, uint64_t offset);
+
+struct smb2_copy_range_cb_data {
+        struct smb2fh *src;
+        uint64_t src_offset;
+        struct smb2fh *dst;
+        uint64_t dst_offset;
+        /* number of bytes that were copied */
+        uint64_t count;
+};
+
+/*
+ * Async server side copy.
+ * Copies count bytes from src_offset in src to dst_offset in dst without
+ * the data passing through the client, using FSCTL_SRV_COPYCHUNK_WRITE.
+ * Both handles must have been opened on this context, src for reading
+ * and dst for writing.
+ * The copy is sent as several IOCTLs that are in flight at the same
+ * time. Writes that are buffered by write-behind on either handle are
+ * flushed first.
+ *
+ * Returns
+ *  0     : The operation was initiated. The result of the operation will
+ *          be reported through the callback function.
+ * -errno : There was an error. The callback function will not be invoked.
+ *
+ * When the callback is invoked, status indicates the result:
+ *      0 : Success. Command_data is a struct smb2_copy_range_cb_data
+ *          and count is the number of bytes that were copied.
+ *          It is less than requested if the copy ended early, for
+ *          example at the end of the source file or on an error after
+ *          some of the data had been copied. Data past count may still
+ *          have been written to dst.
+ * -errno : An error occurred before any data was copied, for example
+ *          -EINVAL if the server does not support server side copy.
+ */
+int smb2_copy_range_async(struct smb2_context *smb2,
+                          struct smb2fh *src, uint64_t src_offset,
+                          struct smb2fh *dst, uint64_t dst_offset,
+                          uint64_t count, smb2_command_cb cb, void *cb_data);
+
+/*
+ * Sync server side copy.
+ * Returns the number of bytes that were copied or -errno.
+ */
+int64_t smb2_copy_range(struct smb2_context *smb2,
+                        struct smb2fh *src, uint64_t src_offset,
+                        struct smb2fh *dst, uint64_t dst_offset,
+                        uint64_t count);
+
+/*
+ * Make smb2_pread_async(), smb2_pwrite_async() and everything built on
+ * them, such as smb2_pread(), smb2_read() and smb2_write(), behave like
+ * smb2_pread_split_async()/smb2_pwrite_split_async() for requests that
+ * do not fit in one PDU, instead of transferring only the first part.
+ *
+ * Default is 0: requests are truncated to what fits in one PDU.
+ */
+void smb2_set_split_io(struct smb2_context *smb2, int enable);
+
+/*
+ * Read ahead on a file handle that is read sequentially.
+ *
+ * Once reads on fh follow each other, the data that follows is read
+ * ahead in PDUs of up to max_read_size bytes, using at most max_bytes
+ * of memory, and smb2_pread_async()/smb2_read_async() are served from
+ * there. How far ahead is read depends on how fast the application
+ * consumes the data and on the round trip time to the server.
+ * Reads elsewhere in the file are sent as usual.
+ *
+ * A read that is served from data that has already arrived invokes its
+ * callback before smb2_pread_async() returns.
+ * Writes and truncates through fh, and a break of the oplock or lease
+ * that fh was opened with, drop the data that was read ahead.
+ * Changes that others make to the file are not seen until then.
+ *
+ * max_bytes 0 turns read-ahead off. This is the default.
+ *
+ * Returns 0 on success, -EBUSY if reads are still waiting for the
+ * read-ahead, or -errno.
+ */
+int smb2_set_read_ahead(struct smb2_context *smb2, struct smb2fh *fh,
+                        uint32_t max_bytes);
+
+/*
+ * Buffer the writes to a file handle.
+ *
+ * smb2_pwrite_async()/smb2_write_async() copy the data into buffers of
+ * up to max_write_size bytes, using at most max_bytes of memory, and
+ * invoke their callback right away, before they return. Writes that are
+ * adjacent to or overlap the buffer being filled are merged into it.
+ * A buffer is sent once it is full, once a write lands elsewhere in the
+ * file, once it holds data older than max_delay_ms, checked whenever
+ * smb2_service() runs, or on a break of the oplock or lease the handle
+ * was opened with. Several buffers are in flight at a time. Once all
+ * buffers are in use, writes wait for one to complete.
+ *
+ * smb2_fsync(), smb2_close() and smb2_ftruncate() first wait for the
+ * buffered writes, as do reads of data that is still buffered.
+ *
+ * If a buffered write fails, the error is returned by the next write,
+ * fsync or close of the handle, or by turning the buffering off.
+ *
+ * max_bytes 0 turns buffering off. This is the default.
+ * max_delay_ms 0 means there is no time limit.
+ *
+ * Returns 0 on success, -EBUSY if writes are still buffered, or -errno.
+ */
+int smb2_set_write_behind(struct smb2_context *smb2, struct smb2fh *fh,
+                          uint32_t max_bytes, uint32_t max_delay_ms);
+
 /*
  * READ
  */
@@ -1283,12 +1817,14 @@ struct smb2_utf16 {
 };
 
 /* Returns a string converted to UTF-16 format. Use free() to release
- * the utf16 string.
+ * the utf16 string, or the free hook if a global allocator was installed
+ * with smb2_set_allocator().
  */
 struct smb2_utf16 *smb2_utf8_to_utf16(const char *utf8);
 
 /* Returns a string converted to UTF8 format. Use free() to release
- * the utf8 string.
+ * the utf8 string, or the free hook if a global allocator was installed
+ * with smb2_set_allocator().
  */
 const char *smb2_utf16_to_utf8(const uint16_t *str, size_t len);
 
@@ -1393,6 +1929,18 @@ int smb2_serve_port_async(const int fd, const int to_msecs, struct smb2_context
  */
 int smb2_serve_port(struct smb2_server *server, const int max_connections, smb2_client_connection cb, void *cb_data);
 
+/*
+ * Like smb2_serve_port() but accepts the in-process connections of a
+ * memory transport instead of listening on server->port.
+ *
+ * Returns
+ * -ESHUTDOWN : smb2_memory_transport_shutdown() was called
+ * -errno     : There was an error causing server loop to exit
+ */
+int smb2_serve_memory_transport(struct smb2_server *server,
+                                struct smb2_memory_transport *mt,
+                                smb2_client_connection cb, void *cb_data);
+
 /*
  * Some symbols have moved over to a different header file to allow better
  * separation between dcerpc and smb2, so we need to include this header
@@ -106,6 +106,12 @@ enum smb2_command {
 
 #define SMB2_ENCRYPTION_AES_128_CCM        0x0001
 #define SMB2_ENCRYPTION_AES_128_GCM        0x0002
+#define SMB2_ENCRYPTION_AES_256_CCM        0x0003
+#define SMB2_ENCRYPTION_AES_256_GCM        0x0004
+
+#define SMB2_SIGNING_HMAC_SHA256           0x0000
+#define SMB2_SIGNING_AES_CMAC              0x0001
+#define SMB2_SIGNING_AES_GMAC              0x0002
 
 #define SMB2_NEGOTIATE_MAX_DIALECTS 10
 
@@ -1035,6 +1041,45 @@ struct  smb2_ioctl_validate_negotiate_info {
         uint16_t dialect;
 };
 
+/*
+ * Server side copy, 2.2.31.1 and 2.2.32.1 of [MS-SMB2].
+ * The server decodes the input of FSCTL_SRV_COPYCHUNK(_WRITE) into a
+ * struct smb2_srv_copychunk_copy and encodes a struct
+ * smb2_srv_request_resume_key or smb2_srv_copychunk_response as the
+ * output, unless passthrough is set.
+ */
+#define SMB2_RESUME_KEY_SIZE 24
+
+#define SMB2_SRV_REQUEST_RESUME_KEY_SIZE 28
+
+struct smb2_srv_request_resume_key {
+        uint8_t resume_key[SMB2_RESUME_KEY_SIZE];
+};
+
+#define SMB2_SRV_COPYCHUNK_SIZE 24
+
+struct smb2_srv_copychunk {
+        uint64_t source_offset;
+        uint64_t target_offset;
+        uint32_t length;
+};
+
+#define SMB2_SRV_COPYCHUNK_COPY_SIZE 32
+
+struct smb2_srv_copychunk_copy {
+        uint8_t source_key[SMB2_RESUME_KEY_SIZE];
+        uint32_t chunk_count;
+        struct smb2_srv_copychunk *chunks;
+};
+
+#define SMB2_SRV_COPYCHUNK_RESPONSE_SIZE 12
+
+struct smb2_srv_copychunk_response {
+        uint32_t chunks_written;
+        uint32_t chunk_bytes_written;
+        uint32_t total_bytes_written;
+};
+
 #define SMB2_CHANGE_NOTIFY_FILE_NOTIFY_CHANGE_FILE_NAME    0x00000001
 #define SMB2_CHANGE_NOTIFY_FILE_NOTIFY_CHANGE_DIR_NAME     0x00000002
 #define SMB2_CHANGE_NOTIFY_FILE_NOTIFY_CHANGE_ATTRIBUTES   0x00000004
@@ -18,16 +18,62 @@
 
 #include "aes.h"
 
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
 #ifdef __APPLE__
 #include "aes_apple.h"
-#else
-#include "aes_reference.h"
 #endif
+#include "aes_reference.h"
+#include "aes_hw.h"
 
 void AES128_ECB_encrypt(uint8_t* input, const uint8_t* key, uint8_t *output) {
+        struct aes_key ks;
+
+        if (AES_hw_available()) {
+                AES_init_key(&ks, key, 16);
+                AES_ECB_encrypt_blocks_hw(ks.round_keys, ks.rounds,
+                                          input, output, 1);
+                return;
+        }
+#ifdef __APPLE__
+        AES128_ECB_encrypt_apple(input, key, output);
+#else
+        AES128_ECB_encrypt_reference(input, key, output);
+#endif
+}
+
+void AES256_ECB_encrypt(uint8_t* input, const uint8_t* key, uint8_t *output) {
+        struct aes_key ks;
+
+        if (AES_hw_available()) {
+                AES_init_key(&ks, key, 32);
+                AES_ECB_encrypt_blocks_hw(ks.round_keys, ks.rounds,
+                                          input, output, 1);
+                return;
+        }
 #ifdef __APPLE__
-AES128_ECB_encrypt_apple(input, key, output);
+        AES256_ECB_encrypt_apple(input, key, output);
 #else
-AES128_ECB_encrypt_reference(input, key, output);
+        AES256_ECB_encrypt_reference(input, key, output);
 #endif
 }
+
+void AES_init_key(struct aes_key *ks, const uint8_t *key, size_t key_len) {
+        ks->rounds = AES_expand_key_reference(key, (uint32_t)key_len,
+                                              ks->round_keys);
+        memcpy(ks->key, key, key_len);
+        ks->key_len = key_len;
+}
+
+void AES_ECB_encrypt_blocks(const struct aes_key *ks, const uint8_t *input,
+                            uint8_t *output, size_t nblocks) {
+        if (AES_hw_available()) {
+                AES_ECB_encrypt_blocks_hw(ks->round_keys, ks->rounds,
+                                          input, output, nblocks);
+                return;
+        }
+        AES_ECB_encrypt_blocks_reference(ks->round_keys, ks->rounds,
+                                         input, output, nblocks);
+}
@@ -24,6 +24,31 @@
 
 #include "compat.h"
 
+#include <stddef.h>
+
 void AES128_ECB_encrypt(uint8_t* input, const uint8_t* key, uint8_t *output);
+void AES256_ECB_encrypt(uint8_t* input, const uint8_t* key, uint8_t *output);
+
+/*
+ * An expanded AES-128 or AES-256 key. Expanding the key once and reusing
+ * it avoids redoing the key schedule for every block.
+ * The key itself is kept as well for crypto providers that do their own
+ * key schedule, see smb2_set_crypto_provider().
+ */
+struct aes_key {
+        uint8_t round_keys[240];
+        int rounds;
+        uint8_t key[32];
+        size_t key_len;
+};
+
+void AES_init_key(struct aes_key *ks, const uint8_t *key, size_t key_len);
+
+/*
+ * Encrypts nblocks independent 16 byte blocks. Uses the AES instructions
+ * of the cpu when available. input and output may be the same buffer.
+ */
+void AES_ECB_encrypt_blocks(const struct aes_key *ks, const uint8_t *input,
+                            uint8_t *output, size_t nblocks);
 
 #endif
@@ -34,8 +34,9 @@
 
 #include "portable-endian.h"
 #include "aes.h"
+#include "aes128ccm.h"
 
-static void aes_ccm_generate_b0(unsigned char *nonce, size_t nlen,
+static void aes_ccm_generate_b0(const unsigned char *nonce, size_t nlen,
                                 size_t alen, size_t plen, size_t mlen,
                                 unsigned char *buf)
 {
@@ -53,26 +54,98 @@ static void aes_ccm_generate_b0(unsigned char *nonce, size_t nlen,
         memcpy(&buf[1], nonce, nlen);
 }
 
-static inline void bxory(unsigned char *b, unsigned char *y, size_t num)
+static inline void bxory(unsigned char *b, const unsigned char *y, size_t num)
 {
-        int i;
+        size_t i;
 
-        for(i = 0; i < (int)num; i++) {
+        for(i = 0; i < num; i++) {
                 b[i] = b[i] ^ y[i];
         }
 }
 
-static void ccm_generate_T(unsigned char *key,
-                           unsigned char *nonce, size_t nlen,
-                           unsigned char *aad, size_t alen,
-                           unsigned char *p, size_t plen,
-                           unsigned char *m, size_t mlen)
+/* y = E(y ^ block), a short block is implicitly zero padded */
+static inline void ccm_mac_block(const struct aes_key *ks, unsigned char *y,
+                                 const unsigned char *block, size_t len)
 {
-        unsigned char b[16] _U_, y[16]_U_;
+        bxory(y, block, len);
+        AES_ECB_encrypt_blocks(ks, y, y, 1);
+}
+
+/* CBC-MAC of the payload, a partial block is kept until more data
+ * arrives or aes_ccm_final() pads it.
+ */
+static void ccm_mac_update(struct aes_ccm_ctx *ctx, const unsigned char *p,
+                           size_t len)
+{
+        size_t l;
+
+        if (ctx->buf_len) {
+                l = 16 - ctx->buf_len;
+                if (l > len) {
+                        l = len;
+                }
+                memcpy(&ctx->buf[ctx->buf_len], p, l);
+                ctx->buf_len += l;
+                p   += l;
+                len -= l;
+                if (ctx->buf_len < 16) {
+                        return;
+                }
+                ccm_mac_block(ctx->ks, ctx->y, ctx->buf, 16);
+                ctx->buf_len = 0;
+        }
+        while (len >= 16) {
+                ccm_mac_block(ctx->ks, ctx->y, p, 16);
+                p   += 16;
+                len -= 16;
+        }
+        if (len) {
+                memcpy(ctx->buf, p, len);
+                ctx->buf_len = len;
+        }
+}
+
+/* The counter is stored in the last 15 - nlen bytes of the block */
+static void ccm_set_counter(unsigned char *s, size_t nlen, uint32_t i)
+{
+        size_t q = 15 - nlen;
+
+        i = htobe32(i);
+        if (q >= 4) {
+                memcpy(&s[12], &i, 4);
+        } else {
+                memcpy(&s[16 - q], (unsigned char *)&i + 4 - q, q);
+        }
+}
+
+static void ccm_init_counter(unsigned char *s, const unsigned char *nonce,
+                             size_t nlen)
+{
+        memset(s, 0, 16);
+        s[0] |= (15 - nlen - 1) & 0x07;
+        memcpy(&s[1], nonce, nlen);
+}
+
+void aes_ccm_init(struct aes_ccm_ctx *ctx, const struct aes_key *ks,
+                  const unsigned char *nonce, size_t nlen,
+                  const unsigned char *aad, size_t alen,
+                  size_t plen, size_t mlen, int encrypt)
+{
+        unsigned char b[16] _U_;
         uint16_t l;
 
+        ctx->ks = ks;
+        ctx->nlen = nlen;
+        ctx->mlen = mlen;
+        ctx->encrypt = encrypt;
+        ctx->buf_len = 0;
+        ctx->ctr = 1;
+        ctx->s_len = 0;
+        ctx->s_used = 0;
+        ccm_init_counter(ctx->a0, nonce, nlen);
+
         aes_ccm_generate_b0(nonce, nlen, alen, plen, mlen, &b[0]);
-        AES128_ECB_encrypt(b, key, y);
+        AES_ECB_encrypt_blocks(ks, b, ctx->y, 1);
 
         /* Create Aad */
         if (alen) {
@@ -86,69 +159,102 @@ static void ccm_generate_T(unsigned char *key,
                 aad  += l;
                 alen -= l;
 
-                bxory(b, y, 16);
-                AES128_ECB_encrypt(b, key, y);
+                ccm_mac_block(ks, ctx->y, b, 16);
 
                 while (alen) {
-                        memset(b, 0, 16);
                         l = (alen > 16) ? 16 : (uint16_t)alen;
-                        memcpy(b, aad, l);
+                        ccm_mac_block(ks, ctx->y, aad, l);
                         aad  += l;
                         alen -= l;
-
-                        bxory(b, y, 16);
-                        AES128_ECB_encrypt(b, key, y);
                 }
         }
+}
 
-        /* Create Payload */
-        while (plen) {
-                memset(b, 0, 16);
-                l = (plen > 16) ? 16 : (uint16_t)plen;
-                memcpy(b, p, l);
-                p    += l;
-                plen -= l;
+/* CTR mode starting at counter 1. The keystream is generated
+ * CCM_CTR_BLOCKS blocks at a time.
+ */
+void aes_ccm_update(struct aes_ccm_ctx *ctx, const unsigned char *in,
+                    unsigned char *out, size_t len)
+{
+        unsigned char cb[CCM_CTR_BLOCKS * 16];
+        size_t i, n, l;
+
+        while (len) {
+                if (ctx->s_used == ctx->s_len) {
+                        n = (len + 15) / 16;
+                        if (n > CCM_CTR_BLOCKS) {
+                                n = CCM_CTR_BLOCKS;
+                        }
+                        for (i = 0; i < n; i++) {
+                                memcpy(&cb[i * 16], ctx->a0, 16);
+                                ccm_set_counter(&cb[i * 16], ctx->nlen,
+                                                ctx->ctr++);
+                        }
+                        AES_ECB_encrypt_blocks(ctx->ks, cb, ctx->s, n);
+                        ctx->s_len = n * 16;
+                        ctx->s_used = 0;
+                }
 
-                bxory(b, y, 16);
-                AES128_ECB_encrypt(b, key, y);
+                l = ctx->s_len - ctx->s_used;
+                if (l > len) {
+                        l = len;
+                }
+                if (ctx->encrypt) {
+                        ccm_mac_update(ctx, in, l);
+                }
+                for (i = 0; i < l; i++) {
+                        out[i] = in[i] ^ ctx->s[ctx->s_used + i];
+                }
+                if (!ctx->encrypt) {
+                        ccm_mac_update(ctx, out, l);
+                }
+                ctx->s_used += l;
+                in  += l;
+                out += l;
+                len -= l;
         }
-
-        memcpy(m, y, mlen);
 }
 
-static void ccm_generate_s(unsigned char *key, unsigned char *nonce, size_t nlen,
-                           size_t plen, int i, unsigned char *s)
+void aes_ccm_final(struct aes_ccm_ctx *ctx, unsigned char *m)
 {
-        uint32_t l;
-
-        memset(s, 0, 16);
-        s[0] |= (15 - nlen - 1) & 0x07;
+        unsigned char s[16] _U_;
 
-        l = htobe32(i);
-        memcpy(&s[12], &l, 4);
+        if (ctx->buf_len) {
+                ccm_mac_block(ctx->ks, ctx->y, ctx->buf, ctx->buf_len);
+                ctx->buf_len = 0;
+        }
+        AES_ECB_encrypt_blocks(ctx->ks, ctx->a0, s, 1);
+        memcpy(m, ctx->y, ctx->mlen);
+        bxory(m, s, ctx->mlen);
+}
 
-        memcpy(&s[1], nonce, nlen);
+void aes_ccm_encrypt(const struct aes_key *ks,
+                     unsigned char *nonce, size_t nlen,
+                     unsigned char *aad, size_t alen,
+                     unsigned char *p, size_t plen,
+                     unsigned char *m, size_t mlen)
+{
+        struct aes_ccm_ctx ctx;
 
-        AES128_ECB_encrypt(s, key, s);
+        aes_ccm_init(&ctx, ks, nonce, nlen, aad, alen, plen, mlen, 1);
+        aes_ccm_update(&ctx, p, p, plen);
+        aes_ccm_final(&ctx, m);
 }
 
-static void aes_ccm_crypt(unsigned char *key,
-                          unsigned char *nonce, size_t nlen,
-                          unsigned char *p, size_t plen)
+int aes_ccm_decrypt(const struct aes_key *ks,
+                    unsigned char *nonce, size_t nlen,
+                    unsigned char *aad, size_t alen,
+                    unsigned char *p, size_t plen,
+                    unsigned char *m, size_t mlen)
 {
-        int j;
-        size_t l;
-        unsigned char s[16] _U_;
+        struct aes_ccm_ctx ctx;
+        unsigned char tmp[16];
 
-        j = 0;
-        while (plen) {
-                l = (plen > 16) ? 16 : plen;
-                ccm_generate_s(key, nonce, nlen, plen, j + 1, &s[0]);
-                bxory(&p[j * 16], &s[0], l);
+        aes_ccm_init(&ctx, ks, nonce, nlen, aad, alen, plen, mlen, 0);
+        aes_ccm_update(&ctx, p, p, plen);
+        aes_ccm_final(&ctx, tmp);
 
-                j++;
-                plen -= l;
-        }
+        return memcmp(tmp, m, mlen);
 }
 
 void aes128ccm_encrypt(unsigned char *key,
@@ -157,13 +263,10 @@ void aes128ccm_encrypt(unsigned char *key,
                        unsigned char *p, size_t plen,
                        unsigned char *m, size_t mlen)
 {
-        unsigned char s[16] _U_;
+        struct aes_key ks;
 
-        ccm_generate_T(key, nonce, nlen, aad, alen, p, plen, m, mlen);
-        ccm_generate_s(key, nonce, nlen, plen, 0, &s[0]);
-        bxory(m, &s[0], mlen);
-
-        aes_ccm_crypt(key, nonce, nlen, p, plen);
+        AES_init_key(&ks, key, 16);
+        aes_ccm_encrypt(&ks, nonce, nlen, aad, alen, p, plen, m, mlen);
 }
 
 int aes128ccm_decrypt(unsigned char *key,
@@ -172,14 +275,32 @@ int aes128ccm_decrypt(unsigned char *key,
                       unsigned char *p, size_t plen,
                       unsigned char *m, size_t mlen)
 {
-        unsigned char s[16] _U_;
-        unsigned char tmp[16];
+        struct aes_key ks;
 
-        aes_ccm_crypt(key, nonce, nlen, p, plen);
+        AES_init_key(&ks, key, 16);
+        return aes_ccm_decrypt(&ks, nonce, nlen, aad, alen, p, plen, m, mlen);
+}
 
-        ccm_generate_T(key, nonce, nlen, aad, alen, p, plen, tmp, mlen);
-        ccm_generate_s(key, nonce, nlen, plen, 0, &s[0]);
-        bxory(tmp, &s[0], mlen);
+void aes256ccm_encrypt(unsigned char *key,
+                       unsigned char *nonce, size_t nlen,
+                       unsigned char *aad, size_t alen,
+                       unsigned char *p, size_t plen,
+                       unsigned char *m, size_t mlen)
+{
+        struct aes_key ks;
 
-        return memcmp(tmp, m, mlen);
+        AES_init_key(&ks, key, 32);
+        aes_ccm_encrypt(&ks, nonce, nlen, aad, alen, p, plen, m, mlen);
+}
+
+int aes256ccm_decrypt(unsigned char *key,
+                      unsigned char *nonce, size_t nlen,
+                      unsigned char *aad, size_t alen,
+                      unsigned char *p, size_t plen,
+                      unsigned char *m, size_t mlen)
+{
+        struct aes_key ks;
+
+        AES_init_key(&ks, key, 32);
+        return aes_ccm_decrypt(&ks, nonce, nlen, aad, alen, p, plen, m, mlen);
 }
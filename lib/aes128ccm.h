@@ -15,6 +15,58 @@
    You should have received a copy of the GNU Lesser General Public License
    along with this program; if not, see <http://www.gnu.org/licenses/>.
 */
+struct aes_key;
+
+/* Number of counter blocks encrypted per call, so that the block cipher
+ * can work on several independent blocks at once.
+ */
+#define CCM_CTR_BLOCKS 8
+
+/*
+ * AES-CCM where the payload is passed in pieces, each piece can be
+ * encrypted or decrypted from one buffer into another or in place.
+ * Unlike GCM the total payload length has to be known up front.
+ * This is internal state, only use the functions below to access it.
+ */
+struct aes_ccm_ctx {
+        const struct aes_key *ks;
+        size_t nlen;
+        size_t mlen;
+        int encrypt;
+        unsigned char a0[16];           /* counter block 0 */
+        unsigned char y[16];            /* CBC-MAC */
+        unsigned char buf[16];          /* partial CBC-MAC block */
+        size_t buf_len;
+        uint32_t ctr;
+        unsigned char s[CCM_CTR_BLOCKS * 16];   /* keystream */
+        size_t s_len;
+        size_t s_used;
+};
+
+void aes_ccm_init(struct aes_ccm_ctx *ctx, const struct aes_key *ks,
+		  const unsigned char *nonce, size_t nlen,
+		  const unsigned char *aad, size_t alen,
+		  size_t plen, size_t mlen, int encrypt);
+
+void aes_ccm_update(struct aes_ccm_ctx *ctx, const unsigned char *in,
+		    unsigned char *out, size_t len);
+
+/* writes the mlen byte tag */
+void aes_ccm_final(struct aes_ccm_ctx *ctx, unsigned char *m);
+
+/* Encrypt/decrypt with an already expanded key, see AES_init_key() */
+void aes_ccm_encrypt(const struct aes_key *ks,
+		     unsigned char *nonce, size_t nlen,
+		     unsigned char *aad, size_t alen,
+		     unsigned char *p, size_t plen,
+		     unsigned char *m, size_t mlen);
+
+int aes_ccm_decrypt(const struct aes_key *ks,
+		    unsigned char *nonce, size_t nlen,
+		    unsigned char *aad, size_t alen,
+		    unsigned char *p, size_t plen,
+		    unsigned char *m, size_t mlen);
+
 void aes128ccm_encrypt(unsigned char *key,
 		       unsigned char *nonce, size_t nlen,
 		       unsigned char *aad, size_t alen,
@@ -26,3 +78,15 @@ int aes128ccm_decrypt(unsigned char *key,
 		      unsigned char *aad, size_t alen,
 		      unsigned char *p, size_t plen,
 		      unsigned char *m, size_t mlen);
+
+void aes256ccm_encrypt(unsigned char *key,
+		       unsigned char *nonce, size_t nlen,
+		       unsigned char *aad, size_t alen,
+		       unsigned char *p, size_t plen,
+		       unsigned char *m, size_t mlen);
+
+int aes256ccm_decrypt(unsigned char *key,
+		      unsigned char *nonce, size_t nlen,
+		      unsigned char *aad, size_t alen,
+		      unsigned char *p, size_t plen,
+		      unsigned char *m, size_t mlen);
@@ -0,0 +1,782 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include <stdio.h>
+#include <string.h>
+
+#include "compat.h"
+
+#include "portable-endian.h"
+#include "aes.h"
+#include "aes128gcm.h"
+
+/*
+ * AES-128-GCM and AES-256-GCM (NIST SP 800-38D) with a 96 bit nonce.
+ *
+ * There are two implementations. The portable one uses the block cipher
+ * from aes.c for the counter mode and a 4-bit table driven GHASH.
+ * On x86 compilers that support function target attributes there is also
+ * an AES-NI + PCLMULQDQ implementation that is selected at runtime
+ * if the cpu supports these instructions.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+        (defined(__GNUC__) || defined(__clang__))
+#define HAVE_GCM_AESNI 1
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+static inline void bxory(unsigned char *b, const unsigned char *y, size_t num)
+{
+        size_t i;
+
+        for (i = 0; i < num; i++) {
+                b[i] = b[i] ^ y[i];
+        }
+}
+
+static int tag_compare(const unsigned char *a, const unsigned char *b,
+                       size_t len)
+{
+        unsigned char diff = 0;
+        size_t i;
+
+        for (i = 0; i < len; i++) {
+                diff |= a[i] ^ b[i];
+        }
+        return diff;
+}
+
+static void put_be64(unsigned char *buf, uint64_t val)
+{
+        val = htobe64(val);
+        memcpy(buf, &val, 8);
+}
+
+static uint64_t get_be64(const unsigned char *buf)
+{
+        uint64_t val;
+
+        memcpy(&val, buf, 8);
+        return be64toh(val);
+}
+
+/*
+ * Portable implementation
+ */
+static const uint64_t gcm_last4[16] = {
+        0x0000, 0x1c20, 0x3840, 0x2460, 0x7080, 0x6ca0, 0x48c0, 0x54e0,
+        0xe100, 0xfd20, 0xd940, 0xc560, 0x9180, 0x8da0, 0xa9c0, 0xb5e0
+};
+
+/* Precompute i * H for all 4 bit values of i. */
+static void gcm_ghash_init(struct gcm_ghash *g, const unsigned char *h)
+{
+        uint64_t vh, vl;
+        int i, j;
+
+        memset(g, 0, sizeof(*g));
+        vh = get_be64(&h[0]);
+        vl = get_be64(&h[8]);
+        g->hl[8] = vl;
+        g->hh[8] = vh;
+        for (i = 4; i > 0; i >>= 1) {
+                uint64_t t = (vl & 1) * 0xe1000000U;
+
+                vl = (vh << 63) | (vl >> 1);
+                vh = (vh >> 1) ^ (t << 32);
+                g->hl[i] = vl;
+                g->hh[i] = vh;
+        }
+        for (i = 2; i <= 8; i *= 2) {
+                vh = g->hh[i];
+                vl = g->hl[i];
+                for (j = 1; j < i; j++) {
+                        g->hh[i + j] = vh ^ g->hh[j];
+                        g->hl[i + j] = vl ^ g->hl[j];
+                }
+        }
+}
+
+/* X = (X ^ block) * H */
+static void gcm_ghash_block(struct gcm_ghash *g, const unsigned char *block,
+                            size_t len)
+{
+        unsigned char *x = g->x;
+        uint64_t zh, zl;
+        unsigned char lo, hi, rem;
+        int i;
+
+        bxory(x, block, len);
+
+        lo = x[15] & 0x0f;
+        zh = g->hh[lo];
+        zl = g->hl[lo];
+        for (i = 15; i >= 0; i--) {
+                lo = x[i] & 0x0f;
+                hi = (x[i] >> 4) & 0x0f;
+                if (i != 15) {
+                        rem = (unsigned char)(zl & 0x0f);
+                        zl = (zh << 60) | (zl >> 4);
+                        zh = (zh >> 4) ^ (gcm_last4[rem] << 48);
+                        zh ^= g->hh[lo];
+                        zl ^= g->hl[lo];
+                }
+                rem = (unsigned char)(zl & 0x0f);
+                zl = (zh << 60) | (zl >> 4);
+                zh = (zh >> 4) ^ (gcm_last4[rem] << 48);
+                zh ^= g->hh[hi];
+                zl ^= g->hl[hi];
+        }
+        put_be64(&x[0], zh);
+        put_be64(&x[8], zl);
+}
+
+static void gcm_ghash_update(struct gcm_ghash *g, const unsigned char *buf,
+                             size_t len)
+{
+        size_t l;
+
+        while (len) {
+                l = len > 16 ? 16 : len;
+                gcm_ghash_block(g, buf, l);
+                buf += l;
+                len -= l;
+        }
+}
+
+static void gcm_set_counter(unsigned char *cb, uint32_t ctr)
+{
+        ctr = htobe32(ctr);
+        memcpy(&cb[12], &ctr, 4);
+}
+
+#define GCM_CTR_BLOCKS 8
+
+#ifdef HAVE_GCM_AESNI
+/*
+ * AES-NI + PCLMULQDQ implementation.
+ * GHASH is done on byte reflected blocks as described in the Intel
+ * "Carry-Less Multiplication and Its Usage for Computing the GCM Mode"
+ * white paper. Four blocks are processed per iteration, both to keep the
+ * AES pipeline busy and to only do one reduction per four multiplications
+ * using H^1 .. H^4.
+ */
+#define AESNI_TARGET __attribute__((target("aes,pclmul,ssse3,sse4.1")))
+
+AESNI_TARGET static inline __m128i aesni_encrypt(const __m128i *rk, int nr,
+                                                 __m128i b)
+{
+        int i;
+
+        b = _mm_xor_si128(b, rk[0]);
+        for (i = 1; i < nr; i++) {
+                b = _mm_aesenc_si128(b, rk[i]);
+        }
+        return _mm_aesenclast_si128(b, rk[nr]);
+}
+
+AESNI_TARGET static inline void aesni_encrypt4(const __m128i *rk, int nr,
+                                               __m128i *b)
+{
+        int i;
+
+        b[0] = _mm_xor_si128(b[0], rk[0]);
+        b[1] = _mm_xor_si128(b[1], rk[0]);
+        b[2] = _mm_xor_si128(b[2], rk[0]);
+        b[3] = _mm_xor_si128(b[3], rk[0]);
+        for (i = 1; i < nr; i++) {
+                b[0] = _mm_aesenc_si128(b[0], rk[i]);
+                b[1] = _mm_aesenc_si128(b[1], rk[i]);
+                b[2] = _mm_aesenc_si128(b[2], rk[i]);
+                b[3] = _mm_aesenc_si128(b[3], rk[i]);
+        }
+        b[0] = _mm_aesenclast_si128(b[0], rk[nr]);
+        b[1] = _mm_aesenclast_si128(b[1], rk[nr]);
+        b[2] = _mm_aesenclast_si128(b[2], rk[nr]);
+        b[3] = _mm_aesenclast_si128(b[3], rk[nr]);
+}
+
+/* 256 bit carry-less product of a and b, accumulated into lo/hi. */
+AESNI_TARGET static inline void clmul_acc(__m128i a, __m128i b,
+                                          __m128i *lo, __m128i *hi)
+{
+        __m128i t0, t1, t2, t3;
+
+        t0 = _mm_clmulepi64_si128(a, b, 0x00);
+        t1 = _mm_clmulepi64_si128(a, b, 0x10);
+        t2 = _mm_clmulepi64_si128(a, b, 0x01);
+        t3 = _mm_clmulepi64_si128(a, b, 0x11);
+        t1 = _mm_xor_si128(t1, t2);
+        t0 = _mm_xor_si128(t0, _mm_slli_si128(t1, 8));
+        t3 = _mm_xor_si128(t3, _mm_srli_si128(t1, 8));
+        *lo = _mm_xor_si128(*lo, t0);
+        *hi = _mm_xor_si128(*hi, t3);
+}
+
+/* Shift the reflected 256 bit product left by one and reduce it. */
+AESNI_TARGET static inline __m128i clmul_reduce(__m128i lo, __m128i hi)
+{
+        __m128i t2, t4, t5, t7, t8, t9;
+
+        t7 = _mm_srli_epi32(lo, 31);
+        t8 = _mm_srli_epi32(hi, 31);
+        lo = _mm_slli_epi32(lo, 1);
+        hi = _mm_slli_epi32(hi, 1);
+        t9 = _mm_srli_si128(t7, 12);
+        t8 = _mm_slli_si128(t8, 4);
+        t7 = _mm_slli_si128(t7, 4);
+        lo = _mm_or_si128(lo, t7);
+        hi = _mm_or_si128(hi, t8);
+        hi = _mm_or_si128(hi, t9);
+
+        t7 = _mm_slli_epi32(lo, 31);
+        t8 = _mm_slli_epi32(lo, 30);
+        t9 = _mm_slli_epi32(lo, 25);
+        t7 = _mm_xor_si128(t7, t8);
+        t7 = _mm_xor_si128(t7, t9);
+        t8 = _mm_srli_si128(t7, 4);
+        t7 = _mm_slli_si128(t7, 12);
+        lo = _mm_xor_si128(lo, t7);
+
+        t2 = _mm_srli_epi32(lo, 1);
+        t4 = _mm_srli_epi32(lo, 2);
+        t5 = _mm_srli_epi32(lo, 7);
+        t2 = _mm_xor_si128(t2, t4);
+        t2 = _mm_xor_si128(t2, t5);
+        t2 = _mm_xor_si128(t2, t8);
+        lo = _mm_xor_si128(lo, t2);
+        return _mm_xor_si128(hi, lo);
+}
+
+AESNI_TARGET static inline __m128i gfmul(__m128i a, __m128i b)
+{
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+
+        clmul_acc(a, b, &lo, &hi);
+        return clmul_reduce(lo, hi);
+}
+
+struct gcm_aesni {
+        __m128i rk[15];
+        int nr;
+        __m128i h[4];           /* H^1 .. H^4, byte reflected */
+        __m128i bswap;
+        __m128i x;
+};
+
+AESNI_TARGET static inline __m128i gcm_aesni_load(const struct gcm_aesni *g,
+                                                  const unsigned char *buf,
+                                                  size_t len)
+{
+        unsigned char b[16];
+
+        if (len == 16) {
+                return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)buf),
+                                        g->bswap);
+        }
+        memset(b, 0, 16);
+        memcpy(b, buf, len);
+        return _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)b),
+                                g->bswap);
+}
+
+/* Hash four already byte reflected blocks. */
+AESNI_TARGET static inline void gcm_aesni_ghash4(struct gcm_aesni *g,
+                                                 const __m128i *b)
+{
+        __m128i lo = _mm_setzero_si128();
+        __m128i hi = _mm_setzero_si128();
+
+        clmul_acc(_mm_xor_si128(g->x, b[0]), g->h[3], &lo, &hi);
+        clmul_acc(b[1], g->h[2], &lo, &hi);
+        clmul_acc(b[2], g->h[1], &lo, &hi);
+        clmul_acc(b[3], g->h[0], &lo, &hi);
+        g->x = clmul_reduce(lo, hi);
+}
+
+AESNI_TARGET static void gcm_aesni_ghash(struct gcm_aesni *g,
+                                         const unsigned char *buf, size_t len)
+{
+        __m128i b[4];
+        size_t l;
+
+        while (len >= 64) {
+                b[0] = gcm_aesni_load(g, buf, 16);
+                b[1] = gcm_aesni_load(g, buf + 16, 16);
+                b[2] = gcm_aesni_load(g, buf + 32, 16);
+                b[3] = gcm_aesni_load(g, buf + 48, 16);
+                gcm_aesni_ghash4(g, b);
+                buf += 64;
+                len -= 64;
+        }
+        while (len) {
+                l = len > 16 ? 16 : len;
+                g->x = gfmul(_mm_xor_si128(g->x, gcm_aesni_load(g, buf, l)),
+                             g->h[0]);
+                buf += l;
+                len -= l;
+        }
+}
+
+/*
+ * Counter mode and GHASH of whole blocks, fused so that the data is only
+ * read once. The GHASH state is the one of the GMAC context, which keeps
+ * H^1 .. H^4 and X byte reflected.
+ */
+AESNI_TARGET static void gcm_aesni_ctr_blocks(struct aes_gcm_ctx *ctx,
+                                              const unsigned char *in,
+                                              unsigned char *out,
+                                              size_t nblocks)
+{
+        const struct aes_key *ks = ctx->mac.ks;
+        struct gcm_aesni g;
+        __m128i cb, one, four, b[4], c[4];
+        unsigned char tmp[16];
+        int i;
+
+        g.bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                               8, 9, 10, 11, 12, 13, 14, 15);
+        g.nr = ks->rounds;
+        g.rk[0] = _mm_loadu_si128((const __m128i *)&ks->round_keys[0]);
+        for (i = 1; i <= g.nr; i++) {
+                g.rk[i] = _mm_loadu_si128(
+                                (const __m128i *)&ks->round_keys[i * 16]);
+        }
+        for (i = 0; i < 4; i++) {
+                g.h[i] = _mm_loadu_si128((const __m128i *)ctx->mac.h[i]);
+        }
+        g.x = _mm_loadu_si128((const __m128i *)ctx->mac.g.x);
+
+        /* The counter block is kept byte reflected so that the 32 bit
+         * counter can be incremented with a plain add.
+         */
+        memcpy(tmp, ctx->mac.j0, 16);
+        gcm_set_counter(tmp, ctx->ctr);
+        ctx->ctr += (uint32_t)nblocks;
+        cb = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)tmp), g.bswap);
+        one = _mm_set_epi32(0, 0, 0, 1);
+        four = _mm_set_epi32(0, 0, 0, 4);
+
+        while (nblocks >= 4) {
+                b[0] = _mm_shuffle_epi8(cb, g.bswap);
+                b[1] = _mm_shuffle_epi8(_mm_add_epi32(cb, one), g.bswap);
+                b[2] = _mm_shuffle_epi8(_mm_add_epi32(cb,
+                                        _mm_set_epi32(0, 0, 0, 2)), g.bswap);
+                b[3] = _mm_shuffle_epi8(_mm_add_epi32(cb,
+                                        _mm_set_epi32(0, 0, 0, 3)), g.bswap);
+                cb = _mm_add_epi32(cb, four);
+                aesni_encrypt4(g.rk, g.nr, b);
+
+                for (i = 0; i < 4; i++) {
+                        c[i] = _mm_loadu_si128((const __m128i *)&in[i * 16]);
+                        b[i] = _mm_xor_si128(b[i], c[i]);
+                        _mm_storeu_si128((__m128i *)&out[i * 16], b[i]);
+                        if (ctx->encrypt) {
+                                c[i] = b[i];
+                        }
+                        c[i] = _mm_shuffle_epi8(c[i], g.bswap);
+                }
+                gcm_aesni_ghash4(&g, c);
+                in += 64;
+                out += 64;
+                nblocks -= 4;
+        }
+        while (nblocks--) {
+                b[0] = aesni_encrypt(g.rk, g.nr, _mm_shuffle_epi8(cb, g.bswap));
+                cb = _mm_add_epi32(cb, one);
+                c[0] = _mm_loadu_si128((const __m128i *)in);
+                b[0] = _mm_xor_si128(b[0], c[0]);
+                _mm_storeu_si128((__m128i *)out, b[0]);
+                if (ctx->encrypt) {
+                        c[0] = b[0];
+                }
+                g.x = gfmul(_mm_xor_si128(g.x,
+                                          _mm_shuffle_epi8(c[0], g.bswap)),
+                            g.h[0]);
+                in += 16;
+                out += 16;
+        }
+        _mm_storeu_si128((__m128i *)ctx->mac.g.x, g.x);
+}
+
+/* The GMAC context keeps H^1 .. H^4 and X byte reflected. */
+AESNI_TARGET static void gmac_aesni_init(struct aes_gmac_ctx *ctx,
+                                         const unsigned char *h)
+{
+        __m128i bswap, hp[4];
+        int i;
+
+        bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                             8, 9, 10, 11, 12, 13, 14, 15);
+        hp[0] = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)h), bswap);
+        hp[1] = gfmul(hp[0], hp[0]);
+        hp[2] = gfmul(hp[1], hp[0]);
+        hp[3] = gfmul(hp[2], hp[0]);
+        for (i = 0; i < 4; i++) {
+                _mm_storeu_si128((__m128i *)ctx->h[i], hp[i]);
+        }
+        memset(ctx->g.x, 0, 16);
+}
+
+AESNI_TARGET static void gmac_aesni_ghash(struct aes_gmac_ctx *ctx,
+                                          const unsigned char *buf,
+                                          size_t len)
+{
+        struct gcm_aesni g;
+        int i;
+
+        g.bswap = _mm_set_epi8(0, 1, 2, 3, 4, 5, 6, 7,
+                               8, 9, 10, 11, 12, 13, 14, 15);
+        for (i = 0; i < 4; i++) {
+                g.h[i] = _mm_loadu_si128((const __m128i *)ctx->h[i]);
+        }
+        g.x = _mm_loadu_si128((const __m128i *)ctx->g.x);
+        gcm_aesni_ghash(&g, buf, len);
+        _mm_storeu_si128((__m128i *)ctx->g.x, g.x);
+}
+
+static int gcm_have_aesni(void)
+{
+        static int have_aesni = -1;
+        unsigned int eax, ebx, ecx, edx;
+
+        if (have_aesni < 0) {
+                have_aesni = 0;
+                if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+                    (ecx & bit_AES) && (ecx & bit_PCLMUL) &&
+                    (ecx & bit_SSSE3) && (ecx & bit_SSE4_1)) {
+                        have_aesni = 1;
+                }
+        }
+        return have_aesni;
+}
+#endif /* HAVE_GCM_AESNI */
+
+void aes_gmac_init(struct aes_gmac_ctx *ctx, const struct aes_key *ks,
+                   const unsigned char *nonce)
+{
+        unsigned char h[16];
+
+        ctx->ks = ks;
+        ctx->buf_len = 0;
+        ctx->len = 0;
+        memcpy(ctx->j0, nonce, 12);
+        gcm_set_counter(ctx->j0, 1);
+
+        memset(h, 0, 16);
+        AES_ECB_encrypt_blocks(ks, h, h, 1);
+        ctx->clmul = 0;
+#ifdef HAVE_GCM_AESNI
+        if (gcm_have_aesni()) {
+                ctx->clmul = 1;
+                gmac_aesni_init(ctx, h);
+                return;
+        }
+#endif
+        gcm_ghash_init(&ctx->g, h);
+}
+
+/* Only the last call before the lengths may pass a partial block. */
+static void gmac_ghash(struct aes_gmac_ctx *ctx, const unsigned char *buf,
+                       size_t len)
+{
+#ifdef HAVE_GCM_AESNI
+        if (ctx->clmul) {
+                gmac_aesni_ghash(ctx, buf, len);
+                return;
+        }
+#endif
+        gcm_ghash_update(&ctx->g, buf, len);
+}
+
+void aes_gmac_update(struct aes_gmac_ctx *ctx,
+                     const unsigned char *buf, size_t len)
+{
+        size_t l;
+
+        ctx->len += len;
+        if (ctx->buf_len) {
+                l = 16 - ctx->buf_len;
+                if (l > len) {
+                        l = len;
+                }
+                memcpy(&ctx->buf[ctx->buf_len], buf, l);
+                ctx->buf_len += l;
+                buf += l;
+                len -= l;
+                if (ctx->buf_len < 16) {
+                        return;
+                }
+                gmac_ghash(ctx, ctx->buf, 16);
+                ctx->buf_len = 0;
+        }
+        l = len & ~(size_t)15;
+        if (l) {
+                gmac_ghash(ctx, buf, l);
+                buf += l;
+                len -= l;
+        }
+        if (len) {
+                memcpy(ctx->buf, buf, len);
+                ctx->buf_len = len;
+        }
+}
+
+/* Hashes the partial block, if any, zero padded. */
+static void gmac_flush(struct aes_gmac_ctx *ctx)
+{
+        if (ctx->buf_len) {
+                gmac_ghash(ctx, ctx->buf, ctx->buf_len);
+                ctx->buf_len = 0;
+        }
+}
+
+static void gmac_finish(struct aes_gmac_ctx *ctx, uint64_t alen,
+                        uint64_t clen, unsigned char *tag)
+{
+        unsigned char b[16], s[16];
+        int i;
+
+        gmac_flush(ctx);
+        put_be64(&b[0], alen * 8);
+        put_be64(&b[8], clen * 8);
+        gmac_ghash(ctx, b, 16);
+
+        if (ctx->clmul) {
+                for (i = 0; i < 16; i++) {
+                        tag[i] = ctx->g.x[15 - i];
+                }
+        } else {
+                memcpy(tag, ctx->g.x, 16);
+        }
+        AES_ECB_encrypt_blocks(ctx->ks, ctx->j0, s, 1);
+        bxory(tag, s, 16);
+}
+
+void aes_gmac_final(struct aes_gmac_ctx *ctx, unsigned char *tag)
+{
+        gmac_finish(ctx, ctx->len, 0, tag);
+}
+
+#define GCM_CTR_BLOCKS 8
+
+/* Portable counter mode of whole blocks, GCM_CTR_BLOCKS at a time */
+static void gcm_ctr_blocks(struct aes_gcm_ctx *ctx, const unsigned char *in,
+                           unsigned char *out, size_t nblocks)
+{
+        unsigned char cb[GCM_CTR_BLOCKS * 16], s[GCM_CTR_BLOCKS * 16];
+        size_t i, n;
+
+        for (i = 0; i < GCM_CTR_BLOCKS; i++) {
+                memcpy(&cb[i * 16], ctx->mac.j0, 16);
+        }
+        while (nblocks) {
+                n = nblocks > GCM_CTR_BLOCKS ? GCM_CTR_BLOCKS : nblocks;
+                for (i = 0; i < n; i++) {
+                        gcm_set_counter(&cb[i * 16], ctx->ctr++);
+                }
+                AES_ECB_encrypt_blocks(ctx->mac.ks, cb, s, n);
+                if (!ctx->encrypt) {
+                        gmac_ghash(&ctx->mac, in, n * 16);
+                }
+                for (i = 0; i < n * 16; i++) {
+                        out[i] = in[i] ^ s[i];
+                }
+                if (ctx->encrypt) {
+                        gmac_ghash(&ctx->mac, out, n * 16);
+                }
+                in += n * 16;
+                out += n * 16;
+                nblocks -= n;
+        }
+}
+
+/* Uses up to the end of the current keystream block */
+static void gcm_ctr_partial(struct aes_gcm_ctx *ctx, const unsigned char *in,
+                            unsigned char *out, size_t len)
+{
+        size_t i;
+
+        if (!ctx->encrypt) {
+                aes_gmac_update(&ctx->mac, in, len);
+        }
+        for (i = 0; i < len; i++) {
+                out[i] = in[i] ^ ctx->s[ctx->s_used + i];
+        }
+        if (ctx->encrypt) {
+                aes_gmac_update(&ctx->mac, out, len);
+        }
+        ctx->s_used += len;
+}
+
+void aes_gcm_init(struct aes_gcm_ctx *ctx, const struct aes_key *ks,
+                  const unsigned char *nonce,
+                  const unsigned char *aad, size_t alen, int encrypt)
+{
+        aes_gmac_init(&ctx->mac, ks, nonce);
+        aes_gmac_update(&ctx->mac, aad, alen);
+        gmac_flush(&ctx->mac);
+        ctx->alen = alen;
+        ctx->mac.len = 0;
+        ctx->ctr = 2;
+        ctx->s_used = 16;
+        ctx->encrypt = encrypt;
+}
+
+void aes_gcm_update(struct aes_gcm_ctx *ctx, const unsigned char *in,
+                    unsigned char *out, size_t len)
+{
+        unsigned char cb[16];
+        size_t l;
+
+        if (ctx->s_used < 16) {
+                l = 16 - ctx->s_used;
+                if (l > len) {
+                        l = len;
+                }
+                gcm_ctr_partial(ctx, in, out, l);
+                in += l;
+                out += l;
+                len -= l;
+        }
+
+        /* Whole blocks. Everything before them was a multiple of the
+         * block size so there is no partial GHASH block pending.
+         */
+        l = len / 16;
+        if (l) {
+#ifdef HAVE_GCM_AESNI
+                if (ctx->mac.clmul) {
+                        gcm_aesni_ctr_blocks(ctx, in, out, l);
+                } else
+#endif
+                gcm_ctr_blocks(ctx, in, out, l);
+                ctx->mac.len += l * 16;
+                in += l * 16;
+                out += l * 16;
+                len -= l * 16;
+        }
+
+        if (len) {
+                memcpy(cb, ctx->mac.j0, 16);
+                gcm_set_counter(cb, ctx->ctr++);
+                AES_ECB_encrypt_blocks(ctx->mac.ks, cb, ctx->s, 1);
+                ctx->s_used = 0;
+                gcm_ctr_partial(ctx, in, out, len);
+        }
+}
+
+void aes_gcm_final(struct aes_gcm_ctx *ctx, unsigned char *tag)
+{
+        gmac_finish(&ctx->mac, ctx->alen, ctx->mac.len, tag);
+}
+
+void aes_gcm_encrypt(const struct aes_key *ks,
+                     unsigned char *nonce, size_t nlen,
+                     unsigned char *aad, size_t alen,
+                     unsigned char *p, size_t plen,
+                     unsigned char *m, size_t mlen)
+{
+        struct aes_gcm_ctx ctx;
+        unsigned char tag[16];
+
+        if (nlen != 12 || mlen > 16) {
+                memset(m, 0, mlen);
+                return;
+        }
+        aes_gcm_init(&ctx, ks, nonce, aad, alen, 1);
+        aes_gcm_update(&ctx, p, p, plen);
+        aes_gcm_final(&ctx, tag);
+        memcpy(m, tag, mlen);
+}
+
+int aes_gcm_decrypt(const struct aes_key *ks,
+                    unsigned char *nonce, size_t nlen,
+                    unsigned char *aad, size_t alen,
+                    unsigned char *p, size_t plen,
+                    unsigned char *m, size_t mlen)
+{
+        struct aes_gcm_ctx ctx;
+        unsigned char tag[16];
+
+        if (nlen != 12 || mlen > 16) {
+                return -1;
+        }
+        aes_gcm_init(&ctx, ks, nonce, aad, alen, 0);
+        aes_gcm_update(&ctx, p, p, plen);
+        aes_gcm_final(&ctx, tag);
+        return tag_compare(tag, m, mlen);
+}
+
+void aes128gcm_encrypt(unsigned char *key,
+                       unsigned char *nonce, size_t nlen,
+                       unsigned char *aad, size_t alen,
+                       unsigned char *p, size_t plen,
+                       unsigned char *m, size_t mlen)
+{
+        struct aes_key ks;
+
+        AES_init_key(&ks, key, 16);
+        aes_gcm_encrypt(&ks, nonce, nlen, aad, alen, p, plen, m, mlen);
+}
+
+int aes128gcm_decrypt(unsigned char *key,
+                      unsigned char *nonce, size_t nlen,
+                      unsigned char *aad, size_t alen,
+                      unsigned char *p, size_t plen,
+                      unsigned char *m, size_t mlen)
+{
+        struct aes_key ks;
+
+        AES_init_key(&ks, key, 16);
+        return aes_gcm_decrypt(&ks, nonce, nlen, aad, alen, p, plen, m, mlen);
+}
+
+void aes256gcm_encrypt(unsigned char *key,
+                       unsigned char *nonce, size_t nlen,
+                       unsigned char *aad, size_t alen,
+                       unsigned char *p, size_t plen,
+                       unsigned char *m, size_t mlen)
+{
+        struct aes_key ks;
+
+        AES_init_key(&ks, key, 32);
+        aes_gcm_encrypt(&ks, nonce, nlen, aad, alen, p, plen, m, mlen);
+}
+
+int aes256gcm_decrypt(unsigned char *key,
+                      unsigned char *nonce, size_t nlen,
+                      unsigned char *aad, size_t alen,
+                      unsigned char *p, size_t plen,
+                      unsigned char *m, size_t mlen)
+{
+        struct aes_key ks;
+
+        AES_init_key(&ks, key, 32);
+        return aes_gcm_decrypt(&ks, nonce, nlen, aad, alen, p, plen, m, mlen);
+}
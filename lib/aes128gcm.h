@@ -0,0 +1,117 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+/*
+ * AES-128-GCM and AES-256-GCM as used by SMB 3.1.1 encryption.
+ * The aes128 functions take a 16 byte key, the aes256 ones a 32 byte key.
+ * Only 12 byte nonces are supported. Encryption and decryption are done
+ * in place, the tag is written to / compared against m.
+ */
+struct aes_key;
+
+/*
+ * AES-GMAC, i.e. GCM over additional data only, as used for SMB 3.1.1
+ * signing. The data can be passed in any number of pieces.
+ * This is internal state, only use the functions below to access it.
+ */
+struct gcm_ghash {
+        uint64_t hl[16];
+        uint64_t hh[16];
+        unsigned char x[16];
+};
+
+struct aes_gmac_ctx {
+        const struct aes_key *ks;
+        int clmul;
+        struct gcm_ghash g;
+        unsigned char h[4][16];         /* H^1 .. H^4 for PCLMULQDQ */
+        unsigned char j0[16];
+        unsigned char buf[16];
+        size_t buf_len;
+        uint64_t len;
+};
+
+/* nonce is 12 bytes */
+void aes_gmac_init(struct aes_gmac_ctx *ctx, const struct aes_key *ks,
+                   const unsigned char *nonce);
+
+void aes_gmac_update(struct aes_gmac_ctx *ctx,
+                     const unsigned char *buf, size_t len);
+
+/* writes the 16 byte tag */
+void aes_gmac_final(struct aes_gmac_ctx *ctx, unsigned char *tag);
+
+/*
+ * AES-GCM where the data is passed in pieces, each piece can be
+ * encrypted or decrypted from one buffer into another or in place.
+ */
+struct aes_gcm_ctx {
+        struct aes_gmac_ctx mac;
+        uint64_t alen;
+        uint32_t ctr;
+        unsigned char s[16];            /* keystream of a partial block */
+        size_t s_used;
+        int encrypt;
+};
+
+/* nonce is 12 bytes */
+void aes_gcm_init(struct aes_gcm_ctx *ctx, const struct aes_key *ks,
+                  const unsigned char *nonce,
+                  const unsigned char *aad, size_t alen, int encrypt);
+
+void aes_gcm_update(struct aes_gcm_ctx *ctx, const unsigned char *in,
+                    unsigned char *out, size_t len);
+
+/* writes the 16 byte tag */
+void aes_gcm_final(struct aes_gcm_ctx *ctx, unsigned char *tag);
+
+/* Encrypt/decrypt with an already expanded key, see AES_init_key() */
+void aes_gcm_encrypt(const struct aes_key *ks,
+                     unsigned char *nonce, size_t nlen,
+                     unsigned char *aad, size_t alen,
+                     unsigned char *p, size_t plen,
+                     unsigned char *m, size_t mlen);
+
+int aes_gcm_decrypt(const struct aes_key *ks,
+                    unsigned char *nonce, size_t nlen,
+                    unsigned char *aad, size_t alen,
+                    unsigned char *p, size_t plen,
+                    unsigned char *m, size_t mlen);
+
+void aes128gcm_encrypt(unsigned char *key,
+                       unsigned char *nonce, size_t nlen,
+                       unsigned char *aad, size_t alen,
+                       unsigned char *p, size_t plen,
+                       unsigned char *m, size_t mlen);
+
+int aes128gcm_decrypt(unsigned char *key,
+                      unsigned char *nonce, size_t nlen,
+                      unsigned char *aad, size_t alen,
+                      unsigned char *p, size_t plen,
+                      unsigned char *m, size_t mlen);
+
+void aes256gcm_encrypt(unsigned char *key,
+                       unsigned char *nonce, size_t nlen,
+                       unsigned char *aad, size_t alen,
+                       unsigned char *p, size_t plen,
+                       unsigned char *m, size_t mlen);
+
+int aes256gcm_decrypt(unsigned char *key,
+                      unsigned char *nonce, size_t nlen,
+                      unsigned char *aad, size_t alen,
+                      unsigned char *p, size_t plen,
+                      unsigned char *m, size_t mlen);
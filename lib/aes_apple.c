@@ -25,9 +25,10 @@
 #include <CommonCrypto/CommonCrypto.h>
 
 #define AES128_KEY_LEN 16
+#define AES256_KEY_LEN 32
 #define AES128_BLOCK_SIZE 16
 
-void AES128_ECB_encrypt_apple(const uint8_t *input, const uint8_t *key, uint8_t *output) {
+static void AES_ECB_encrypt_apple(const uint8_t *input, const uint8_t *key, size_t key_len, uint8_t *output) {
     CCCryptorRef cryptor = NULL;
 
     // Create an AES ECB encryption context
@@ -36,7 +37,7 @@ void AES128_ECB_encrypt_apple(const uint8_t *input, const uint8_t *key, uint8_t
         kCCAlgorithmAES,     
         kCCOptionECBMode,     
         key,                   
-        AES128_KEY_LEN,         
+        key_len,
         NULL,                    
         &cryptor           
     );
@@ -64,6 +65,14 @@ void AES128_ECB_encrypt_apple(const uint8_t *input, const uint8_t *key, uint8_t
     CCCryptorRelease(cryptor);
 }
 
+void AES128_ECB_encrypt_apple(const uint8_t *input, const uint8_t *key, uint8_t *output) {
+    AES_ECB_encrypt_apple(input, key, AES128_KEY_LEN, output);
+}
+
+void AES256_ECB_encrypt_apple(const uint8_t *input, const uint8_t *key, uint8_t *output) {
+    AES_ECB_encrypt_apple(input, key, AES256_KEY_LEN, output);
+}
+
 #endif
 
 #endif
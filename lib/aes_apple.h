@@ -29,6 +29,7 @@
 
 #ifdef __APPLE__
 void AES128_ECB_encrypt_apple(const uint8_t* input, const uint8_t* key, uint8_t *output);
+void AES256_ECB_encrypt_apple(const uint8_t* input, const uint8_t* key, uint8_t *output);
 #endif
 
 #endif
@@ -0,0 +1,223 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include "aes_hw.h"
+
+/*
+ * The kernels are compiled with function target attributes so that the
+ * library itself does not need to be built for a cpu with AES
+ * instructions. Which one is used is decided at runtime.
+ * Four blocks are encrypted at a time to hide the latency of the
+ * AES instructions.
+ */
+
+#if (defined(__x86_64__) || defined(__i386__)) && \
+        (defined(__GNUC__) || defined(__clang__))
+#define HAVE_AES_HW_X86 1
+#include <cpuid.h>
+#include <immintrin.h>
+#elif defined(__aarch64__) && \
+        ((defined(__GNUC__) && !defined(__clang__)) || \
+         defined(__ARM_FEATURE_AES) || defined(__ARM_FEATURE_CRYPTO))
+/* Older clang only declares the crypto intrinsics when the whole
+ * compilation unit targets them, gcc honours the target attribute.
+ */
+#define HAVE_AES_HW_ARM 1
+#include <arm_neon.h>
+#if defined(__linux__)
+#include <sys/auxv.h>
+#ifndef HWCAP_AES
+#define HWCAP_AES (1 << 3)
+#endif
+#endif
+#endif
+
+#ifdef HAVE_AES_HW_X86
+#define AES_HW_TARGET __attribute__((target("aes,sse2")))
+
+AES_HW_TARGET static void
+aes_x86_encrypt_blocks(const uint8_t *round_keys, int rounds,
+                       const uint8_t *input, uint8_t *output,
+                       size_t nblocks)
+{
+        __m128i rk[15], b0, b1, b2, b3;
+        int i;
+
+        for (i = 0; i <= rounds; i++) {
+                rk[i] = _mm_loadu_si128((const __m128i *)&round_keys[i * 16]);
+        }
+
+        while (nblocks >= 4) {
+                b0 = _mm_loadu_si128((const __m128i *)&input[0]);
+                b1 = _mm_loadu_si128((const __m128i *)&input[16]);
+                b2 = _mm_loadu_si128((const __m128i *)&input[32]);
+                b3 = _mm_loadu_si128((const __m128i *)&input[48]);
+                b0 = _mm_xor_si128(b0, rk[0]);
+                b1 = _mm_xor_si128(b1, rk[0]);
+                b2 = _mm_xor_si128(b2, rk[0]);
+                b3 = _mm_xor_si128(b3, rk[0]);
+                for (i = 1; i < rounds; i++) {
+                        b0 = _mm_aesenc_si128(b0, rk[i]);
+                        b1 = _mm_aesenc_si128(b1, rk[i]);
+                        b2 = _mm_aesenc_si128(b2, rk[i]);
+                        b3 = _mm_aesenc_si128(b3, rk[i]);
+                }
+                b0 = _mm_aesenclast_si128(b0, rk[rounds]);
+                b1 = _mm_aesenclast_si128(b1, rk[rounds]);
+                b2 = _mm_aesenclast_si128(b2, rk[rounds]);
+                b3 = _mm_aesenclast_si128(b3, rk[rounds]);
+                _mm_storeu_si128((__m128i *)&output[0], b0);
+                _mm_storeu_si128((__m128i *)&output[16], b1);
+                _mm_storeu_si128((__m128i *)&output[32], b2);
+                _mm_storeu_si128((__m128i *)&output[48], b3);
+                input += 64;
+                output += 64;
+                nblocks -= 4;
+        }
+        while (nblocks--) {
+                b0 = _mm_loadu_si128((const __m128i *)input);
+                b0 = _mm_xor_si128(b0, rk[0]);
+                for (i = 1; i < rounds; i++) {
+                        b0 = _mm_aesenc_si128(b0, rk[i]);
+                }
+                b0 = _mm_aesenclast_si128(b0, rk[rounds]);
+                _mm_storeu_si128((__m128i *)output, b0);
+                input += 16;
+                output += 16;
+        }
+}
+
+int AES_hw_available(void)
+{
+        static int have_aes = -1;
+        unsigned int eax, ebx, ecx, edx;
+
+        if (have_aes < 0) {
+                have_aes = 0;
+                if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) &&
+                    (ecx & bit_AES) && (edx & bit_SSE2)) {
+                        have_aes = 1;
+                }
+        }
+        return have_aes;
+}
+
+void AES_ECB_encrypt_blocks_hw(const uint8_t *round_keys, int rounds,
+                               const uint8_t *input, uint8_t *output,
+                               size_t nblocks)
+{
+        aes_x86_encrypt_blocks(round_keys, rounds, input, output, nblocks);
+}
+
+#elif defined(HAVE_AES_HW_ARM)
+#if defined(__clang__)
+#define AES_HW_TARGET __attribute__((target("crypto")))
+#else
+#define AES_HW_TARGET __attribute__((target("+crypto")))
+#endif
+
+/*
+ * AESE does AddRoundKey, SubBytes and ShiftRows and AESMC does MixColumns
+ * so the last round key is added with a plain xor.
+ */
+AES_HW_TARGET static void
+aes_arm_encrypt_blocks(const uint8_t *round_keys, int rounds,
+                       const uint8_t *input, uint8_t *output,
+                       size_t nblocks)
+{
+        uint8x16_t rk[15], b0, b1, b2, b3;
+        int i;
+
+        for (i = 0; i <= rounds; i++) {
+                rk[i] = vld1q_u8(&round_keys[i * 16]);
+        }
+
+        while (nblocks >= 4) {
+                b0 = vld1q_u8(&input[0]);
+                b1 = vld1q_u8(&input[16]);
+                b2 = vld1q_u8(&input[32]);
+                b3 = vld1q_u8(&input[48]);
+                for (i = 0; i < rounds - 1; i++) {
+                        b0 = vaesmcq_u8(vaeseq_u8(b0, rk[i]));
+                        b1 = vaesmcq_u8(vaeseq_u8(b1, rk[i]));
+                        b2 = vaesmcq_u8(vaeseq_u8(b2, rk[i]));
+                        b3 = vaesmcq_u8(vaeseq_u8(b3, rk[i]));
+                }
+                b0 = veorq_u8(vaeseq_u8(b0, rk[rounds - 1]), rk[rounds]);
+                b1 = veorq_u8(vaeseq_u8(b1, rk[rounds - 1]), rk[rounds]);
+                b2 = veorq_u8(vaeseq_u8(b2, rk[rounds - 1]), rk[rounds]);
+                b3 = veorq_u8(vaeseq_u8(b3, rk[rounds - 1]), rk[rounds]);
+                vst1q_u8(&output[0], b0);
+                vst1q_u8(&output[16], b1);
+                vst1q_u8(&output[32], b2);
+                vst1q_u8(&output[48], b3);
+                input += 64;
+                output += 64;
+                nblocks -= 4;
+        }
+        while (nblocks--) {
+                b0 = vld1q_u8(input);
+                for (i = 0; i < rounds - 1; i++) {
+                        b0 = vaesmcq_u8(vaeseq_u8(b0, rk[i]));
+                }
+                b0 = veorq_u8(vaeseq_u8(b0, rk[rounds - 1]), rk[rounds]);
+                vst1q_u8(output, b0);
+                input += 16;
+                output += 16;
+        }
+}
+
+int AES_hw_available(void)
+{
+#if defined(__linux__)
+        static int have_aes = -1;
+
+        if (have_aes < 0) {
+                have_aes = (getauxval(AT_HWCAP) & HWCAP_AES) ? 1 : 0;
+        }
+        return have_aes;
+#elif defined(__APPLE__) || defined(__ARM_FEATURE_AES) || \
+        defined(__ARM_FEATURE_CRYPTO)
+        /* all Apple arm64 cpus have the crypto extension */
+        return 1;
+#else
+        return 0;
+#endif
+}
+
+void AES_ECB_encrypt_blocks_hw(const uint8_t *round_keys, int rounds,
+                               const uint8_t *input, uint8_t *output,
+                               size_t nblocks)
+{
+        aes_arm_encrypt_blocks(round_keys, rounds, input, output, nblocks);
+}
+
+#else
+
+int AES_hw_available(void)
+{
+        return 0;
+}
+
+void AES_ECB_encrypt_blocks_hw(const uint8_t *round_keys, int rounds,
+                               const uint8_t *input, uint8_t *output,
+                               size_t nblocks)
+{
+}
+
+#endif
@@ -0,0 +1,47 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _AES_HW_H_
+#define _AES_HW_H_
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#include <stddef.h>
+
+/*
+ * AES block encryption using the AES instructions of the cpu:
+ * AES-NI on x86 and the ARMv8 cryptography extension on aarch64.
+ * The round keys are the standard FIPS-197 expanded key, 16 bytes per
+ * round, as produced by AES_expand_key_reference().
+ */
+
+/* Returns non-zero if AES_ECB_encrypt_blocks_hw() can be used. */
+int AES_hw_available(void);
+
+/* input and output may be the same buffer. */
+void AES_ECB_encrypt_blocks_hw(const uint8_t *round_keys, int rounds,
+                               const uint8_t *input, uint8_t *output,
+                               size_t nblocks);
+
+#endif /* _AES_HW_H_ */
@@ -47,12 +47,14 @@ NOTE:   String length must be evenly divisible by 16byte (str_len % 16 == 0)
 /*****************************************************************************/
 // The number of columns comprising a state in AES. This is a constant in AES. Value=4
 #define Nb 4
-// The number of 32 bit words in a key.
-#define Nk 4
-// Key length in bytes [128 bit]
+// The number of 32 bit words in a key, for 128 and 256 bit keys.
+#define Nk128 4
+#define Nk256 8
+// Block length in bytes
 #define KEYLEN 16
-// The number of rounds in AES Cipher.
-#define Nr 10
+// The number of rounds in AES Cipher, for 128 and 256 bit keys.
+#define Nr128 10
+#define Nr256 14
 
 // jcallan@github points out that declaring Multiply as a function
 // reduces code size considerably with the Keil ARM compiler.
@@ -143,7 +145,7 @@ static uint8_t getSBoxInvert(uint8_t num)
 }
 
 // This function produces Nb(Nr+1) round keys. The round keys are used in each round to decrypt the states.
-static void KeyExpansion(const uint8_t* Key, uint8_t* roundKey)
+static void KeyExpansion(const uint8_t* Key, uint8_t* roundKey, uint32_t Nk, uint32_t Nr)
 {
   uint32_t i, j, k;
   uint8_t tempa[4]; // Used for the column/row operations
@@ -210,7 +212,7 @@ static void KeyExpansion(const uint8_t* Key, uint8_t* roundKey)
 
 // This function adds the round key to state.
 // The round key is added to the state by an XOR function.
-static void AddRoundKey(uint8_t* roundKey, state_t* state, uint8_t round)
+static void AddRoundKey(const uint8_t* roundKey, state_t* state, uint8_t round)
 {
   uint8_t i,j;
   for(i=0;i<4;++i)
@@ -374,7 +376,7 @@ static void InvShiftRows(state_t* state)
 
 
 // Cipher is the main function that encrypts the PlainText.
-static void Cipher(uint8_t* roundKey, state_t* state)
+static void Cipher(const uint8_t* roundKey, state_t* state, uint8_t Nr)
 {
   uint8_t round = 0;
 
@@ -399,7 +401,7 @@ static void Cipher(uint8_t* roundKey, state_t* state)
   AddRoundKey(roundKey, state, Nr);
 }
 
-static void InvCipher(uint8_t* roundKey, state_t* state)
+static void InvCipher(const uint8_t* roundKey, state_t* state, uint8_t Nr)
 {
   uint8_t round=0;
 
@@ -424,7 +426,7 @@ static void InvCipher(uint8_t* roundKey, state_t* state)
   AddRoundKey(roundKey, state, 0);
 }
 
-static void BlockCopy(uint8_t* output, uint8_t* input)
+static void BlockCopy(uint8_t* output, const uint8_t* input)
 {
   uint8_t i;
   for (i=0;i<KEYLEN;++i)
@@ -449,10 +451,47 @@ void AES128_ECB_encrypt_reference(uint8_t* input, const uint8_t* key, uint8_t* o
   // Copy input to output, and work in-memory on output
   BlockCopy(output, input);
 
-  KeyExpansion(key, roundKey);
+  KeyExpansion(key, roundKey, Nk128, Nr128);
 
   // The next function call encrypts the PlainText with the Key using AES algorithm.
-  Cipher(roundKey, (state_t*)output);
+  Cipher(roundKey, (state_t*)output, Nr128);
+}
+
+void AES256_ECB_encrypt_reference(uint8_t* input, const uint8_t* key, uint8_t* output)
+{
+  // The array that stores the round keys.
+  uint8_t roundKey[240];
+
+  // Copy input to output, and work in-memory on output
+  BlockCopy(output, input);
+
+  KeyExpansion(key, roundKey, Nk256, Nr256);
+
+  Cipher(roundKey, (state_t*)output, Nr256);
+}
+
+// Expands a 16 or 32 byte key into roundKey, which must hold 240 bytes.
+// Returns the number of rounds.
+int AES_expand_key_reference(const uint8_t* key, uint32_t keyLen, uint8_t* roundKey)
+{
+  uint32_t nk = keyLen == 32 ? Nk256 : Nk128;
+  uint32_t nr = keyLen == 32 ? Nr256 : Nr128;
+
+  KeyExpansion(key, roundKey, nk, nr);
+  return (int)nr;
+}
+
+// Encrypts nblocks blocks with an already expanded key.
+// input and output may be the same buffer.
+void AES_ECB_encrypt_blocks_reference(const uint8_t* roundKey, int rounds, const uint8_t* input, uint8_t* output, size_t nblocks)
+{
+  while (nblocks--)
+  {
+    BlockCopy(output, input);
+    Cipher(roundKey, (state_t*)output, (uint8_t)rounds);
+    input += KEYLEN;
+    output += KEYLEN;
+  }
 }
 
 void AES128_ECB_decrypt_reference(uint8_t* input, const uint8_t* key, uint8_t *output)
@@ -464,9 +503,9 @@ void AES128_ECB_decrypt_reference(uint8_t* input, const uint8_t* key, uint8_t *o
   BlockCopy(output, input);
 
   // The KeyExpansion routine must be called before encryption.
-  KeyExpansion(key, roundKey);
+  KeyExpansion(key, roundKey, Nk128, Nr128);
 
-  InvCipher(roundKey, (state_t*)output);
+  InvCipher(roundKey, (state_t*)output, Nr128);
 }
 
 
@@ -501,14 +540,14 @@ void AES128_CBC_encrypt_buffer_reference(uint8_t* output, uint8_t* input, uint32
   // Skip the key expansion if key is passed as 0
   if(0 != key)
   {
-    KeyExpansion(key, roundKey);
+    KeyExpansion(key, roundKey, Nk128, Nr128);
   }
 
   for(i = 0; i < length; i += KEYLEN)
   {
     XorWithIv(input, iv);
     BlockCopy(output, input);
-    Cipher(roundKey, (state_t*)output);
+    Cipher(roundKey, (state_t*)output, Nr128);
     iv = output;
     input += KEYLEN;
     output += KEYLEN;
@@ -518,7 +557,7 @@ void AES128_CBC_encrypt_buffer_reference(uint8_t* output, uint8_t* input, uint32
   {
     BlockCopy(output, input);
     memset(output + remainders, 0, KEYLEN - remainders); /* add 0-padding */
-    Cipher(roundKey, (state_t*)output);
+    Cipher(roundKey, (state_t*)output, Nr128);
   }
 }
 
@@ -535,13 +574,13 @@ void AES128_CBC_decrypt_buffer_reference(uint8_t* output, uint8_t* input, uint32
   // Skip the key expansion if key is passed as 0
   if(0 != key)
   {
-    KeyExpansion(key, roundKey);
+    KeyExpansion(key, roundKey, Nk128, Nr128);
   }
 
   for(i = 0; i < length; i += KEYLEN)
   {
     BlockCopy(output, input);
-    InvCipher(roundKey, (state_t*)output);
+    InvCipher(roundKey, (state_t*)output, Nr128);
     XorWithIv(output, iv);
     iv = input;
     input += KEYLEN;
@@ -552,7 +591,7 @@ void AES128_CBC_decrypt_buffer_reference(uint8_t* output, uint8_t* input, uint32
   {
     BlockCopy(output, input);
     memset(output+remainders, 0, KEYLEN - remainders); /* add 0-padding */
-    InvCipher(roundKey, (state_t*)output);
+    InvCipher(roundKey, (state_t*)output, Nr128);
   }
 }
 
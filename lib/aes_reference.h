@@ -13,6 +13,8 @@
 #include <stdint.h>
 #endif
 
+#include <stddef.h>
+
 // #define the macros below to 1/0 to enable/disable the mode of operation.
 //
 // CBC enables AES128 encryption in CBC-mode of operation and handles 0-padding.
@@ -33,6 +35,9 @@
 
 void AES128_ECB_encrypt_reference(uint8_t* input, const uint8_t* key, uint8_t *output);
 void AES128_ECB_decrypt_reference(uint8_t* input, const uint8_t* key, uint8_t *output);
+void AES256_ECB_encrypt_reference(uint8_t* input, const uint8_t* key, uint8_t *output);
+int AES_expand_key_reference(const uint8_t* key, uint32_t keyLen, uint8_t* roundKey);
+void AES_ECB_encrypt_blocks_reference(const uint8_t* roundKey, int rounds, const uint8_t* input, uint8_t* output, size_t nblocks);
 
 #endif // #if defined(ECB) && ECB
 
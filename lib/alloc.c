@@ -60,95 +60,298 @@
 #endif
 
 
+#include <errno.h>
+
 #include "compat.h"
 
 #include <smb2.h>
 #include <libsmb2.h>
 #include "libsmb2-private.h"
 
-#define container_of(ptr, type, member) ({                      \
-        const typeof( ((type *)0)->member ) *__mptr = (ptr);    \
-        (type *)(void *)( (char *)__mptr - offsetof(type,member) );})
+static void *
+smb2_libc_malloc(size_t size, void *opaque)
+{
+        return malloc(size);
+}
+
+static void *
+smb2_libc_calloc(size_t nmemb, size_t size, void *opaque)
+{
+        return calloc(nmemb, size);
+}
+
+static void
+smb2_libc_free(void *ptr, void *opaque)
+{
+        free(ptr);
+}
+
+static const struct smb2_allocator smb2_libc_allocator = {
+        smb2_libc_malloc,
+        smb2_libc_calloc,
+        smb2_libc_free,
+        NULL
+};
+
+/* Used for new contexts and for allocations that are not tied to one */
+static struct smb2_allocator smb2_global_allocator = {
+        smb2_libc_malloc,
+        smb2_libc_calloc,
+        smb2_libc_free,
+        NULL
+};
+
+#define smb2_allocator(smb2) ((smb2) ? &(smb2)->allocator : &smb2_global_allocator)
+
+void
+smb2_init_allocator(struct smb2_context *smb2)
+{
+        smb2->allocator = smb2_global_allocator;
+}
+
+void *
+smb2_malloc(struct smb2_context *smb2, size_t size)
+{
+        struct smb2_allocator *a = smb2_allocator(smb2);
+
+        return a->malloc(size, a->opaque);
+}
+
+void *
+smb2_calloc(struct smb2_context *smb2, size_t nmemb, size_t size)
+{
+        struct smb2_allocator *a = smb2_allocator(smb2);
+
+        return a->calloc(nmemb, size, a->opaque);
+}
+
+char *
+smb2_strdup(struct smb2_context *smb2, const char *s)
+{
+        size_t len = strlen(s) + 1;
+        char *ptr;
+
+        ptr = smb2_malloc(smb2, len);
+        if (ptr == NULL) {
+                return NULL;
+        }
+        memcpy(ptr, s, len);
 
-struct smb2_alloc_entry {
-        struct smb2_alloc_entry *next;
-#if 0 /* UNUSED. */
+        return ptr;
+}
+
+void
+smb2_free(struct smb2_context *smb2, void *ptr)
+{
+        struct smb2_allocator *a = smb2_allocator(smb2);
+
+        if (ptr == NULL) {
+                return;
+        }
+        a->free(ptr, a->opaque);
+}
+
+/*
+ * Free callback for buffers allocated with smb2_malloc()/smb2_calloc().
+ * When invoked through smb2_call_free_cb() the buffer is released to the
+ * allocator of the context, otherwise to the global one.
+ */
+void
+smb2_free_cb(void *ptr)
+{
+        smb2_free(NULL, ptr);
+}
+
+void
+smb2_call_free_cb(struct smb2_context *smb2, void (*free_cb)(void *),
+                  void *ptr)
+{
+        if (free_cb == smb2_free_cb) {
+                smb2_free(smb2, ptr);
+                return;
+        }
+        free_cb(ptr);
+}
+
+/*
+ * Strings owned by the context when the allocator is switched, these have
+ * to be moved over to the new allocator.
+ */
+static int
+smb2_move_string(struct smb2_context *smb2, const struct smb2_allocator *to,
+                 const char **str)
+{
         size_t len;
-#endif
-        char buf[0];
+        char *ptr;
+
+        if (*str == NULL) {
+                return 0;
+        }
+        len = strlen(*str) + 1;
+        ptr = to->malloc(len, to->opaque);
+        if (ptr == NULL) {
+                return -1;
+        }
+        memcpy(ptr, *str, len);
+        smb2_free(smb2, discard_const(*str));
+        *str = ptr;
+
+        return 0;
+}
+
+int
+smb2_set_allocator(struct smb2_context *smb2,
+                   const struct smb2_allocator *allocator)
+{
+        if (allocator == NULL) {
+                allocator = &smb2_libc_allocator;
+        }
+        if (allocator->malloc == NULL || allocator->calloc == NULL ||
+            allocator->free == NULL) {
+                if (smb2) {
+                        smb2_set_error(smb2, "Allocator is missing malloc, "
+                                       "calloc or free");
+                }
+                return -EINVAL;
+        }
+
+        if (smb2 == NULL) {
+                smb2_global_allocator = *allocator;
+                return 0;
+        }
+
+        if (SMB2_VALID_SOCKET(smb2->fd) || smb2->connecting_fds_count ||
+            smb2->outqueue.head || smb2->waitqueue.head || smb2->pdu_cache ||
+            smb2->connect_data || smb2->uring) {
+                smb2_set_error(smb2, "Can not change the allocator of a "
+                               "context that is in use");
+                return -EBUSY;
+        }
+        if (smb2_move_string(smb2, allocator, &smb2->user) ||
+            smb2_move_string(smb2, allocator, &smb2->password) ||
+            smb2_move_string(smb2, allocator, &smb2->domain) ||
+            smb2_move_string(smb2, allocator, &smb2->workstation) ||
+            smb2_move_string(smb2, allocator, &smb2->server) ||
+            smb2_move_string(smb2, allocator, &smb2->share)) {
+                smb2_set_error(smb2, "Failed to allocate memory");
+                return -ENOMEM;
+        }
+        smb2->allocator = *allocator;
+
+        return 0;
+}
+
+/*
+ * Decoded replies are built in a small bump allocator. smb2_alloc_init()
+ * allocates the top level object together with some spare room that
+ * smb2_alloc_data() then hands out, so that a typical reply lives in a
+ * single block. Once that runs out further chunks are allocated and
+ * everything is released at once by smb2_free_data().
+ */
+#define SMB2_ALLOC_ALIGN 8
+#define smb2_alloc_align(size) \
+        (((size) + SMB2_ALLOC_ALIGN - 1) & ~((size_t)SMB2_ALLOC_ALIGN - 1))
+
+/* Spare room allocated along with the object in smb2_alloc_init() */
+#define SMB2_ALLOC_INIT_SPARE 256
+/* Size of the chunks we allocate once that is used up */
+#define SMB2_ALLOC_CHUNK_SIZE 4096
+
+struct smb2_alloc_chunk {
+        struct smb2_alloc_chunk *next;
 };
 
 struct smb2_alloc_header {
-        struct smb2_alloc_entry *mem;
-        char buf[0];
+        /* additional chunks, freed together with the header */
+        struct smb2_alloc_chunk *chunks;
+        /* unused part of the current chunk */
+        char *pos;
+        char *end;
 };
 
+#define SMB2_ALLOC_HEADER_SIZE smb2_alloc_align(sizeof(struct smb2_alloc_header))
+#define SMB2_ALLOC_CHUNK_HEADER_SIZE smb2_alloc_align(sizeof(struct smb2_alloc_chunk))
+
+#define smb2_alloc_hdr(memctx) \
+        ((struct smb2_alloc_header *)(void *)((char *)(memctx) - SMB2_ALLOC_HEADER_SIZE))
+
 void *
 smb2_alloc_init(struct smb2_context *smb2, size_t size)
 {
-        struct smb2_alloc_header *ptr;
+        struct smb2_alloc_header *hdr;
+        char *ptr;
 
-        size += offsetof(struct smb2_alloc_header, buf);
+        size = smb2_alloc_align(size);
 
-        ptr = calloc(size, 1);
+        ptr = smb2_calloc(smb2, 1, SMB2_ALLOC_HEADER_SIZE + size +
+                          SMB2_ALLOC_INIT_SPARE);
         if (ptr == NULL) {
                 return NULL;
         }
 
-        return &ptr->buf[0];
+        hdr = (struct smb2_alloc_header *)(void *)ptr;
+        ptr += SMB2_ALLOC_HEADER_SIZE;
+        hdr->pos = ptr + size;
+        hdr->end = hdr->pos + SMB2_ALLOC_INIT_SPARE;
+
+        return ptr;
 }
 
 void *
 smb2_alloc_data(struct smb2_context *smb2, void *memctx, size_t size)
 {
-        struct smb2_alloc_header *hdr;
-        struct smb2_alloc_entry *ptr;
+        struct smb2_alloc_header *hdr = smb2_alloc_hdr(memctx);
+        struct smb2_alloc_chunk *chunk;
+        size_t len;
+        char *ptr;
 
-        size += offsetof(struct smb2_alloc_entry, buf);
+        size = smb2_alloc_align(size);
 
-        ptr = calloc(size, 1);
-        if (ptr == NULL) {
+        if (size <= (size_t)(hdr->end - hdr->pos)) {
+                ptr = hdr->pos;
+                hdr->pos += size;
+                return ptr;
+        }
+
+        /* Large objects get a chunk of their own so we keep using
+         * the current chunk for the small ones.
+         */
+        len = SMB2_ALLOC_CHUNK_SIZE - SMB2_ALLOC_CHUNK_HEADER_SIZE;
+        if (size > len / 4) {
+                len = size;
+        }
+
+        chunk = smb2_calloc(smb2, 1, SMB2_ALLOC_CHUNK_HEADER_SIZE + len);
+        if (chunk == NULL) {
                 smb2_set_error(smb2, "Failed to alloc %zu bytes", size);
                 return NULL;
         }
+        chunk->next = hdr->chunks;
+        hdr->chunks = chunk;
 
-#ifndef _MSC_VER
-        hdr = (struct smb2_alloc_header *)(void *)container_of(memctx, struct smb2_alloc_header, buf);
-#else
-        {
-          const char* __mptr = memctx;
-          hdr = (struct smb2_alloc_header*)((char *)__mptr - offsetof(struct smb2_alloc_header, buf));
+        ptr = (char *)chunk + SMB2_ALLOC_CHUNK_HEADER_SIZE;
+        if (len > size) {
+                hdr->pos = ptr + size;
+                hdr->end = ptr + len;
         }
-#endif /* !_MSC_VER */
-
-        ptr->next = hdr->mem;
-        hdr->mem = ptr;
 
-        return &ptr->buf[0];
+        return ptr;
 }
 
 void
 smb2_free_data(struct smb2_context *smb2, void *ptr)
 {
         struct smb2_alloc_header *hdr;
-        struct smb2_alloc_entry *ent;
+        struct smb2_alloc_chunk *chunk;
 
         if (ptr == NULL) {
                 return;
         }
 
-#ifndef _MSC_VER
-        hdr = (struct smb2_alloc_header *)(void *)container_of(ptr, struct smb2_alloc_header, buf);
-#else
-        {
-          const char* __mptr = ptr;
-          hdr = (struct smb2_alloc_header*)((char *)__mptr - offsetof(struct smb2_alloc_header, buf));
-        }
-#endif /* !_MSC_VER */
-
-        while ((ent = hdr->mem)) {
-                hdr->mem = ent->next;
-                free(ent);
+        hdr = smb2_alloc_hdr(ptr);
+        while ((chunk = hdr->chunks)) {
+                hdr->chunks = chunk->next;
+                smb2_free(smb2, chunk);
         }
-        free(hdr);
+        smb2_free(smb2, hdr);
 }
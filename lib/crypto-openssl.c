@@ -0,0 +1,611 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#include "compat.h"
+
+#include "smb2.h"
+#include "libsmb2.h"
+
+#ifdef HAVE_OPENSSL
+
+/* Only use what OpenSSL 1.1 has, so that this builds against 1.1 and 3.x */
+#define OPENSSL_API_COMPAT 0x10100000L
+
+#include <limits.h>
+#ifdef HAVE_CRYPTO_THREADS
+#include <pthread.h>
+#endif
+#include <openssl/cmac.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+
+/*
+ * The OpenSSL libcrypto as a crypto provider, see
+ * smb2_set_crypto_provider().
+ *
+ * OpenSSL can only do CCM over the whole message in one call, so CCM is
+ * built here from AES-CTR and an AES-CBC-MAC, which both stream.
+ * The state of operations and keys lives in the buffers that libsmb2
+ * passes in, and the AES contexts of the session keys are set up once in
+ * their key state, so that signing and sealing a PDU allocates nothing.
+ * MD4 is only in the legacy provider of OpenSSL 3, when it can not be
+ * loaded hash_init fails and the built in MD4 is used instead.
+ */
+
+static const EVP_CIPHER *
+ossl_aes_gcm(size_t key_len)
+{
+        return key_len == 32 ? EVP_aes_256_gcm() : EVP_aes_128_gcm();
+}
+
+static const EVP_CIPHER *
+ossl_aes_ctr(size_t key_len)
+{
+        return key_len == 32 ? EVP_aes_256_ctr() : EVP_aes_128_ctr();
+}
+
+static const EVP_CIPHER *
+ossl_aes_cbc(size_t key_len)
+{
+        return key_len == 32 ? EVP_aes_256_cbc() : EVP_aes_128_cbc();
+}
+
+/* EVP_CipherUpdate() takes an int length */
+static int
+ossl_cipher_update(EVP_CIPHER_CTX *ctx, uint8_t *out, const uint8_t *in,
+                   size_t len)
+{
+        int n, outl;
+
+        while (len) {
+                n = len > INT_MAX / 2 ? INT_MAX / 2 : (int)len;
+                if (!EVP_CipherUpdate(ctx, out, &outl, in, n)) {
+                        return -1;
+                }
+                if (out) {
+                        out += outl;
+                }
+                in += n;
+                len -= n;
+        }
+        return 0;
+}
+
+/* Sets up a context with the key, the IV is set for each message */
+static EVP_CIPHER_CTX *
+ossl_cipher_new(const EVP_CIPHER *cipher, const uint8_t *key)
+{
+        EVP_CIPHER_CTX *ctx;
+
+        ctx = EVP_CIPHER_CTX_new();
+        if (ctx == NULL) {
+                return NULL;
+        }
+        if (!EVP_EncryptInit_ex(ctx, cipher, NULL, key, NULL)) {
+                EVP_CIPHER_CTX_free(ctx);
+                return NULL;
+        }
+        return ctx;
+}
+
+/*
+ * The contexts for a signing or encryption key. They are keyed once in
+ * ossl_key_init() and each message only sets the IV or resets them.
+ * One operation at a time borrows them, an operation that finds them in
+ * use, on another crypto thread, sets up contexts of its own instead.
+ */
+struct ossl_key {
+#ifdef HAVE_CRYPTO_THREADS
+        pthread_mutex_t mutex;
+#endif
+        int busy;
+        EVP_CIPHER_CTX *gcm;
+        EVP_CIPHER_CTX *ctr;
+        EVP_CIPHER_CTX *cbc;
+        CMAC_CTX *cmac;
+};
+
+static void
+ossl_key_free(void *key_state)
+{
+        struct ossl_key *k = key_state;
+
+        EVP_CIPHER_CTX_free(k->gcm);
+        EVP_CIPHER_CTX_free(k->ctr);
+        EVP_CIPHER_CTX_free(k->cbc);
+        CMAC_CTX_free(k->cmac);
+#ifdef HAVE_CRYPTO_THREADS
+        pthread_mutex_destroy(&k->mutex);
+#endif
+}
+
+static void *
+ossl_key_init(void *buf, const uint8_t *key, size_t key_len)
+{
+        struct ossl_key *k = buf;
+
+        if (key_len != 16 && key_len != 32) {
+                return NULL;
+        }
+        memset(k, 0, sizeof(*k));
+#ifdef HAVE_CRYPTO_THREADS
+        pthread_mutex_init(&k->mutex, NULL);
+#endif
+        k->gcm = ossl_cipher_new(ossl_aes_gcm(key_len), key);
+        k->ctr = ossl_cipher_new(ossl_aes_ctr(key_len), key);
+        k->cbc = ossl_cipher_new(ossl_aes_cbc(key_len), key);
+        k->cmac = CMAC_CTX_new();
+        if (k->gcm == NULL || k->ctr == NULL || k->cbc == NULL ||
+            k->cmac == NULL ||
+            !CMAC_Init(k->cmac, key, key_len, ossl_aes_cbc(key_len), NULL)) {
+                ossl_key_free(k);
+                return NULL;
+        }
+        return k;
+}
+
+/* Returns 0 when the contexts of the key are now ours */
+static int
+ossl_key_get(struct ossl_key *k)
+{
+        int rc = -1;
+
+        if (k == NULL) {
+                return -1;
+        }
+#ifdef HAVE_CRYPTO_THREADS
+        pthread_mutex_lock(&k->mutex);
+#endif
+        if (!k->busy) {
+                k->busy = 1;
+                rc = 0;
+        }
+#ifdef HAVE_CRYPTO_THREADS
+        pthread_mutex_unlock(&k->mutex);
+#endif
+        return rc;
+}
+
+static void
+ossl_key_put(struct ossl_key *k)
+{
+#ifdef HAVE_CRYPTO_THREADS
+        pthread_mutex_lock(&k->mutex);
+#endif
+        k->busy = 0;
+#ifdef HAVE_CRYPTO_THREADS
+        pthread_mutex_unlock(&k->mutex);
+#endif
+}
+
+/* Kept in the buffer that the caller passes to aead_init */
+struct ossl_aead {
+        /* the key the contexts are borrowed from, NULL if they are ours */
+        struct ossl_key *key;
+        /* GCM, or AES-CTR for CCM */
+        EVP_CIPHER_CTX *ctx;
+        /* AES-CBC for the CCM MAC, NULL for GCM */
+        EVP_CIPHER_CTX *mac;
+        int encrypt;
+        int err;
+        /* CCM: the last CBC-MAC block and the first key stream block */
+        uint8_t cbc[16];
+        uint8_t s0[16];
+        size_t len;
+};
+
+static void
+ossl_aead_free(void *state)
+{
+        struct ossl_aead *st = state;
+
+        if (st->key) {
+                ossl_key_put(st->key);
+        } else {
+                EVP_CIPHER_CTX_free(st->ctx);
+                EVP_CIPHER_CTX_free(st->mac);
+        }
+}
+
+/* Runs data through the CBC-MAC, only the last output block is kept */
+static void
+ossl_ccm_mac(struct ossl_aead *st, const uint8_t *in, size_t len)
+{
+        uint8_t out[1024 + 16];
+        size_t n;
+        int outl;
+
+        while (len) {
+                n = len > 1024 ? 1024 : len;
+                if (!EVP_EncryptUpdate(st->mac, out, &outl, in, (int)n)) {
+                        st->err = 1;
+                        return;
+                }
+                if (outl >= 16) {
+                        memcpy(st->cbc, &out[outl - 16], 16);
+                }
+                in += n;
+                len -= n;
+        }
+}
+
+static int
+ossl_ccm_init(struct ossl_aead *st, const uint8_t *nonce,
+              const uint8_t *aad, size_t aad_len, size_t len)
+{
+        static const uint8_t zero[16];
+        uint8_t b[16];
+        size_t pad;
+        int outl;
+
+        /* 11 byte nonce, 4 byte length and 16 byte tag */
+        b[0] = 0x40 | (((16 - 2) / 2) << 3) | (4 - 1);
+        memcpy(&b[1], nonce, 11);
+        b[12] = (uint8_t)(len >> 24);
+        b[13] = (uint8_t)(len >> 16);
+        b[14] = (uint8_t)(len >> 8);
+        b[15] = (uint8_t)len;
+        if (!EVP_EncryptInit_ex(st->mac, NULL, NULL, NULL, zero)) {
+                return -1;
+        }
+        EVP_CIPHER_CTX_set_padding(st->mac, 0);
+        ossl_ccm_mac(st, b, 16);
+        b[0] = (uint8_t)(aad_len >> 8);
+        b[1] = (uint8_t)aad_len;
+        ossl_ccm_mac(st, b, 2);
+        ossl_ccm_mac(st, aad, aad_len);
+        pad = (16 - (2 + aad_len) % 16) % 16;
+        ossl_ccm_mac(st, zero, pad);
+        if (st->err) {
+                return -1;
+        }
+
+        /* Counter block 0 encrypts the tag, the data starts at 1 */
+        b[0] = 4 - 1;
+        memcpy(&b[1], nonce, 11);
+        memset(&b[12], 0, 4);
+        if (!EVP_EncryptInit_ex(st->ctx, NULL, NULL, NULL, b)) {
+                return -1;
+        }
+        if (!EVP_EncryptUpdate(st->ctx, st->s0, &outl, zero, 16)) {
+                return -1;
+        }
+        st->len = len;
+        return 0;
+}
+
+static void *
+ossl_aead_init(void *key_state, void *buf, uint16_t cipher,
+               const uint8_t *key, size_t key_len,
+               const uint8_t *nonce, const uint8_t *aad, size_t aad_len,
+               size_t len, int encrypt)
+{
+        struct ossl_aead *st = buf;
+        int gcm;
+
+        switch (cipher) {
+        case SMB2_ENCRYPTION_AES_128_GCM:
+        case SMB2_ENCRYPTION_AES_256_GCM:
+                gcm = 1;
+                break;
+        case SMB2_ENCRYPTION_AES_128_CCM:
+        case SMB2_ENCRYPTION_AES_256_CCM:
+                if (len > 0xffffffff) {
+                        return NULL;
+                }
+                gcm = 0;
+                break;
+        default:
+                return NULL;
+        }
+
+        memset(st, 0, sizeof(*st));
+        st->encrypt = encrypt;
+        if (ossl_key_get(key_state) == 0) {
+                st->key = key_state;
+                st->ctx = gcm ? st->key->gcm : st->key->ctr;
+                st->mac = gcm ? NULL : st->key->cbc;
+        } else {
+                st->ctx = ossl_cipher_new(gcm ? ossl_aes_gcm(key_len) :
+                                          ossl_aes_ctr(key_len), key);
+                if (!gcm) {
+                        st->mac = ossl_cipher_new(ossl_aes_cbc(key_len), key);
+                }
+                if (st->ctx == NULL || (!gcm && st->mac == NULL)) {
+                        goto failed;
+                }
+        }
+
+        if (gcm) {
+                if (!EVP_CipherInit_ex(st->ctx, NULL, NULL, NULL, nonce,
+                                       encrypt)) {
+                        goto failed;
+                }
+                if (ossl_cipher_update(st->ctx, NULL, aad, aad_len)) {
+                        goto failed;
+                }
+        } else if (ossl_ccm_init(st, nonce, aad, aad_len, len)) {
+                goto failed;
+        }
+        return st;
+
+ failed:
+        ossl_aead_free(st);
+        return NULL;
+}
+
+static void
+ossl_aead_update(void *state, const uint8_t *in, uint8_t *out, size_t len)
+{
+        struct ossl_aead *st = state;
+
+        if (st->mac && st->encrypt) {
+                /* the MAC is over the plaintext */
+                ossl_ccm_mac(st, in, len);
+        }
+        if (ossl_cipher_update(st->ctx, out, in, len)) {
+                st->err = 1;
+        }
+        if (st->mac && !st->encrypt) {
+                ossl_ccm_mac(st, out, len);
+        }
+}
+
+static int
+ossl_aead_final(void *state, uint8_t *tag)
+{
+        static const uint8_t zero[16];
+        struct ossl_aead *st = state;
+        uint8_t buf[16];
+        int i, outl, rc = -1;
+
+        if (st->mac) {
+                ossl_ccm_mac(st, zero, (16 - st->len % 16) % 16);
+                for (i = 0; i < 16; i++) {
+                        buf[i] = st->cbc[i] ^ st->s0[i];
+                }
+                if (st->err) {
+                        goto out;
+                }
+                if (st->encrypt) {
+                        memcpy(tag, buf, 16);
+                        rc = 0;
+                } else {
+                        rc = CRYPTO_memcmp(buf, tag, 16) ? -1 : 0;
+                }
+                goto out;
+        }
+
+        if (st->err) {
+                goto out;
+        }
+        if (!st->encrypt &&
+            !EVP_CIPHER_CTX_ctrl(st->ctx, EVP_CTRL_GCM_SET_TAG, 16, tag)) {
+                goto out;
+        }
+        if (EVP_CipherFinal_ex(st->ctx, buf, &outl) <= 0) {
+                goto out;
+        }
+        if (st->encrypt &&
+            !EVP_CIPHER_CTX_ctrl(st->ctx, EVP_CTRL_GCM_GET_TAG, 16, tag)) {
+                goto out;
+        }
+        rc = 0;
+
+ out:
+        ossl_aead_free(st);
+        return rc;
+}
+
+/* Kept in the buffer that the caller passes to hash_init */
+struct ossl_hash {
+        int alg;
+        /* the key the CMAC or GMAC context is borrowed from */
+        struct ossl_key *key;
+        union {
+                EVP_MD_CTX *md;
+                HMAC_CTX *hmac;
+                CMAC_CTX *cmac;
+                EVP_CIPHER_CTX *gmac;
+        } u;
+};
+
+static void
+ossl_hash_free(struct ossl_hash *st)
+{
+        if (st->key) {
+                ossl_key_put(st->key);
+                return;
+        }
+        switch (st->alg) {
+        case SMB2_CRYPTO_SHA512:
+        case SMB2_CRYPTO_MD4:
+                EVP_MD_CTX_free(st->u.md);
+                break;
+        case SMB2_CRYPTO_HMAC_SHA256:
+        case SMB2_CRYPTO_HMAC_MD5:
+                HMAC_CTX_free(st->u.hmac);
+                break;
+        case SMB2_CRYPTO_AES_CMAC:
+                CMAC_CTX_free(st->u.cmac);
+                break;
+        case SMB2_CRYPTO_AES_GMAC:
+                EVP_CIPHER_CTX_free(st->u.gmac);
+                break;
+        }
+}
+
+static void *
+ossl_hash_init(void *key_state, void *buf, int alg,
+               const uint8_t *key, size_t key_len, const uint8_t *nonce)
+{
+        struct ossl_hash *st = buf;
+        int ok = 0;
+
+        memset(st, 0, sizeof(*st));
+        st->alg = alg;
+        if ((alg == SMB2_CRYPTO_AES_CMAC || alg == SMB2_CRYPTO_AES_GMAC) &&
+            ossl_key_get(key_state) == 0) {
+                st->key = key_state;
+        }
+        switch (alg) {
+        case SMB2_CRYPTO_SHA512:
+        case SMB2_CRYPTO_MD4:
+                st->u.md = EVP_MD_CTX_new();
+                ok = st->u.md &&
+                        EVP_DigestInit_ex(st->u.md,
+                                          alg == SMB2_CRYPTO_MD4 ?
+                                          EVP_md4() : EVP_sha512(), NULL);
+                break;
+        case SMB2_CRYPTO_HMAC_SHA256:
+        case SMB2_CRYPTO_HMAC_MD5:
+                st->u.hmac = HMAC_CTX_new();
+                ok = st->u.hmac &&
+                        HMAC_Init_ex(st->u.hmac, key, (int)key_len,
+                                     alg == SMB2_CRYPTO_HMAC_MD5 ?
+                                     EVP_md5() : EVP_sha256(), NULL);
+                break;
+        case SMB2_CRYPTO_AES_CMAC:
+                if (st->key) {
+                        /* restarts with the key that is already set up */
+                        st->u.cmac = st->key->cmac;
+                        ok = CMAC_Init(st->u.cmac, NULL, 0, NULL, NULL);
+                        break;
+                }
+                st->u.cmac = CMAC_CTX_new();
+                ok = st->u.cmac &&
+                        CMAC_Init(st->u.cmac, key, key_len,
+                                  ossl_aes_cbc(key_len), NULL);
+                break;
+        case SMB2_CRYPTO_AES_GMAC:
+                st->u.gmac = st->key ? st->key->gcm :
+                        ossl_cipher_new(ossl_aes_gcm(key_len), key);
+                ok = st->u.gmac &&
+                        EVP_EncryptInit_ex(st->u.gmac, NULL, NULL, NULL,
+                                           nonce);
+                break;
+        }
+        if (!ok) {
+                ossl_hash_free(st);
+                return NULL;
+        }
+        return st;
+}
+
+static void
+ossl_hash_update(void *state, const uint8_t *data, size_t len)
+{
+        struct ossl_hash *st = state;
+
+        switch (st->alg) {
+        case SMB2_CRYPTO_SHA512:
+        case SMB2_CRYPTO_MD4:
+                EVP_DigestUpdate(st->u.md, data, len);
+                break;
+        case SMB2_CRYPTO_HMAC_SHA256:
+        case SMB2_CRYPTO_HMAC_MD5:
+                HMAC_Update(st->u.hmac, data, len);
+                break;
+        case SMB2_CRYPTO_AES_CMAC:
+                CMAC_Update(st->u.cmac, data, len);
+                break;
+        case SMB2_CRYPTO_AES_GMAC:
+                /* GMAC is GCM with nothing but additional data */
+                ossl_cipher_update(st->u.gmac, NULL, data, len);
+                break;
+        }
+}
+
+static void
+ossl_hash_final(void *state, uint8_t *out)
+{
+        struct ossl_hash *st = state;
+        unsigned int ulen;
+        size_t slen;
+        uint8_t buf[16];
+        int outl;
+
+        switch (st->alg) {
+        case SMB2_CRYPTO_SHA512:
+        case SMB2_CRYPTO_MD4:
+                EVP_DigestFinal_ex(st->u.md, out, &ulen);
+                break;
+        case SMB2_CRYPTO_HMAC_SHA256:
+        case SMB2_CRYPTO_HMAC_MD5:
+                HMAC_Final(st->u.hmac, out, &ulen);
+                break;
+        case SMB2_CRYPTO_AES_CMAC:
+                CMAC_Final(st->u.cmac, out, &slen);
+                break;
+        case SMB2_CRYPTO_AES_GMAC:
+                EVP_EncryptFinal_ex(st->u.gmac, buf, &outl);
+                EVP_CIPHER_CTX_ctrl(st->u.gmac, EVP_CTRL_GCM_GET_TAG, 16,
+                                    out);
+                break;
+        }
+        ossl_hash_free(st);
+}
+
+static const struct smb2_crypto_provider smb2_openssl_provider = {
+        "openssl",
+        ossl_aead_init,
+        ossl_aead_update,
+        ossl_aead_final,
+        ossl_aead_free,
+        ossl_hash_init,
+        ossl_hash_update,
+        ossl_hash_final,
+        ossl_key_init,
+        ossl_key_free
+};
+
+const struct smb2_crypto_provider *
+smb2_openssl_crypto_provider(void)
+{
+        return &smb2_openssl_provider;
+}
+
+#else /* HAVE_OPENSSL */
+
+const struct smb2_crypto_provider *
+smb2_openssl_crypto_provider(void)
+{
+        return NULL;
+}
+
+#endif /* HAVE_OPENSSL */
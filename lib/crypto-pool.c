@@ -0,0 +1,232 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#include <errno.h>
+
+#include "compat.h"
+
+#include "slist.h"
+#include "smb2.h"
+#include "libsmb2.h"
+#include "libsmb2-private.h"
+#include "crypto-pool.h"
+
+#ifdef HAVE_CRYPTO_THREADS
+
+#include <pthread.h>
+
+struct smb2_crypto_pool {
+        pthread_mutex_t mutex;
+        /* signalled when a job is queued or the pool is stopped */
+        pthread_cond_t work;
+        /* signalled when a job is done */
+        pthread_cond_t done;
+        struct smb2_crypto_job *head;
+        struct smb2_crypto_job *tail;
+        int stop;
+        int nthreads;
+        pthread_t threads[1];
+};
+
+static void *
+smb2_crypto_worker(void *arg)
+{
+        struct smb2_crypto_pool *pool = arg;
+        struct smb2_crypto_job *job;
+
+        pthread_mutex_lock(&pool->mutex);
+        while (1) {
+                while (pool->head == NULL && !pool->stop) {
+                        pthread_cond_wait(&pool->work, &pool->mutex);
+                }
+                job = pool->head;
+                if (job == NULL) {
+                        break;
+                }
+                pool->head = job->next;
+                if (pool->head == NULL) {
+                        pool->tail = NULL;
+                }
+                pthread_mutex_unlock(&pool->mutex);
+
+                job->fn(job);
+
+                pthread_mutex_lock(&pool->mutex);
+                job->done = 1;
+                pthread_cond_broadcast(&pool->done);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+        return NULL;
+}
+
+struct smb2_crypto_pool *
+smb2_crypto_pool_create(struct smb2_context *smb2, int nthreads)
+{
+        struct smb2_crypto_pool *pool;
+        int i, err = 0;
+
+        pool = smb2_calloc(smb2, 1, sizeof(*pool) +
+                           (nthreads - 1) * sizeof(pthread_t));
+        if (pool == NULL) {
+                smb2_set_error(smb2, "Failed to allocate crypto pool");
+                errno = ENOMEM;
+                return NULL;
+        }
+        pthread_mutex_init(&pool->mutex, NULL);
+        pthread_cond_init(&pool->work, NULL);
+        pthread_cond_init(&pool->done, NULL);
+        for (i = 0; i < nthreads; i++) {
+                err = pthread_create(&pool->threads[i], NULL,
+                                     smb2_crypto_worker, pool);
+                if (err != 0) {
+                        smb2_set_error(smb2, "Failed to start crypto "
+                                       "thread: %s", strerror(err));
+                        break;
+                }
+                pool->nthreads++;
+        }
+        if (pool->nthreads < nthreads) {
+                smb2_crypto_pool_destroy(smb2, pool);
+                errno = err;
+                return NULL;
+        }
+        return pool;
+}
+
+void
+smb2_crypto_pool_destroy(struct smb2_context *smb2,
+                         struct smb2_crypto_pool *pool)
+{
+        int i;
+
+        pthread_mutex_lock(&pool->mutex);
+        pool->stop = 1;
+        pthread_cond_broadcast(&pool->work);
+        pthread_mutex_unlock(&pool->mutex);
+        /* the workers drain the queue before they exit */
+        for (i = 0; i < pool->nthreads; i++) {
+                pthread_join(pool->threads[i], NULL);
+        }
+        pthread_cond_destroy(&pool->done);
+        pthread_cond_destroy(&pool->work);
+        pthread_mutex_destroy(&pool->mutex);
+        smb2_free(smb2, pool);
+}
+
+void
+smb2_crypto_pool_submit(struct smb2_crypto_pool *pool,
+                        struct smb2_crypto_job *job)
+{
+        job->next = NULL;
+        job->done = 0;
+        pthread_mutex_lock(&pool->mutex);
+        if (pool->tail) {
+                pool->tail->next = job;
+        } else {
+                pool->head = job;
+        }
+        pool->tail = job;
+        pthread_cond_signal(&pool->work);
+        pthread_mutex_unlock(&pool->mutex);
+}
+
+int
+smb2_crypto_job_done(struct smb2_crypto_pool *pool,
+                     struct smb2_crypto_job *job)
+{
+        int done;
+
+        pthread_mutex_lock(&pool->mutex);
+        done = job->done;
+        pthread_mutex_unlock(&pool->mutex);
+        return done;
+}
+
+void
+smb2_crypto_job_wait(struct smb2_crypto_pool *pool,
+                     struct smb2_crypto_job *job)
+{
+        pthread_mutex_lock(&pool->mutex);
+        while (!job->done) {
+                pthread_cond_wait(&pool->done, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+}
+
+#else /* HAVE_CRYPTO_THREADS */
+
+struct smb2_crypto_pool *
+smb2_crypto_pool_create(struct smb2_context *smb2, int nthreads)
+{
+        smb2_set_error(smb2, "libsmb2 was built without crypto thread "
+                       "support");
+        errno = ENOSYS;
+        return NULL;
+}
+
+void
+smb2_crypto_pool_destroy(struct smb2_context *smb2,
+                         struct smb2_crypto_pool *pool)
+{
+}
+
+void
+smb2_crypto_pool_submit(struct smb2_crypto_pool *pool,
+                        struct smb2_crypto_job *job)
+{
+        job->fn(job);
+        job->done = 1;
+}
+
+int
+smb2_crypto_job_done(struct smb2_crypto_pool *pool,
+                     struct smb2_crypto_job *job)
+{
+        return job->done;
+}
+
+void
+smb2_crypto_job_wait(struct smb2_crypto_pool *pool,
+                     struct smb2_crypto_job *job)
+{
+}
+
+#endif /* HAVE_CRYPTO_THREADS */
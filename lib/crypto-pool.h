@@ -0,0 +1,71 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CRYPTO_POOL_H_
+#define _CRYPTO_POOL_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * A small pool of worker threads that runs the AES work for large sealed
+ * PDUs, see smb2_set_crypto_threads().
+ *
+ * Jobs are submitted and waited for by the thread that services the
+ * context. The workers only run the job function, they never allocate
+ * memory or call back into the library, so the allocator hooks and the
+ * rest of the context do not have to be thread safe.
+ *
+ * Only available with HAVE_CRYPTO_THREADS, otherwise
+ * smb2_crypto_pool_create() fails with ENOSYS.
+ */
+struct smb2_crypto_pool;
+
+struct smb2_crypto_job {
+        struct smb2_crypto_job *next;
+        void (*fn)(struct smb2_crypto_job *job);
+        /* set by the worker once fn has returned, see
+         * smb2_crypto_job_done().
+         */
+        int done;
+};
+
+struct smb2_crypto_pool *
+smb2_crypto_pool_create(struct smb2_context *smb2, int nthreads);
+
+/* Waits for all submitted jobs and stops the threads */
+void smb2_crypto_pool_destroy(struct smb2_context *smb2,
+                              struct smb2_crypto_pool *pool);
+
+void smb2_crypto_pool_submit(struct smb2_crypto_pool *pool,
+                             struct smb2_crypto_job *job);
+
+/* Returns non-zero once the job has run */
+int smb2_crypto_job_done(struct smb2_crypto_pool *pool,
+                         struct smb2_crypto_job *job);
+
+/* Blocks until the job has run */
+void smb2_crypto_job_wait(struct smb2_crypto_pool *pool,
+                          struct smb2_crypto_job *job);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CRYPTO_POOL_H_ */
@@ -0,0 +1,598 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#include "compat.h"
+
+#include "slist.h"
+#include "smb2.h"
+#include "libsmb2.h"
+#include "libsmb2-private.h"
+#include "crypto.h"
+#include "portable-endian.h"
+#include "md4.h"
+#include "hmac-md5.h"
+
+#define AES_BLOCK_SIZE 16
+
+/*
+ * AES-CMAC
+ */
+static int
+aes_cmac_shift_left(uint8_t data[AES_BLOCK_SIZE])
+{
+        int i = 0;
+        int cin = 0;
+        int cout = 0;
+
+        for (i = AES_BLOCK_SIZE - 1; i >= 0; i--) {
+            cout = ((int) data[i] & 0x80) >> 7;
+            data[i] = (data[i] << 1) | cin;
+            cin = cout;
+        }
+
+        return cout;
+}
+
+static void
+aes_cmac_xor(uint8_t data[AES_BLOCK_SIZE],
+             const uint8_t value[AES_BLOCK_SIZE])
+{
+        int i = 0;
+
+        for (i = 0; i < AES_BLOCK_SIZE; i++) {
+            data[i] ^= value[i];
+        }
+}
+
+static void
+aes_cmac_sub_keys(const struct aes_key *ks,
+                  uint8_t sub_key1[AES_BLOCK_SIZE],
+                  uint8_t sub_key2[AES_BLOCK_SIZE])
+{
+        uint8_t zero[AES_BLOCK_SIZE] = {0};
+        static const uint8_t rb[AES_BLOCK_SIZE] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0x87};
+
+        AES_ECB_encrypt_blocks(ks, zero, sub_key1, 1);
+        if (aes_cmac_shift_left(sub_key1)) {
+                aes_cmac_xor(sub_key1, rb);
+        }
+
+        memcpy(sub_key2, sub_key1, AES_BLOCK_SIZE);
+
+        if (aes_cmac_shift_left(sub_key2)) {
+                aes_cmac_xor(sub_key2, rb);
+        }
+}
+
+static void
+aes_cmac_init(struct aes_cmac_ctx *ctx, const struct aes_key *ks)
+{
+        ctx->ks = ks;
+        memset(ctx->mac, 0, AES_BLOCK_SIZE);
+        ctx->buf_len = 0;
+}
+
+static void
+aes_cmac_update(struct aes_cmac_ctx *ctx, const uint8_t *data, size_t len)
+{
+        size_t n;
+
+        while (len) {
+                if (ctx->buf_len == AES_BLOCK_SIZE) {
+                        /* more data follows so this is not the last block */
+                        aes_cmac_xor(ctx->mac, ctx->buf);
+                        AES_ECB_encrypt_blocks(ctx->ks, ctx->mac, ctx->mac, 1);
+                        ctx->buf_len = 0;
+                }
+                if (ctx->buf_len == 0) {
+                        while (len > AES_BLOCK_SIZE) {
+                                aes_cmac_xor(ctx->mac, data);
+                                AES_ECB_encrypt_blocks(ctx->ks, ctx->mac,
+                                                       ctx->mac, 1);
+                                data += AES_BLOCK_SIZE;
+                                len -= AES_BLOCK_SIZE;
+                        }
+                }
+                n = MIN(AES_BLOCK_SIZE - ctx->buf_len, len);
+                memcpy(&ctx->buf[ctx->buf_len], data, n);
+                ctx->buf_len += n;
+                data += n;
+                len -= n;
+        }
+}
+
+static void
+aes_cmac_final(struct aes_cmac_ctx *ctx, uint8_t mac[AES_BLOCK_SIZE])
+{
+        uint8_t sub_key1[AES_BLOCK_SIZE], sub_key2[AES_BLOCK_SIZE];
+
+        aes_cmac_sub_keys(ctx->ks, sub_key1, sub_key2);
+        if (ctx->buf_len == AES_BLOCK_SIZE) {
+                aes_cmac_xor(ctx->buf, sub_key1);
+        } else {
+                ctx->buf[ctx->buf_len] = 0x80;
+                memset(&ctx->buf[ctx->buf_len + 1], 0,
+                       AES_BLOCK_SIZE - (ctx->buf_len + 1));
+                aes_cmac_xor(ctx->buf, sub_key2);
+        }
+        aes_cmac_xor(ctx->mac, ctx->buf);
+        AES_ECB_encrypt_blocks(ctx->ks, ctx->mac, mac, 1);
+}
+
+void
+smb2_key_init(struct smb2_key *key, const struct smb2_crypto_provider *p,
+              const uint8_t *data, size_t len)
+{
+        AES_init_key(&key->ks, data, len);
+        key->p = NULL;
+        key->state = NULL;
+        if (p && p->key_init) {
+                key->state = p->key_init(key->provider.buf, data, len);
+                if (key->state) {
+                        key->p = p;
+                }
+        }
+}
+
+void
+smb2_key_free(struct smb2_key *key)
+{
+        if (key->p && key->p->key_free) {
+                key->p->key_free(key->state);
+        }
+        key->p = NULL;
+        key->state = NULL;
+}
+
+void
+smb2_free_keys(struct smb2_context *smb2)
+{
+        /* a decryption in progress may use the state of a key */
+        if (smb2->dec_ctx) {
+                smb2_aead_free(smb2->dec_ctx);
+        }
+        if (smb2->signing_ks == NULL) {
+                return;
+        }
+        smb2_key_free(smb2->signing_ks);
+        smb2_key_free(smb2->serverin_ks);
+        smb2_key_free(smb2->serverout_ks);
+}
+
+/* Constant time so that the tag can not be guessed byte by byte */
+static int
+smb2_tag_compare(const uint8_t *a, const uint8_t *b)
+{
+        uint8_t diff = 0;
+        int i;
+
+        for (i = 0; i < 16; i++) {
+                diff |= a[i] ^ b[i];
+        }
+        return diff ? -1 : 0;
+}
+
+/*
+ * AES-CCM and AES-GCM
+ */
+void
+smb2_aead_init(struct smb2_aead_ctx *ctx,
+               const struct smb2_crypto_provider *p, uint16_t cipher,
+               const struct smb2_key *key, const uint8_t *nonce,
+               const uint8_t *aad, size_t alen, size_t len, int encrypt)
+{
+        const struct aes_key *ks = &key->ks;
+
+        ctx->gcm = cipher == SMB2_ENCRYPTION_AES_128_GCM ||
+                cipher == SMB2_ENCRYPTION_AES_256_GCM;
+        ctx->encrypt = encrypt;
+        ctx->p = NULL;
+        ctx->state = NULL;
+        if (p && p->aead_init && p->aead_update && p->aead_final) {
+                ctx->state = p->aead_init(key->p == p ? key->state : NULL,
+                                          ctx->u.provider, cipher,
+                                          ks->key, ks->key_len,
+                                          nonce, aad, alen, len, encrypt);
+                if (ctx->state) {
+                        ctx->p = p;
+                        return;
+                }
+        }
+
+        if (ctx->gcm) {
+                aes_gcm_init(&ctx->u.gcm, ks, nonce, aad, alen, encrypt);
+        } else {
+                aes_ccm_init(&ctx->u.ccm, ks, nonce, 11, aad, alen, len,
+                             16, encrypt);
+        }
+}
+
+void
+smb2_aead_update(struct smb2_aead_ctx *ctx, const uint8_t *in,
+                 uint8_t *out, size_t len)
+{
+        if (ctx->p) {
+                ctx->p->aead_update(ctx->state, in, out, len);
+        } else if (ctx->gcm) {
+                aes_gcm_update(&ctx->u.gcm, in, out, len);
+        } else {
+                aes_ccm_update(&ctx->u.ccm, in, out, len);
+        }
+}
+
+int
+smb2_aead_final(struct smb2_aead_ctx *ctx, uint8_t *tag)
+{
+        uint8_t m[16];
+        int rc;
+
+        if (ctx->p) {
+                rc = ctx->p->aead_final(ctx->state, tag);
+                ctx->p = NULL;
+                ctx->state = NULL;
+                return rc ? -1 : 0;
+        }
+
+        if (ctx->gcm) {
+                aes_gcm_final(&ctx->u.gcm, ctx->encrypt ? tag : m);
+        } else {
+                aes_ccm_final(&ctx->u.ccm, ctx->encrypt ? tag : m);
+        }
+        if (ctx->encrypt) {
+                return 0;
+        }
+        return smb2_tag_compare(m, tag);
+}
+
+void
+smb2_aead_move(struct smb2_aead_ctx *dst, struct smb2_aead_ctx *src)
+{
+        *dst = *src;
+        if (src->state == (void *)src->u.provider) {
+                dst->state = dst->u.provider;
+        }
+        src->p = NULL;
+        src->state = NULL;
+}
+
+void
+smb2_aead_free(struct smb2_aead_ctx *ctx)
+{
+        if (ctx->p && ctx->p->aead_free) {
+                ctx->p->aead_free(ctx->state);
+        }
+        ctx->p = NULL;
+        ctx->state = NULL;
+}
+
+/*
+ * Hashes and MACs
+ */
+static int
+smb2_hash_provider_init(struct smb2_hash_ctx *ctx,
+                        const struct smb2_crypto_provider *p,
+                        void *key_state, int alg,
+                        const uint8_t *key, size_t key_len,
+                        const uint8_t *nonce)
+{
+        ctx->alg = alg;
+        ctx->p = NULL;
+        ctx->state = NULL;
+        if (p && p->hash_init && p->hash_update && p->hash_final) {
+                ctx->state = p->hash_init(key_state, ctx->u.provider, alg,
+                                          key, key_len, nonce);
+                if (ctx->state) {
+                        ctx->p = p;
+                        return 0;
+                }
+        }
+        return -1;
+}
+
+void
+smb2_hash_init(struct smb2_hash_ctx *ctx,
+               const struct smb2_crypto_provider *p, int alg,
+               const uint8_t *key, size_t key_len)
+{
+        if (smb2_hash_provider_init(ctx, p, NULL, alg, key, key_len,
+                                    NULL) == 0) {
+                return;
+        }
+
+        if (alg == SMB2_CRYPTO_HMAC_SHA256) {
+                hmacReset(&ctx->u.hmac, SHA256, key, (int)key_len);
+        } else {
+                USHAReset(&ctx->u.sha, SHA512);
+        }
+}
+
+void
+smb2_aes_mac_init(struct smb2_hash_ctx *ctx,
+                  const struct smb2_crypto_provider *p, int alg,
+                  const struct smb2_key *key, const uint8_t *nonce)
+{
+        const struct aes_key *ks = &key->ks;
+
+        if (smb2_hash_provider_init(ctx, p, key->p == p ? key->state : NULL,
+                                    alg, ks->key, ks->key_len, nonce) == 0) {
+                return;
+        }
+
+        if (alg == SMB2_CRYPTO_AES_GMAC) {
+                aes_gmac_init(&ctx->u.gmac, ks, nonce);
+        } else {
+                aes_cmac_init(&ctx->u.cmac, ks);
+        }
+}
+
+void
+smb2_hash_update(struct smb2_hash_ctx *ctx, const uint8_t *data, size_t len)
+{
+        if (ctx->p) {
+                ctx->p->hash_update(ctx->state, data, len);
+                return;
+        }
+
+        switch (ctx->alg) {
+        case SMB2_CRYPTO_AES_CMAC:
+                aes_cmac_update(&ctx->u.cmac, data, len);
+                break;
+        case SMB2_CRYPTO_AES_GMAC:
+                aes_gmac_update(&ctx->u.gmac, data, len);
+                break;
+        case SMB2_CRYPTO_HMAC_SHA256:
+                hmacInput(&ctx->u.hmac, data, (int)len);
+                break;
+        case SMB2_CRYPTO_SHA512:
+                USHAInput(&ctx->u.sha, data, (unsigned int)len);
+                break;
+        }
+}
+
+void
+smb2_hash_final(struct smb2_hash_ctx *ctx, uint8_t *out)
+{
+        if (ctx->p) {
+                ctx->p->hash_final(ctx->state, out);
+                ctx->p = NULL;
+                ctx->state = NULL;
+                return;
+        }
+
+        switch (ctx->alg) {
+        case SMB2_CRYPTO_AES_CMAC:
+                aes_cmac_final(&ctx->u.cmac, out);
+                break;
+        case SMB2_CRYPTO_AES_GMAC:
+                aes_gmac_final(&ctx->u.gmac, out);
+                break;
+        case SMB2_CRYPTO_HMAC_SHA256:
+                hmacResult(&ctx->u.hmac, out);
+                break;
+        case SMB2_CRYPTO_SHA512:
+                USHAResult(&ctx->u.sha, out);
+                break;
+        }
+}
+
+/*
+ * Key derivation
+ */
+/* strings used to derive SMB signing and encryption keys */
+static const char SMBSigningKey[] = "SMBSigningKey";
+static const char SMBC2SCipherKey[] = "SMBC2SCipherKey";
+static const char SMBS2CCipherKey[] = "SMBS2CCipherKey";
+static const char SMB2AESCMAC[] = "SMB2AESCMAC";
+static const char SmbSign[] = "SmbSign";
+static const char SMB2AESCCM[] = "SMB2AESCCM";
+static const char ServerOut[] = "ServerOut";
+static const char ServerIn[] = "ServerIn ";
+/* The following strings will be used for deriving other keys */
+#if 0
+static const char SMB2APP[] = "SMB2APP";
+static const char SmbRpc[] = "SmbRpc";
+static const char SMBAppKey[] = "SMBAppKey";
+#endif
+
+/*
+ * SP800-108 KDF in counter mode. The first kdf_key_len bytes of the
+ * derivation key, zero padded if it is shorter, are used as the key.
+ */
+void smb2_derive_key(
+    struct smb2_context *smb2,
+    uint8_t     *derivation_key,
+    uint32_t    derivation_key_len,
+    uint32_t    kdf_key_len,
+    const char  *label,
+    uint32_t    label_len,
+    const char  *context,
+    uint32_t    context_len,
+    uint8_t     *derived_key,
+    uint32_t    derived_key_len
+    )
+{
+        unsigned char nul = 0;
+        const uint32_t counter = htobe32(1);
+        const uint32_t keylen = htobe32(derived_key_len * 8);
+        uint8_t input_key[SMB2_MAX_KEY_SIZE] = {0};
+        uint32_t input_key_len = MIN(sizeof(input_key), kdf_key_len);
+        struct smb2_hash_ctx ctx;
+        uint8_t digest[USHAMaxHashSize];
+
+        if (derivation_key) {
+                memcpy(input_key, derivation_key, MIN(input_key_len,
+                                                      derivation_key_len));
+        }
+        smb2_hash_init(&ctx, smb2->crypto, SMB2_CRYPTO_HMAC_SHA256,
+                       input_key, input_key_len);
+        smb2_hash_update(&ctx, (const uint8_t *)&counter, sizeof(counter));
+        smb2_hash_update(&ctx, (const uint8_t *)label, label_len);
+        smb2_hash_update(&ctx, &nul, 1);
+        smb2_hash_update(&ctx, (const uint8_t *)context, context_len);
+        smb2_hash_update(&ctx, (const uint8_t *)&keylen, sizeof(keylen));
+        smb2_hash_final(&ctx, digest);
+        memcpy(derived_key, digest, derived_key_len);
+}
+
+/*
+ * Derives the signing and encryption keys of the negotiated dialect from
+ * the session key. cipher_key_size is the key size of the negotiated
+ * cipher for 3.x, 16 otherwise.
+ */
+void
+smb2_derive_session_keys(struct smb2_context *smb2, int cipher_key_size)
+{
+        uint32_t kdf_key_len = SMB2_KEY_SIZE;
+
+        /* MS-SMB2 3.2.5.3.1: with 3.1.1 and a 256 bit cipher all keys,
+         * the signing key too, are derived from the full session key.
+         * Otherwise only the first 16 bytes are used.
+         */
+        if (smb2->dialect == SMB2_VERSION_0311 &&
+            cipher_key_size > SMB2_KEY_SIZE) {
+                kdf_key_len = smb2->session_key_size;
+        }
+
+        /* Derive the signing key from session key
+         * This is based on negotiated protocol
+         */
+        if (smb2->dialect == SMB2_VERSION_0202 ||
+            smb2->dialect == SMB2_VERSION_0210) {
+                /* For SMB2 session key is the signing key */
+                memcpy(smb2->signing_key,
+                       smb2->session_key,
+                       MIN(smb2->session_key_size, SMB2_KEY_SIZE));
+        } else if (smb2->dialect <= SMB2_VERSION_0302) {
+                smb2_derive_key(smb2, smb2->session_key,
+                                smb2->session_key_size, kdf_key_len,
+                                SMB2AESCMAC,
+                                sizeof(SMB2AESCMAC),
+                                SmbSign,
+                                sizeof(SmbSign),
+                                smb2->signing_key, SMB2_KEY_SIZE);
+                smb2_derive_key(smb2, smb2->session_key,
+                                smb2->session_key_size, kdf_key_len,
+                                SMB2AESCCM,
+                                sizeof(SMB2AESCCM),
+                                ServerIn,
+                                sizeof(ServerIn),
+                                smb2->serverin_key, SMB2_KEY_SIZE);
+                smb2_derive_key(smb2, smb2->session_key,
+                                smb2->session_key_size, kdf_key_len,
+                                SMB2AESCCM,
+                                sizeof(SMB2AESCCM),
+                                ServerOut,
+                                sizeof(ServerOut),
+                                smb2->serverout_key, SMB2_KEY_SIZE);
+        } else if (smb2->dialect > SMB2_VERSION_0302) {
+                smb2_derive_key(smb2, smb2->session_key,
+                                smb2->session_key_size, kdf_key_len,
+                                SMBSigningKey,
+                                sizeof(SMBSigningKey),
+                                (char *)smb2->preauthhash,
+                                SMB2_PREAUTH_HASH_SIZE,
+                                smb2->signing_key, SMB2_KEY_SIZE);
+                smb2_derive_key(smb2, smb2->session_key,
+                                smb2->session_key_size, kdf_key_len,
+                                SMBC2SCipherKey,
+                                sizeof(SMBC2SCipherKey),
+                                (char *)smb2->preauthhash,
+                                SMB2_PREAUTH_HASH_SIZE,
+                                smb2->serverin_key,
+                                cipher_key_size);
+                smb2_derive_key(smb2, smb2->session_key,
+                                smb2->session_key_size, kdf_key_len,
+                                SMBS2CCipherKey,
+                                sizeof(SMBS2CCipherKey),
+                                (char *)smb2->preauthhash,
+                                SMB2_PREAUTH_HASH_SIZE,
+                                smb2->serverout_key,
+                                cipher_key_size);
+        }
+}
+
+/* MD4 and HMAC-MD5 are only used once per NTLMSSP authentication */
+void
+smb2_md4(const struct smb2_crypto_provider *p,
+         const uint8_t *data, size_t len, uint8_t digest[16])
+{
+        struct smb2_hash_ctx ctx;
+        MD4_CTX md4;
+
+        if (smb2_hash_provider_init(&ctx, p, NULL, SMB2_CRYPTO_MD4,
+                                    NULL, 0, NULL) == 0) {
+                smb2_hash_update(&ctx, data, len);
+                smb2_hash_final(&ctx, digest);
+                return;
+        }
+
+        MD4Init(&md4);
+        MD4Update(&md4, discard_const(data), (unsigned int)len);
+        MD4Final(digest, &md4);
+}
+
+void
+smb2_hmac_md5_digest(const struct smb2_crypto_provider *p,
+                     const uint8_t *data, size_t len,
+                     const uint8_t *key, size_t key_len,
+                     uint8_t digest[16])
+{
+        struct smb2_hash_ctx ctx;
+
+        if (smb2_hash_provider_init(&ctx, p, NULL, SMB2_CRYPTO_HMAC_MD5,
+                                    key, key_len, NULL) == 0) {
+                smb2_hash_update(&ctx, data, len);
+                smb2_hash_final(&ctx, digest);
+                return;
+        }
+
+        smb2_hmac_md5(discard_const(data), (int)len, discard_const(key),
+                      (unsigned int)key_len, digest);
+}
+
+void
+smb2_set_crypto_provider(struct smb2_context *smb2,
+                         const struct smb2_crypto_provider *provider)
+{
+        smb2->crypto = provider;
+}
+
+const struct smb2_crypto_provider *
+smb2_get_crypto_provider(struct smb2_context *smb2)
+{
+        return smb2->crypto;
+}
@@ -0,0 +1,156 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _CRYPTO_H_
+#define _CRYPTO_H_
+
+#include "aes.h"
+#include "aes128ccm.h"
+#include "aes128gcm.h"
+#include "sha.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * The cryptographic primitives that the rest of libsmb2 uses. Each
+ * operation goes to the crypto provider of the context when it
+ * implements it and to the built in implementation otherwise, see
+ * smb2_set_crypto_provider().
+ * p is the provider of the context, NULL for the built in one.
+ */
+
+/*
+ * A signing or encryption key: the built in key schedule and the state
+ * that the provider the key was set up with keeps for it, see key_init
+ * in struct smb2_crypto_provider.
+ */
+struct smb2_key {
+        struct aes_key ks;
+        const struct smb2_crypto_provider *p;
+        void *state;
+        union {
+                void *ptr;
+                uint64_t u64;
+                uint8_t buf[SMB2_CRYPTO_STATE_SIZE];
+        } provider;
+};
+
+void smb2_key_init(struct smb2_key *key, const struct smb2_crypto_provider *p,
+                   const uint8_t *data, size_t len);
+
+/* Releases the provider state, the key can then be set up again */
+void smb2_key_free(struct smb2_key *key);
+
+/*
+ * Incremental AES-CMAC (RFC 4493) so that a PDU can be signed straight
+ * from its iovectors. The last block is held back in buf until the end
+ * since it is the one that is combined with a sub key.
+ */
+struct aes_cmac_ctx {
+        const struct aes_key *ks;
+        uint8_t mac[16];
+        uint8_t buf[16];
+        size_t buf_len;
+};
+
+/* AES-CCM or AES-GCM, encrypting or decrypting */
+struct smb2_aead_ctx {
+        /* the provider that holds state, NULL if the built in one is used */
+        const struct smb2_crypto_provider *p;
+        void *state;
+        int gcm;
+        int encrypt;
+        union {
+                struct aes_gcm_ctx gcm;
+                struct aes_ccm_ctx ccm;
+                uint8_t provider[SMB2_CRYPTO_STATE_SIZE];
+        } u;
+};
+
+/* cipher is one of SMB2_ENCRYPTION_AES_*, the nonce is 11 bytes for CCM
+ * and 12 bytes for GCM.
+ */
+void smb2_aead_init(struct smb2_aead_ctx *ctx,
+                    const struct smb2_crypto_provider *p, uint16_t cipher,
+                    const struct smb2_key *key, const uint8_t *nonce,
+                    const uint8_t *aad, size_t alen, size_t len,
+                    int encrypt);
+
+void smb2_aead_update(struct smb2_aead_ctx *ctx, const uint8_t *in,
+                      uint8_t *out, size_t len);
+
+/*
+ * Writes the 16 byte tag when encrypting. When decrypting the tag is
+ * checked instead and -1 is returned if it does not match.
+ */
+int smb2_aead_final(struct smb2_aead_ctx *ctx, uint8_t *tag);
+
+/*
+ * Hands an operation that is in progress over to dst, the provider may
+ * keep its state inside the context.
+ */
+void smb2_aead_move(struct smb2_aead_ctx *dst, struct smb2_aead_ctx *src);
+
+/* Releases an operation that is abandoned before smb2_aead_final() */
+void smb2_aead_free(struct smb2_aead_ctx *ctx);
+
+/* Hashes and MACs, alg is one of SMB2_CRYPTO_* */
+struct smb2_hash_ctx {
+        const struct smb2_crypto_provider *p;
+        void *state;
+        int alg;
+        union {
+                struct aes_cmac_ctx cmac;
+                struct aes_gmac_ctx gmac;
+                HMACContext hmac;
+                USHAContext sha;
+                uint8_t provider[SMB2_CRYPTO_STATE_SIZE];
+        } u;
+};
+
+/* SMB2_CRYPTO_HMAC_SHA256 or SMB2_CRYPTO_SHA512, key is NULL for SHA512 */
+void smb2_hash_init(struct smb2_hash_ctx *ctx,
+                    const struct smb2_crypto_provider *p, int alg,
+                    const uint8_t *key, size_t key_len);
+
+/* SMB2_CRYPTO_AES_CMAC or SMB2_CRYPTO_AES_GMAC with its 12 byte nonce */
+void smb2_aes_mac_init(struct smb2_hash_ctx *ctx,
+                       const struct smb2_crypto_provider *p, int alg,
+                       const struct smb2_key *key, const uint8_t *nonce);
+
+void smb2_hash_update(struct smb2_hash_ctx *ctx, const uint8_t *data,
+                      size_t len);
+
+/* Writes 16 bytes for the AES MACs, 32 for HMAC-SHA256, 64 for SHA512 */
+void smb2_hash_final(struct smb2_hash_ctx *ctx, uint8_t *out);
+
+void smb2_md4(const struct smb2_crypto_provider *p,
+              const uint8_t *data, size_t len, uint8_t digest[16]);
+
+void smb2_hmac_md5_digest(const struct smb2_crypto_provider *p,
+                          const uint8_t *data, size_t len,
+                          const uint8_t *key, size_t key_len,
+                          uint8_t digest[16]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _CRYPTO_H_ */
@@ -448,7 +448,7 @@ dcerpc_create_context(struct smb2_context *smb2)
 {
         struct dcerpc_context *ctx;
 
-        ctx = calloc(1, sizeof(struct dcerpc_context));
+        ctx = smb2_calloc(smb2, 1, sizeof(struct dcerpc_context));
         if (ctx == NULL) {
                 smb2_set_error(smb2, "Failed to allocate dcercp context.");
                 return NULL;
@@ -465,7 +465,7 @@ dcerpc_connect_context_async(struct dcerpc_context *dce, const char *path,
                              dcerpc_cb cb, void *cb_data)
 {
         dce->call_id = 2;
-        dce->path = strdup(path);
+        dce->path = smb2_strdup(dce->smb2, path);
         if (dce->path == NULL) {
                 smb2_set_error(dce->smb2, "Failed to allocate path for "
                                "dcercp context.");
@@ -490,8 +490,8 @@ dcerpc_destroy_context(struct dcerpc_context *dce)
         if (dce == NULL) {
                 return;
         }
-        free(discard_const(dce->path));
-        free(dce);
+        smb2_free(dce->smb2, discard_const(dce->path));
+        smb2_free(dce->smb2, dce);
 }
 
 void
@@ -504,7 +504,7 @@ dcerpc_free_pdu(struct dcerpc_context *dce, struct dcerpc_pdu *pdu)
         if (pdu->payload) {
                 smb2_free_data(dce->smb2, pdu->payload);
         }
-        free(pdu);
+        smb2_free(dce->smb2, pdu);
 }
 
 struct dcerpc_pdu *
@@ -512,7 +512,7 @@ dcerpc_allocate_pdu(struct dcerpc_context *dce, int direction, int payload_size)
 {
         struct dcerpc_pdu *pdu;
 
-        pdu = calloc(1, sizeof(struct dcerpc_pdu));
+        pdu = smb2_calloc(dce->smb2, 1, sizeof(struct dcerpc_pdu));
         if (pdu == NULL) {
                 smb2_set_error(dce->smb2, "Failed to allocate DCERPC PDU");
                 return NULL;
@@ -961,7 +961,7 @@ dcerpc_encode_utf16(struct dcerpc_context *ctx, struct dcerpc_pdu *pdu,
                 if (s->utf8 == NULL) {
                         s->utf8 = "";
                 }
-                s->utf16 = smb2_utf8_to_utf16(s->utf8);
+                s->utf16 = smb2_ctx_utf8_to_utf16(ctx->smb2, s->utf8);
                 if (s->utf16 == NULL) {
                         return -1;
                 }
@@ -1007,7 +1007,7 @@ dcerpc_encode_utf16(struct dcerpc_context *ctx, struct dcerpc_pdu *pdu,
                         return -1;
                 }
         }
-        free(s->utf16);
+        smb2_free(ctx->smb2, s->utf16);
         return 0;
 }
 
@@ -1056,16 +1056,16 @@ dcerpc_decode_utf16(struct dcerpc_context *ctx, struct dcerpc_pdu *pdu,
                         *(uint16_t *)(void *)&iov->buf[*offset + i * 2] = v;
                 }
         }
-        tmp = smb2_utf16_to_utf8((uint16_t *)(void *)(&iov->buf[*offset]), (size_t)s->actual_count);
+        tmp = smb2_ctx_utf16_to_utf8(ctx->smb2, (uint16_t *)(void *)(&iov->buf[*offset]), (size_t)s->actual_count);
         *offset += (int)s->actual_count * 2;
 
         str = smb2_alloc_data(ctx->smb2, pdu->payload, strlen(tmp) + 1);
         if (str == NULL) {
-                free(discard_const(tmp));
+                smb2_free(ctx->smb2, discard_const(tmp));
                 return -1;
         }
         strcat(str, tmp);
-        free(discard_const(tmp));
+        smb2_free(ctx->smb2, discard_const(tmp));
 
         s->utf8 = str;
 
@@ -1658,12 +1658,12 @@ dcerpc_bind_cb(struct dcerpc_context *dce, int status,
 
         if (status != SMB2_STATUS_SUCCESS) {
                 data->cb(dce, status, NULL, data->cb_data);
-                free(data);
+                smb2_free(dce->smb2, data);
                 return;
         }
 
         data->cb(dce, 0, NULL, data->cb_data);
-        free(data);
+        smb2_free(dce->smb2, data);
 }
 
 static void
@@ -1838,7 +1838,7 @@ smb2_open_cb(struct smb2_context *smb2, int status,
         if (status != SMB2_STATUS_SUCCESS) {
                 data->cb(dce, -nterror_to_errno(status),
                          NULL, data->cb_data);
-                free(data);
+                smb2_free(smb2, data);
                 return;
         }
         
@@ -1847,7 +1847,7 @@ smb2_open_cb(struct smb2_context *smb2, int status,
         status = dcerpc_bind_async(dce, dcerpc_bind_cb, data);
         if (status) {
                 data->cb(dce, status, NULL, data->cb_data);
-                free(data);
+                smb2_free(smb2, data);
                 return;
         }
 
@@ -1862,7 +1862,7 @@ dcerpc_open_async(struct dcerpc_context *dce, dcerpc_cb cb,
         struct smb2_pdu *pdu;
         struct dcerpc_cb_data *data;
 
-        data = calloc(1, sizeof(struct dcerpc_cb_data));
+        data = smb2_calloc(dce->smb2, 1, sizeof(struct dcerpc_cb_data));
         if (data == NULL) {
                 smb2_set_error(dce->smb2, "Failed to allocate dcerpc callback "
                                "data");
@@ -1894,7 +1894,7 @@ dcerpc_open_async(struct dcerpc_context *dce, dcerpc_cb cb,
 
         pdu = smb2_cmd_create_async(dce->smb2, &req, smb2_open_cb, data);
         if (pdu == NULL) {
-                free(data);
+                smb2_free(dce->smb2, data);
                 return -ENOMEM;
         }
         smb2_queue_pdu(dce->smb2, pdu);
@@ -45,6 +45,7 @@
 #include <sys/unistd.h>
 #endif
 
+#include <assert.h>
 #include <stdarg.h>
 #include <stdio.h>
 
@@ -74,6 +75,11 @@
 #include "libsmb2.h"
 #include "libsmb2-private.h"
 #include "slist.h"
+#include "crypto.h"
+#include "crypto-pool.h"
+#include "read-ahead.h"
+#include "write-behind.h"
+#include "smb3-seal.h"
 
 #define MAX_URL_SIZE 1024
 
@@ -147,6 +153,20 @@ smb2_parse_args(struct smb2_context *smb2, const char *args)
                                                "%s", value);
                                 return -1;
                         }
+                } else if (!strcmp(args, "cipher")) {
+                        if(!strcmp(value, "aes128ccm")) {
+                                smb2->requested_cypher = SMB2_ENCRYPTION_AES_128_CCM;
+                        } else if(!strcmp(value, "aes128gcm")) {
+                                smb2->requested_cypher = SMB2_ENCRYPTION_AES_128_GCM;
+                        } else if(!strcmp(value, "aes256ccm")) {
+                                smb2->requested_cypher = SMB2_ENCRYPTION_AES_256_CCM;
+                        } else if(!strcmp(value, "aes256gcm")) {
+                                smb2->requested_cypher = SMB2_ENCRYPTION_AES_256_GCM;
+                        } else {
+                                smb2_set_error(smb2, "Unknown cipher= argument: "
+                                               "%s", value);
+                                return -1;
+                        }
                 } else if (!strcmp(args, "timeout")) {
                         smb2->timeout = (int)strtol(value, NULL, 10);
                 } else {
@@ -201,7 +221,7 @@ struct smb2_url *smb2_parse_url(struct smb2_context *smb2, const char *url)
                 }
         }
 
-        u = calloc(1, sizeof(struct smb2_url));
+        u = smb2_calloc(NULL, 1, sizeof(struct smb2_url));
         if (u == NULL) {
                 smb2_set_error(smb2, "Failed to allocate smb2_url");
                 return NULL;
@@ -219,19 +239,19 @@ struct smb2_url *smb2_parse_url(struct smb2_context *smb2, const char *url)
         /* domain */
         if ((tmp = strchr(ptr, ';')) != NULL && strlen(tmp) > len_shared_folder) {
                 *(tmp++) = '\0';
-                u->domain = strdup(ptr);
+                u->domain = smb2_strdup(NULL, ptr);
                 ptr = tmp;
         }
         /* user */
         if ((tmp = strchr(ptr, '@')) != NULL && strlen(tmp) > len_shared_folder) {
                 *(tmp++) = '\0';
-                u->user = strdup(ptr);
+                u->user = smb2_strdup(NULL, ptr);
                 ptr = tmp;
         }
         /* server */
         if ((tmp = strchr(ptr, '/')) != NULL) {
                 *(tmp++) = '\0';
-                u->server = strdup(ptr);
+                u->server = smb2_strdup(NULL, ptr);
                 ptr = tmp;
         }
 
@@ -240,14 +260,14 @@ struct smb2_url *smb2_parse_url(struct smb2_context *smb2, const char *url)
 
         /* We only have a share */
         if (tmp == NULL) {
-                u->share = strdup(ptr);
+                u->share = smb2_strdup(NULL, ptr);
                 return u;
         }
 
         /* we have both share and object path */
         *(tmp++) = '\0';
-        u->share = strdup(ptr);
-        u->path = strdup(tmp);
+        u->share = smb2_strdup(NULL, ptr);
+        u->path = smb2_strdup(NULL, tmp);
 
         return u;
 }
@@ -257,12 +277,12 @@ void smb2_destroy_url(struct smb2_url *url)
         if (url == NULL) {
                 return;
         }
-        free(discard_const(url->domain));
-        free(discard_const(url->user));
-        free(discard_const(url->server));
-        free(discard_const(url->share));
-        free(discard_const(url->path));
-        free(url);
+        smb2_free(NULL, discard_const(url->domain));
+        smb2_free(NULL, discard_const(url->user));
+        smb2_free(NULL, discard_const(url->server));
+        smb2_free(NULL, discard_const(url->share));
+        smb2_free(NULL, discard_const(url->path));
+        smb2_free(NULL, url);
 }
 
 
@@ -275,10 +295,11 @@ struct smb2_context *smb2_init_context(void)
 
         srandom((unsigned)time(NULL) ^ getpid() ^ ctr++);
 
-        smb2 = calloc(1, sizeof(struct smb2_context));
+        smb2 = smb2_calloc(NULL, 1, sizeof(struct smb2_context));
         if (smb2 == NULL) {
                 return NULL;
         }
+        smb2_init_allocator(smb2);
 
         ret = getlogin_r(buf, sizeof(buf));
         smb2_set_user(smb2, ret == 0 ? buf : "Guest");
@@ -290,6 +311,8 @@ struct smb2_context *smb2_init_context(void)
         smb2->sec = SMB2_SEC_UNDEFINED;
         smb2->version = SMB2_VERSION_ANY;
         smb2->ndr = 1;
+        smb2->recv_buf_size = SMB2_DEFAULT_RECV_BUFFER_SIZE;
+        smb2->transport = &smb2_tcp_transport;
 
         for (i = 0; i < 8; i++) {
                 smb2->client_challenge[i] = random() & 0xff;
@@ -313,21 +336,21 @@ void smb2_destroy_context(struct smb2_context *smb2)
                 return;
         }
 
+        if (smb2->uring) {
+                smb2_uring_remove_context(smb2);
+        }
         if (SMB2_VALID_SOCKET(smb2->fd)) {
-                if (smb2->change_fd) {
-                        smb2->change_fd(smb2, smb2->fd, SMB2_DEL_FD);
-                }
-                close(smb2->fd);
-                smb2->fd = SMB2_INVALID_SOCKET;
+                smb2_close_socket(smb2);
         }
         else {
                 smb2_close_connecting_fds(smb2);
         }
+        smb3_flush_rx(smb2);
 
-        while (smb2->outqueue) {
-                struct smb2_pdu *pdu = smb2->outqueue;
+        while (smb2->outqueue.head) {
+                struct smb2_pdu *pdu = smb2->outqueue.head;
 
-                smb2->outqueue = pdu->next;
+                smb2_outqueue_remove(smb2, pdu);
                 if (pdu->cb) {
                         pdu->cb(smb2, SMB2_STATUS_SHUTDOWN, NULL, pdu->cb_data);
                 }
@@ -341,10 +364,10 @@ void smb2_destroy_context(struct smb2_context *smb2)
                 }
                 smb2_free_pdu(smb2, smb2->pdu);
         }
-        while (smb2->waitqueue) {
-                struct smb2_pdu *pdu = smb2->waitqueue;
+        while (smb2->waitqueue.head) {
+                struct smb2_pdu *pdu = smb2->waitqueue.head;
 
-                smb2->waitqueue = pdu->next;
+                smb2_waitqueue_remove(smb2, pdu);
                 if (pdu->cb) {
                         pdu->cb(smb2, SMB2_STATUS_SHUTDOWN, NULL, pdu->cb_data);
                 }
@@ -354,22 +377,40 @@ void smb2_destroy_context(struct smb2_context *smb2)
                 smb2_free_pdu(smb2, pdu);
         }
         smb2_free_iovector(smb2, &smb2->in);
+        /* no read-ahead PDU is left to complete */
+        smb2_ra_destroy_all(smb2);
+        smb2_wb_destroy_all(smb2);
+        /* all seal jobs have been waited for when their PDUs were freed */
+        if (smb2->crypto_pool) {
+                smb2_crypto_pool_destroy(smb2, smb2->crypto_pool);
+                smb2->crypto_pool = NULL;
+        }
 
         if (smb2->connect_cb) {
            smb2->connect_cb(smb2, SMB2_STATUS_CANCELLED,
                          NULL, smb2->connect_data);
            smb2->connect_cb = NULL;
         }
-        free(smb2->session_key);
+        smb2_free(smb2, smb2->session_key);
         smb2->session_key = NULL;
-
-        free(discard_const(smb2->user));
-        free(discard_const(smb2->server));
-        free(discard_const(smb2->share));
-        free(discard_const(smb2->password));
-        free(discard_const(smb2->domain));
-        free(discard_const(smb2->workstation));
-        free(smb2->enc);
+        smb2_free_keys(smb2);
+        smb2_free(smb2, smb2->dec_ctx);
+        smb2->dec_ctx = NULL;
+        smb2_free(smb2, smb2->signing_ks);
+        smb2->signing_ks = NULL;
+        smb2->serverin_ks = NULL;
+        smb2->serverout_ks = NULL;
+        smb2_free(smb2, smb2->crypt_buf);
+        smb2->crypt_buf = NULL;
+
+        smb2_free(smb2, discard_const(smb2->user));
+        smb2_free(smb2, discard_const(smb2->server));
+        smb2_free(smb2, discard_const(smb2->share));
+        smb2_free(smb2, discard_const(smb2->password));
+        smb2_free(smb2, discard_const(smb2->domain));
+        smb2_free(smb2, discard_const(smb2->workstation));
+        smb2_free_iovector(smb2, &smb2->enc);
+        smb2_free(smb2, smb2->enc_buf);
 
 #ifdef HAVE_LIBKRB5
         if (smb2->cred_handle) {
@@ -381,9 +422,12 @@ void smb2_destroy_context(struct smb2_context *smb2)
         if (smb2->connect_data) {
             free_c_data(smb2, smb2->connect_data);  /* sets smb2->connect_data to NULL */
         }
+        smb2_free_pdu_cache(smb2);
+        smb2_free(smb2, smb2->recv_buf);
+        smb2_memory_transport_release(smb2);
 
         SMB2_LIST_REMOVE(&active_contexts, smb2);
-        free(smb2);
+        smb2_free(NULL, smb2);
 }
 
 struct smb2_context *smb2_active_contexts(void)
@@ -410,9 +454,23 @@ void smb2_free_iovector(struct smb2_context *smb2, struct smb2_io_vectors *v)
 
         for (i = 0; i < v->niov; i++) {
                 if (v->iov[i].free) {
-                        v->iov[i].free(v->iov[i].buf);
+                        smb2_call_free_cb(smb2, v->iov[i].free, v->iov[i].buf);
+                }
+        }
+        if (v->iov && v->iov != v->inline_iov) {
+#ifndef NDEBUG
+                /* Nothing may write through a pointer to an inline entry
+                 * once we have switched to the heap array.
+                 */
+                for (i = 0; i < SMB2_INLINE_VECTORS; i++) {
+                        assert(v->inline_iov[i].buf == NULL &&
+                               v->inline_iov[i].len == 0 &&
+                               v->inline_iov[i].free == NULL);
                 }
+#endif
+                smb2_free(smb2, v->iov);
         }
+        v->iov = NULL;
         v->niov = 0;
         v->total_size = 0;
         v->num_done = 0;
@@ -424,15 +482,35 @@ struct smb2_iovec *smb2_add_iovector(struct smb2_context *smb2,
                                     void (*free_cb)(void *))
 {
                 struct smb2_iovec *iov;
+
+                if (v->iov == NULL) {
+                        v->iov = v->inline_iov;
+                }
                 /* Bounds checking */
                 if (v->niov >= SMB2_MAX_VECTORS) {
                         smb2_set_error(smb2, "Too many I/O vectors");
                         /* Avoid leaks for caller-provided buffers */
                         if (free_cb && buf) {
-                                free_cb(buf);
+                                smb2_call_free_cb(smb2, free_cb, buf);
                         }
                         return NULL;
                 }
+                if (v->niov == SMB2_INLINE_VECTORS && v->iov == v->inline_iov) {
+                        iov = smb2_malloc(smb2, SMB2_MAX_VECTORS * sizeof(struct smb2_iovec));
+                        if (iov == NULL) {
+                                smb2_set_error(smb2, "Failed to allocate I/O vectors");
+                                if (free_cb && buf) {
+                                        smb2_call_free_cb(smb2, free_cb, buf);
+                                }
+                                return NULL;
+                        }
+                        memcpy(iov, v->inline_iov, sizeof(v->inline_iov));
+                        /* Clear the inline entries so that a stale pointer
+                         * to one of them can not be used by mistake.
+                         */
+                        memset(v->inline_iov, 0, sizeof(v->inline_iov));
+                        v->iov = iov;
+                }
 
                 iov = &v->iov[v->niov];
                 v->iov[v->niov].buf = buf;
@@ -545,7 +623,7 @@ void smb2_set_password_from_file(struct smb2_context *smb2)
 #if defined(NTDDI_WIN10_RS3) && (NTDDI_VERSION >= NTDDI_WIN10_RS3)
         uint32_t name_len = GetEnvironmentVariableA("NTLM_USER_FILE", NULL, 0);
         if (name_len > 0) {
-                name = (char*)malloc(name_len + 1);
+                name = (char*)smb2_malloc(smb2, name_len + 1);
                 if (name == NULL) {
                         return;
                 }
@@ -557,13 +635,13 @@ void smb2_set_password_from_file(struct smb2_context *smb2)
 #endif
         if (name == NULL || smb2->user == NULL) {
 #ifdef _MSC_UWP
-                free(name);
+                smb2_free(smb2, name);
 #endif
                 return;
         }
         fh = fopen(name, "r");
 #ifdef _MSC_UWP
-        free(name);
+        smb2_free(smb2, name);
 #endif
         if (!fh) {
             return;
@@ -626,13 +704,13 @@ void smb2_set_password_from_file(struct smb2_context *smb2)
 void smb2_set_user(struct smb2_context *smb2, const char *user)
 {
         if (smb2->user) {
-                free(discard_const(smb2->user));
+                smb2_free(smb2, discard_const(smb2->user));
                 smb2->user = NULL;
         }
         if (user == NULL) {
                 return;
         }
-        smb2->user = strdup(user);
+        smb2->user = smb2_strdup(smb2, user);
         smb2_set_password_from_file(smb2);
 }
 
@@ -655,25 +733,25 @@ const char *smb2_get_workstation(struct smb2_context *smb2)
 void smb2_set_password(struct smb2_context *smb2, const char *password)
 {
         if (smb2->password) {
-                free(discard_const(smb2->password));
+                smb2_free(smb2, discard_const(smb2->password));
                 smb2->password = NULL;
         }
         if (password == NULL) {
                 return;
         }
-        smb2->password = strdup(password);
+        smb2->password = smb2_strdup(smb2, password);
 }
 
 void smb2_set_domain(struct smb2_context *smb2, const char *domain)
 {
         if (smb2->domain) {
-                free(discard_const(smb2->domain));
+                smb2_free(smb2, discard_const(smb2->domain));
                 smb2->domain = NULL;
         }
         if (domain == NULL) {
                 return;
         }
-        smb2->domain = strdup(domain);
+        smb2->domain = smb2_strdup(smb2, domain);
         smb2_set_password_from_file(smb2);
 }
 
@@ -688,13 +766,13 @@ const char *smb2_get_domain(struct smb2_context *smb2)
 void smb2_set_workstation(struct smb2_context *smb2, const char *workstation)
 {
         if (smb2->workstation) {
-                free(discard_const(smb2->workstation));
+                smb2_free(smb2, discard_const(smb2->workstation));
                 smb2->workstation = NULL;
         }
         if (workstation == NULL) {
                 return;
         }
-        smb2->workstation = strdup(workstation);
+        smb2->workstation = smb2_strdup(smb2, workstation);
 }
 
 void smb2_set_opaque(struct smb2_context *smb2, void *opaque)
@@ -717,6 +795,23 @@ void smb2_set_sign(struct smb2_context *smb2, int val)
         smb2->sign = val;
 }
 
+int smb2_set_cipher(struct smb2_context *smb2, uint16_t cipher)
+{
+        switch (cipher) {
+        case 0:
+        case SMB2_ENCRYPTION_AES_128_CCM:
+        case SMB2_ENCRYPTION_AES_128_GCM:
+        case SMB2_ENCRYPTION_AES_256_CCM:
+        case SMB2_ENCRYPTION_AES_256_GCM:
+                break;
+        default:
+                smb2_set_error(smb2, "Unknown cipher 0x%04x", cipher);
+                return -EINVAL;
+        }
+        smb2->requested_cypher = cipher;
+        return 0;
+}
+
 void smb2_set_authentication(struct smb2_context *smb2, int val)
 {
         smb2->sec = (enum smb2_sec)val;
@@ -727,6 +822,82 @@ void smb2_set_timeout(struct smb2_context *smb2, int seconds)
         smb2->timeout = seconds;
 }
 
+int smb2_set_recv_buffer_size(struct smb2_context *smb2, size_t size)
+{
+        if (smb2->recv_buf_pos < smb2->recv_buf_len || smb2->uring) {
+                smb2_set_error(smb2, "Can not resize the receive buffer "
+                               "while it holds unread data or the context "
+                               "is attached to an io_uring");
+                return -EBUSY;
+        }
+        smb2_free(smb2, smb2->recv_buf);
+        smb2->recv_buf = NULL;
+        smb2->recv_buf_size = size;
+        smb2->recv_buf_pos = 0;
+        smb2->recv_buf_len = 0;
+
+        return 0;
+}
+
+int smb2_set_crypto_threads(struct smb2_context *smb2, int nthreads)
+{
+        struct smb2_crypto_pool *pool = NULL;
+        struct smb2_pdu *pdu;
+
+        if (nthreads < 0) {
+                smb2_set_error(smb2, "Invalid number of crypto threads");
+                return -EINVAL;
+        }
+        for (pdu = smb2->outqueue.head; pdu; pdu = pdu->next) {
+                if (pdu->seal_job) {
+                        break;
+                }
+        }
+        if (smb2->rx_head || pdu) {
+                smb2_set_error(smb2, "Can not change the crypto threads "
+                               "while PDUs are being sealed or unsealed");
+                return -EBUSY;
+        }
+        if (nthreads) {
+                pool = smb2_crypto_pool_create(smb2, nthreads);
+                if (pool == NULL) {
+                        return -errno;
+                }
+        }
+        if (smb2->crypto_pool) {
+                smb2_crypto_pool_destroy(smb2, smb2->crypto_pool);
+        }
+        smb2->crypto_pool = pool;
+
+        return 0;
+}
+
+int smb2_set_transport(struct smb2_context *smb2,
+                       const struct smb2_transport *transport, void *opaque)
+{
+        if (transport == NULL) {
+                transport = &smb2_tcp_transport;
+                opaque = NULL;
+        }
+        if (transport->connect == NULL || transport->readv == NULL ||
+            transport->writev == NULL || transport->close == NULL) {
+                smb2_set_error(smb2, "Transport is missing connect, readv, "
+                               "writev or close");
+                return -EINVAL;
+        }
+        if (SMB2_VALID_SOCKET(smb2->fd) || smb2->connecting_fds_count ||
+            smb2->uring) {
+                smb2_set_error(smb2, "Can not change the transport of a "
+                               "connected context");
+                return -EBUSY;
+        }
+        smb2_memory_transport_release(smb2);
+        smb2->transport = transport;
+        smb2->transport_opaque = opaque;
+
+        return 0;
+}
+
 void smb2_set_version(struct smb2_context *smb2,
                       enum smb2_negotiate_version version)
 {
@@ -752,6 +923,17 @@ void smb2_get_passthrough(struct smb2_context *smb2,
         *passthrough = smb2->passthrough;
 }
 
+void smb2_set_split_io(struct smb2_context *smb2, int enable)
+{
+        smb2->split_io = !!enable;
+}
+
+void smb2_get_pdu_cache_stats(struct smb2_context *smb2,
+                              struct smb2_pdu_cache_stats *stats)
+{
+        *stats = smb2->pdu_cache_stats;
+}
+
 void smb2_set_oplock_or_lease_break_callback(struct smb2_context *smb2,
                     smb2_oplock_or_lease_break_cb cb)
 {
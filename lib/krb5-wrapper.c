@@ -109,7 +109,7 @@ krb5_free_auth_data(struct private_auth_data *auth)
         }
 
         free(auth->g_server);
-        free(auth);
+        smb2_free(NULL, auth);
 }
 
 static char *
@@ -193,7 +193,7 @@ krb5_negotiate_reply(struct smb2_context *smb2,
                 }
         }
 
-        auth_data = calloc(1, sizeof(struct private_auth_data));
+        auth_data = smb2_calloc(NULL, 1, sizeof(struct private_auth_data));
         if (auth_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate private_auth_data");
                 krb5_free_auth_data(auth_data);
@@ -309,7 +309,7 @@ krb5_negotiate_reply(struct smb2_context *smb2,
                         return NULL;
                 }
 
-                nc_password = strdup(password);
+                nc_password = smb2_strdup(smb2, password);
                 passwd.value = nc_password;
                 passwd.length = strlen(nc_password);
 
@@ -350,7 +350,7 @@ krb5_negotiate_reply(struct smb2_context *smb2,
         #endif
 
         if (nc_password) {
-                free(nc_password);
+                smb2_free(smb2, nc_password);
                 nc_password = NULL;
         }
 
@@ -385,7 +385,7 @@ krb5_session_get_session_key(struct smb2_context *smb2,
                 return -1;
         }
 
-        smb2->session_key = (uint8_t *) malloc(sessionKey->elements[0].length);
+        smb2->session_key = (uint8_t *) smb2_malloc(smb2, sessionKey->elements[0].length);
         if (smb2->session_key == NULL) {
                 smb2_set_error(smb2, "Failed to allocate SessionKey");
                 return -1;
@@ -571,7 +571,7 @@ krb5_init_server_client_cred(struct smb2_server *server, struct smb2_context *sm
                 mechs = &mechlist;
         }
 
-        auth_data = calloc(1, sizeof(struct private_auth_data));
+        auth_data = smb2_calloc(NULL, 1, sizeof(struct private_auth_data));
         if (auth_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate private_auth_data");
                 return NULL;
@@ -738,7 +738,7 @@ krb5_session_reply(struct smb2_context *smb2,
                 char *dpos;
                 int namelen = token.length;;
 
-                user = malloc(namelen + 1);
+                user = smb2_malloc(smb2, namelen + 1);
                 if (!user) {
                         smb2_set_error(smb2, "can not alloc name buffer");
                         return -1;
@@ -767,7 +767,7 @@ krb5_session_reply(struct smb2_context *smb2,
                         return -1;
                 }
 
-                free(user);
+                smb2_free(smb2, user);
         }
 
         if (auth_data->get_proxy_cred && (!(ret_flags & GSS_C_DELEG_FLAG) ||
@@ -891,7 +891,7 @@ krb5_init_server_credentials(struct smb2_server *server, const char *keytab_path
         }
 
         do { // try
-                auth_data = calloc(1, sizeof(struct private_auth_data));
+                auth_data = smb2_calloc(NULL, 1, sizeof(struct private_auth_data));
                 if (auth_data == NULL) {
                         snprintf(server->error, sizeof(server->error), "Can't alloc auth_data");
                         break;
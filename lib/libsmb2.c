@@ -68,6 +68,14 @@
 #include <poll.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_SYS__IOVEC_H
+#include <sys/_iovec.h>
+#endif
+
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
@@ -88,23 +96,20 @@
 #include <sys/socket.h>
 #endif
 
-#if defined(_WIN32) || defined(_XBOX) || defined(__AROS__)
-#include "asprintf.h"
-#endif
-
 #include "compat.h"
 
-#include "sha.h"
-#include "sha-private.h"
-
 #include "slist.h"
 #include "smb2.h"
 #include "libsmb2.h"
+#include "crypto.h"
 #include "libsmb2-raw.h"
 #include "libsmb2-private.h"
 #include "smb2-signing.h"
+#include "smb3-seal.h"
 #include "portable-endian.h"
 #include "ntlmssp.h"
+#include "read-ahead.h"
+#include "write-behind.h"
 
 #ifdef HAVE_LIBKRB5
 #include "krb5-wrapper.h"
@@ -119,22 +124,6 @@
 #define DEFAULT_OUTPUT_BUFFER_LENGTH 0xffff
 #endif
 
-/* strings used to derive SMB signing and encryption keys */
-static const char SMBSigningKey[] = "SMBSigningKey";
-static const char SMBC2SCipherKey[] = "SMBC2SCipherKey";
-static const char SMBS2CCipherKey[] = "SMBS2CCipherKey";
-static const char SMB2AESCMAC[] = "SMB2AESCMAC";
-static const char SmbSign[] = "SmbSign";
-static const char SMB2AESCCM[] = "SMB2AESCCM";
-static const char ServerOut[] = "ServerOut";
-static const char ServerIn[] = "ServerIn ";
-/* The following strings will be used for deriving other keys */
-#if 0
-static const char SMB2APP[] = "SMB2APP";
-static const char SmbRpc[] = "SmbRpc";
-static const char SMBAppKey[] = "SMBAppKey";
-#endif
-
 const smb2_file_id compound_file_id = {
         0xff, 0xff, 0xff, 0xff,  0xff, 0xff, 0xff, 0xff,
         0xff, 0xff, 0xff, 0xff,  0xff, 0xff, 0xff, 0xff
@@ -158,15 +147,6 @@ struct connect_data {
         struct smb2_server *server_context;
 };
 
-struct smb2fh {
-        smb2_command_cb cb;
-        void *cb_data;
-
-        smb2_file_id file_id;
-        int64_t offset;
-        int64_t end_of_file;
-};
-
 void
 smb2_close_context(struct smb2_context *smb2)
 {
@@ -175,11 +155,7 @@ smb2_close_context(struct smb2_context *smb2)
         }
 
         if (SMB2_VALID_SOCKET(smb2->fd)) {
-                if (smb2->change_fd) {
-                        smb2->change_fd(smb2, smb2->fd, SMB2_DEL_FD);
-                }
-                close(smb2->fd);
-                smb2->fd = SMB2_INVALID_SOCKET;
+                smb2_close_socket(smb2);
         }
 
         smb2->message_id = 0;
@@ -188,8 +164,12 @@ smb2_close_context(struct smb2_context *smb2)
         smb2->tree_id_cur = 0;
         smb2->tree_id[0] = 0xdeadbeef;
         memset(smb2->signing_key, 0, SMB2_KEY_SIZE);
+        if (smb2->signing_ks) {
+                smb2_free_keys(smb2);
+                memset(smb2->signing_ks, 0, 3 * sizeof(struct smb2_key));
+        }
         if (smb2->session_key) {
-                free(smb2->session_key);
+                smb2_free(smb2, smb2->session_key);
                 smb2->session_key = NULL;
         }
         smb2->session_key_size = 0;
@@ -206,14 +186,14 @@ free_smb2dir(struct smb2_context *smb2, struct smb2dir *dir)
         while (dir->entries) {
                 struct smb2_dirent_internal *e = dir->entries->next;
 
-                free(discard_const(dir->entries->dirent.name));
-                free(dir->entries);
+                smb2_free(smb2, discard_const(dir->entries->dirent.name));
+                smb2_free(smb2, dir->entries);
                 dir->entries = e;
         }
         if (dir->free_cb_data) {
-                dir->free_cb_data(dir->cb_data);
+                smb2_call_free_cb(smb2, dir->free_cb_data, dir->cb_data);
         }
-        free(dir);
+        smb2_free(smb2, dir);
 }
 
 void
@@ -294,7 +274,7 @@ decode_dirents(struct smb2_context *smb2, struct smb2dir *dir,
                         return -1;
                 }
 
-                ent = calloc(1, sizeof(struct smb2_dirent_internal));
+                ent = smb2_calloc(smb2, 1, sizeof(struct smb2_dirent_internal));
                 if (ent == NULL) {
                         smb2_set_error(smb2, "Failed to allocate "
                                        "dirent_internal");
@@ -475,7 +455,7 @@ _smb2_opendir_async(struct smb2_context *smb2, const char *path,
                 path = "";
         }
 
-        dir = calloc(1, sizeof(struct smb2dir));
+        dir = smb2_calloc(smb2, 1, sizeof(struct smb2dir));
         if (dir == NULL) {
                 smb2_set_error(smb2, "Failed to allocate smb2dir.");
                 return NULL;
@@ -543,12 +523,12 @@ free_c_data(struct smb2_context *smb2, struct connect_data *c_data)
         if (smb2->connect_data == c_data) {
             smb2->connect_data = NULL;  /* to prevent double-free in smb2_destroy_context */
         }
-        free(c_data->utf8_unc);
-        free(c_data->utf16_unc);
-        free(discard_const(c_data->server));
-        free(discard_const(c_data->share));
-        free(discard_const(c_data->user));
-        free(c_data);
+        smb2_free(smb2, c_data->utf8_unc);
+        smb2_free(smb2, c_data->utf16_unc);
+        smb2_free(smb2, discard_const(c_data->server));
+        smb2_free(smb2, discard_const(c_data->share));
+        smb2_free(smb2, discard_const(c_data->user));
+        smb2_free(smb2, c_data);
 }
 
 static void
@@ -571,35 +551,6 @@ tree_connect_cb(struct smb2_context *smb2, int status,
         free_c_data(smb2, c_data);
 }
 
-void smb2_derive_key(
-    uint8_t     *derivation_key,
-    uint32_t    derivation_key_len,
-    const char  *label,
-    uint32_t    label_len,
-    const char  *context,
-    uint32_t    context_len,
-    uint8_t     derived_key[SMB2_KEY_SIZE]
-    )
-{
-        unsigned char nul = 0;
-        const uint32_t counter = htobe32(1);
-        const uint32_t keylen = htobe32(SMB2_KEY_SIZE * 8);
-        uint8_t input_key[SMB2_KEY_SIZE] = {0};
-        HMACContext ctx;
-        uint8_t digest[USHAMaxHashSize];
-
-        memcpy(input_key, derivation_key, MIN(sizeof(input_key),
-                                              derivation_key_len));
-        hmacReset(&ctx, SHA256, input_key, sizeof(input_key));
-        hmacInput(&ctx, (unsigned char *)&counter, sizeof(counter));
-        hmacInput(&ctx, (unsigned char *)label, label_len);
-        hmacInput(&ctx, &nul, 1);
-        hmacInput(&ctx, (unsigned char *)context, context_len);
-        hmacInput(&ctx, (unsigned char *)&keylen, sizeof(keylen));
-        hmacResult(&ctx, digest);
-        memcpy(derived_key, digest, SMB2_KEY_SIZE);
-}
-
 /* MS-SMB2 3.2.5.2 */
 static void
 smb3_init_preauth_hash(struct smb2_context *smb2)
@@ -608,79 +559,59 @@ smb3_init_preauth_hash(struct smb2_context *smb2)
 }
 
 /* MS-SMB2 3.2.5.2 */
-static int
+int
 smb3_update_preauth_hash(struct smb2_context *smb2, int niov,
                          struct smb2_iovec *iov)
 {
         int i;
-        USHAContext tctx;
+        struct smb2_hash_ctx tctx;
 
-        USHAReset(&tctx, SHA512);
-        USHAInput(&tctx, smb2->preauthhash, SMB2_PREAUTH_HASH_SIZE);
+        smb2_hash_init(&tctx, smb2->crypto, SMB2_CRYPTO_SHA512, NULL, 0);
+        smb2_hash_update(&tctx, smb2->preauthhash, SMB2_PREAUTH_HASH_SIZE);
         for (i = 0; i < niov; i++) {
-                USHAInput(&tctx, iov[i].buf, iov[i].len);
+                smb2_hash_update(&tctx, iov[i].buf, iov[i].len);
         }
-        USHAResult(&tctx, smb2->preauthhash);
+        smb2_hash_final(&tctx, smb2->preauthhash);
 
         return 0;
 }
 
-static void smb2_create_signing_key(struct smb2_context *smb2)
+static int smb2_create_signing_key(struct smb2_context *smb2)
 {
-        /* Derive the signing key from session key
-         * This is based on negotiated protocol
-         */
-        if (smb2->dialect == SMB2_VERSION_0202 ||
-            smb2->dialect == SMB2_VERSION_0210) {
-                /* For SMB2 session key is the signing key */
-                memcpy(smb2->signing_key,
-                       smb2->session_key,
-                       MIN(smb2->session_key_size, SMB2_KEY_SIZE));
-        } else if (smb2->dialect <= SMB2_VERSION_0302) {
-                smb2_derive_key(smb2->session_key,
-                                smb2->session_key_size,
-                                SMB2AESCMAC,
-                                sizeof(SMB2AESCMAC),
-                                SmbSign,
-                                sizeof(SmbSign),
-                                smb2->signing_key);
-                smb2_derive_key(smb2->session_key,
-                                smb2->session_key_size,
-                                SMB2AESCCM,
-                                sizeof(SMB2AESCCM),
-                                ServerIn,
-                                sizeof(ServerIn),
-                                smb2->serverin_key);
-                smb2_derive_key(smb2->session_key,
-                                smb2->session_key_size,
-                                SMB2AESCCM,
-                                sizeof(SMB2AESCCM),
-                                ServerOut,
-                                sizeof(ServerOut),
-                                smb2->serverout_key);
-        } else if (smb2->dialect > SMB2_VERSION_0302) {
-                smb2_derive_key(smb2->session_key,
-                                smb2->session_key_size,
-                                SMBSigningKey,
-                                sizeof(SMBSigningKey),
-                                (char *)smb2->preauthhash,
-                                SMB2_PREAUTH_HASH_SIZE,
-                                smb2->signing_key);
-                smb2_derive_key(smb2->session_key,
-                                smb2->session_key_size,
-                                SMBC2SCipherKey,
-                                sizeof(SMBC2SCipherKey),
-                                (char *)smb2->preauthhash,
-                                SMB2_PREAUTH_HASH_SIZE,
-                                smb2->serverin_key);
-                smb2_derive_key(smb2->session_key,
-                                smb2->session_key_size,
-                                SMBS2CCipherKey,
-                                sizeof(SMBS2CCipherKey),
-                                (char *)smb2->preauthhash,
-                                SMB2_PREAUTH_HASH_SIZE,
-                                smb2->serverout_key);
+        int cipher_key_size = SMB2_KEY_SIZE;
+
+        if (smb2->dialect > SMB2_VERSION_0302) {
+                cipher_key_size = smb3_cipher_key_size(smb2->cypher);
+        }
+        smb2_derive_session_keys(smb2, cipher_key_size);
+
+        if (smb2->dialect <= SMB2_VERSION_0210) {
+                return 0;
         }
+
+        /* Expand the AES keys once here instead of for every PDU that is
+         * signed or encrypted.
+         */
+        if (smb2->signing_ks == NULL) {
+                smb2->signing_ks = smb2_calloc(smb2, 3,
+                                               sizeof(struct smb2_key));
+                if (smb2->signing_ks == NULL) {
+                        smb2_set_error(smb2, "Failed to allocate key schedules");
+                        return -1;
+                }
+                smb2->serverin_ks = &smb2->signing_ks[1];
+                smb2->serverout_ks = &smb2->signing_ks[2];
+        }
+        smb2_free_keys(smb2);
+        smb2_key_init(smb2->signing_ks, smb2->crypto, smb2->signing_key,
+                      SMB2_KEY_SIZE);
+        smb2_key_init(smb2->serverin_ks, smb2->crypto, smb2->serverin_key,
+                      cipher_key_size);
+        smb2_key_init(smb2->serverout_ks, smb2->crypto, smb2->serverout_key,
+                      cipher_key_size);
+        smb2->nonce_counter = 0;
+
+        return 0;
 }
 
 static void
@@ -770,7 +701,12 @@ session_setup_cb(struct smb2_context *smb2, int status,
                         return;
                 }
 
-                smb2_create_signing_key(smb2);
+                if (smb2_create_signing_key(smb2) < 0) {
+                        smb2_close_context(smb2);
+                        c_data->cb(smb2, -ENOMEM, NULL, c_data->cb_data);
+                        free_c_data(smb2, c_data);
+                        return;
+                }
 
                 if (smb2->hdr.flags & SMB2_FLAGS_SIGNED) {
                         uint8_t signature[16] _U_;
@@ -899,7 +835,14 @@ negotiate_cb(struct smb2_context *smb2, int status,
         smb2->max_read_size     = rep->max_read_size;
         smb2->max_write_size    = rep->max_write_size;
         smb2->dialect           = rep->dialect_revision;
-        smb2->cypher            = rep->cypher;
+        /* 3.0 and 3.0.2 only have CCM, 3.1.1 selects the cipher in
+         * the encryption negotiate context.
+         */
+        if (smb2->dialect < SMB2_VERSION_0311) {
+                smb2->cypher = SMB2_ENCRYPTION_AES_128_CCM;
+        } else {
+                smb2->cypher = rep->cypher;
+        }
 
         if (smb2->seal && (smb2->dialect == SMB2_VERSION_0300 ||
                            smb2->dialect == SMB2_VERSION_0302)) {
@@ -912,6 +855,17 @@ negotiate_cb(struct smb2_context *smb2, int status,
                         return;
                 }
         }
+        if (smb2->seal && smb2->dialect >= SMB2_VERSION_0300 &&
+            (!smb3_cipher_supported(smb2->cypher) ||
+             (smb2->requested_cypher &&
+              smb2->cypher != smb2->requested_cypher))) {
+                smb2_set_error(smb2, "Encryption requested but server "
+                               "did not select a supported cipher.");
+                smb2_close_context(smb2);
+                c_data->cb(smb2, -ENOMEM, NULL, c_data->cb_data);
+                free_c_data(smb2, c_data);
+                return;
+        }
 
         if (smb2->sign &&
             !(rep->security_mode & SMB2_NEGOTIATE_SIGNING_ENABLED)) {
@@ -959,7 +913,7 @@ negotiate_cb(struct smb2_context *smb2, int status,
         }
 
         if (smb2->sec == SMB2_SEC_NTLMSSP) {
-                c_data->auth_data = ntlmssp_init_context(smb2->user,
+                c_data->auth_data = ntlmssp_init_context(smb2, smb2->user,
                                                          smb2->password,
                                                          smb2->domain,
                                                          smb2->workstation,
@@ -1065,6 +1019,7 @@ smb2_connect_share_async(struct smb2_context *smb2,
                          smb2_command_cb cb, void *cb_data)
 {
         struct connect_data *c_data;
+        size_t len;
         int err;
 
         if (smb2 == NULL) {
@@ -1072,7 +1027,7 @@ smb2_connect_share_async(struct smb2_context *smb2,
         }
 
         if (smb2->server != NULL) {
-                free(discard_const(smb2->server));
+                smb2_free(smb2, discard_const(smb2->server));
                 smb2->server = NULL;
         }
         if (server == NULL) {
@@ -1083,15 +1038,15 @@ smb2_connect_share_async(struct smb2_context *smb2,
                 smb2_set_error(smb2, "No share name provided");
                 return -EINVAL;
         }
-        smb2->server = strdup(server);
+        smb2->server = smb2_strdup(smb2, server);
         if (smb2->server == NULL) {
                 return -ENOMEM;
         }
 
         if (smb2->share) {
-                free(discard_const(smb2->share));
+                smb2_free(smb2, discard_const(smb2->share));
         }
-        smb2->share = strdup(share);
+        smb2->share = smb2_strdup(smb2, share);
         if (smb2->share == NULL) {
                 return -ENOMEM;
         }
@@ -1099,18 +1054,18 @@ smb2_connect_share_async(struct smb2_context *smb2,
         if (user) {
                 smb2_set_user(smb2, user);
         }
-        c_data = calloc(1, sizeof(struct connect_data));
+        c_data = smb2_calloc(smb2, 1, sizeof(struct connect_data));
         if (c_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate connect_data");
                 return -ENOMEM;
         }
-        c_data->server = strdup(smb2->server);
+        c_data->server = smb2_strdup(smb2, smb2->server);
         if (c_data->server == NULL) {
                 free_c_data(smb2, c_data);
                 smb2_set_error(smb2, "Failed to strdup(server)");
                 return -ENOMEM;
         }
-        c_data->share = strdup(smb2->share);
+        c_data->share = smb2_strdup(smb2, smb2->share);
         if (c_data->share == NULL) {
                 free_c_data(smb2, c_data);
                 smb2_set_error(smb2, "Failed to strdup(share)");
@@ -1120,20 +1075,23 @@ smb2_connect_share_async(struct smb2_context *smb2,
                 smb2_set_error(smb2, "smb2->user is NULL");
                 return -ENOMEM;
         }
-        c_data->user = strdup(smb2->user);
+        c_data->user = smb2_strdup(smb2, smb2->user);
         if (c_data->user == NULL) {
                 free_c_data(smb2, c_data);
                 smb2_set_error(smb2, "Failed to strdup(user)");
                 return -ENOMEM;
         }
-        if (asprintf(&c_data->utf8_unc, "\\\\%s\\%s", c_data->server,
-                     c_data->share) < 0) {
+        len = strlen(c_data->server) + strlen(c_data->share) + 4;
+        c_data->utf8_unc = smb2_malloc(smb2, len);
+        if (c_data->utf8_unc == NULL) {
                 free_c_data(smb2, c_data);
                 smb2_set_error(smb2, "Failed to allocate unc string.");
                 return -ENOMEM;
         }
+        snprintf(c_data->utf8_unc, len, "\\\\%s\\%s", c_data->server,
+                 c_data->share);
 
-        c_data->utf16_unc = smb2_utf8_to_utf16(c_data->utf8_unc);
+        c_data->utf16_unc = smb2_ctx_utf8_to_utf16(smb2, c_data->utf8_unc);
         if (c_data->utf16_unc == NULL) {
                 smb2_set_error(smb2, "Count not convert UNC:[%s] into UTF-16",
                                c_data->utf8_unc);
@@ -1153,10 +1111,36 @@ smb2_connect_share_async(struct smb2_context *smb2,
         return 0;
 }
 
+/*
+ * Whether an oplock or lease break is for the oplock or lease that fh
+ * was opened with.
+ */
+int
+smb2_fh_break_matches(struct smb2fh *fh,
+                      struct smb2_oplock_or_lease_break_reply *rep)
+{
+        switch (rep->break_type) {
+        case SMB2_BREAK_TYPE_LEASE_NOTIFICATION:
+                return fh->has_lease &&
+                        !memcmp(fh->lease_key, rep->lock.lease.lease_key,
+                                SMB2_LEASE_KEY_SIZE);
+        case SMB2_BREAK_TYPE_OPLOCK_NOTIFICATION:
+                return !memcmp(fh->file_id, rep->lock.oplock.file_id,
+                               SMB2_FD_SIZE);
+        }
+        return 0;
+}
+
 static void
 free_smb2fh(struct smb2_context *smb2, struct smb2fh *fh)
 {
-        free(fh);
+        if (fh->ra) {
+                smb2_ra_free(smb2, fh->ra);
+        }
+        if (fh->wb) {
+                smb2_wb_free(smb2, fh->wb);
+        }
+        smb2_free(smb2, fh);
 }
 
 static void
@@ -1198,7 +1182,7 @@ _smb2_open_async_with_oplock_or_lease(struct smb2_context *smb2, const char *pat
                 return NULL;
         }
 
-        fh = calloc(1, sizeof(struct smb2fh));
+        fh = smb2_calloc(smb2, 1, sizeof(struct smb2fh));
         if (fh == NULL) {
                 smb2_set_error(smb2, "Failed to allocate smbfh");
                 return NULL;
@@ -1268,8 +1252,10 @@ _smb2_open_async_with_oplock_or_lease(struct smb2_context *smb2, const char *pat
         req.name = path;
 
         if (lease_state && lease_key) {
+                fh->has_lease = 1;
+                memcpy(fh->lease_key, lease_key, SMB2_LEASE_KEY_SIZE);
                 req.create_context_length = SMB2_CREATE_REQUEST_LEASE_SIZE + 24;
-                req.create_context = calloc(1, SMB2_CREATE_REQUEST_LEASE_SIZE + 24);
+                req.create_context = smb2_calloc(smb2, 1, SMB2_CREATE_REQUEST_LEASE_SIZE + 24);
                 iov.buf = req.create_context;
                 iov.len = req.create_context_length;
                 smb2_set_uint32(&iov, 0, 0);    /* chain offset */
@@ -1290,7 +1276,7 @@ _smb2_open_async_with_oplock_or_lease(struct smb2_context *smb2, const char *pat
                 return NULL;
         }
         if (req.create_context && req.create_context_length) {
-                free(req.create_context);
+                smb2_free(smb2, req.create_context);
         }
 
         pdu->caller_frees_pdu = caller_frees_pdu;
@@ -1366,6 +1352,12 @@ smb2_close_async(struct smb2_context *smb2, struct smb2fh *fh,
             smb2_set_error(smb2, "File handle was NULL");
             return -EINVAL;
         }
+        if (fh->wb) {
+                int rc = smb2_wb_close(smb2, fh, cb, cb_data);
+                if (rc <= 0) {
+                        return rc;
+                }
+        }
 
         fh->cb = cb;
         fh->cb_data = cb_data;
@@ -1414,6 +1406,12 @@ smb2_fsync_async(struct smb2_context *smb2, struct smb2fh *fh,
             smb2_set_error(smb2, "File handle was NULL");
             return -EINVAL;
         }
+        if (fh->wb) {
+                int rc = smb2_wb_fsync(smb2, fh, cb, cb_data);
+                if (rc <= 0) {
+                        return rc;
+                }
+        }
 
         fh->cb = cb;
         fh->cb_data = cb_data;
@@ -1431,6 +1429,29 @@ smb2_fsync_async(struct smb2_context *smb2, struct smb2fh *fh,
         return 0;
 }
 
+/*
+ * Largest read or write that can go in a single PDU right now.
+ * A multi-credit PDU can not ask for more credits than we currently have
+ * or it might never be sent.
+ */
+uint32_t
+smb2_max_io_size(struct smb2_context *smb2, uint32_t max_size)
+{
+        uint32_t size = max_size;
+        int credits = smb2->credits > 0 ? smb2->credits : 1;
+
+        if (smb2->dialect <= SMB2_VERSION_0202) {
+                return size > 65536 ? 65536 : size;
+        }
+        if (size > (MAX_CREDITS - 16) * 65536) {
+                size = (MAX_CREDITS - 16) * 65536;
+        }
+        if (size > (uint32_t)credits * 65536) {
+                size = credits * 65536;
+        }
+        return size;
+}
+
 struct read_data {
         smb2_command_cb cb;
         void *cb_data;
@@ -1449,7 +1470,7 @@ read_cb(struct smb2_context *smb2, int status,
                 smb2_set_nterror(smb2, status, "Read/Write failed with (0x%08x) %s",
                                status, nterror_to_str(status));
                 rd->cb(smb2, -nterror_to_errno(status), &rd->read_cb_data, rd->cb_data);
-                free(rd);
+                smb2_free(smb2, rd);
                 return;
         }
 
@@ -1458,7 +1479,7 @@ read_cb(struct smb2_context *smb2, int status,
         }
 
         rd->cb(smb2, rep->data_length, &rd->read_cb_data, rd->cb_data);
-        free(rd);
+        smb2_free(smb2, rd);
 }
 
 int
@@ -1469,7 +1490,7 @@ smb2_pread_async(struct smb2_context *smb2, struct smb2fh *fh,
         struct smb2_read_request req;
         struct read_data *rd;
         struct smb2_pdu *pdu;
-        int needed_credits;
+        uint32_t max_size;
 
         if (smb2 == NULL) {
                 return -EINVAL;
@@ -1478,8 +1499,27 @@ smb2_pread_async(struct smb2_context *smb2, struct smb2fh *fh,
                 smb2_set_error(smb2, "File handle was NULL");
                 return -EINVAL;
         }
+        if (fh->wb) {
+                int rc = smb2_wb_pread(smb2, fh, buf, count, offset,
+                                       cb, cb_data);
+                if (rc <= 0) {
+                        return rc;
+                }
+        }
+        if (fh->ra) {
+                int rc = smb2_ra_pread(smb2, fh, buf, count, offset,
+                                       cb, cb_data);
+                if (rc <= 0) {
+                        return rc;
+                }
+        }
+        if (smb2->split_io &&
+            count > smb2_max_io_size(smb2, smb2->max_read_size)) {
+                return smb2_pread_split_async(smb2, fh, buf, count, offset,
+                                              cb, cb_data);
+        }
 
-        rd = calloc(1, sizeof(struct read_data));
+        rd = smb2_calloc(smb2, 1, sizeof(struct read_data));
         if (rd == NULL) {
                 smb2_set_error(smb2, "Failed to allocate read_data");
                 return -ENOMEM;
@@ -1492,25 +1532,10 @@ smb2_pread_async(struct smb2_context *smb2, struct smb2fh *fh,
         rd->read_cb_data.count = count;
         rd->read_cb_data.offset = offset;
 
-        if (count > smb2->max_read_size) {
-                count = smb2->max_read_size;
+        max_size = smb2_max_io_size(smb2, smb2->max_read_size);
+        if (count > max_size) {
+                count = max_size;
         }
-        needed_credits = (count - 1) / 65536 + 1;
-
-        if (smb2->dialect > SMB2_VERSION_0202) {
-                if (needed_credits > MAX_CREDITS - 16) {
-                        count =  (MAX_CREDITS - 16) * 65536;
-                }
-                needed_credits = (count - 1) / 65536 + 1;
-                if (needed_credits > smb2->credits) {
-                        count = smb2->credits * 65536;
-                }
-        } else {
-                if (count > 65536) {
-                        count = 65536;
-                }
-        }
-        needed_credits = (count - 1) / 65536 + 1;
 
         memset(&req, 0, sizeof(struct smb2_read_request));
         req.flags = 0;
@@ -1568,7 +1593,7 @@ write_cb(struct smb2_context *smb2, int status,
                 smb2_set_nterror(smb2, status, "Read/Write failed with (0x%08x) %s",
                                status, nterror_to_str(status));
                 wd->cb(smb2, -nterror_to_errno(status), &wd->write_cb_data, wd->cb_data);
-                free(wd);
+                smb2_free(smb2, wd);
                 return;
         }
 
@@ -1577,7 +1602,7 @@ write_cb(struct smb2_context *smb2, int status,
         }
 
         wd->cb(smb2, rep->count, &wd->write_cb_data, wd->cb_data);
-        free(wd);
+        smb2_free(smb2, wd);
 }
 
 int
@@ -1588,7 +1613,7 @@ smb2_pwrite_async(struct smb2_context *smb2, struct smb2fh *fh,
         struct smb2_write_request req;
         struct write_data *wr;
         struct smb2_pdu *pdu;
-        int needed_credits;
+        uint32_t max_size;
 
         if (smb2 == NULL) {
                 return -EINVAL;
@@ -1597,8 +1622,23 @@ smb2_pwrite_async(struct smb2_context *smb2, struct smb2fh *fh,
                 smb2_set_error(smb2, "File handle was NULL");
                 return -EINVAL;
         }
+        if (fh->ra) {
+                smb2_ra_invalidate(smb2, fh->ra);
+        }
+        if (fh->wb) {
+                int rc = smb2_wb_pwrite(smb2, fh, buf, count, offset,
+                                        cb, cb_data);
+                if (rc <= 0) {
+                        return rc;
+                }
+        }
+        if (smb2->split_io &&
+            count > smb2_max_io_size(smb2, smb2->max_write_size)) {
+                return smb2_pwrite_split_async(smb2, fh, buf, count, offset,
+                                               cb, cb_data);
+        }
 
-        wr = calloc(1, sizeof(struct write_data));
+        wr = smb2_calloc(smb2, 1, sizeof(struct write_data));
         if (wr == NULL) {
                 smb2_set_error(smb2, "Failed to allocate write_data");
                 return -ENOMEM;
@@ -1611,25 +1651,10 @@ smb2_pwrite_async(struct smb2_context *smb2, struct smb2fh *fh,
         wr->write_cb_data.count = count;
         wr->write_cb_data.offset = offset;
 
-        if (count > smb2->max_write_size) {
-                count = smb2->max_write_size;
+        max_size = smb2_max_io_size(smb2, smb2->max_write_size);
+        if (count > max_size) {
+                count = max_size;
         }
-        needed_credits = (count - 1) / 65536 + 1;
-
-        if (smb2->dialect > SMB2_VERSION_0202) {
-                if (needed_credits > MAX_CREDITS - 16) {
-                        count =  (MAX_CREDITS - 16) * 65536;
-                }
-                needed_credits = (count - 1) / 65536 + 1;
-                if (needed_credits > smb2->credits) {
-                        count = smb2->credits * 65536;
-                }
-        } else {
-                if (count > 65536) {
-                        count = 65536;
-                }
-        }
-        needed_credits = (count - 1) / 65536 + 1;
 
         memset(&req, 0, sizeof(struct smb2_write_request));
         req.length = count;
@@ -1666,6 +1691,829 @@ smb2_write_async(struct smb2_context *smb2, struct smb2fh *fh,
                                  cb, cb_data);
 }
 
+/*
+ * Reads and writes that are larger than one PDU, see
+ * smb2_pread_split_async(). The request is cut into segments that are
+ * all queued at once and sent as credits allow. The callback is invoked
+ * once the last segment has completed.
+ */
+struct split_segment {
+        struct split_data *sd;
+        /* offset into the caller's buffer */
+        uint32_t offset;
+        uint32_t count;
+        /* bytes transferred or -errno */
+        int status;
+};
+
+struct split_data {
+        smb2_command_cb cb;
+        void *cb_data;
+        int is_write;
+        /* of all segments */
+        uint32_t count;
+
+        struct smb2_read_cb_data read_cb_data;
+        struct smb2_write_cb_data write_cb_data;
+
+        int num_segments;
+        /* segments not completed yet, plus one while they are queued */
+        int pending;
+        struct split_segment segments[1];
+};
+
+static void
+split_done(struct smb2_context *smb2, struct split_data *sd)
+{
+        struct split_segment *seg;
+        struct smb2fh *fh;
+        uint64_t offset;
+        uint32_t total = 0;
+        int i, status = 0;
+
+        /* The result is the part that was transferred without a gap,
+         * like a short read. An error is only reported if it hit the
+         * first segment.
+         */
+        for (i = 0; i < sd->num_segments; i++) {
+                seg = &sd->segments[i];
+                if (seg->status < 0) {
+                        if (total == 0) {
+                                status = seg->status;
+                        }
+                        break;
+                }
+                total += seg->status;
+                if ((uint32_t)seg->status < seg->count) {
+                        break;
+                }
+        }
+
+        if (sd->is_write) {
+                fh = sd->write_cb_data.fh;
+                offset = sd->write_cb_data.offset;
+        } else {
+                fh = sd->read_cb_data.fh;
+                offset = sd->read_cb_data.offset;
+        }
+        if (status == 0) {
+                status = (int)total;
+                if (total) {
+                        fh->offset = offset + total;
+                }
+        }
+
+        if (sd->is_write) {
+                sd->cb(smb2, status, &sd->write_cb_data, sd->cb_data);
+        } else {
+                sd->cb(smb2, status, &sd->read_cb_data, sd->cb_data);
+        }
+        smb2_free(smb2, sd);
+}
+
+static void
+split_cb(struct smb2_context *smb2, int status,
+         void *command_data, void *private_data)
+{
+        struct split_segment *seg = private_data;
+        struct split_data *sd = seg->sd;
+
+        if (status == SMB2_STATUS_END_OF_FILE) {
+                seg->status = 0;
+        } else if (status) {
+                smb2_set_nterror(smb2, status, "Read/Write failed with (0x%08x) %s",
+                               status, nterror_to_str(status));
+                seg->status = -nterror_to_errno(status);
+        } else if (sd->is_write) {
+                seg->status = ((struct smb2_write_reply *)command_data)->count;
+        } else {
+                seg->status = ((struct smb2_read_reply *)command_data)->data_length;
+        }
+
+        if (--sd->pending == 0) {
+                split_done(smb2, sd);
+        }
+}
+
+static void
+split_hl_cb(struct smb2_context *smb2, int status,
+            void *command_data, void *private_data)
+{
+        struct split_segment *seg = private_data;
+        struct split_data *sd = seg->sd;
+
+        seg->status = status;
+        if (--sd->pending == 0) {
+                split_done(smb2, sd);
+        }
+}
+
+/* Most buffers that one segment gathers from or scatters into, the
+ * PDU needs a few more vectors for the header and padding.
+ */
+#define SPLIT_MAX_IOV (SMB2_MAX_VECTORS / 2)
+
+/*
+ * Takes up to max bytes from the buffers, starting at buffer *idx and
+ * *off bytes into it, and advances *idx and *off past them. The pieces
+ * are stored in out, if not NULL. Returns the number of pieces.
+ */
+static int
+split_gather(const struct iovec *iov, int iovcnt, int *idx, size_t *off,
+             uint32_t max, struct iovec *out, uint32_t *count)
+{
+        size_t n;
+        int num = 0;
+
+        *count = 0;
+        while (*idx < iovcnt && *count < max && num < SPLIT_MAX_IOV) {
+                n = iov[*idx].iov_len - *off;
+                if (n == 0) {
+                        (*idx)++;
+                        *off = 0;
+                        continue;
+                }
+                if (n > max - *count) {
+                        n = max - *count;
+                }
+                if (out) {
+                        out[num].iov_base = (uint8_t *)iov[*idx].iov_base +
+                                *off;
+                        out[num].iov_len = n;
+                }
+                num++;
+                *count += (uint32_t)n;
+                *off += n;
+                if (*off == iov[*idx].iov_len) {
+                        (*idx)++;
+                        *off = 0;
+                }
+        }
+        return num;
+}
+
+/*
+ * Number of segments of at most seg_size bytes that smb2_split_hl_async()
+ * cuts the first count bytes of the buffers into.
+ */
+static int
+split_hl_segments(const struct iovec *iov, int iovcnt, uint32_t count,
+                  uint32_t seg_size)
+{
+        uint32_t len, pos = 0;
+        int i, num = 0;
+
+        for (i = 0; i < iovcnt && pos < count; i++) {
+                len = iov[i].iov_len < count - pos ?
+                        (uint32_t)iov[i].iov_len : count - pos;
+                num += (len + seg_size - 1) / seg_size;
+                pos += len;
+        }
+        return num;
+}
+
+/*
+ * With read-ahead or write-behind on the handle each buffer goes through
+ * smb2_pread_async()/smb2_pwrite_async() so that they see the data.
+ * Buffers larger than seg_size are cut up as those would otherwise
+ * truncate them to one PDU.
+ */
+static int
+smb2_split_hl_async(struct smb2_context *smb2, struct smb2fh *fh,
+                    struct split_data *sd, const struct iovec *iov,
+                    int iovcnt, uint64_t offset, uint32_t seg_size)
+{
+        struct split_segment *seg;
+        uint32_t pos = 0;
+        size_t off;
+        int i, rc = 0;
+
+        sd->num_segments = 0;
+        for (i = 0; i < iovcnt && pos < sd->count; i++) {
+                for (off = 0; off < iov[i].iov_len && pos < sd->count;
+                     off += seg->count) {
+                        seg = &sd->segments[sd->num_segments];
+                        seg->sd = sd;
+                        seg->offset = pos;
+                        seg->count = iov[i].iov_len - off < seg_size ?
+                                (uint32_t)(iov[i].iov_len - off) : seg_size;
+                        if (seg->count > sd->count - pos) {
+                                seg->count = sd->count - pos;
+                        }
+                        sd->pending++;
+                        if (sd->is_write) {
+                                rc = smb2_pwrite_async(smb2, fh,
+                                                       (uint8_t *)iov[i].iov_base + off,
+                                                       seg->count, offset + pos,
+                                                       split_hl_cb, seg);
+                        } else {
+                                rc = smb2_pread_async(smb2, fh,
+                                                      (uint8_t *)iov[i].iov_base + off,
+                                                      seg->count, offset + pos,
+                                                      split_hl_cb, seg);
+                        }
+                        if (rc < 0) {
+                                sd->pending--;
+                                return rc;
+                        }
+                        sd->num_segments++;
+                        pos += seg->count;
+                }
+        }
+        return rc;
+}
+
+static int
+smb2_splitv_async(struct smb2_context *smb2, struct smb2fh *fh, int is_write,
+                  const struct iovec *iov, int iovcnt, uint64_t offset,
+                  int hl, smb2_command_cb cb, void *cb_data)
+{
+        struct smb2_read_request rreq;
+        struct smb2_write_request wreq;
+        struct iovec pieces[SPLIT_MAX_IOV];
+        struct split_segment *seg;
+        struct split_data *sd;
+        struct smb2_pdu *pdu;
+        uint32_t seg_size, count = 0, n, got;
+        size_t off;
+        int i, idx, num, num_segments, rc;
+
+        if (is_write && fh->ra) {
+                smb2_ra_invalidate(smb2, fh->ra);
+        }
+        seg_size = smb2_max_io_size(smb2, is_write ? smb2->max_write_size :
+                                    smb2->max_read_size);
+        if (seg_size == 0) {
+                seg_size = 65536;
+        }
+
+        /* the callback reports the number of bytes as an int */
+        for (i = 0; i < iovcnt; i++) {
+                if (iov[i].iov_len > 0x7fffffff - count) {
+                        count = 0x7fffffff;
+                        break;
+                }
+                count += (uint32_t)iov[i].iov_len;
+        }
+        if (hl) {
+                num_segments = split_hl_segments(iov, iovcnt, count,
+                                                 seg_size);
+        } else {
+                /* a segment ends early if it needs too many pieces */
+                num_segments = 0;
+                idx = 0;
+                off = 0;
+                for (n = 0; n < count; n += got) {
+                        split_gather(iov, iovcnt, &idx, &off, count - n <
+                                     seg_size ? count - n : seg_size,
+                                     NULL, &got);
+                        num_segments++;
+                }
+        }
+        if (num_segments == 0) {
+                num_segments = 1;
+        }
+
+        sd = smb2_calloc(smb2, 1, sizeof(struct split_data) +
+                         (num_segments - 1) * sizeof(struct split_segment));
+        if (sd == NULL) {
+                smb2_set_error(smb2, "Failed to allocate split_data");
+                return -ENOMEM;
+        }
+        sd->cb = cb;
+        sd->cb_data = cb_data;
+        sd->is_write = is_write;
+        sd->count = count;
+        if (is_write) {
+                sd->write_cb_data.fh = fh;
+                sd->write_cb_data.buf = iovcnt == 1 ? iov[0].iov_base : NULL;
+                sd->write_cb_data.count = count;
+                sd->write_cb_data.offset = offset;
+        } else {
+                sd->read_cb_data.fh = fh;
+                sd->read_cb_data.buf = iovcnt == 1 ? iov[0].iov_base : NULL;
+                sd->read_cb_data.count = count;
+                sd->read_cb_data.offset = offset;
+        }
+        sd->pending = 1;
+
+        if (hl) {
+                rc = smb2_split_hl_async(smb2, fh, sd, iov, iovcnt, offset,
+                                         seg_size);
+                if (rc < 0 && sd->num_segments == 0) {
+                        smb2_free(smb2, sd);
+                        return rc;
+                }
+                if (--sd->pending == 0) {
+                        split_done(smb2, sd);
+                }
+                return 0;
+        }
+
+        idx = 0;
+        off = 0;
+        for (i = 0; i < num_segments; i++) {
+                seg = &sd->segments[i];
+                seg->sd = sd;
+                seg->offset = i ? seg[-1].offset + seg[-1].count : 0;
+                num = split_gather(iov, iovcnt, &idx, &off,
+                                   count - seg->offset < seg_size ?
+                                   count - seg->offset : seg_size,
+                                   pieces, &seg->count);
+
+                if (is_write) {
+                        memset(&wreq, 0, sizeof(struct smb2_write_request));
+                        wreq.length = seg->count;
+                        wreq.offset = offset + seg->offset;
+                        memcpy(wreq.file_id, fh->file_id, SMB2_FD_SIZE);
+                        wreq.channel = SMB2_CHANNEL_NONE;
+                        pdu = smb2_cmd_writev_async(smb2, &wreq, pieces, num,
+                                                    split_cb, seg);
+                } else {
+                        memset(&rreq, 0, sizeof(struct smb2_read_request));
+                        rreq.length = seg->count;
+                        rreq.offset = offset + seg->offset;
+                        memcpy(rreq.file_id, fh->file_id, SMB2_FD_SIZE);
+                        rreq.channel = SMB2_CHANNEL_NONE;
+                        pdu = smb2_cmd_readv_async(smb2, &rreq, pieces, num,
+                                                   split_cb, seg);
+                }
+                if (pdu == NULL) {
+                        break;
+                }
+                sd->pending++;
+                smb2_queue_pdu(smb2, pdu);
+        }
+        if (i == 0) {
+                smb2_set_error(smb2, "Failed to create %s command",
+                               is_write ? "write" : "read");
+                smb2_free(smb2, sd);
+                return -ENOMEM;
+        }
+        /* If we ran out of memory the rest is reported as a short
+         * read or write.
+         */
+        sd->num_segments = i;
+
+        if (--sd->pending == 0) {
+                split_done(smb2, sd);
+        }
+        return 0;
+}
+
+static int
+smb2_split_async(struct smb2_context *smb2, struct smb2fh *fh, int is_write,
+                 uint8_t *buf, uint32_t count, uint64_t offset,
+                 smb2_command_cb cb, void *cb_data)
+{
+        struct iovec iov;
+
+        iov.iov_base = buf;
+        iov.iov_len = count;
+        return smb2_splitv_async(smb2, fh, is_write, &iov, 1, offset, 0,
+                                 cb, cb_data);
+}
+
+int
+smb2_pread_split_async(struct smb2_context *smb2, struct smb2fh *fh,
+                       uint8_t *buf, uint32_t count, uint64_t offset,
+                       smb2_command_cb cb, void *cb_data)
+{
+        if (smb2 == NULL) {
+                return -EINVAL;
+        }
+        if (fh == NULL) {
+                smb2_set_error(smb2, "File handle was NULL");
+                return -EINVAL;
+        }
+        return smb2_split_async(smb2, fh, 0, buf, count, offset,
+                                cb, cb_data);
+}
+
+int
+smb2_pwrite_split_async(struct smb2_context *smb2, struct smb2fh *fh,
+                        const uint8_t *buf, uint32_t count, uint64_t offset,
+                        smb2_command_cb cb, void *cb_data)
+{
+        if (smb2 == NULL) {
+                return -EINVAL;
+        }
+        if (fh == NULL) {
+                smb2_set_error(smb2, "File handle was NULL");
+                return -EINVAL;
+        }
+        if (fh->wb && count) {
+                /* the write is buffered, no need to split it */
+                return smb2_pwrite_async(smb2, fh, buf, count, offset,
+                                         cb, cb_data);
+        }
+        return smb2_split_async(smb2, fh, 1, discard_const(buf), count,
+                                offset, cb, cb_data);
+}
+
+static int
+smb2_vector_async(struct smb2_context *smb2, struct smb2fh *fh, int is_write,
+                  const struct iovec *iov, int iovcnt, uint64_t offset,
+                  smb2_command_cb cb, void *cb_data)
+{
+        if (smb2 == NULL) {
+                return -EINVAL;
+        }
+        if (fh == NULL) {
+                smb2_set_error(smb2, "File handle was NULL");
+                return -EINVAL;
+        }
+        if (iovcnt < 0 || (iovcnt && iov == NULL)) {
+                smb2_set_error(smb2, "Invalid I/O vector");
+                return -EINVAL;
+        }
+        return smb2_splitv_async(smb2, fh, is_write, iov, iovcnt, offset,
+                                 fh->ra || fh->wb, cb, cb_data);
+}
+
+int
+smb2_preadv_async(struct smb2_context *smb2, struct smb2fh *fh,
+                  const struct iovec *iov, int iovcnt, uint64_t offset,
+                  smb2_command_cb cb, void *cb_data)
+{
+        return smb2_vector_async(smb2, fh, 0, iov, iovcnt, offset,
+                                 cb, cb_data);
+}
+
+int
+smb2_pwritev_async(struct smb2_context *smb2, struct smb2fh *fh,
+                   const struct iovec *iov, int iovcnt, uint64_t offset,
+                   smb2_command_cb cb, void *cb_data)
+{
+        return smb2_vector_async(smb2, fh, 1, iov, iovcnt, offset,
+                                 cb, cb_data);
+}
+
+/*
+ * Server side copy with FSCTL_SRV_COPYCHUNK_WRITE, 3.2.4.20.2 of
+ * [MS-SMB2]. Each IOCTL copies up to COPY_MAX_BATCH bytes in chunks of
+ * COPY_MAX_CHUNK_SIZE, the limits of Windows and Samba, and a few of them
+ * are kept in flight. A server with lower limits fails the IOCTL with
+ * STATUS_INVALID_PARAMETER, it is then sent again in smaller batches and
+ * the context remembers the smaller size for later copies.
+ */
+#define COPY_MAX_CHUNK_SIZE (1024 * 1024)
+#define COPY_MAX_BATCH (16 * 1024 * 1024)
+#define COPY_MIN_BATCH (64 * 1024)
+#define COPY_MAX_IN_FLIGHT 4
+
+enum copy_stage {
+        COPY_FLUSH_SRC,
+        COPY_FLUSH_DST,
+        COPY_RESUME_KEY,
+        COPY_CHUNKS,
+};
+
+struct copy_range_data {
+        smb2_command_cb cb;
+        void *cb_data;
+        enum copy_stage stage;
+        uint8_t resume_key[SMB2_RESUME_KEY_SIZE];
+        uint32_t chunk_size;
+        uint32_t max_batch;
+        /* bytes that have been sent */
+        uint64_t next;
+        /* where the copy ends, lowered when a batch fails or is short */
+        uint64_t end;
+        int status;
+        int in_flight;
+
+        struct smb2_copy_range_cb_data copy_cb_data;
+};
+
+struct copy_batch {
+        struct copy_range_data *crd;
+        uint64_t offset;
+        uint32_t length;
+        uint8_t input[1];
+};
+
+static int copy_range_next(struct smb2_context *smb2,
+                           struct copy_range_data *crd);
+
+static void
+copy_range_done(struct smb2_context *smb2, struct copy_range_data *crd)
+{
+        struct smb2fh *dst = crd->copy_cb_data.dst;
+
+        if (dst->ra) {
+                smb2_ra_invalidate(smb2, dst->ra);
+        }
+        crd->copy_cb_data.count = crd->end;
+        crd->cb(smb2, crd->end ? 0 : crd->status, &crd->copy_cb_data,
+                crd->cb_data);
+        smb2_free(smb2, crd);
+}
+
+/* Ends the copy at offset, unless it already ends earlier */
+static void
+copy_range_stop(struct copy_range_data *crd, uint64_t offset, int status)
+{
+        if (offset < crd->end) {
+                crd->end = offset;
+                crd->status = status;
+        }
+}
+
+static void copy_batch_cb(struct smb2_context *smb2, int status,
+                          void *command_data, void *private_data);
+
+/*
+ * Sends one COPYCHUNK_WRITE for up to count bytes at offset.
+ * Returns the number of bytes it covers or -errno.
+ */
+static int64_t
+copy_send_batch(struct smb2_context *smb2, struct copy_range_data *crd,
+                uint64_t offset, uint64_t count)
+{
+        struct smb2_ioctl_request req;
+        struct copy_batch *batch;
+        struct smb2_iovec vec;
+        struct smb2_pdu *pdu;
+        uint32_t length, len, num_chunks, i;
+
+        length = count < crd->max_batch ? (uint32_t)count : crd->max_batch;
+        num_chunks = (length - 1) / crd->chunk_size + 1;
+
+        batch = smb2_calloc(smb2, 1, offsetof(struct copy_batch, input) +
+                            SMB2_SRV_COPYCHUNK_COPY_SIZE +
+                            num_chunks * SMB2_SRV_COPYCHUNK_SIZE);
+        if (batch == NULL) {
+                smb2_set_error(smb2, "Failed to allocate copychunk batch");
+                return -ENOMEM;
+        }
+        batch->crd = crd;
+        batch->offset = offset;
+        batch->length = length;
+
+        vec.buf = batch->input;
+        vec.len = SMB2_SRV_COPYCHUNK_COPY_SIZE +
+                num_chunks * SMB2_SRV_COPYCHUNK_SIZE;
+        memcpy(vec.buf, crd->resume_key, SMB2_RESUME_KEY_SIZE);
+        smb2_set_uint32(&vec, 24, num_chunks);
+        for (i = 0; i < num_chunks; i++) {
+                len = length - i * crd->chunk_size;
+                if (len > crd->chunk_size) {
+                        len = crd->chunk_size;
+                }
+                smb2_set_uint64(&vec, SMB2_SRV_COPYCHUNK_COPY_SIZE +
+                                i * SMB2_SRV_COPYCHUNK_SIZE,
+                                crd->copy_cb_data.src_offset + offset +
+                                (uint64_t)i * crd->chunk_size);
+                smb2_set_uint64(&vec, SMB2_SRV_COPYCHUNK_COPY_SIZE +
+                                i * SMB2_SRV_COPYCHUNK_SIZE + 8,
+                                crd->copy_cb_data.dst_offset + offset +
+                                (uint64_t)i * crd->chunk_size);
+                smb2_set_uint32(&vec, SMB2_SRV_COPYCHUNK_COPY_SIZE +
+                                i * SMB2_SRV_COPYCHUNK_SIZE + 16, len);
+        }
+
+        memset(&req, 0, sizeof(struct smb2_ioctl_request));
+        req.ctl_code = SMB2_FSCTL_SRV_COPYCHUNK_WRITE;
+        memcpy(req.file_id, crd->copy_cb_data.dst->file_id, SMB2_FD_SIZE);
+        req.input_count = (uint32_t)vec.len;
+        req.input = batch->input;
+        req.flags = SMB2_0_IOCTL_IS_FSCTL;
+
+        pdu = smb2_cmd_ioctl_async(smb2, &req, copy_batch_cb, batch);
+        if (pdu == NULL) {
+                smb2_set_error(smb2, "Failed to create ioctl command");
+                smb2_free(smb2, batch);
+                return -ENOMEM;
+        }
+        smb2_queue_pdu(smb2, pdu);
+        crd->in_flight++;
+
+        return length;
+}
+
+/* Sends batches until COPY_MAX_IN_FLIGHT are in flight */
+static void
+copy_send(struct smb2_context *smb2, struct copy_range_data *crd)
+{
+        int64_t n;
+
+        while (crd->in_flight < COPY_MAX_IN_FLIGHT && crd->next < crd->end) {
+                n = copy_send_batch(smb2, crd, crd->next,
+                                    crd->end - crd->next);
+                if (n < 0) {
+                        copy_range_stop(crd, crd->next, (int)n);
+                        break;
+                }
+                crd->next += n;
+        }
+}
+
+static void
+copy_batch_cb(struct smb2_context *smb2, int status,
+              void *command_data, void *private_data)
+{
+        struct copy_batch *batch = private_data;
+        struct copy_range_data *crd = batch->crd;
+        struct smb2_ioctl_reply *rep = command_data;
+        struct smb2_iovec vec;
+        uint32_t total;
+        uint64_t offset;
+        int64_t n;
+
+        crd->in_flight--;
+        if (status == SMB2_STATUS_SUCCESS) {
+                total = 0;
+                if (rep->output_count >= SMB2_SRV_COPYCHUNK_RESPONSE_SIZE) {
+                        vec.buf = rep->output;
+                        vec.len = rep->output_count;
+                        smb2_get_uint32(&vec, 8, &total);
+                }
+                smb2_free_data(smb2, rep->output);
+                if (total < batch->length) {
+                        copy_range_stop(crd, batch->offset + total, 0);
+                }
+        } else if (status == SMB2_STATUS_INVALID_PARAMETER &&
+                   batch->length > COPY_MIN_BATCH) {
+                /* beyond the limits of the server, send it again in
+                 * smaller batches
+                 */
+                if (crd->max_batch >= batch->length) {
+                        crd->max_batch = batch->length / 2;
+                        if (crd->chunk_size > crd->max_batch) {
+                                crd->chunk_size = crd->max_batch;
+                        }
+                        smb2->copy_max_batch = crd->max_batch;
+                }
+                offset = batch->offset;
+                while (offset < batch->offset + batch->length &&
+                       offset < crd->end) {
+                        n = copy_send_batch(smb2, crd, offset,
+                                            batch->offset + batch->length -
+                                            offset);
+                        if (n < 0) {
+                                copy_range_stop(crd, offset, (int)n);
+                                break;
+                        }
+                        offset += n;
+                }
+        } else {
+                smb2_set_nterror(smb2, status, "Copychunk failed with "
+                                 "(0x%08x) %s", status,
+                                 nterror_to_str(status));
+                copy_range_stop(crd, batch->offset,
+                                -nterror_to_errno(status));
+        }
+        smb2_free(smb2, batch);
+
+        copy_send(smb2, crd);
+        if (crd->in_flight == 0) {
+                copy_range_done(smb2, crd);
+        }
+}
+
+static void
+copy_resume_key_cb(struct smb2_context *smb2, int status,
+                   void *command_data, void *private_data)
+{
+        struct copy_range_data *crd = private_data;
+        struct smb2_ioctl_reply *rep = command_data;
+
+        if (status != SMB2_STATUS_SUCCESS) {
+                smb2_set_nterror(smb2, status, "Request resume key failed "
+                                 "with (0x%08x) %s", status,
+                                 nterror_to_str(status));
+                crd->end = 0;
+                crd->status = -nterror_to_errno(status);
+                copy_range_done(smb2, crd);
+                return;
+        }
+        if (rep->output_count < SMB2_RESUME_KEY_SIZE) {
+                smb2_free_data(smb2, rep->output);
+                smb2_set_error(smb2, "Resume key reply too short");
+                crd->end = 0;
+                crd->status = -EINVAL;
+                copy_range_done(smb2, crd);
+                return;
+        }
+        memcpy(crd->resume_key, rep->output, SMB2_RESUME_KEY_SIZE);
+        smb2_free_data(smb2, rep->output);
+
+        crd->stage = COPY_CHUNKS;
+        copy_send(smb2, crd);
+        if (crd->in_flight == 0) {
+                copy_range_done(smb2, crd);
+        }
+}
+
+static void
+copy_flush_cb(struct smb2_context *smb2, int status,
+              void *command_data, void *private_data)
+{
+        struct copy_range_data *crd = private_data;
+
+        if (status == 0) {
+                crd->stage++;
+                status = copy_range_next(smb2, crd);
+        }
+        if (status < 0) {
+                crd->end = 0;
+                crd->status = status;
+                copy_range_done(smb2, crd);
+        }
+}
+
+/*
+ * Writes that are buffered by write-behind must reach the server before
+ * it copies, then the source is asked for its resume key.
+ */
+static int
+copy_range_next(struct smb2_context *smb2, struct copy_range_data *crd)
+{
+        struct smb2fh *src = crd->copy_cb_data.src;
+        struct smb2fh *dst = crd->copy_cb_data.dst;
+        struct smb2_ioctl_request req;
+        struct smb2_pdu *pdu;
+
+        if (crd->stage == COPY_FLUSH_SRC) {
+                if (src->wb) {
+                        return smb2_fsync_async(smb2, src, copy_flush_cb,
+                                                crd);
+                }
+                crd->stage++;
+        }
+        if (crd->stage == COPY_FLUSH_DST) {
+                if (dst->wb && dst != src) {
+                        return smb2_fsync_async(smb2, dst, copy_flush_cb,
+                                                crd);
+                }
+                crd->stage++;
+        }
+
+        memset(&req, 0, sizeof(struct smb2_ioctl_request));
+        req.ctl_code = SMB2_FSCTL_SRV_REQUEST_RESUME_KEY;
+        memcpy(req.file_id, src->file_id, SMB2_FD_SIZE);
+        req.flags = SMB2_0_IOCTL_IS_FSCTL;
+
+        pdu = smb2_cmd_ioctl_async(smb2, &req, copy_resume_key_cb, crd);
+        if (pdu == NULL) {
+                smb2_set_error(smb2, "Failed to create ioctl command");
+                return -ENOMEM;
+        }
+        smb2_queue_pdu(smb2, pdu);
+
+        return 0;
+}
+
+int
+smb2_copy_range_async(struct smb2_context *smb2,
+                      struct smb2fh *src, uint64_t src_offset,
+                      struct smb2fh *dst, uint64_t dst_offset,
+                      uint64_t count, smb2_command_cb cb, void *cb_data)
+{
+        struct copy_range_data *crd;
+        int rc;
+
+        if (smb2 == NULL) {
+                return -EINVAL;
+        }
+        if (src == NULL || dst == NULL) {
+                smb2_set_error(smb2, "File handle was NULL");
+                return -EINVAL;
+        }
+
+        crd = smb2_calloc(smb2, 1, sizeof(struct copy_range_data));
+        if (crd == NULL) {
+                smb2_set_error(smb2, "Failed to allocate copy_range_data");
+                return -ENOMEM;
+        }
+        crd->cb = cb;
+        crd->cb_data = cb_data;
+        crd->max_batch = COPY_MAX_BATCH;
+        if (smb2->copy_max_batch) {
+                crd->max_batch = smb2->copy_max_batch;
+        }
+        crd->chunk_size = COPY_MAX_CHUNK_SIZE;
+        if (crd->chunk_size > crd->max_batch) {
+                crd->chunk_size = crd->max_batch;
+        }
+        crd->end = count;
+        crd->copy_cb_data.src = src;
+        crd->copy_cb_data.src_offset = src_offset;
+        crd->copy_cb_data.dst = dst;
+        crd->copy_cb_data.dst_offset = dst_offset;
+
+        if (dst->ra) {
+                smb2_ra_invalidate(smb2, dst->ra);
+        }
+        rc = copy_range_next(smb2, crd);
+        if (rc < 0) {
+                smb2_free(smb2, crd);
+                return rc;
+        }
+        return 0;
+}
+
 int64_t
 smb2_lseek(struct smb2_context *smb2, struct smb2fh *fh,
            int64_t offset, int whence, uint64_t *current_offset)
@@ -1736,7 +2584,7 @@ create_cb_2(struct smb2_context *smb2, int status,
         }
 
         create_data->cb(smb2, status, NULL, create_data->cb_data);
-        free(create_data);
+        smb2_free(smb2, create_data);
 }
 
 static void
@@ -1763,7 +2611,7 @@ smb2_unlink_internal(struct smb2_context *smb2, const char *path,
                 return -EINVAL;
         }
 
-        create_data = calloc(1, sizeof(struct create_cb_data));
+        create_data = smb2_calloc(smb2, 1, sizeof(struct create_cb_data));
         if (create_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate create_data");
                 return -ENOMEM;
@@ -1802,7 +2650,7 @@ smb2_unlink_internal(struct smb2_context *smb2, const char *path,
         if (next_pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create close command");
                 smb2_free_pdu(smb2, pdu);
-                free(create_data);
+                smb2_free(smb2, create_data);
                 return -ENOMEM;
         }
         smb2_add_compound_pdu(smb2, pdu, next_pdu);
@@ -1839,7 +2687,7 @@ smb2_mkdir_async(struct smb2_context *smb2, const char *path,
                 return -EINVAL;
         }
 
-        create_data = calloc(1, sizeof(struct create_cb_data));
+        create_data = smb2_calloc(smb2, 1, sizeof(struct create_cb_data));
         if (create_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate create_data");
                 return -ENOMEM;
@@ -1872,7 +2720,7 @@ smb2_mkdir_async(struct smb2_context *smb2, const char *path,
         if (next_pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create close command");
                 smb2_free_pdu(smb2, pdu);
-                free(create_data);
+                smb2_free(smb2, create_data);
                 return -ENOMEM;
         }
         smb2_add_compound_pdu(smb2, pdu, next_pdu);
@@ -1904,7 +2752,7 @@ fstat_cb_1(struct smb2_context *smb2, int status,
         if (status != SMB2_STATUS_SUCCESS) {
                 stat_data->cb(smb2, -nterror_to_errno(status),
                        NULL, stat_data->cb_data);
-                free(stat_data);
+                smb2_free(smb2, stat_data);
                 return;
         }
 
@@ -1934,7 +2782,7 @@ fstat_cb_1(struct smb2_context *smb2, int status,
         smb2_free_data(smb2, fs);
 
         stat_data->cb(smb2, 0, st, stat_data->cb_data);
-        free(stat_data);
+        smb2_free(smb2, stat_data);
 }
 
 int
@@ -1954,7 +2802,7 @@ smb2_fstat_async(struct smb2_context *smb2, struct smb2fh *fh,
                 return -EINVAL;
         }
 
-        stat_data = calloc(1, sizeof(struct stat_cb_data));
+        stat_data = smb2_calloc(smb2, 1, sizeof(struct stat_cb_data));
         if (stat_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate stat_data");
                 return -ENOMEM;
@@ -1975,7 +2823,7 @@ smb2_fstat_async(struct smb2_context *smb2, struct smb2fh *fh,
         pdu = smb2_cmd_query_info_async(smb2, &req, fstat_cb_1, stat_data);
         if (pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create query command");
-                free(stat_data);
+                smb2_free(smb2, stat_data);
                 return -ENOMEM;
         }
         smb2_queue_pdu(smb2, pdu);
@@ -1995,7 +2843,7 @@ getinfo_cb_3(struct smb2_context *smb2, int status,
 
         stat_data->cb(smb2, -nterror_to_errno(stat_data->status),
                       stat_data->st, stat_data->cb_data);
-        free(stat_data);
+        smb2_free(smb2, stat_data);
 }
 
 static void
@@ -2082,7 +2930,7 @@ smb2_getinfo_async(struct smb2_context *smb2, const char *path,
                 return -EINVAL;
         }
 
-        stat_data = calloc(1, sizeof(struct stat_cb_data));
+        stat_data = smb2_calloc(smb2, 1, sizeof(struct stat_cb_data));
         if (stat_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate create_data");
                 return -1;
@@ -2108,7 +2956,7 @@ smb2_getinfo_async(struct smb2_context *smb2, const char *path,
         pdu = smb2_cmd_create_async(smb2, &cr_req, getinfo_cb_1, stat_data);
         if (pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create create command");
-                free(stat_data);
+                smb2_free(smb2, stat_data);
                 return -1;
         }
 
@@ -2125,7 +2973,7 @@ smb2_getinfo_async(struct smb2_context *smb2, const char *path,
                                              getinfo_cb_2, stat_data);
         if (next_pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create query command");
-                free(stat_data);
+                smb2_free(smb2, stat_data);
                 smb2_free_pdu(smb2, pdu);
                 return -1;
         }
@@ -2139,7 +2987,7 @@ smb2_getinfo_async(struct smb2_context *smb2, const char *path,
         next_pdu = smb2_cmd_close_async(smb2, &cl_req, getinfo_cb_3, stat_data);
         if (next_pdu == NULL) {
                 stat_data->cb(smb2, -ENOMEM, NULL, stat_data->cb_data);
-                free(stat_data);
+                smb2_free(smb2, stat_data);
                 smb2_free_pdu(smb2, pdu);
                 return -1;
         }
@@ -2192,7 +3040,7 @@ trunc_cb_3(struct smb2_context *smb2, int status,
 
         trunc_data->cb(smb2, -nterror_to_errno(trunc_data->status),
                        NULL, trunc_data->cb_data);
-        free(trunc_data);
+        smb2_free(smb2, trunc_data);
 }
 
 static void
@@ -2232,7 +3080,7 @@ smb2_truncate_async(struct smb2_context *smb2, const char *path,
                 return -EINVAL;
         }
 
-        trunc_data = calloc(1, sizeof(struct trunc_cb_data));
+        trunc_data = smb2_calloc(smb2, 1, sizeof(struct trunc_cb_data));
         if (trunc_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate trunc_data");
                 return -ENOMEM;
@@ -2256,7 +3104,7 @@ smb2_truncate_async(struct smb2_context *smb2, const char *path,
         pdu = smb2_cmd_create_async(smb2, &cr_req, trunc_cb_1, trunc_data);
         if (pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create create command");
-                free(trunc_data);
+                smb2_free(smb2, trunc_data);
                 return -EINVAL;
         }
 
@@ -2275,7 +3123,7 @@ smb2_truncate_async(struct smb2_context *smb2, const char *path,
         if (next_pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create set command. %s",
                                smb2_get_error(smb2));
-                free(trunc_data);
+                smb2_free(smb2, trunc_data);
                 smb2_free_pdu(smb2, pdu);
                 return -EINVAL;
         }
@@ -2289,7 +3137,7 @@ smb2_truncate_async(struct smb2_context *smb2, const char *path,
         next_pdu = smb2_cmd_close_async(smb2, &cl_req, trunc_cb_3, trunc_data);
         if (next_pdu == NULL) {
                 trunc_data->cb(smb2, -ENOMEM, NULL, trunc_data->cb_data);
-                free(trunc_data);
+                smb2_free(smb2, trunc_data);
                 smb2_free_pdu(smb2, pdu);
                 return -EINVAL;
         }
@@ -2307,10 +3155,11 @@ struct rename_cb_data {
         uint32_t status;
 };
 
-static void free_rename_data(struct rename_cb_data *rename_data)
+static void free_rename_data(struct smb2_context *smb2,
+                             struct rename_cb_data *rename_data)
 {
-        free(rename_data->newpath);
-        free(rename_data);
+        smb2_free(smb2, rename_data->newpath);
+        smb2_free(smb2, rename_data);
 }
 
 static void
@@ -2325,7 +3174,7 @@ rename_cb_3(struct smb2_context *smb2, int status,
 
         rename_data->cb(smb2, -nterror_to_errno(rename_data->status),
                         NULL, rename_data->cb_data);
-        free_rename_data(rename_data);
+        free_rename_data(smb2, rename_data);
 }
 
 static void
@@ -2366,7 +3215,7 @@ smb2_rename_async(struct smb2_context *smb2, const char *oldpath,
                 return -EINVAL;
         }
 
-        rename_data = calloc(1, sizeof(struct rename_cb_data));
+        rename_data = smb2_calloc(smb2, 1, sizeof(struct rename_cb_data));
         if (rename_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate rename_data");
                 return -ENOMEM;
@@ -2374,9 +3223,9 @@ smb2_rename_async(struct smb2_context *smb2, const char *oldpath,
 
         rename_data->cb = cb;
         rename_data->cb_data = cb_data;
-        rename_data->newpath = (uint8_t *)strdup(newpath);
+        rename_data->newpath = (uint8_t *)smb2_strdup(smb2, newpath);
         if (rename_data->newpath == NULL) {
-                free_rename_data(rename_data);
+                free_rename_data(smb2, rename_data);
                 smb2_set_error(smb2, "Failed to allocate rename_data->newpath");
                 return -ENOMEM;
         }
@@ -2400,7 +3249,7 @@ smb2_rename_async(struct smb2_context *smb2, const char *oldpath,
         pdu = smb2_cmd_create_async(smb2, &cr_req, rename_cb_1, rename_data);
         if (pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create create command");
-                free_rename_data(rename_data);
+                free_rename_data(smb2, rename_data);
                 return -EINVAL;
         }
 
@@ -2420,7 +3269,7 @@ smb2_rename_async(struct smb2_context *smb2, const char *oldpath,
         if (next_pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create set command. %s",
                                smb2_get_error(smb2));
-                free_rename_data(rename_data);
+                free_rename_data(smb2, rename_data);
                 smb2_free_pdu(smb2, pdu);
                 return -EINVAL;
         }
@@ -2434,7 +3283,7 @@ smb2_rename_async(struct smb2_context *smb2, const char *oldpath,
         next_pdu = smb2_cmd_close_async(smb2, &cl_req, rename_cb_3, rename_data);
         if (next_pdu == NULL) {
                 rename_data->cb(smb2, -ENOMEM, NULL, rename_data->cb_data);
-                free_rename_data(rename_data);
+                free_rename_data(smb2, rename_data);
                 smb2_free_pdu(smb2, pdu);
                 return -EINVAL;
         }
@@ -2453,7 +3302,7 @@ ftrunc_cb_1(struct smb2_context *smb2, int status,
 
         cb_data->cb(smb2, -nterror_to_errno(status),
                     NULL, cb_data->cb_data);
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 }
 
 int
@@ -2472,8 +3321,17 @@ smb2_ftruncate_async(struct smb2_context *smb2, struct smb2fh *fh,
                 smb2_set_error(smb2, "File handle was NULL");
                 return -EINVAL;
         }
+        if (fh->wb) {
+                int rc = smb2_wb_ftruncate(smb2, fh, length, cb, cb_data);
+                if (rc <= 0) {
+                        return rc;
+                }
+        }
+        if (fh->ra) {
+                smb2_ra_invalidate(smb2, fh->ra);
+        }
 
-        create_data = calloc(1, sizeof(struct create_cb_data));
+        create_data = smb2_calloc(smb2, 1, sizeof(struct create_cb_data));
         if (create_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate create_data");
                 return -ENOMEM;
@@ -2526,7 +3384,7 @@ readlink_cb_3(struct smb2_context *smb2, int status,
         cb_data->cb(smb2, -nterror_to_errno(cb_data->status),
                     target, cb_data->cb_data);
         smb2_free_data(smb2, rp);
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 }
 
 static void
@@ -2573,7 +3431,7 @@ smb2_readlink_async(struct smb2_context *smb2, const char *path,
                 return -EINVAL;
         }
 
-        readlink_data = calloc(1, sizeof(struct readlink_cb_data));
+        readlink_data = smb2_calloc(smb2, 1, sizeof(struct readlink_cb_data));
         if (readlink_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate readlink_data");
                 return -ENOMEM;
@@ -2597,7 +3455,7 @@ smb2_readlink_async(struct smb2_context *smb2, const char *path,
         pdu = smb2_cmd_create_async(smb2, &cr_req, readlink_cb_1, readlink_data);
         if (pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create create command");
-                free(readlink_data);
+                smb2_free(smb2, readlink_data);
                 return -EINVAL;
         }
 
@@ -2612,7 +3470,7 @@ smb2_readlink_async(struct smb2_context *smb2, const char *path,
         next_pdu = smb2_cmd_ioctl_async(smb2, &io_req, readlink_cb_2,
                                         readlink_data);
         if (next_pdu == NULL) {
-                free(readlink_data);
+                smb2_free(smb2, readlink_data);
                 smb2_free_pdu(smb2, pdu);
                 return -EINVAL;
         }
@@ -2626,7 +3484,7 @@ smb2_readlink_async(struct smb2_context *smb2, const char *path,
         next_pdu = smb2_cmd_close_async(smb2, &cl_req, readlink_cb_3,
                                         readlink_data);
         if (next_pdu == NULL) {
-                free(readlink_data);
+                smb2_free(smb2, readlink_data);
                 smb2_free_pdu(smb2, pdu);
                 return -EINVAL;
         }
@@ -2649,12 +3507,8 @@ disconnect_cb_2(struct smb2_context *smb2, int status,
         struct disconnect_data *dc_data = private_data;
 
         dc_data->cb(smb2, 0, NULL, dc_data->cb_data);
-        free(dc_data);
-        if (smb2->change_fd) {
-                smb2->change_fd(smb2, smb2->fd, SMB2_DEL_FD);
-        }
-        close(smb2->fd);
-        smb2->fd = SMB2_INVALID_SOCKET;
+        smb2_free(smb2, dc_data);
+        smb2_close_socket(smb2);
 }
 
 static void
@@ -2667,13 +3521,13 @@ disconnect_cb_1(struct smb2_context *smb2, int status,
         if (status != SMB2_STATUS_SUCCESS) {
                 smb2_set_nterror(smb2, status, "%s", nterror_to_str(status));
                 dc_data->cb(smb2, -ENOMEM, NULL, dc_data->cb_data);
-                free(dc_data);
+                smb2_free(smb2, dc_data);
                 return;
         }
         pdu = smb2_cmd_logoff_async(smb2, disconnect_cb_2, dc_data);
         if (pdu == NULL) {
                 dc_data->cb(smb2, -ENOMEM, NULL, dc_data->cb_data);
-                free(dc_data);
+                smb2_free(smb2, dc_data);
                 return;
         }
         smb2_queue_pdu(smb2, pdu);
@@ -2695,7 +3549,7 @@ smb2_disconnect_share_async(struct smb2_context *smb2,
                 return -EINVAL;
         }
 
-        dc_data = calloc(1, sizeof(struct disconnect_data));
+        dc_data = smb2_calloc(smb2, 1, sizeof(struct disconnect_data));
         if (dc_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate disconnect_data");
                 return -ENOMEM;
@@ -2706,7 +3560,7 @@ smb2_disconnect_share_async(struct smb2_context *smb2,
 
         pdu = smb2_cmd_tree_disconnect_async(smb2, disconnect_cb_1, dc_data);
         if (pdu == NULL) {
-                free(dc_data);
+                smb2_free(smb2, dc_data);
                 return -ENOMEM;
         }
         smb2_queue_pdu(smb2, pdu);
@@ -2727,7 +3581,7 @@ echo_cb(struct smb2_context *smb2, int status,
 
         cb_data->cb(smb2, -nterror_to_errno(status),
                     NULL, cb_data->cb_data);
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 }
 
 int
@@ -2741,7 +3595,7 @@ smb2_echo_async(struct smb2_context *smb2,
                 return -EINVAL;
         }
 
-        echo_data = calloc(1, sizeof(struct echo_data));
+        echo_data = smb2_calloc(smb2, 1, sizeof(struct echo_data));
         if (echo_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate echo_data");
                 return -ENOMEM;
@@ -2752,7 +3606,7 @@ smb2_echo_async(struct smb2_context *smb2,
 
         pdu = smb2_cmd_echo_async(smb2, echo_cb, echo_data);
         if (pdu == NULL) {
-                free(echo_data);
+                smb2_free(smb2, echo_data);
                 return -ENOMEM;
         }
         smb2_queue_pdu(smb2, pdu);
@@ -2783,7 +3637,7 @@ smb2_fh_from_file_id(struct smb2_context *smb2, smb2_file_id *fileid)
 {
         struct smb2fh *fh;
 
-        fh = calloc(1, sizeof(struct smb2fh));
+        fh = smb2_calloc(smb2, 1, sizeof(struct smb2fh));
         if (fh == NULL) {
                 return NULL;
         }
@@ -2813,6 +3667,10 @@ smb2_oplock_break_notify(struct smb2_context *smb2, int status, void *command_da
 
         rep= command_data;
 
+        if (status == 0) {
+                smb2_ra_break(smb2, rep);
+                smb2_wb_break(smb2, rep);
+        }
 
         if (smb2->oplock_or_lease_break_cb) {
                 smb2->oplock_or_lease_break_cb(smb2,
@@ -2866,12 +3724,12 @@ smb2_decode_filenotifychangeinformation(
         }
         smb2_get_uint32(vec, next_entry_offset+4, &fnc->action);
         smb2_get_uint32(vec, next_entry_offset+8, &name_len);
-        fnc->name = smb2_utf16_to_utf8((uint16_t *)(void *)&vec->buf[next_entry_offset+12], name_len / 2);
+        fnc->name = smb2_ctx_utf16_to_utf8(smb2, (uint16_t *)(void *)&vec->buf[next_entry_offset+12], name_len / 2);
 
         smb2_get_uint32(vec, next_entry_offset, &tmp);
         next_entry_offset += tmp;
         if (tmp != 0) {
-                struct smb2_file_notify_change_information *next_fnc = calloc(1, sizeof(struct smb2_file_notify_change_information));
+                struct smb2_file_notify_change_information *next_fnc = smb2_calloc(smb2, 1, sizeof(struct smb2_file_notify_change_information));
                 fnc->next = next_fnc;
                 smb2_decode_filenotifychangeinformation(smb2, next_fnc, vec, next_entry_offset);
         }
@@ -2884,8 +3742,8 @@ free_smb2_file_notify_change_information(struct smb2_context *smb2, struct smb2_
         if (fnc->next) {
                 free_smb2_file_notify_change_information(smb2, fnc->next);
         }
-        free(discard_const(fnc->name));
-        free(fnc);
+        smb2_free(smb2, discard_const(fnc->name));
+        smb2_free(smb2, fnc);
 }
 
 struct notify_change_cb_data {
@@ -2910,7 +3768,7 @@ notify_change_cb(struct smb2_context *smb2, int status,
 
         struct smb2_change_notify_reply *rep = command_data;
         struct smb2_iovec vec;
-        struct smb2_file_notify_change_information *fnc = calloc(1, sizeof(struct smb2_file_notify_change_information));
+        struct smb2_file_notify_change_information *fnc = smb2_calloc(smb2, 1, sizeof(struct smb2_file_notify_change_information));
 
         if (status) {
                 smb2_set_error(smb2, "notify_change_cb failed (%s) %s\n",
@@ -2938,7 +3796,7 @@ notify_change_cb(struct smb2_context *smb2, int status,
         } else {
                 smb2_close(smb2, notify_change_data->fh);
         }
-        free(notify_change_data);
+        smb2_free(smb2, notify_change_data);
 }
 
 int smb2_notify_change_filehandle_async(struct smb2_context *smb2, struct smb2fh *smb2_dir_fh, uint16_t flags, uint32_t filter, int loop,
@@ -2948,7 +3806,7 @@ int smb2_notify_change_filehandle_async(struct smb2_context *smb2, struct smb2fh
         struct smb2_change_notify_request ch_req;
         struct smb2_pdu *pdu;
 
-        notify_change_cb_data = calloc(1, sizeof(struct notify_change_cb_data));
+        notify_change_cb_data = smb2_calloc(smb2, 1, sizeof(struct notify_change_cb_data));
         if (notify_change_cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate notify_change_data");
                 return -1;
@@ -2974,7 +3832,7 @@ int smb2_notify_change_filehandle_async(struct smb2_context *smb2, struct smb2fh
                                              notify_change_cb, notify_change_cb_data);
         if (pdu == NULL) {
                 smb2_set_error(smb2, "Failed to create change_notify command\n");
-                free(notify_change_cb_data);
+                smb2_free(smb2, notify_change_cb_data);
                 return -1;
         }
         smb2_queue_pdu(smb2, pdu);
@@ -3315,6 +4173,11 @@ smb2_ioctl_request_cb(struct smb2_server *server, struct smb2_context *smb2, voi
                 if (server->handlers && server->handlers->ioctl_cmd) {
                         ret = server->handlers->ioctl_cmd(server, smb2, req, &rep);
                 }
+                if ((req->ctl_code == SMB2_FSCTL_SRV_COPYCHUNK ||
+                     req->ctl_code == SMB2_FSCTL_SRV_COPYCHUNK_WRITE) &&
+                    !smb2->passthrough && req->input) {
+                        smb2_free_data(smb2, req->input);
+                }
                 if (!ret) {
                         pdu = smb2_cmd_ioctl_reply_async(smb2, &rep, NULL, cb_data);
                 }
@@ -3670,7 +4533,7 @@ smb2_session_setup_request_cb(struct smb2_context *smb2, int status, void *comma
                         if (c_data->auth_data) {
                                 ntlmssp_destroy_context(c_data->auth_data);
                         }
-                        c_data->auth_data = ntlmssp_init_context(
+                        c_data->auth_data = ntlmssp_init_context(smb2,
                                         "",
                                         "",
                                         "",
@@ -3781,11 +4644,19 @@ smb2_session_setup_request_cb(struct smb2_context *smb2, int status, void *comma
                 return;
         }
 
-        if (smb2->sign)  {
+        /* The encryption keys are needed as well if the client decides
+         * to seal the session.
+         */
+        if (smb2->sign ||
+            (!more_processing_needed && smb2->session_key &&
+             smb2->dialect >= SMB2_VERSION_0300)) {
                 /* Derive the signing key from session key
                 * This is based on negotiated protocol
                 */
-                smb2_create_signing_key(smb2);
+                if (smb2_create_signing_key(smb2) < 0) {
+                        smb2_close_context(smb2);
+                        return;
+                }
         }
 
         if (server->allow_anonymous &&
@@ -3828,7 +4699,6 @@ smb2_session_setup_request_cb(struct smb2_context *smb2, int status, void *comma
 
         smb2_set_pdu_message_id(smb2, pdu, smb2->message_id);
         smb2_queue_pdu(smb2, pdu);
-        smb3_update_preauth_hash(smb2, pdu->out.niov, &pdu->out.iov[0]);
 }
 
 static void
@@ -3966,6 +4836,13 @@ smb2_negotiate_request_cb(struct smb2_context *smb2, int status, void *command_d
                         }
                 }
 
+                /* for 3.1.1 the cipher was selected when parsing the
+                 * encryption negotiate context.
+                 */
+                if (smb2->dialect < SMB2_VERSION_0311) {
+                        smb2->cypher = SMB2_ENCRYPTION_AES_128_CCM;
+                }
+
                 if (req->security_mode & SMB2_NEGOTIATE_SIGNING_REQUIRED) {
                         will_sign = 1;
                 }
@@ -4025,7 +4902,7 @@ smb2_negotiate_request_cb(struct smb2_context *smb2, int status, void *command_d
 
         pdu = smb2_cmd_negotiate_reply_async(smb2, &rep, NULL, cb_data);
         if (rep.security_buffer) {
-                free(rep.security_buffer);
+                smb2_free(smb2, rep.security_buffer);
         }
         if (pdu == NULL) {
                 return;
@@ -4033,7 +4910,6 @@ smb2_negotiate_request_cb(struct smb2_context *smb2, int status, void *command_d
 
         smb2_set_pdu_message_id(smb2, pdu, smb2->message_id);
         smb2_queue_pdu(smb2, pdu);
-        smb3_update_preauth_hash(smb2, pdu->out.niov, &pdu->out.iov[0]);
 
         if (req) {
                 /* alloc a pdu for session request */
@@ -4088,7 +4964,14 @@ int smb2_serve_port_async(const int fd, const int to_msecs, struct smb2_context
         return err;
 }
 
-int smb2_serve_port(struct smb2_server *server, const int max_connections, smb2_client_connection cb, void *cb_data)
+/*
+ * Serves the connections of the memory transport mt if it is set, or
+ * those to server->port.
+ */
+static int
+smb2_serve(struct smb2_server *server, struct smb2_memory_transport *mt,
+           const int max_connections, smb2_client_connection cb,
+           void *cb_data)
 {
         struct smb2_context *smb2;
         struct connect_data *c_data = cb_data;
@@ -4126,7 +5009,12 @@ int smb2_serve_port(struct smb2_server *server, const int max_connections, smb2_
                 return err;
         }
 #endif
-        err = smb2_bind_and_listen(server->port, max_connections, &server->fd);
+        if (mt) {
+                err = smb2_memory_transport_listen(mt, &server->fd);
+        } else {
+                err = smb2_bind_and_listen(server->port, max_connections,
+                                           &server->fd);
+        }
         if (err != 0) {
                 return err;
         }
@@ -4202,9 +5090,14 @@ int smb2_serve_port(struct smb2_server *server, const int max_connections, smb2_
 
                         if (FD_ISSET(server->fd, &rfds)) {
                                 smb2 = NULL;
-                                err = smb2_serve_port_async(server->fd, 10, &smb2);
+                                if (mt) {
+                                        err = smb2_memory_transport_accept(
+                                                mt, &smb2);
+                                } else {
+                                        err = smb2_serve_port_async(server->fd, 10, &smb2);
+                                }
                                 if (!err && smb2) {
-                                        c_data = calloc(1, sizeof(struct connect_data));
+                                        c_data = smb2_calloc(smb2, 1, sizeof(struct connect_data));
                                         if (c_data == NULL) {
                                                 smb2_set_error(smb2, "Failed to allocate connect_data");
                                                 smb2_close_context(smb2);
@@ -4262,7 +5155,9 @@ int smb2_serve_port(struct smb2_server *server, const int max_connections, smb2_
         }
         while (err == 0);
 
-        close(server->fd);
+        if (!mt) {
+                close(server->fd);
+        }
         server->fd = -1;
 
         while (smb2_active_contexts()) {
@@ -4275,3 +5170,16 @@ int smb2_serve_port(struct smb2_server *server, const int max_connections, smb2_
         return err;
 }
 
+int smb2_serve_port(struct smb2_server *server, const int max_connections, smb2_client_connection cb, void *cb_data)
+{
+        return smb2_serve(server, NULL, max_connections, cb, cb_data);
+}
+
+int
+smb2_serve_memory_transport(struct smb2_server *server,
+                            struct smb2_memory_transport *mt,
+                            smb2_client_connection cb, void *cb_data)
+{
+        return smb2_serve(server, mt, 1, cb, cb_data);
+}
+
@@ -0,0 +1,549 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef STDC_HEADERS
+#include <stddef.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_FCNTL_H
+#include <fcntl.h>
+#endif
+
+#ifdef HAVE_SYS_EVENTFD_H
+#include <sys/eventfd.h>
+#elif defined(HAVE_SOCKETPAIR)
+#include <sys/socket.h>
+#endif
+
+#include <errno.h>
+
+#include "compat.h"
+
+#include "slist.h"
+#include "smb2.h"
+#include "libsmb2.h"
+#include "libsmb2-private.h"
+
+#if defined(HAVE_SYS_EVENTFD_H) || defined(HAVE_SOCKETPAIR)
+
+/*
+ * Each end of a connection owns a pipe that the other end writes into.
+ * Everything runs in one thread so the pipes need no locking. The only
+ * thing that goes through the kernel is the doorbell which makes the fd
+ * of an end readable while its pipe holds data, or once the other end
+ * has been closed.
+ */
+
+/* Initial size of a pipe, it grows as needed up to SMB2_MEMORY_PIPE_MAX.
+ * Once a pipe is full writes to it fail with EAGAIN until the reader has
+ * caught up. The fd of an end is always writable so the writer keeps
+ * being serviced and retries.
+ */
+#define SMB2_MEMORY_PIPE_SIZE (64 * 1024)
+#define SMB2_MEMORY_PIPE_MAX (4 * 1024 * 1024)
+
+struct smb2_memory_doorbell {
+        /* fd[0] is polled and fd[1] written to, with eventfd() both
+         * are the same fd */
+        t_socket fd[2];
+        int rung;
+};
+
+struct smb2_memory_pipe {
+        uint8_t *buf;
+        size_t size;
+        /* bytes [pos, len) have not been read yet */
+        size_t pos;
+        size_t len;
+        /* the writing end is gone */
+        int closed;
+};
+
+struct smb2_memory_end {
+        /* for the list of connections not accepted yet */
+        struct smb2_memory_end *next;
+        struct smb2_memory_end *peer;
+        struct smb2_memory_pipe rx;
+        struct smb2_memory_doorbell bell;
+};
+
+struct smb2_memory_transport {
+        struct smb2_memory_end *pending;
+        struct smb2_memory_doorbell bell;
+        int shutdown;
+        /* one for the owner and one for each context that was set to
+         * use the transport
+         */
+        int refs;
+};
+
+static int
+smb2_memory_doorbell_init(struct smb2_memory_doorbell *bell)
+{
+#ifdef HAVE_SYS_EVENTFD_H
+        bell->fd[0] = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (bell->fd[0] < 0) {
+                return -1;
+        }
+        bell->fd[1] = bell->fd[0];
+#else
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, bell->fd) != 0) {
+                return -1;
+        }
+        fcntl(bell->fd[0], F_SETFL, fcntl(bell->fd[0], F_GETFL, 0) | O_NONBLOCK);
+        fcntl(bell->fd[1], F_SETFL, fcntl(bell->fd[1], F_GETFL, 0) | O_NONBLOCK);
+#endif
+        bell->rung = 0;
+        return 0;
+}
+
+static void
+smb2_memory_doorbell_destroy(struct smb2_memory_doorbell *bell)
+{
+        close(bell->fd[0]);
+        if (bell->fd[1] != bell->fd[0]) {
+                close(bell->fd[1]);
+        }
+}
+
+static void
+smb2_memory_doorbell_ring(struct smb2_memory_doorbell *bell)
+{
+        uint64_t one = 1;
+
+        if (bell->rung) {
+                return;
+        }
+        if (write(bell->fd[1], &one, sizeof(one)) == sizeof(one)) {
+                bell->rung = 1;
+        }
+}
+
+static void
+smb2_memory_doorbell_clear(struct smb2_memory_doorbell *bell)
+{
+        uint64_t val;
+
+        if (!bell->rung) {
+                return;
+        }
+        if (read(bell->fd[0], &val, sizeof(val)) == sizeof(val)) {
+                bell->rung = 0;
+        }
+}
+
+static struct smb2_memory_end *
+smb2_memory_end_alloc(void)
+{
+        struct smb2_memory_end *end;
+
+        end = smb2_calloc(NULL, 1, sizeof(struct smb2_memory_end));
+        if (end == NULL) {
+                return NULL;
+        }
+        if (smb2_memory_doorbell_init(&end->bell) != 0) {
+                smb2_free(NULL, end);
+                return NULL;
+        }
+        return end;
+}
+
+/* Frees the end, the peer sees the connection being closed */
+static void
+smb2_memory_end_free(struct smb2_memory_end *end)
+{
+        if (end->peer) {
+                end->peer->rx.closed = 1;
+                smb2_memory_doorbell_ring(&end->peer->bell);
+                end->peer->peer = NULL;
+        }
+        smb2_memory_doorbell_destroy(&end->bell);
+        smb2_free(NULL, end->rx.buf);
+        smb2_free(NULL, end);
+}
+
+static int
+smb2_memory_connect(struct smb2_context *smb2, const char *server,
+                    t_socket *fd, void *opaque)
+{
+        struct smb2_memory_transport *mt = opaque;
+        struct smb2_memory_end *client, *srv;
+
+        if (mt->shutdown) {
+                smb2_set_error(smb2, "Memory transport is shut down");
+                return -ECONNREFUSED;
+        }
+
+        client = smb2_memory_end_alloc();
+        if (client == NULL) {
+                smb2_set_error(smb2, "Failed to allocate memory transport "
+                               "connection");
+                return -ENOMEM;
+        }
+        srv = smb2_memory_end_alloc();
+        if (srv == NULL) {
+                smb2_memory_end_free(client);
+                smb2_set_error(smb2, "Failed to allocate memory transport "
+                               "connection");
+                return -ENOMEM;
+        }
+        client->peer = srv;
+        srv->peer = client;
+
+        SMB2_LIST_ADD_END(&mt->pending, srv);
+        smb2_memory_doorbell_ring(&mt->bell);
+
+        /* The doorbell is always writable so the connection completes
+         * as soon as the fd is polled.
+         */
+        smb2->transport_conn = client;
+        *fd = client->bell.fd[0];
+
+        return 0;
+}
+
+static ssize_t
+smb2_memory_readv(struct smb2_context *smb2, const struct iovec *iov,
+                  int iovcnt, void *opaque)
+{
+        struct smb2_memory_end *end = smb2->transport_conn;
+        struct smb2_memory_pipe *rx;
+        size_t len, count = 0;
+        int i;
+
+        /* the context was closed while it was being serviced */
+        if (!SMB2_VALID_SOCKET(smb2->fd) || end == NULL) {
+                errno = EBADF;
+                return -1;
+        }
+        rx = &end->rx;
+
+        for (i = 0; i < iovcnt && rx->pos < rx->len; i++) {
+                len = MIN(iov[i].iov_len, rx->len - rx->pos);
+                memcpy(iov[i].iov_base, &rx->buf[rx->pos], len);
+                rx->pos += len;
+                count += len;
+        }
+        if (rx->pos == rx->len) {
+                rx->pos = rx->len = 0;
+                /* stay readable so the closed connection is noticed */
+                if (!rx->closed) {
+                        smb2_memory_doorbell_clear(&end->bell);
+                }
+        }
+
+        if (count == 0 && !rx->closed) {
+                errno = EAGAIN;
+                return -1;
+        }
+        return (ssize_t)count;
+}
+
+static ssize_t
+smb2_memory_writev(struct smb2_context *smb2, const struct iovec *iov,
+                   int iovcnt, void *opaque)
+{
+        struct smb2_memory_end *end = smb2->transport_conn;
+        struct smb2_memory_pipe *rx;
+        size_t size, len, count = 0;
+        uint8_t *buf;
+        int i;
+
+        if (!SMB2_VALID_SOCKET(smb2->fd) || end == NULL) {
+                errno = EBADF;
+                return -1;
+        }
+        if (end->peer == NULL) {
+                errno = EPIPE;
+                return -1;
+        }
+        rx = &end->peer->rx;
+
+        for (i = 0; i < iovcnt; i++) {
+                count += iov[i].iov_len;
+        }
+
+        if (rx->len + count > rx->size) {
+                /* move what is left to the front before growing */
+                if (rx->pos) {
+                        memmove(rx->buf, &rx->buf[rx->pos],
+                                rx->len - rx->pos);
+                        rx->len -= rx->pos;
+                        rx->pos = 0;
+                }
+        }
+        if (rx->len + count > rx->size && rx->size < SMB2_MEMORY_PIPE_MAX) {
+                size = rx->size ? rx->size : SMB2_MEMORY_PIPE_SIZE;
+                while (size < rx->len + count && size < SMB2_MEMORY_PIPE_MAX) {
+                        size *= 2;
+                }
+                buf = smb2_malloc(NULL, size);
+                if (buf == NULL) {
+                        errno = ENOMEM;
+                        return -1;
+                }
+                if (rx->len) {
+                        memcpy(buf, rx->buf, rx->len);
+                }
+                smb2_free(NULL, rx->buf);
+                rx->buf = buf;
+                rx->size = size;
+        }
+
+        /* a full pipe takes as much as fits, like a socket would */
+        count = MIN(count, rx->size - rx->len);
+        if (count == 0) {
+                errno = EAGAIN;
+                return -1;
+        }
+        for (i = 0, len = count; len > 0; i++) {
+                size = MIN(iov[i].iov_len, len);
+                memcpy(&rx->buf[rx->len], iov[i].iov_base, size);
+                rx->len += size;
+                len -= size;
+        }
+        smb2_memory_doorbell_ring(&end->peer->bell);
+
+        return (ssize_t)count;
+}
+
+static void
+smb2_memory_close(struct smb2_context *smb2, t_socket fd, void *opaque)
+{
+        struct smb2_memory_end *end = smb2->transport_conn;
+
+        if (end == NULL) {
+                return;
+        }
+        smb2->transport_conn = NULL;
+        smb2_memory_end_free(end);
+}
+
+static const struct smb2_transport smb2_memory_pipe_transport = {
+        smb2_memory_connect,
+        smb2_memory_readv,
+        smb2_memory_writev,
+        smb2_memory_close
+};
+
+struct smb2_memory_transport *
+smb2_memory_transport_init(void)
+{
+        struct smb2_memory_transport *mt;
+
+        mt = smb2_calloc(NULL, 1, sizeof(struct smb2_memory_transport));
+        if (mt == NULL) {
+                errno = ENOMEM;
+                return NULL;
+        }
+        if (smb2_memory_doorbell_init(&mt->bell) != 0) {
+                smb2_free(NULL, mt);
+                return NULL;
+        }
+        mt->refs = 1;
+        return mt;
+}
+
+static void
+smb2_memory_transport_put(struct smb2_memory_transport *mt)
+{
+        if (--mt->refs == 0) {
+                smb2_free(NULL, mt);
+        }
+}
+
+void
+smb2_memory_transport_destroy(struct smb2_memory_transport *mt)
+{
+        struct smb2_memory_end *end;
+
+        if (mt == NULL) {
+                return;
+        }
+        /* client contexts may still point at us, they now fail to
+         * connect instead.
+         */
+        mt->shutdown = 1;
+        while ((end = mt->pending)) {
+                SMB2_LIST_REMOVE(&mt->pending, end);
+                smb2_memory_end_free(end);
+        }
+        smb2_memory_doorbell_destroy(&mt->bell);
+        smb2_memory_transport_put(mt);
+}
+
+void
+smb2_memory_transport_release(struct smb2_context *smb2)
+{
+        if (smb2->transport != &smb2_memory_pipe_transport ||
+            smb2->transport_opaque == NULL) {
+                return;
+        }
+        smb2_memory_transport_put(smb2->transport_opaque);
+        smb2->transport_opaque = NULL;
+}
+
+void
+smb2_memory_transport_shutdown(struct smb2_memory_transport *mt)
+{
+        mt->shutdown = 1;
+        smb2_memory_doorbell_ring(&mt->bell);
+}
+
+int
+smb2_set_memory_transport(struct smb2_context *smb2,
+                          struct smb2_memory_transport *mt)
+{
+        int err;
+
+        mt->refs++;
+        err = smb2_set_transport(smb2, &smb2_memory_pipe_transport, mt);
+        if (err) {
+                mt->refs--;
+        }
+        return err;
+}
+
+int
+smb2_memory_transport_listen(struct smb2_memory_transport *mt, int *out_fd)
+{
+        if (mt->shutdown) {
+                return -ESHUTDOWN;
+        }
+        *out_fd = mt->bell.fd[0];
+        return 0;
+}
+
+/*
+ * Called when the listen fd is readable. Creates the server context for
+ * the oldest pending connection, if any.
+ */
+int
+smb2_memory_transport_accept(struct smb2_memory_transport *mt,
+                             struct smb2_context **out_smb2)
+{
+        struct smb2_memory_end *end = mt->pending;
+        struct smb2_context *smb2;
+
+        *out_smb2 = NULL;
+
+        if (mt->shutdown) {
+                return -ESHUTDOWN;
+        }
+        if (end == NULL) {
+                smb2_memory_doorbell_clear(&mt->bell);
+                return 0;
+        }
+        SMB2_LIST_REMOVE(&mt->pending, end);
+        if (mt->pending == NULL) {
+                smb2_memory_doorbell_clear(&mt->bell);
+        }
+
+        smb2 = smb2_init_context();
+        if (smb2 == NULL) {
+                smb2_memory_end_free(end);
+                return -ENOMEM;
+        }
+        /* server contexts do not hold a reference on the transport */
+        smb2->transport = &smb2_memory_pipe_transport;
+        smb2->transport_conn = end;
+        smb2->fd = end->bell.fd[0];
+
+        *out_smb2 = smb2;
+        return 0;
+}
+
+#else /* HAVE_SYS_EVENTFD_H || HAVE_SOCKETPAIR */
+
+struct smb2_memory_transport *
+smb2_memory_transport_init(void)
+{
+        errno = ENOSYS;
+        return NULL;
+}
+
+void
+smb2_memory_transport_destroy(struct smb2_memory_transport *mt)
+{
+}
+
+void
+smb2_memory_transport_shutdown(struct smb2_memory_transport *mt)
+{
+}
+
+int
+smb2_set_memory_transport(struct smb2_context *smb2,
+                          struct smb2_memory_transport *mt)
+{
+        smb2_set_error(smb2, "libsmb2 was built without memory transport "
+                       "support");
+        return -ENOSYS;
+}
+
+int
+smb2_memory_transport_listen(struct smb2_memory_transport *mt, int *out_fd)
+{
+        return -ENOSYS;
+}
+
+int
+smb2_memory_transport_accept(struct smb2_memory_transport *mt,
+                             struct smb2_context **out_smb2)
+{
+        *out_smb2 = NULL;
+        return -ENOSYS;
+}
+
+void
+smb2_memory_transport_release(struct smb2_context *smb2)
+{
+}
+
+#endif /* HAVE_SYS_EVENTFD_H || HAVE_SOCKETPAIR */
@@ -76,9 +76,7 @@
 #include "libsmb2-private.h"
 #include "spnego-wrapper.h"
 
-#include "md4.h"
-#include "md5.h"
-#include "hmac-md5.h"
+#include "crypto.h"
 #include "ntlmssp.h"
 
 struct auth_data {
@@ -90,6 +88,8 @@ struct auth_data {
         unsigned char *ntlm_buf;
         size_t ntlm_len;
 
+        struct smb2_context *smb2;
+
         char *user;
         char *domain;
         char *password;
@@ -125,29 +125,29 @@ struct auth_data {
 void
 ntlmssp_destroy_context(struct auth_data *auth)
 {
-        free(auth->ntlm_buf);
-        free(auth->buf);
-        free(auth->user);
-        free(auth->password);
-        free(auth->domain);
-        free(auth->workstation);
-        free(auth->target_name);
-        free(auth->client_challenge);
-        free(auth->target_info);
-        free(auth);
+        smb2_free(auth->smb2, auth->ntlm_buf);
+        smb2_free(auth->smb2, auth->buf);
+        smb2_free(auth->smb2, auth->user);
+        smb2_free(auth->smb2, auth->password);
+        smb2_free(auth->smb2, auth->domain);
+        smb2_free(auth->smb2, auth->workstation);
+        smb2_free(auth->smb2, auth->target_name);
+        smb2_free(auth->smb2, auth->client_challenge);
+        smb2_free(auth->smb2, auth->target_info);
+        smb2_free(auth->smb2, auth);
 }
 
 static int
 auth_data_set_password(struct auth_data *auth_data, const char *password)
 {
-        free(auth_data->password);
+        smb2_free(auth_data->smb2, auth_data->password);
         auth_data->password = NULL;
 
         if (password == NULL) {
                 return 0;
         }
 
-        auth_data->password = strdup(password);
+        auth_data->password = smb2_strdup(auth_data->smb2, password);
         if (auth_data->password == NULL) {
                 return -ENOMEM;
         }
@@ -157,14 +157,14 @@ auth_data_set_password(struct auth_data *auth_data, const char *password)
 static int
 auth_data_set_domain(struct auth_data *auth_data, const char *domain)
 {
-        free(auth_data->domain);
+        smb2_free(auth_data->smb2, auth_data->domain);
         auth_data->domain = NULL;
 
         if (domain == NULL) {
                 return 0;
         }
 
-        auth_data->domain = strdup(domain);
+        auth_data->domain = smb2_strdup(auth_data->smb2, domain);
         if (auth_data->domain == NULL) {
                 return -ENOMEM;
         }
@@ -172,7 +172,8 @@ auth_data_set_domain(struct auth_data *auth_data, const char *domain)
 }
 
 struct auth_data *
-ntlmssp_init_context(const char *user,
+ntlmssp_init_context(struct smb2_context *smb2,
+                     const char *user,
                      const char *password,
                      const char *domain,
                      const char *workstation,
@@ -181,13 +182,14 @@ ntlmssp_init_context(const char *user,
         struct auth_data *auth_data = NULL;
         struct smb2_timeval tv;
 
-        auth_data = calloc(1, sizeof(struct auth_data));
+        auth_data = smb2_calloc(smb2, 1, sizeof(struct auth_data));
         if (auth_data == NULL) {
                 return NULL;
         }
+        auth_data->smb2 = smb2;
 
         if (user) {
-                auth_data->user = strdup(user);
+                auth_data->user = smb2_strdup(smb2, user);
                 if (auth_data->user == NULL) {
                         goto failed;
                 }
@@ -199,12 +201,12 @@ ntlmssp_init_context(const char *user,
                 goto failed;
         }
         if (workstation) {
-                auth_data->workstation = strdup(workstation);
+                auth_data->workstation = smb2_strdup(smb2, workstation);
                 if (auth_data->workstation == NULL) {
                         goto failed;
                 }
         }
-        auth_data->client_challenge = malloc(8);
+        auth_data->client_challenge = smb2_malloc(smb2, 8);
         if (auth_data->client_challenge == NULL) {
                 goto failed;
         }
@@ -217,11 +219,11 @@ ntlmssp_init_context(const char *user,
 
         return auth_data;
  failed:
-        free(auth_data->user);
-        free(auth_data->password);
-        free(auth_data->domain);
-        free(auth_data->workstation);
-        free(auth_data->client_challenge);
+        smb2_free(smb2, auth_data->user);
+        smb2_free(smb2, auth_data->password);
+        smb2_free(smb2, auth_data->domain);
+        smb2_free(smb2, auth_data->workstation);
+        smb2_free(smb2, auth_data->client_challenge);
         return NULL;
 }
 
@@ -252,13 +254,13 @@ encoder(const void *buffer, size_t size, void *ptr)
                 unsigned char *tmp = auth_data->buf;
 
                 auth_data->allocated = 2 * ((size + auth_data->allocated + 256) & ~0xff);
-                auth_data->buf = malloc(auth_data->allocated);
+                auth_data->buf = smb2_malloc(auth_data->smb2, auth_data->allocated);
                 if (auth_data->buf == NULL) {
-                        free(tmp);
+                        smb2_free(auth_data->smb2, tmp);
                         return -1;
                 }
                 memcpy(auth_data->buf, tmp, auth_data->len);
-                free(tmp);
+                smb2_free(auth_data->smb2, tmp);
         }
 
         if (auth_data->buf == NULL) {
@@ -334,20 +336,20 @@ ntlm_decode_challenge_message(struct smb2_context *smb2, struct auth_data *auth_
                 const uint32_t challenge_header_len = 56;
 
                 /* form destination SPN in case server is checking */
-                free(auth_data->target_info);
+                smb2_free(smb2, auth_data->target_info);
                 alloc_len = 32 + strlen(smb2->server);
-                auth_data->target_info = malloc(alloc_len);
+                auth_data->target_info = smb2_malloc(smb2, alloc_len);
                 if (!auth_data->target_info) {
                         return -1;
                 }
                 auth_data->target_info_len = snprintf((char*)auth_data->target_info,
                         alloc_len, "cifs/%s", smb2->server);
 
-                free(auth_data->ntlm_buf);
+                smb2_free(smb2, auth_data->ntlm_buf);
                 auth_data->ntlm_len = len;
                 /* alloc enough to add a target-name attribute */
                 alloc_len = auth_data->ntlm_len + 400;
-                auth_data->ntlm_buf = malloc(alloc_len);
+                auth_data->ntlm_buf = smb2_malloc(smb2, alloc_len);
                 if (auth_data->ntlm_buf == NULL) {
                         return -1;
                 }
@@ -368,7 +370,7 @@ ntlm_decode_challenge_message(struct smb2_context *smb2, struct auth_data *auth_
                 memcpy(&auth_data->ntlm_buf[16], &u32, 4);
 
                 if (inlen > 0 && inlen < len && (outoff + inlen) < alloc_len) {
-                        auth_data->target_name = discard_const(smb2_utf16_to_utf8((const uint16_t *)(void *)&buf[inoff], inlen / 2));
+                        auth_data->target_name = discard_const(smb2_ctx_utf16_to_utf8(smb2, (const uint16_t *)(void *)&buf[inoff], inlen / 2));
                         memcpy(&auth_data->ntlm_buf[outoff], &buf[inoff], inlen);
                         outoff += inlen;
                 }
@@ -399,7 +401,7 @@ ntlm_decode_challenge_message(struct smb2_context *smb2, struct auth_data *auth_
                                 if (attr_code == 0) { /* end of list */
                                         /*  insert target-name */
                                         if (auth_data->target_info && auth_data->target_info_len) {
-                                                utf16_spn = smb2_utf8_to_utf16((char*)auth_data->target_info);
+                                                utf16_spn = smb2_ctx_utf8_to_utf16(smb2, (char*)auth_data->target_info);
                                                 if (utf16_spn != NULL) {
                                                         attr_code = 0x9; /* target-name code */
                                                         attr_len = utf16_spn->len * 2;
@@ -412,7 +414,7 @@ ntlm_decode_challenge_message(struct smb2_context *smb2, struct auth_data *auth_
                                                                 (uint8_t*)utf16_spn->val, attr_len);
                                                         outoff += attr_len;
                                                         infolen += 4 + attr_len;
-                                                        free(utf16_spn);
+                                                        smb2_free(smb2, utf16_spn);
                                                 }
                                         }
                                         /* insert original end of list attr */
@@ -452,12 +454,12 @@ ntlm_decode_challenge_message(struct smb2_context *smb2, struct auth_data *auth_
 }
 
 static int
-ntlm_convert_password_hash(const char *password, unsigned char password_hash[16])
+ntlm_convert_password_hash(struct smb2_context *smb2, const char *password, unsigned char password_hash[16])
 {
         int i, hn, ln;
         struct smb2_utf16 *utf16_password = NULL;
 
-        utf16_password = smb2_utf8_to_utf16(password);
+        utf16_password = smb2_ctx_utf8_to_utf16(smb2, password);
         if (utf16_password == NULL) {
                 return -1;
         }
@@ -481,25 +483,23 @@ ntlm_convert_password_hash(const char *password, unsigned char password_hash[16]
 }
 
 static int
-NTOWFv1(const char *password, unsigned char password_hash[16])
+NTOWFv1(struct smb2_context *smb2, const char *password, unsigned char password_hash[16])
 {
-        MD4_CTX ctx;
         struct smb2_utf16 *utf16_password = NULL;
 
-        utf16_password = smb2_utf8_to_utf16(password);
+        utf16_password = smb2_ctx_utf8_to_utf16(smb2, password);
         if (utf16_password == NULL) {
                 return -1;
         }
-        MD4Init(&ctx);
-        MD4Update(&ctx, (unsigned char *)utf16_password->val, utf16_password->len * 2);
-        MD4Final(password_hash, &ctx);
-        free(utf16_password);
+        smb2_md4(smb2->crypto, (uint8_t *)utf16_password->val,
+                 utf16_password->len * 2, password_hash);
+        smb2_free(smb2, utf16_password);
 
         return 0;
 }
 
 static int
-NTOWFv2(const char *user, const char *password, const char *domain,
+NTOWFv2(struct smb2_context *smb2, const char *user, const char *password, const char *domain,
         unsigned char ntlmv2_hash[16])
 {
         int64_t i;
@@ -514,11 +514,11 @@ NTOWFv2(const char *user, const char *password, const char *domain,
 
         /* ntlm:F638EDF864C4805DC65D9BF2BB77E4C0 */
         if ((strlen(password) == 37) && (strncmp(password, "ntlm:", 5) == 0)) {
-                if (ntlm_convert_password_hash(password + 5, ntlm_hash) < 0) {
+                if (ntlm_convert_password_hash(smb2, password + 5, ntlm_hash) < 0) {
                         return -1;
                 }
         } else {
-                if (NTOWFv1(password, ntlm_hash) < 0) {
+                if (NTOWFv1(smb2, password, ntlm_hash) < 0) {
                         return -1;
                 }
         }
@@ -527,7 +527,7 @@ NTOWFv2(const char *user, const char *password, const char *domain,
         if (domain) {
                 len += strlen(domain);
         }
-        userdomain = malloc(len);
+        userdomain = smb2_malloc(smb2, len);
         if (userdomain == NULL) {
                 return -1;
         }
@@ -542,17 +542,18 @@ NTOWFv2(const char *user, const char *password, const char *domain,
                 strcat(userdomain, domain);
         }
 
-        utf16_userdomain = smb2_utf8_to_utf16(userdomain);
+        utf16_userdomain = smb2_ctx_utf8_to_utf16(smb2, userdomain);
         if (utf16_userdomain == NULL) {
-                free(userdomain);
+                smb2_free(smb2, userdomain);
                 return -1;
         }
 
-        smb2_hmac_md5((unsigned char *)utf16_userdomain->val,
-                 utf16_userdomain->len * 2,
-                 ntlm_hash, 16, ntlmv2_hash);
-        free(userdomain);
-        free(utf16_userdomain);
+        smb2_hmac_md5_digest(smb2->crypto,
+                             (unsigned char *)utf16_userdomain->val,
+                             utf16_userdomain->len * 2,
+                             ntlm_hash, 16, ntlmv2_hash);
+        smb2_free(smb2, userdomain);
+        smb2_free(smb2, utf16_userdomain);
 
         return 0;
 }
@@ -646,7 +647,7 @@ encode_ntlm_auth(struct smb2_context *smb2, time_t ti,
         /*
          * Generate Concatenation of(NTProofStr, temp)
          */
-        if (NTOWFv2(auth_data->user, auth_data->password,
+        if (NTOWFv2(smb2, auth_data->user, auth_data->password,
                     auth_data->domain, ResponseKeyNT) < 0) {
                 goto finished;
         }
@@ -683,8 +684,9 @@ encode_ntlm_auth(struct smb2_context *smb2, time_t ti,
                 return -1;
         }
 
-        smb2_hmac_md5(&auth_data->buf[8], (unsigned int)auth_data->len-8,
-                 ResponseKeyNT, 16, NTProofStr);
+        smb2_hmac_md5_digest(smb2->crypto, &auth_data->buf[8],
+                             (unsigned int)auth_data->len-8,
+                             ResponseKeyNT, 16, NTProofStr);
         memcpy(auth_data->buf, NTProofStr, 16);
 
         NTChallengeResponse_buf = auth_data->buf;
@@ -697,7 +699,8 @@ encode_ntlm_auth(struct smb2_context *smb2, time_t ti,
         /* get the NTLMv2 Key-Exchange Key
            For NTLMv2 - Key Exchange Key is the Session Base Key
          */
-        smb2_hmac_md5(NTProofStr, 16, ResponseKeyNT, 16, key_exch);
+        smb2_hmac_md5_digest(smb2->crypto, NTProofStr, 16,
+                             ResponseKeyNT, 16, key_exch);
         memcpy(auth_data->exported_session_key, key_exch, 16);
 
  encode:
@@ -724,7 +727,7 @@ encode_ntlm_auth(struct smb2_context *smb2, time_t ti,
 
         /* domain name fields */
         if (!anonymous && auth_data->domain) {
-                utf16_domain = smb2_utf8_to_utf16(auth_data->domain);
+                utf16_domain = smb2_ctx_utf8_to_utf16(smb2, auth_data->domain);
                 if (utf16_domain == NULL) {
                         goto finished;
                 }
@@ -741,7 +744,7 @@ encode_ntlm_auth(struct smb2_context *smb2, time_t ti,
 
         /* user name fields */
         if (!anonymous) {
-                utf16_user = smb2_utf8_to_utf16(auth_data->user);
+                utf16_user = smb2_ctx_utf8_to_utf16(smb2, auth_data->user);
                 if (utf16_user == NULL) {
                         goto finished;
                 }
@@ -758,7 +761,7 @@ encode_ntlm_auth(struct smb2_context *smb2, time_t ti,
 
         /* workstation name fields */
         if (!anonymous && auth_data->workstation) {
-                utf16_workstation = smb2_utf8_to_utf16(auth_data->workstation);
+                utf16_workstation = smb2_ctx_utf8_to_utf16(smb2, auth_data->workstation);
                 if (utf16_workstation == NULL) {
                         goto finished;
                 }
@@ -831,10 +834,10 @@ encode_ntlm_auth(struct smb2_context *smb2, time_t ti,
 
         ret = 0;
 finished:
-        free(utf16_domain);
-        free(utf16_user);
-        free(utf16_workstation);
-        free(NTChallengeResponse_buf);
+        smb2_free(smb2, utf16_domain);
+        smb2_free(smb2, utf16_user);
+        smb2_free(smb2, utf16_workstation);
+        smb2_free(smb2, NTChallengeResponse_buf);
 
         return ret;
 }
@@ -909,7 +912,7 @@ encode_ntlm_challenge(struct smb2_context *smb2, struct auth_data *auth_data)
         if (auth_data->workstation) {
              int i;
                 namelen = strlen(auth_data->workstation);
-                upper = malloc(namelen + 1);
+                upper = smb2_malloc(smb2, namelen + 1);
                 if (!upper) {
                         return -1;
                 }
@@ -917,11 +920,11 @@ encode_ntlm_challenge(struct smb2_context *smb2, struct auth_data *auth_data)
                         upper[i] = toupper(auth_data->workstation[i]);
                 }
                 upper[namelen] = 0;
-                utf16_workstation = smb2_utf8_to_utf16(auth_data->workstation);
+                utf16_workstation = smb2_ctx_utf8_to_utf16(smb2, auth_data->workstation);
                 if (utf16_workstation == NULL) {
                         goto finished;
                 }
-                utf16_workstation_upper = smb2_utf8_to_utf16(upper);
+                utf16_workstation_upper = smb2_ctx_utf8_to_utf16(smb2, upper);
                 if (utf16_workstation_upper == NULL) {
                         goto finished;
                 }
@@ -974,7 +977,7 @@ encode_ntlm_challenge(struct smb2_context *smb2, struct auth_data *auth_data)
 
         /* save the target info in auth-data for later */
         auth_data->target_info_len = auth_data->len - target_info_pos;
-        auth_data->target_info = malloc(auth_data->target_info_len);
+        auth_data->target_info = smb2_malloc(smb2, auth_data->target_info_len);
         memcpy(auth_data->target_info,
                         auth_data->buf + target_info_pos,
                         auth_data->target_info_len);
@@ -989,13 +992,13 @@ encode_ntlm_challenge(struct smb2_context *smb2, struct auth_data *auth_data)
         ret = 0;
 finished:
         if (upper) {
-                free(upper);
+                smb2_free(smb2, upper);
         }
         if (utf16_workstation) {
-                free(utf16_workstation);
+                smb2_free(smb2, utf16_workstation);
         }
         if (utf16_workstation_upper) {
-                free(utf16_workstation_upper);
+                smb2_free(smb2, utf16_workstation_upper);
         }
         return ret;
 }
@@ -1013,7 +1016,7 @@ ntlmssp_generate_blob(struct smb2_server *server, struct smb2_context *smb2, tim
         int spnego_len;
         int is_wrapped;
 
-        free(auth_data->buf);
+        smb2_free(smb2, auth_data->buf);
         auth_data->buf = NULL;
         auth_data->len = 0;
         auth_data->allocated = 0;
@@ -1031,7 +1034,7 @@ ntlmssp_generate_blob(struct smb2_server *server, struct smb2_context *smb2, tim
                                 smb2_set_error(smb2, "can not wrap negotiate");
                                 return -1;
                         }
-                        free(auth_data->buf);
+                        smb2_free(smb2, auth_data->buf);
                         auth_data->buf = spnego_buf;
                         auth_data->len = spnego_len;
                 }
@@ -1066,7 +1069,7 @@ ntlmssp_generate_blob(struct smb2_server *server, struct smb2_context *smb2, tim
                                                 smb2_set_error(smb2, "can not wrap challenge");
                                                 return -1;
                                         }
-                                        free(auth_data->buf);
+                                        smb2_free(smb2, auth_data->buf);
                                         auth_data->buf = spnego_buf;
                                         auth_data->len = spnego_len;
                                 }
@@ -1082,7 +1085,7 @@ ntlmssp_generate_blob(struct smb2_server *server, struct smb2_context *smb2, tim
                                                 smb2_set_error(smb2, "can not wrap auth result");
                                                 return -1;
                                         }
-                                        free(auth_data->buf);
+                                        smb2_free(smb2, auth_data->buf);
                                         auth_data->buf = spnego_buf;
                                         auth_data->len = spnego_len;
                                 }
@@ -1100,7 +1103,7 @@ ntlmssp_generate_blob(struct smb2_server *server, struct smb2_context *smb2, tim
                                 }
                                 if (auth_data->domain == NULL && auth_data->target_name) {
                                         smb2_set_domain(smb2, auth_data->target_name);
-                                        auth_data->domain = strdup(auth_data->target_name);
+                                        auth_data->domain = smb2_strdup(smb2, auth_data->target_name);
                                         if (auth_data->domain == NULL) {
                                                 return -1;
                                         }
@@ -1120,7 +1123,7 @@ ntlmssp_generate_blob(struct smb2_server *server, struct smb2_context *smb2, tim
                                                 smb2_set_error(smb2, "can not wrap auth result");
                                                 return -1;
                                         }
-                                        free(auth_data->buf);
+                                        smb2_free(smb2, auth_data->buf);
                                         auth_data->buf = spnego_buf;
                                         auth_data->len = spnego_len;
                                 }
@@ -1139,7 +1142,7 @@ ntlmssp_generate_blob(struct smb2_server *server, struct smb2_context *smb2, tim
 }
 
 void
-ntlmssp_get_utf16_field(uint8_t *input_buf, int input_len, int offset, char **result)
+ntlmssp_get_utf16_field(struct smb2_context *smb2, uint8_t *input_buf, int input_len, int offset, char **result)
 {
         uint32_t field_len;
         uint32_t field_off;
@@ -1155,7 +1158,7 @@ ntlmssp_get_utf16_field(uint8_t *input_buf, int input_len, int offset, char **re
         memcpy(&u32, &input_buf[offset + 4], 4);
         field_off = le32toh(u32);
         if (field_len && field_off) {
-                *result = (char*)smb2_utf16_to_utf8((uint16_t *)(void *)(input_buf + field_off), field_len / 2);
+                *result = (char*)smb2_ctx_utf16_to_utf8(smb2, (uint16_t *)(void *)(input_buf + field_off), field_len / 2);
         }
 }
 
@@ -1186,20 +1189,20 @@ ntlmssp_authenticate_blob(struct smb2_server *server, struct smb2_context *smb2,
                 return -1;
         }
         if (auth_data->domain) {
-                free(auth_data->domain);
+                smb2_free(smb2, auth_data->domain);
                 auth_data->domain = NULL;
         }
         if (auth_data->user) {
-                free(auth_data->user);
+                smb2_free(smb2, auth_data->user);
                 auth_data->user = NULL;
         }
         if (auth_data->workstation) {
-                free(auth_data->workstation);
+                smb2_free(smb2, auth_data->workstation);
                 auth_data->workstation = NULL;
         }
-        ntlmssp_get_utf16_field(input_buf, input_len, 4*7, &auth_data->domain);
-        ntlmssp_get_utf16_field(input_buf, input_len, 4*9, &auth_data->user);
-        ntlmssp_get_utf16_field(input_buf, input_len, 4*11, &auth_data->workstation);
+        ntlmssp_get_utf16_field(smb2, input_buf, input_len, 4*7, &auth_data->domain);
+        ntlmssp_get_utf16_field(smb2, input_buf, input_len, 4*9, &auth_data->user);
+        ntlmssp_get_utf16_field(smb2, input_buf, input_len, 4*11, &auth_data->workstation);
         memcpy(&u32, &input_buf[4*15], 4);
 
         smb2_set_user(smb2, auth_data->user);
@@ -1253,9 +1256,9 @@ ntlmssp_authenticate_blob(struct smb2_server *server, struct smb2_context *smb2,
                 temp = input_buf + field_off + 16;
                 temp_len = field_len - 16;
                 if (auth_data->client_challenge) {
-                        free(auth_data->client_challenge);
+                        smb2_free(smb2, auth_data->client_challenge);
                 }
-                auth_data->client_challenge = malloc(8);
+                auth_data->client_challenge = smb2_malloc(smb2, 8);
                 memcpy(auth_data->client_challenge, input_buf + field_off + 32, 8);
         }
         else {
@@ -1263,7 +1266,7 @@ ntlmssp_authenticate_blob(struct smb2_server *server, struct smb2_context *smb2,
                        challenge_len);
                 return -1;
         }
-        if (NTOWFv2(auth_data->user, smb2->password,
+        if (NTOWFv2(smb2, auth_data->user, smb2->password,
                     auth_data->domain, ResponseKeyNT) < 0) {
                 return -1;
         }
@@ -1279,7 +1282,8 @@ ntlmssp_authenticate_blob(struct smb2_server *server, struct smb2_context *smb2,
         temp = auth_data->buf;
         temp_len = auth_data->len;
 
-        smb2_hmac_md5(temp, temp_len, ResponseKeyNT, 16, NTProofStr);
+        smb2_hmac_md5_digest(smb2->crypto, temp, temp_len,
+                             ResponseKeyNT, 16, NTProofStr);
         memcpy(auth_data->buf, NTProofStr, 16);
 
         /* verify ntproof */
@@ -1287,11 +1291,12 @@ ntlmssp_authenticate_blob(struct smb2_server *server, struct smb2_context *smb2,
                 smb2_set_error(smb2, "NTLMSSP NTProof != response. Auth failed");
                 goto fail;
         }
-        smb2_hmac_md5(NTProofStr, 16, ResponseKeyNT, 16, key_exch);
+        smb2_hmac_md5_digest(smb2->crypto, NTProofStr, 16,
+                             ResponseKeyNT, 16, key_exch);
         memcpy(auth_data->exported_session_key, key_exch, 16);
         ret = 0;
 fail:
-        free(auth_data->buf);
+        smb2_free(smb2, auth_data->buf);
         auth_data->buf = NULL;
         auth_data->len = 0;
         return ret;
@@ -1309,7 +1314,7 @@ ntlmssp_get_session_key(struct auth_data *auth,
                 return -1;
         }
 
-        mkey = (uint8_t *) malloc(SMB2_KEY_SIZE);
+        mkey = (uint8_t *) smb2_malloc(auth->smb2, SMB2_KEY_SIZE);
         if (mkey == NULL) {
                 return -1;
         }
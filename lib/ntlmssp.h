@@ -37,7 +37,8 @@ extern "C" {
 struct auth_data;
 
 struct auth_data *
-ntlmssp_init_context(const char *user,
+ntlmssp_init_context(struct smb2_context *smb2,
+                     const char *user,
                      const char *password,
                      const char *domain,
                      const char *workstation,
@@ -80,6 +80,11 @@ smb2_pad_to_64bit(struct smb2_context *smb2, struct smb2_io_vectors *v)
         return 0;
 }
 
+/* We can have thousands of PDUs in flight so make sure they stay small.
+ * This fails to compile if struct smb2_pdu grows past 1kB.
+ */
+typedef char smb2_pdu_size_check[(sizeof(struct smb2_pdu) <= 1024) ? 1 : -1];
+
 #include <stdio.h>
 
 struct smb2_pdu *
@@ -90,10 +95,19 @@ smb2_allocate_pdu(struct smb2_context *smb2, enum smb2_command command,
         struct smb2_header *hdr;
         char magic[4] = {0xFE, 'S', 'M', 'B'};
 
-        pdu = calloc(1, sizeof(struct smb2_pdu));
-        if (pdu == NULL) {
-                smb2_set_error(smb2, "Failed to allocate pdu");
-                return NULL;
+        if (smb2->pdu_cache) {
+                pdu = smb2->pdu_cache;
+                smb2->pdu_cache = pdu->next;
+                smb2->pdu_cache_len--;
+                smb2->pdu_cache_stats.pdu_hits++;
+                memset(pdu, 0, sizeof(struct smb2_pdu));
+        } else {
+                pdu = smb2_calloc(smb2, 1, sizeof(struct smb2_pdu));
+                if (pdu == NULL) {
+                        smb2_set_error(smb2, "Failed to allocate pdu");
+                        return NULL;
+                }
+                smb2->pdu_cache_stats.pdu_misses++;
         }
 
         hdr = &pdu->header;
@@ -156,7 +170,7 @@ smb2_allocate_pdu(struct smb2_context *smb2, enum smb2_command command,
         pdu->out.niov = 0;
 
         if (smb2_add_iovector(smb2, &pdu->out, pdu->hdr, SMB2_HEADER_SIZE, NULL) == NULL) {
-                free(pdu);
+                smb2_free(smb2, pdu);
                 smb2_set_error(smb2, "Too many I/O vectors when adding SMB2 header");
                 return NULL;
         }
@@ -340,11 +354,69 @@ smb2_add_compound_pdu(struct smb2_context *smb2,
         smb2_set_uint32(&next_pdu->out.iov[0], 16, next_pdu->header.flags);
 }
 
+/*
+ * Links a PDU that has a timeout on smb2->timeouts, which is kept ordered
+ * by timeout so that smb2_timeout_pdus() only looks at the head. The
+ * timeout is set when the PDU is allocated so it normally goes at the
+ * tail.
+ */
+static void
+smb2_timeouts_add(struct smb2_context *smb2, struct smb2_pdu *pdu)
+{
+        struct smb2_pdu *prev;
+
+        if (pdu->timeout == 0 || pdu->on_timeouts) {
+                return;
+        }
+        prev = smb2->timeouts.tail;
+        while (prev && prev->timeout > pdu->timeout) {
+                prev = prev->timeout_prev;
+        }
+        pdu->timeout_prev = prev;
+        if (prev) {
+                pdu->timeout_next = prev->timeout_next;
+                prev->timeout_next = pdu;
+        } else {
+                pdu->timeout_next = smb2->timeouts.head;
+                smb2->timeouts.head = pdu;
+        }
+        if (pdu->timeout_next) {
+                pdu->timeout_next->timeout_prev = pdu;
+        } else {
+                smb2->timeouts.tail = pdu;
+        }
+        pdu->on_timeouts = 1;
+}
+
+static void
+smb2_timeouts_remove(struct smb2_context *smb2, struct smb2_pdu *pdu)
+{
+        if (!pdu->on_timeouts) {
+                return;
+        }
+        if (pdu->timeout_prev) {
+                pdu->timeout_prev->timeout_next = pdu->timeout_next;
+        } else {
+                smb2->timeouts.head = pdu->timeout_next;
+        }
+        if (pdu->timeout_next) {
+                pdu->timeout_next->timeout_prev = pdu->timeout_prev;
+        } else {
+                smb2->timeouts.tail = pdu->timeout_prev;
+        }
+        pdu->timeout_next = NULL;
+        pdu->timeout_prev = NULL;
+        pdu->on_timeouts = 0;
+}
+
 void
 smb2_free_pdu(struct smb2_context *smb2, struct smb2_pdu *pdu)
 {
-        SMB2_LIST_REMOVE(&smb2->outqueue, pdu);
-        SMB2_LIST_REMOVE(&smb2->waitqueue, pdu);
+        smb2_outqueue_remove(smb2, pdu);
+        smb2_waitqueue_remove(smb2, pdu);
+        smb2_timeouts_remove(smb2, pdu);
+        /* before the vectors the crypto pool may still be reading from */
+        smb3_put_crypt_buf(smb2, pdu);
 
         if (pdu->next_compound) {
                 smb2_free_pdu(smb2, pdu->next_compound);
@@ -354,16 +426,67 @@ smb2_free_pdu(struct smb2_context *smb2, struct smb2_pdu *pdu)
         smb2_free_iovector(smb2, &pdu->in);
 
         if (pdu->free_cb != NULL) {
-            pdu->free_cb(pdu->cb_data);
+            smb2_call_free_cb(smb2, pdu->free_cb, pdu->cb_data);
         }
         
         if (pdu->free_payload != NULL) {
             pdu->free_payload(smb2, pdu->payload);
         }
 
-        free(pdu->payload);
-        free(pdu->crypt);
-        free(pdu);
+        smb2_free(smb2, pdu->payload);
+
+        if (smb2->pdu_cache_len < SMB2_PDU_CACHE_SIZE) {
+                pdu->next = smb2->pdu_cache;
+                smb2->pdu_cache = pdu;
+                smb2->pdu_cache_len++;
+                return;
+        }
+        smb2_free(smb2, pdu);
+}
+
+void
+smb2_free_pdu_cache(struct smb2_context *smb2)
+{
+        struct smb2_pdu *pdu;
+
+        while ((pdu = smb2->pdu_cache) != NULL) {
+                smb2->pdu_cache = pdu->next;
+                smb2_free(smb2, pdu);
+        }
+        smb2->pdu_cache_len = 0;
+}
+
+/*
+ * Adds a zeroed buffer of len bytes for the fixed part of a request to
+ * pdu->out. Small requests use the buffer embedded in the PDU, so they
+ * are recycled together with the PDU, and only fall back to malloc if
+ * the request is too large or the PDU buffer is already in use.
+ */
+struct smb2_iovec *
+smb2_add_fixed_iovector(struct smb2_context *smb2, struct smb2_pdu *pdu,
+                        size_t len)
+{
+        struct smb2_iovec *iov;
+        uint8_t *buf;
+
+        if (len <= SMB2_PDU_FIXED_SIZE && !pdu->fixed_used) {
+                iov = smb2_add_iovector(smb2, &pdu->out, pdu->fixed, len, NULL);
+                if (iov == NULL) {
+                        return NULL;
+                }
+                pdu->fixed_used = 1;
+                smb2->pdu_cache_stats.buf_hits++;
+                return iov;
+        }
+
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
+        if (buf == NULL) {
+                smb2_set_error(smb2, "Failed to allocate request buffer");
+                return NULL;
+        }
+        smb2->pdu_cache_stats.buf_misses++;
+
+        return smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
 }
 
 int
@@ -573,10 +696,16 @@ smb2_decode_header(struct smb2_context *smb2, struct smb2_iovec *iov,
 static void
 smb2_add_to_outqueue(struct smb2_context *smb2, struct smb2_pdu *pdu)
 {
-        SMB2_LIST_ADD_END(&smb2->outqueue, pdu);
-
-        /* opportunistically try to write it to the socket right away */
-        if (smb2->outqueue == pdu) {
+        SMB2_DLIST_ADD_END(&smb2->outqueue, pdu);
+        pdu->queue = &smb2->outqueue;
+        smb2_timeouts_add(smb2, pdu);
+
+        /* opportunistically try to write it to the socket right away if
+         * the connection is idle. While replies are outstanding we leave
+         * it queued so that everything queued until the next
+         * smb2_service() goes out with a single writev().
+         */
+        if (smb2->outqueue.head == pdu && smb2->waitqueue.head == NULL) {
                 smb2_write_to_socket(smb2);
         }
 
@@ -652,7 +781,7 @@ smb2_correlate_reply(struct smb2_context *smb2, struct smb2_pdu *pdu)
                                pdu->header.flags |= SMB2_FLAGS_ASYNC_COMMAND;
                                pdu->header.async.async_id = req_pdu->header.async.async_id;
                        }
-                       SMB2_LIST_REMOVE(&smb2->waitqueue, req_pdu);
+                       smb2_waitqueue_remove(smb2, req_pdu);
                        smb2_free_pdu(smb2, req_pdu);
                 }
         }
@@ -708,6 +837,18 @@ smb2_queue_pdu(struct smb2_context *smb2, struct smb2_pdu *pdu)
                 }
         }
 
+        /* The server adds its negotiate and intermediate session setup
+         * replies to the preauth hash. This has to happen before the
+         * reply is queued as it may be written and freed right away.
+         */
+        if (smb2_is_server(smb2) &&
+            (pdu->header.command == SMB2_NEGOTIATE ||
+             (pdu->header.command == SMB2_SESSION_SETUP &&
+              pdu->header.status == SMB2_STATUS_MORE_PROCESSING_REQUIRED))) {
+                smb3_update_preauth_hash(smb2, pdu->out.niov,
+                                         &pdu->out.iov[0]);
+        }
+
         smb3_encrypt_pdu(smb2, pdu);
 
         smb2_add_to_outqueue(smb2, pdu);
@@ -768,7 +909,8 @@ smb2_find_pdu(struct smb2_context *smb2,
               uint64_t message_id) {
         struct smb2_pdu *pdu;
 
-        for (pdu = smb2->waitqueue; pdu; pdu = pdu->next) {
+        for (pdu = smb2->waitqueue_hash[smb2_waitqueue_hash(message_id)].head;
+             pdu; pdu = pdu->hash_next) {
                 if (pdu->header.message_id == message_id) {
                         break;
                 }
@@ -776,6 +918,67 @@ smb2_find_pdu(struct smb2_context *smb2,
         return pdu;
 }
 
+void
+smb2_outqueue_remove(struct smb2_context *smb2, struct smb2_pdu *pdu)
+{
+        if (pdu->queue != &smb2->outqueue) {
+                return;
+        }
+        SMB2_DLIST_REMOVE(&smb2->outqueue, pdu);
+        pdu->queue = NULL;
+}
+
+void
+smb2_waitqueue_add(struct smb2_context *smb2, struct smb2_pdu *pdu)
+{
+        struct smb2_pdu_queue *bucket;
+
+        SMB2_DLIST_ADD_END(&smb2->waitqueue, pdu);
+        pdu->queue = &smb2->waitqueue;
+        smb2_timeouts_add(smb2, pdu);
+
+        /* Append to the end of the bucket so that if we ever see a
+         * duplicate message id we will match the oldest request first,
+         * same as a walk of the waitqueue would.
+         */
+        bucket = &smb2->waitqueue_hash[smb2_waitqueue_hash(pdu->header.message_id)];
+        pdu->hash_next = NULL;
+        pdu->hash_prev = bucket->tail;
+        if (bucket->tail) {
+                bucket->tail->hash_next = pdu;
+        } else {
+                bucket->head = pdu;
+        }
+        bucket->tail = pdu;
+}
+
+void
+smb2_waitqueue_remove(struct smb2_context *smb2, struct smb2_pdu *pdu)
+{
+        struct smb2_pdu_queue *bucket;
+
+        if (pdu->queue != &smb2->waitqueue) {
+                return;
+        }
+
+        bucket = &smb2->waitqueue_hash[smb2_waitqueue_hash(pdu->header.message_id)];
+        if (pdu->hash_prev) {
+                pdu->hash_prev->hash_next = pdu->hash_next;
+        } else {
+                bucket->head = pdu->hash_next;
+        }
+        if (pdu->hash_next) {
+                pdu->hash_next->hash_prev = pdu->hash_prev;
+        } else {
+                bucket->tail = pdu->hash_prev;
+        }
+        pdu->hash_next = NULL;
+        pdu->hash_prev = NULL;
+
+        SMB2_DLIST_REMOVE(&smb2->waitqueue, pdu);
+        pdu->queue = NULL;
+}
+
 static int
 smb2_is_error_response(struct smb2_context *smb2,
                        struct smb2_pdu *pdu) {
@@ -1129,31 +1332,22 @@ smb2_process_payload_variable(struct smb2_context *smb2, struct smb2_pdu *pdu)
 
 void smb2_timeout_pdus(struct smb2_context *smb2)
 {
-        struct smb2_pdu *pdu, *next;
+        struct smb2_pdu *pdu;
         time_t t = time(NULL);
 
-        pdu = smb2->outqueue;
-        while (pdu) {
-                next = pdu->next;
-                if (pdu->timeout && pdu->timeout < t) {
-                        SMB2_LIST_REMOVE(&smb2->outqueue, pdu);
-                        pdu->cb(smb2, SMB2_STATUS_IO_TIMEOUT, NULL,
-                                pdu->cb_data);
-                        smb2_free_pdu(smb2, pdu);
-                }
-                pdu = next;
-        }
-
-        pdu = smb2->waitqueue;
-        while (pdu) {
-                next = pdu->next;
-                if (pdu->timeout && pdu->timeout < t) {
-                        SMB2_LIST_REMOVE(&smb2->waitqueue, pdu);
-                        pdu->cb(smb2, SMB2_STATUS_IO_TIMEOUT, NULL,
-                                pdu->cb_data);
-                        smb2_free_pdu(smb2, pdu);
+        while ((pdu = smb2->timeouts.head) != NULL &&
+               pdu->timeout < t) {
+                smb2_timeouts_remove(smb2, pdu);
+                if (pdu->queue == &smb2->outqueue) {
+                        smb2_outqueue_remove(smb2, pdu);
+                } else if (pdu->queue == &smb2->waitqueue) {
+                        smb2_waitqueue_remove(smb2, pdu);
+                } else {
+                        /* no longer queued, its reply is being handled */
+                        continue;
                 }
-                pdu = next;
+                pdu->cb(smb2, SMB2_STATUS_IO_TIMEOUT, NULL, pdu->cb_data);
+                smb2_free_pdu(smb2, pdu);
         }
 }
 
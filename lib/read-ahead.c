@@ -0,0 +1,614 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef STDC_HEADERS
+#include <stddef.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#include <errno.h>
+
+#include "compat.h"
+
+#include "slist.h"
+#include "smb2.h"
+#include "libsmb2.h"
+#include "libsmb2-raw.h"
+#include "libsmb2-private.h"
+#include "read-ahead.h"
+
+/*
+ * Once a handle is read sequentially the data that follows is read in
+ * chunks, ahead of the application, into a ring of buffers. Reads are
+ * then served from the ring, or wait for the chunk that will hold their
+ * data if it is still in flight.
+ *
+ * The number of chunks kept ahead of the application, the window, is
+ * adjusted to the data that the application consumes during one round
+ * trip. It grows whenever the application had to wait for a chunk and
+ * shrinks slowly when it is larger than needed.
+ */
+
+/* Largest read that a single chunk is read with */
+#define RA_MAX_CHUNK (1024 * 1024)
+#define RA_MIN_CHUNK 4096
+
+/* Sequential reads in a row before we start to read ahead */
+#define RA_SEQUENTIAL 1
+
+struct ra_chunk {
+        /* on the free list */
+        struct ra_chunk *next;
+        /* NULL once the chunk was dropped while it was in flight, the
+         * callback then frees it.
+         */
+        struct smb2_read_ahead *ra;
+        uint64_t offset;
+        /* bytes asked for and bytes read */
+        uint32_t size;
+        uint32_t len;
+        int ready;
+        /* 0 or -errno */
+        int status;
+        uint64_t issued;
+        uint8_t buf[1];
+};
+
+/* A read from the application that is waiting for a chunk */
+struct ra_waiter {
+        struct ra_waiter *next;
+        smb2_command_cb cb;
+        void *cb_data;
+        struct smb2_read_cb_data read_cb_data;
+        uint32_t copied;
+};
+
+struct smb2_read_ahead {
+        struct smb2_read_ahead *next;
+        /* NULL once the handle is closed */
+        struct smb2fh *fh;
+
+        uint32_t chunk_size;
+        int num_chunks;
+        int window;
+
+        /* chunks for consecutive file ranges, oldest first */
+        struct ra_chunk **ring;
+        int head;
+        int count;
+        struct ra_chunk *free_chunks;
+        /* where the next chunk is read from */
+        uint64_t next_offset;
+        /* a chunk came back short */
+        int eof;
+
+        /* end of the last read of the application */
+        uint64_t last_end;
+        int sequential;
+
+        struct ra_waiter *waiters;
+        struct ra_waiter *waiters_tail;
+        /* a waiter found its chunk still in flight */
+        int stalled;
+
+        /* smoothed round trip time in us and consumption in bytes/s */
+        uint64_t rtt;
+        uint64_t rate;
+        uint64_t rate_start;
+        uint64_t rate_bytes;
+
+        /* callbacks are being invoked, freeing has to wait */
+        int serving;
+        int freed;
+};
+
+static void ra_serve(struct smb2_context *smb2, struct smb2_read_ahead *ra);
+
+static struct ra_chunk *
+ra_at(struct smb2_read_ahead *ra, int i)
+{
+        return ra->ring[(ra->head + i) % ra->num_chunks];
+}
+
+static void
+ra_pop(struct smb2_read_ahead *ra)
+{
+        struct ra_chunk *c = ra_at(ra, 0);
+
+        c->next = ra->free_chunks;
+        ra->free_chunks = c;
+        ra->head = (ra->head + 1) % ra->num_chunks;
+        ra->count--;
+}
+
+/* Drops every chunk, the ones in flight are freed by their callback */
+static void
+ra_drop(struct smb2_read_ahead *ra)
+{
+        struct ra_chunk *c;
+        int i;
+
+        for (i = 0; i < ra->count; i++) {
+                c = ra_at(ra, i);
+                if (c->ready) {
+                        c->next = ra->free_chunks;
+                        ra->free_chunks = c;
+                } else {
+                        c->ra = NULL;
+                }
+        }
+        ra->head = 0;
+        ra->count = 0;
+        ra->eof = 0;
+}
+
+static void
+ra_adapt(struct smb2_read_ahead *ra)
+{
+        uint64_t now = smb2_monotonic_usec();
+        uint64_t dt = now - ra->rate_start;
+        uint64_t rate, need;
+        int target;
+
+        /* measure over at least 10ms and one round trip */
+        if (dt >= 10000 && dt >= ra->rtt) {
+                rate = ra->rate_bytes * 1000000 / dt;
+                ra->rate = ra->rate ? (ra->rate * 3 + rate) / 4 : rate;
+                ra->rate_start = now;
+                ra->rate_bytes = 0;
+        }
+
+        /* what is consumed during a round trip, twice over for jitter */
+        need = 2 * ra->rate * ra->rtt / 1000000;
+        target = (int)(need / ra->chunk_size) + 1;
+        if (ra->stalled) {
+                if (target <= ra->window) {
+                        target = ra->window + 1;
+                }
+                ra->stalled = 0;
+        }
+        if (target > ra->num_chunks) {
+                target = ra->num_chunks;
+        }
+        if (target > ra->window) {
+                ra->window = target;
+        } else if (target < ra->window) {
+                ra->window--;
+        }
+}
+
+static void
+ra_chunk_cb(struct smb2_context *smb2, int status,
+            void *command_data, void *private_data)
+{
+        struct ra_chunk *c = private_data;
+        struct smb2_read_ahead *ra = c->ra;
+        struct smb2_read_reply *rep = command_data;
+        uint64_t rtt;
+
+        if (ra == NULL) {
+                smb2_free(smb2, c);
+                return;
+        }
+
+        c->ready = 1;
+        if (status == SMB2_STATUS_END_OF_FILE) {
+                c->len = 0;
+        } else if (status) {
+                smb2_set_nterror(smb2, status, "Read failed with (0x%08x) %s",
+                               status, nterror_to_str(status));
+                c->status = -nterror_to_errno(status);
+        } else {
+                c->len = rep->data_length;
+                if (c->len > c->size) {
+                        c->len = c->size;
+                }
+        }
+        if (c->status == 0 && c->len < c->size) {
+                ra->eof = 1;
+        }
+
+        rtt = smb2_monotonic_usec() - c->issued;
+        ra->rtt = ra->rtt ? (ra->rtt * 7 + rtt) / 8 : rtt;
+        ra_adapt(ra);
+
+        ra_serve(smb2, ra);
+}
+
+/* Reads chunks ahead until the window is full, returns -errno if a
+ * chunk could not be issued.
+ */
+static int
+ra_fill(struct smb2_context *smb2, struct smb2_read_ahead *ra)
+{
+        struct smb2_read_request req;
+        struct smb2_pdu *pdu;
+        struct ra_chunk *c;
+        uint32_t size;
+
+        if (ra->fh == NULL || ra->freed || ra->eof) {
+                return 0;
+        }
+        /* the context is being torn down */
+        if (!SMB2_VALID_SOCKET(smb2->fd)) {
+                return -EIO;
+        }
+        while (ra->count < ra->window) {
+                size = smb2_max_io_size(smb2, ra->chunk_size);
+                if (size == 0) {
+                        size = ra->chunk_size;
+                }
+
+                c = ra->free_chunks;
+                if (c) {
+                        ra->free_chunks = c->next;
+                } else {
+                        c = smb2_malloc(smb2, offsetof(struct ra_chunk, buf) +
+                                        ra->chunk_size);
+                        if (c == NULL) {
+                                return -ENOMEM;
+                        }
+                }
+                c->ra = ra;
+                c->offset = ra->next_offset;
+                c->size = size;
+                c->len = 0;
+                c->ready = 0;
+                c->status = 0;
+                c->issued = smb2_monotonic_usec();
+
+                memset(&req, 0, sizeof(struct smb2_read_request));
+                req.length = size;
+                req.offset = c->offset;
+                req.buf = c->buf;
+                memcpy(req.file_id, ra->fh->file_id, SMB2_FD_SIZE);
+                req.channel = SMB2_CHANNEL_NONE;
+
+                pdu = smb2_cmd_read_async(smb2, &req, ra_chunk_cb, c);
+                if (pdu == NULL) {
+                        c->next = ra->free_chunks;
+                        ra->free_chunks = c;
+                        return -ENOMEM;
+                }
+                ra->ring[(ra->head + ra->count) % ra->num_chunks] = c;
+                ra->count++;
+                ra->next_offset += size;
+                smb2_queue_pdu(smb2, pdu);
+        }
+        return 0;
+}
+
+static void
+ra_complete(struct smb2_context *smb2, struct smb2_read_ahead *ra,
+            int status)
+{
+        struct ra_waiter *w = ra->waiters;
+
+        ra->waiters = w->next;
+        if (ra->waiters == NULL) {
+                ra->waiters_tail = NULL;
+        }
+        if (status > 0 && ra->fh) {
+                ra->fh->offset = w->read_cb_data.offset + status;
+        }
+        w->cb(smb2, status, &w->read_cb_data, w->cb_data);
+        smb2_free(smb2, w);
+}
+
+static void
+ra_release(struct smb2_context *smb2, struct smb2_read_ahead *ra)
+{
+        struct ra_chunk *c;
+
+        while ((c = ra->free_chunks) != NULL) {
+                ra->free_chunks = c->next;
+                smb2_free(smb2, c);
+        }
+        smb2_free(smb2, ra->ring);
+        smb2_free(smb2, ra);
+}
+
+/* Copies whatever the waiting reads can get from the ring */
+static void
+ra_serve(struct smb2_context *smb2, struct smb2_read_ahead *ra)
+{
+        struct ra_waiter *w;
+        struct ra_chunk *c;
+        uint64_t pos;
+        uint32_t n;
+        int i, err;
+
+        ra->serving++;
+        while (!ra->freed && (w = ra->waiters) != NULL) {
+                pos = w->read_cb_data.offset + w->copied;
+
+                /* recycle the chunks that have been consumed */
+                while (ra->count && ra_at(ra, 0)->ready &&
+                       ra_at(ra, 0)->offset + ra_at(ra, 0)->size <= pos) {
+                        ra_pop(ra);
+                }
+
+                c = NULL;
+                for (i = 0; i < ra->count; i++) {
+                        if (pos >= ra_at(ra, i)->offset &&
+                            pos < ra_at(ra, i)->offset + ra_at(ra, i)->size) {
+                                c = ra_at(ra, i);
+                                break;
+                        }
+                }
+                if (c == NULL) {
+                        if (ra->eof && pos >= ra->next_offset) {
+                                ra_complete(smb2, ra, w->copied);
+                                continue;
+                        }
+                        if (pos != ra->next_offset) {
+                                ra_drop(ra);
+                                ra->next_offset = pos;
+                        }
+                        err = ra_fill(smb2, ra);
+                        if (ra->count == 0) {
+                                ra_complete(smb2, ra, w->copied ?
+                                            (int)w->copied :
+                                            (err ? err : -EIO));
+                        }
+                        continue;
+                }
+                if (!c->ready) {
+                        ra->stalled = 1;
+                        break;
+                }
+                if (c->status < 0) {
+                        ra_complete(smb2, ra, w->copied ?
+                                    (int)w->copied : c->status);
+                        /* the next read tries again */
+                        ra_drop(ra);
+                        continue;
+                }
+                if (pos >= c->offset + c->len) {
+                        /* end of file, it may have grown by the next read */
+                        ra_complete(smb2, ra, w->copied);
+                        ra_drop(ra);
+                        continue;
+                }
+
+                n = (uint32_t)(c->offset + c->len - pos);
+                if (n > w->read_cb_data.count - w->copied) {
+                        n = w->read_cb_data.count - w->copied;
+                }
+                memcpy(w->read_cb_data.buf + w->copied,
+                       c->buf + (pos - c->offset), n);
+                w->copied += n;
+                ra->rate_bytes += n;
+                if (w->copied == w->read_cb_data.count) {
+                        ra_complete(smb2, ra, w->copied);
+                }
+        }
+        ra->serving--;
+
+        if (ra->freed) {
+                if (ra->serving == 0) {
+                        ra_release(smb2, ra);
+                }
+                return;
+        }
+        if (ra->waiters == NULL) {
+                while (ra->count && ra_at(ra, 0)->ready &&
+                       ra_at(ra, 0)->offset + ra_at(ra, 0)->size <=
+                       ra->last_end) {
+                        ra_pop(ra);
+                }
+        }
+        ra_fill(smb2, ra);
+}
+
+int
+smb2_ra_pread(struct smb2_context *smb2, struct smb2fh *fh,
+              uint8_t *buf, uint32_t count, uint64_t offset,
+              smb2_command_cb cb, void *cb_data)
+{
+        struct smb2_read_ahead *ra = fh->ra;
+        struct ra_waiter *w;
+        uint64_t start;
+
+        if (offset == ra->last_end) {
+                ra->sequential++;
+        } else {
+                ra->sequential = 0;
+        }
+        ra->last_end = offset + count;
+
+        start = ra->count ? ra_at(ra, 0)->offset : ra->next_offset;
+        if ((ra->count == 0 && ra->waiters == NULL) ||
+            offset < start || offset > ra->next_offset) {
+                if (ra->waiters || ra->sequential < RA_SEQUENTIAL) {
+                        /* not sequential, read it as usual */
+                        if (ra->waiters == NULL) {
+                                ra_drop(ra);
+                        }
+                        return 1;
+                }
+                ra_drop(ra);
+                ra->next_offset = offset;
+        }
+
+        w = smb2_calloc(smb2, 1, sizeof(struct ra_waiter));
+        if (w == NULL) {
+                smb2_set_error(smb2, "Failed to allocate ra_waiter");
+                return -ENOMEM;
+        }
+        w->cb = cb;
+        w->cb_data = cb_data;
+        w->read_cb_data.fh = fh;
+        w->read_cb_data.buf = buf;
+        w->read_cb_data.count = count;
+        w->read_cb_data.offset = offset;
+        if (ra->waiters_tail) {
+                ra->waiters_tail->next = w;
+        } else {
+                ra->waiters = w;
+        }
+        ra->waiters_tail = w;
+
+        ra_serve(smb2, ra);
+        return 0;
+}
+
+void
+smb2_ra_invalidate(struct smb2_context *smb2, struct smb2_read_ahead *ra)
+{
+        ra_drop(ra);
+        if (ra->waiters) {
+                /* read what they are waiting for again */
+                ra->next_offset = ra->waiters->read_cb_data.offset +
+                        ra->waiters->copied;
+                ra_fill(smb2, ra);
+        }
+}
+
+void
+smb2_ra_free(struct smb2_context *smb2, struct smb2_read_ahead *ra)
+{
+        SMB2_LIST_REMOVE(&smb2->read_aheads, ra);
+        ra->fh = NULL;
+        ra->freed = 1;
+        ra_drop(ra);
+
+        ra->serving++;
+        while (ra->waiters) {
+                ra_complete(smb2, ra, -EBADF);
+        }
+        ra->serving--;
+
+        if (ra->serving == 0) {
+                ra_release(smb2, ra);
+        }
+}
+
+void
+smb2_ra_break(struct smb2_context *smb2,
+              struct smb2_oplock_or_lease_break_reply *rep)
+{
+        struct smb2_read_ahead *ra;
+
+        for (ra = smb2->read_aheads; ra; ra = ra->next) {
+                if (smb2_fh_break_matches(ra->fh, rep)) {
+                        smb2_ra_invalidate(smb2, ra);
+                }
+        }
+}
+
+void
+smb2_ra_destroy_all(struct smb2_context *smb2)
+{
+        struct smb2_read_ahead *ra;
+
+        while ((ra = smb2->read_aheads) != NULL) {
+                ra->fh->ra = NULL;
+                smb2_ra_free(smb2, ra);
+        }
+}
+
+int
+smb2_set_read_ahead(struct smb2_context *smb2, struct smb2fh *fh,
+                    uint32_t max_bytes)
+{
+        struct smb2_read_ahead *ra;
+        uint32_t chunk_size;
+        int num_chunks;
+
+        if (smb2 == NULL) {
+                return -EINVAL;
+        }
+        if (fh == NULL) {
+                smb2_set_error(smb2, "File handle was NULL");
+                return -EINVAL;
+        }
+        if (fh->ra) {
+                if (fh->ra->waiters) {
+                        smb2_set_error(smb2, "Reads are waiting for the "
+                                       "read-ahead");
+                        return -EBUSY;
+                }
+                smb2_ra_free(smb2, fh->ra);
+                fh->ra = NULL;
+        }
+        if (max_bytes == 0) {
+                return 0;
+        }
+
+        chunk_size = smb2->max_read_size ? smb2->max_read_size : 65536;
+        if (chunk_size > RA_MAX_CHUNK) {
+                chunk_size = RA_MAX_CHUNK;
+        }
+        if (chunk_size > max_bytes / 2) {
+                chunk_size = max_bytes / 2;
+        }
+        if (chunk_size < RA_MIN_CHUNK) {
+                chunk_size = RA_MIN_CHUNK;
+        }
+        num_chunks = max_bytes / chunk_size;
+        if (num_chunks < 2) {
+                num_chunks = 2;
+        }
+
+        ra = smb2_calloc(smb2, 1, sizeof(struct smb2_read_ahead));
+        if (ra == NULL) {
+                smb2_set_error(smb2, "Failed to allocate read-ahead");
+                return -ENOMEM;
+        }
+        ra->ring = smb2_calloc(smb2, num_chunks, sizeof(struct ra_chunk *));
+        if (ra->ring == NULL) {
+                smb2_set_error(smb2, "Failed to allocate read-ahead");
+                smb2_free(smb2, ra);
+                return -ENOMEM;
+        }
+        ra->fh = fh;
+        ra->chunk_size = chunk_size;
+        ra->num_chunks = num_chunks;
+        ra->window = 2;
+        ra->rate_start = smb2_monotonic_usec();
+        /* so that reading on from the current offset is sequential */
+        ra->last_end = fh->offset;
+        ra->next_offset = fh->offset;
+
+        SMB2_LIST_ADD(&smb2->read_aheads, ra);
+        fh->ra = ra;
+        return 0;
+}
@@ -0,0 +1,57 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _READ_AHEAD_H_
+#define _READ_AHEAD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sequential read-ahead for a file handle, see smb2_set_read_ahead().
+ */
+
+/*
+ * Called by smb2_pread_async() for a handle with read-ahead.
+ * Returns 0 if the read is served from the read-ahead buffers, in which
+ * case the callback may be invoked before this returns, 1 if the read
+ * is not sequential and should be sent as usual, or -errno.
+ */
+int smb2_ra_pread(struct smb2_context *smb2, struct smb2fh *fh,
+                  uint8_t *buf, uint32_t count, uint64_t offset,
+                  smb2_command_cb cb, void *cb_data);
+
+/* Drops all data that has been read ahead, for example on a write */
+void smb2_ra_invalidate(struct smb2_context *smb2, struct smb2_read_ahead *ra);
+
+/* Called when the handle is closed */
+void smb2_ra_free(struct smb2_context *smb2, struct smb2_read_ahead *ra);
+
+/* Drops the data of the handles that a lease or oplock break is for */
+void smb2_ra_break(struct smb2_context *smb2,
+                   struct smb2_oplock_or_lease_break_reply *rep);
+
+/* Frees the read-ahead of all handles, once all PDUs are gone */
+void smb2_ra_destroy_all(struct smb2_context *smb2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _READ_AHEAD_H_ */
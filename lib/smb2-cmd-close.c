@@ -61,17 +61,10 @@ smb2_encode_close_request(struct smb2_context *smb2,
                           struct smb2_close_request *req)
 {
         int len;
-        uint8_t *buf;
         struct smb2_iovec *iov;
 
         len = SMB2_CLOSE_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
-        if (buf == NULL) {
-                smb2_set_error(smb2, "Failed to allocate close buffer");
-                return -1;
-        }
-
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_fixed_iovector(smb2, pdu, len);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for close request");
                 return -1;
@@ -119,13 +112,13 @@ smb2_encode_close_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_CLOSE_REPLY_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate close reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for close reply");
                 return -1;
@@ -188,7 +181,7 @@ smb2_process_close_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate close reply");
                 return -1;
@@ -225,7 +218,7 @@ smb2_process_close_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate close request");
                 return -1;
@@ -70,13 +70,7 @@ smb2_encode_create_request(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_CREATE_REQUEST_SIZE & 0xfffe;
-        buf = calloc(len, sizeof(uint8_t));
-        if (buf == NULL) {
-                smb2_set_error(smb2, "Failed to allocate create buffer");
-                return -1;
-        }
-
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_fixed_iovector(smb2, pdu, len);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for create request");
                 return -1;
@@ -84,7 +78,7 @@ smb2_encode_create_request(struct smb2_context *smb2,
 
         /* Name */
         if (req->name && req->name[0]) {
-                name = smb2_utf8_to_utf16(req->name);
+                name = smb2_ctx_utf8_to_utf16(smb2, req->name);
                 if (name == NULL) {
                         smb2_set_error(smb2, "Could not convert name into UTF-16");
                         return -1;
@@ -126,10 +120,10 @@ smb2_encode_create_request(struct smb2_context *smb2,
         /* Name */
         if (name) {
                 len = PAD_TO_64BIT(name_byte_len);
-                buf = malloc(len);
+                buf = smb2_malloc(smb2, len);
                 if (buf == NULL) {
                         smb2_set_error(smb2, "Failed to allocate create name");
-                        free(name);
+                        smb2_free(smb2, name);
                         return -1;
                 }
                 memcpy(buf, &name->val[0], name_byte_len);
@@ -137,7 +131,7 @@ smb2_encode_create_request(struct smb2_context *smb2,
                 iov = smb2_add_iovector(smb2, &pdu->out,
                                         buf,
                                         len,
-                                        free);
+                                        smb2_free_cb);
                 if (iov == NULL) {
                         smb2_set_error(smb2, "Failed to add iovector for create name");
                         return -1;
@@ -149,7 +143,7 @@ smb2_encode_create_request(struct smb2_context *smb2,
                                 smb2_set_uint16(iov, i * 2, 0x005c);
                         }
                 }
-                free(name);
+                smb2_free(smb2, name);
         }
         else {
                 /* have to have at least one byte for name even if len is 0
@@ -166,7 +160,7 @@ smb2_encode_create_request(struct smb2_context *smb2,
         /* Create Context: note there is no encoding, we just pass along */
         if (req->create_context_length) {
                 len = PAD_TO_64BIT(req->create_context_length);
-                buf = malloc(len);
+                buf = smb2_malloc(smb2, len);
                 if (buf == NULL) {
                         smb2_set_error(smb2, "Failed to allocate create context");
                         return -1;
@@ -176,7 +170,7 @@ smb2_encode_create_request(struct smb2_context *smb2,
                 iov = smb2_add_iovector(smb2, &pdu->out,
                                         buf,
                                         len,
-                                        free);
+                                        smb2_free_cb);
                 if (iov == NULL) {
                         smb2_set_error(smb2, "Failed to add iovector for create context");
                         return -1;
@@ -221,13 +215,13 @@ smb2_encode_create_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_CREATE_REPLY_SIZE & 0xfffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate create buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for create reply");
                 return -1;
@@ -252,7 +246,7 @@ smb2_encode_create_reply(struct smb2_context *smb2,
         /* Create Context */
         if (rep->create_context_length) {
                 len = PAD_TO_64BIT(rep->create_context_length);
-                buf = malloc(len);
+                buf = smb2_malloc(smb2, len);
                 if (buf == NULL) {
                         smb2_set_error(smb2, "Failed to allocate create context");
                         return -1;
@@ -262,7 +256,7 @@ smb2_encode_create_reply(struct smb2_context *smb2,
                 iov = smb2_add_iovector(smb2, &pdu->out,
                                         buf,
                                         len,
-                                        free);
+                                        smb2_free_cb);
                 if (iov == NULL) {
                         smb2_set_error(smb2, "Failed to add iovector for create reply context");
                         return -1;
@@ -318,7 +312,7 @@ smb2_process_create_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate create reply");
                 return -1;
@@ -348,7 +342,7 @@ smb2_process_create_fixed(struct smb2_context *smb2,
                 smb2_set_error(smb2, "Create context overlaps with "
                                "reply header");
                 pdu->payload = NULL;
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
 
@@ -399,7 +393,7 @@ smb2_process_create_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req== NULL) {
                 smb2_set_error(smb2, "Failed to allocate create request");
                 return -1;
@@ -433,7 +427,7 @@ smb2_process_create_request_fixed(struct smb2_context *smb2,
                         smb2_set_error(smb2, "name overlaps with "
                                        "request header");
                         pdu->payload = NULL;
-                        free(req);
+                        smb2_free(smb2, req);
                         return -1;
                 }
         }
@@ -444,7 +438,7 @@ smb2_process_create_request_fixed(struct smb2_context *smb2,
                         smb2_set_error(smb2, "Create context overlaps with "
                                        "request header");
                         pdu->payload = NULL;
-                        free(req);
+                        smb2_free(smb2, req);
                         return -1;
                 }
         }
@@ -474,14 +468,14 @@ smb2_process_create_request_variable(struct smb2_context *smb2,
 
         req->name = NULL;
         if (req->name_length > 0) {
-                req->name = smb2_utf16_to_utf8((const uint16_t *)(void *)iov->buf, req->name_length / 2);
+                req->name = smb2_ctx_utf16_to_utf8(smb2, (const uint16_t *)(void *)iov->buf, req->name_length / 2);
                 if (req->name) {
                         name_byte_len = strlen(req->name) + 1;
                         ptr = smb2_alloc_init(smb2, name_byte_len);
                         if (ptr) {
                                 memcpy(ptr, req->name, name_byte_len);
                         }
-                        free(discard_const(req->name));
+                        smb2_free(smb2, discard_const(req->name));
                         req->name = ptr;
                         if (!ptr) {
                                 smb2_set_error(smb2, "can not alloc name buffer");
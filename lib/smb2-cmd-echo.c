@@ -63,13 +63,13 @@ smb2_encode_echo_request(struct smb2_context *smb2,
 
         len = SMB2_ECHO_REQUEST_SIZE;
 
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate echo buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for echo request");
                 return -1;
@@ -114,13 +114,13 @@ smb2_encode_echo_reply(struct smb2_context *smb2,
 
         len = SMB2_ECHO_REPLY_SIZE;
 
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate echo buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for echo reply");
                 return -1;
@@ -191,7 +191,7 @@ smb2_process_echo_request_fixed(struct smb2_context *smb2,
                                (int)iov->len);
                 return -1;
         }
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate echo request");
                 return -1;
@@ -65,13 +65,13 @@ smb2_encode_error_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_ERROR_REPLY_SIZE;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate error buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for error reply");
                 return -1;
@@ -130,7 +130,7 @@ smb2_process_error_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate error reply");
                 return -1;
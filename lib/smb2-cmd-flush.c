@@ -65,13 +65,13 @@ smb2_encode_flush_request(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_FLUSH_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate flush buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 /* buf freed by add_iovector on failure */
                 return -1;
@@ -117,13 +117,13 @@ smb2_encode_flush_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_FLUSH_REPLY_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate flush reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 return -1;
         }
@@ -194,7 +194,7 @@ smb2_process_flush_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate flush request");
                 return -1;
@@ -53,6 +53,7 @@
 
 #include "smb2.h"
 #include "libsmb2.h"
+#include "libsmb2-raw.h"
 #include "libsmb2-private.h"
 
 static int
@@ -65,13 +66,13 @@ smb2_encode_ioctl_request(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_IOCTL_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate ioctl buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 return -1;
         }
@@ -127,21 +128,22 @@ smb2_encode_ioctl_reply(struct smb2_context *smb2,
                           struct smb2_pdu *pdu,
                           struct smb2_ioctl_reply *rep)
 {
-        int len;
+        int len, cmd;
         uint8_t *buf;
         struct smb2_iovec *iov, *ioctlv;
 
         len = SMB2_IOCTL_REPLY_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate ioctl reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 return -1;
         }
+        cmd = pdu->out.niov - 1;
 
         ioctlv = NULL;
         if (rep->output_count) {
@@ -151,6 +153,15 @@ smb2_encode_ioctl_reply(struct smb2_context *smb2,
                         */
                         len = SMB2_IOCTL_VALIDIATE_NEGOTIATE_INFO_SIZE;
                         break;
+                case SMB2_FSCTL_SRV_REQUEST_RESUME_KEY:
+                        len = smb2->passthrough ? rep->output_count :
+                                SMB2_SRV_REQUEST_RESUME_KEY_SIZE;
+                        break;
+                case SMB2_FSCTL_SRV_COPYCHUNK:
+                case SMB2_FSCTL_SRV_COPYCHUNK_WRITE:
+                        len = smb2->passthrough ? rep->output_count :
+                                SMB2_SRV_COPYCHUNK_RESPONSE_SIZE;
+                        break;
                 default:
                         if (smb2->passthrough) {
                                 /* assume the replys output is already coded */
@@ -163,13 +174,13 @@ smb2_encode_ioctl_reply(struct smb2_context *smb2,
                         }
                         break;
                 }
-                buf = malloc(PAD_TO_64BIT(len));
+                buf = smb2_malloc(smb2, PAD_TO_64BIT(len));
                 if (buf == NULL) {
                         smb2_set_error(smb2, "Failed to allocate ioctl output");
                         return -1;
                 }
                 memset(buf, 0, rep->output_count);
-                ioctlv = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+                ioctlv = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
                 if (ioctlv == NULL) {
                         return -1;
                 }
@@ -187,6 +198,37 @@ smb2_encode_ioctl_reply(struct smb2_context *smb2,
                         smb2_set_uint16(ioctlv, 22, info->dialect);
                         break;
                 }
+                case SMB2_FSCTL_SRV_REQUEST_RESUME_KEY:
+                {
+                        struct smb2_srv_request_resume_key *key =
+                                (struct smb2_srv_request_resume_key *)
+                                        rep->output;
+
+                        if (smb2->passthrough) {
+                                memcpy(buf, rep->output, rep->output_count);
+                                break;
+                        }
+                        memset(buf, 0, len);
+                        memcpy(buf, key->resume_key, SMB2_RESUME_KEY_SIZE);
+                        /* context length, 0 */
+                        break;
+                }
+                case SMB2_FSCTL_SRV_COPYCHUNK:
+                case SMB2_FSCTL_SRV_COPYCHUNK_WRITE:
+                {
+                        struct smb2_srv_copychunk_response *cc =
+                                (struct smb2_srv_copychunk_response *)
+                                        rep->output;
+
+                        if (smb2->passthrough) {
+                                memcpy(buf, rep->output, rep->output_count);
+                                break;
+                        }
+                        smb2_set_uint32(ioctlv, 0, cc->chunks_written);
+                        smb2_set_uint32(ioctlv, 4, cc->chunk_bytes_written);
+                        smb2_set_uint32(ioctlv, 8, cc->total_bytes_written);
+                        break;
+                }
                 default:
                         if (smb2->passthrough) {
                                 memcpy(buf, rep->output, rep->output_count);
@@ -201,6 +243,8 @@ smb2_encode_ioctl_reply(struct smb2_context *smb2,
                 }
         }
 
+        /* adding the output may have moved the vectors */
+        iov = &pdu->out.iov[cmd];
         smb2_set_uint16(iov, 0, SMB2_IOCTL_REPLY_SIZE);
         smb2_set_uint32(iov, 4, rep->ctl_code);
         memcpy(iov->buf + 8, rep->file_id, SMB2_FD_SIZE);
@@ -265,7 +309,7 @@ smb2_process_ioctl_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate ioctl reply");
                 return -1;
@@ -289,7 +333,7 @@ smb2_process_ioctl_fixed(struct smb2_context *smb2,
                 smb2_set_error(smb2, "Output buffer overlaps with "
                                "Ioctl reply header");
                 pdu->payload = NULL;
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
 
@@ -362,7 +406,7 @@ smb2_process_ioctl_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate ioctl request");
                 return -1;
@@ -388,7 +432,7 @@ smb2_process_ioctl_request_fixed(struct smb2_context *smb2,
                 smb2_set_error(smb2, "Output buffer overlaps with "
                                "Ioctl request header");
                 pdu->payload = NULL;
-                free(req);
+                smb2_free(smb2, req);
                 return -1;
         }
 
@@ -398,6 +442,52 @@ smb2_process_ioctl_request_fixed(struct smb2_context *smb2,
         return IOVREQ_OFFSET + req->input_count;
 }
 
+static struct smb2_srv_copychunk_copy *
+smb2_decode_srv_copychunk_copy(struct smb2_context *smb2,
+                               struct smb2_iovec *vec, uint32_t len)
+{
+        struct smb2_srv_copychunk_copy *copy;
+        struct smb2_srv_copychunk *chunk;
+        uint32_t i, offset;
+
+        if (len > vec->len || len < SMB2_SRV_COPYCHUNK_COPY_SIZE) {
+                smb2_set_error(smb2, "Copychunk request too short");
+                return NULL;
+        }
+        copy = smb2_alloc_init(smb2, sizeof(struct smb2_srv_copychunk_copy));
+        if (copy == NULL) {
+                smb2_set_error(smb2, "Failed to allocate copychunk request");
+                return NULL;
+        }
+        memcpy(copy->source_key, vec->buf, SMB2_RESUME_KEY_SIZE);
+        smb2_get_uint32(vec, 24, &copy->chunk_count);
+        if (copy->chunk_count > (len - SMB2_SRV_COPYCHUNK_COPY_SIZE) /
+            SMB2_SRV_COPYCHUNK_SIZE) {
+                smb2_set_error(smb2, "Copychunk request has too many "
+                               "chunks");
+                smb2_free_data(smb2, copy);
+                return NULL;
+        }
+        if (copy->chunk_count == 0) {
+                return copy;
+        }
+        copy->chunks = smb2_alloc_data(smb2, copy, copy->chunk_count *
+                                       sizeof(struct smb2_srv_copychunk));
+        if (copy->chunks == NULL) {
+                smb2_free_data(smb2, copy);
+                return NULL;
+        }
+        for (i = 0; i < copy->chunk_count; i++) {
+                chunk = &copy->chunks[i];
+                offset = SMB2_SRV_COPYCHUNK_COPY_SIZE +
+                        i * SMB2_SRV_COPYCHUNK_SIZE;
+                smb2_get_uint64(vec, offset, &chunk->source_offset);
+                smb2_get_uint64(vec, offset + 8, &chunk->target_offset);
+                smb2_get_uint32(vec, offset + 16, &chunk->length);
+        }
+        return copy;
+}
+
 int
 smb2_process_ioctl_request_variable(struct smb2_context *smb2,
                             struct smb2_pdu *pdu)
@@ -426,6 +516,20 @@ smb2_process_ioctl_request_variable(struct smb2_context *smb2,
                 smb2_get_uint16(&vec, 22, &info->dialect);
                 req->input_count = sizeof(struct smb2_ioctl_validate_negotiate_info);
                 break;
+        case SMB2_FSCTL_SRV_COPYCHUNK:
+        case SMB2_FSCTL_SRV_COPYCHUNK_WRITE:
+                if (smb2->passthrough) {
+                        ptr = vec.buf;
+                        req->input_count = vec.len;
+                        break;
+                }
+                ptr = smb2_decode_srv_copychunk_copy(smb2, &vec,
+                                                     req->input_count);
+                if (ptr == NULL) {
+                        return -1;
+                }
+                req->input_count = sizeof(struct smb2_srv_copychunk_copy);
+                break;
         default:
                 if (smb2->passthrough) {
                         /* dont know how to handle this, let user decode it */
@@ -69,13 +69,13 @@ smb2_encode_lock_request(struct smb2_context *smb2,
         uint32_t offset;
 
         len = SMB2_LOCK_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate lock buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for lock request");
                 return -1;
@@ -98,12 +98,12 @@ smb2_encode_lock_request(struct smb2_context *smb2,
 
         if ((req->lock_count > 1) && req->locks) {
                 len = PAD_TO_64BIT(SMB2_LOCK_ELEMENT_SIZE * req->lock_count);
-                buf = calloc(len, sizeof(uint8_t));
+                buf = smb2_calloc(smb2, len, sizeof(uint8_t));
                 if (buf == NULL) {
                         smb2_set_error(smb2, "Failed to allocate locks buffer");
                         return -1;
                 }
-                iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+                iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
                 if (iov == NULL) {
                         smb2_set_error(smb2, "Failed to add iovector for lock elements");
                         return -1;
@@ -155,13 +155,13 @@ smb2_encode_lock_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_LOCK_REPLY_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate lock buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for lock reply");
                 return -1;
@@ -255,7 +255,7 @@ smb2_process_lock_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate lock request");
                 return -1;
@@ -271,7 +271,7 @@ smb2_process_lock_request_fixed(struct smb2_context *smb2,
         if (req->lock_count < 1) {
                 smb2_set_error(smb2, "Lock request must have at least one lock.");
                 pdu->payload = NULL;
-                free(req);
+                smb2_free(smb2, req);
                 return -1;
         }
 
@@ -280,7 +280,7 @@ smb2_process_lock_request_fixed(struct smb2_context *smb2,
         if (!ptr) {
                 smb2_set_error(smb2, "can not alloc lock buffer.");
                 pdu->payload = NULL;
-                free(req);
+                smb2_free(smb2, req);
                 return -1;
         }
         req->locks = ptr;
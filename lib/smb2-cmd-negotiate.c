@@ -67,14 +67,14 @@ smb2_encode_preauth_context(struct smb2_context *smb2, struct smb2_pdu *pdu)
         /* Preauth integrity capability */
         data_len = 38;
         len = 8 + PAD_TO_64BIT(38);
-        buf = malloc(len);
+        buf = smb2_malloc(smb2, len);
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate preauth context");
                 return -1;
         }
         memset(buf, 0, len);
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 return -1;
         }
@@ -90,31 +90,80 @@ smb2_encode_preauth_context(struct smb2_context *smb2, struct smb2_pdu *pdu)
         return 0;
 }
 
+/* Ciphers offered by the client, in order of preference. */
+static const uint16_t smb2_ciphers[] = {
+        SMB2_ENCRYPTION_AES_128_GCM,
+        SMB2_ENCRYPTION_AES_128_CCM,
+        SMB2_ENCRYPTION_AES_256_GCM,
+        SMB2_ENCRYPTION_AES_256_CCM,
+};
+
 static int
-smb2_encode_encryption_context(struct smb2_context *smb2, struct smb2_pdu *pdu)
+smb2_encode_encryption_context(struct smb2_context *smb2, struct smb2_pdu *pdu,
+                               const uint16_t *ciphers, int count)
 {
         uint8_t *buf;
-        int len, data_len;
+        int i, len, data_len;
         struct smb2_iovec *iov;
 
-        data_len = PAD_TO_64BIT(4);
+        data_len = 2 + 2 * count;
         len = 8 + data_len;
         len = PAD_TO_64BIT(len);
-        buf = malloc(len);
+        buf = smb2_malloc(smb2, len);
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate encryption context");
                 return -1;
         }
         memset(buf, 0, len);
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 return -1;
         }
         smb2_set_uint16(iov, 0, SMB2_ENCRYPTION_CAP);
         smb2_set_uint16(iov, 2, data_len);
-        smb2_set_uint16(iov, 8, 1);
-        smb2_set_uint16(iov, 10, SMB2_ENCRYPTION_AES_128_CCM);
+        smb2_set_uint16(iov, 8, count);
+        for (i = 0; i < count; i++) {
+                smb2_set_uint16(iov, 10 + 2 * i, ciphers[i]);
+        }
+
+        return 0;
+}
+
+/* Signing algorithms offered by the client, in order of preference. */
+static const uint16_t smb2_signing_algorithms[] = {
+        SMB2_SIGNING_AES_GMAC,
+        SMB2_SIGNING_AES_CMAC,
+};
+
+static int
+smb2_encode_signing_context(struct smb2_context *smb2, struct smb2_pdu *pdu,
+                            const uint16_t *algorithms, int count)
+{
+        uint8_t *buf;
+        int i, len, data_len;
+        struct smb2_iovec *iov;
+
+        data_len = 2 + 2 * count;
+        len = 8 + data_len;
+        len = PAD_TO_64BIT(len);
+        buf = smb2_malloc(smb2, len);
+        if (buf == NULL) {
+                smb2_set_error(smb2, "Failed to allocate signing context");
+                return -1;
+        }
+        memset(buf, 0, len);
+
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
+        if (iov == NULL) {
+                return -1;
+        }
+        smb2_set_uint16(iov, 0, SMB2_SIGNING_CAP);
+        smb2_set_uint16(iov, 2, data_len);
+        smb2_set_uint16(iov, 8, count);
+        for (i = 0; i < count; i++) {
+                smb2_set_uint16(iov, 10 + 2 * i, algorithms[i]);
+        }
 
         return 0;
 }
@@ -125,7 +174,7 @@ smb2_encode_negotiate_request(struct smb2_context *smb2,
                               struct smb2_negotiate_request *req)
 {
         uint8_t *buf;
-        int i, len;
+        int i, len, ret;
         struct smb2_iovec *iov;
 
         len = SMB2_NEGOTIATE_REQUEST_SIZE +
@@ -139,13 +188,13 @@ smb2_encode_negotiate_request(struct smb2_context *smb2,
                         len += 4;
                 }
         }
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate negotiate buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for negotiate request");
                 return -1;
@@ -161,7 +210,24 @@ smb2_encode_negotiate_request(struct smb2_context *smb2,
                 }
                 req->negotiate_context_count++;
 
-                if (smb2_encode_encryption_context(smb2, pdu)) {
+                if (smb2->requested_cypher) {
+                        ret = smb2_encode_encryption_context(smb2, pdu,
+                                        &smb2->requested_cypher, 1);
+                } else {
+                        ret = smb2_encode_encryption_context(smb2, pdu,
+                                        smb2_ciphers,
+                                        sizeof(smb2_ciphers) /
+                                        sizeof(smb2_ciphers[0]));
+                }
+                if (ret) {
+                        return -1;
+                }
+                req->negotiate_context_count++;
+
+                if (smb2_encode_signing_context(smb2, pdu,
+                                smb2_signing_algorithms,
+                                sizeof(smb2_signing_algorithms) /
+                                sizeof(smb2_signing_algorithms[0]))) {
                         return -1;
                 }
                 req->negotiate_context_count++;
@@ -213,7 +279,7 @@ smb2_encode_negotiate_reply(struct smb2_context *smb2,
                               struct smb2_negotiate_reply *rep)
 {
         uint8_t *buf;
-        int len, seclen;
+        int len, seclen, cmd;
         struct smb2_iovec *iov;
 
         len = SMB2_NEGOTIATE_REPLY_SIZE & 0xfffe;
@@ -226,23 +292,24 @@ smb2_encode_negotiate_reply(struct smb2_context *smb2,
                         len += 4;
                 }
         }
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate negotiate reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for negotiate reply");
                 return -1;
         }
+        cmd = pdu->out.niov - 1;
 
         if (rep->security_buffer_length) {
                 seclen = rep->security_buffer_length;
                 seclen = PAD_TO_64BIT(len);
                 /* Security buffer */
-                buf = malloc(seclen);
+                buf = smb2_malloc(smb2, seclen);
                 if (buf == NULL) {
                         smb2_set_error(smb2, "Failed to allocate secbuf");
                         return -1;
@@ -252,7 +319,7 @@ smb2_encode_negotiate_reply(struct smb2_context *smb2,
                 if (smb2_add_iovector(smb2, &pdu->out,
                                         buf,
                                         seclen,
-                                        free) == NULL) {
+                                        smb2_free_cb) == NULL) {
                         return -1;
                 }
         }
@@ -265,12 +332,27 @@ smb2_encode_negotiate_reply(struct smb2_context *smb2,
                 }
                 rep->negotiate_context_count++;
 
-                if (smb2_encode_encryption_context(smb2, pdu)) {
+                /* the reply carries the one cipher we selected, or 0 */
+                if (smb2_encode_encryption_context(smb2, pdu,
+                                                   &smb2->cypher, 1)) {
                         return -1;
                 }
                 rep->negotiate_context_count++;
+
+                /* only reply with a signing context if the client sent one */
+                if (smb2->signing_algorithm != SMB2_SIGNING_HMAC_SHA256) {
+                        if (smb2_encode_signing_context(smb2, pdu,
+                                        &smb2->signing_algorithm, 1)) {
+                                return -1;
+                        }
+                        rep->negotiate_context_count++;
+                }
         }
 
+        /* adding the security buffer and contexts may have moved the
+         * vectors
+         */
+        iov = &pdu->out.iov[cmd];
         smb2_set_uint16(iov, 0, SMB2_NEGOTIATE_REPLY_SIZE);
         smb2_set_uint16(iov, 2, rep->security_mode);
         smb2_set_uint16(iov, 4, rep->dialect_revision);
@@ -324,9 +406,51 @@ static int
 smb2_parse_encryption_context(struct smb2_context *smb2,
                               struct smb2_negotiate_reply *rep,
                               struct smb2_iovec *iov,
-                              int offset)
+                              int offset, int len)
 {
-        smb2_get_uint16(iov, offset, &rep->cypher);
+        uint16_t count;
+
+        if (len < 4 || offset + 4 > (int)iov->len) {
+                smb2_set_error(smb2, "Bad encryption context in negotiate "
+                               "reply");
+                return -1;
+        }
+        smb2_get_uint16(iov, offset, &count);
+        if (count != 1) {
+                smb2_set_error(smb2, "Server selected %d ciphers in "
+                               "negotiate reply", count);
+                return -1;
+        }
+        smb2_get_uint16(iov, offset + 2, &rep->cypher);
+        return 0;
+}
+
+static int
+smb2_parse_signing_context(struct smb2_context *smb2,
+                           struct smb2_iovec *iov,
+                           int offset, int len)
+{
+        uint16_t count, algorithm;
+
+        if (len < 4 || offset + 4 > (int)iov->len) {
+                smb2_set_error(smb2, "Bad signing context in negotiate "
+                               "reply");
+                return -1;
+        }
+        smb2_get_uint16(iov, offset, &count);
+        if (count != 1) {
+                smb2_set_error(smb2, "Server selected %d signing algorithms "
+                               "in negotiate reply", count);
+                return -1;
+        }
+        smb2_get_uint16(iov, offset + 2, &algorithm);
+        if (algorithm != SMB2_SIGNING_AES_CMAC &&
+            algorithm != SMB2_SIGNING_AES_GMAC) {
+                smb2_set_error(smb2, "Server selected unsupported signing "
+                               "algorithm 0x%04x", algorithm);
+                return -1;
+        }
+        smb2->signing_algorithm = algorithm;
         return 0;
 }
 
@@ -351,11 +475,16 @@ smb2_parse_negotiate_contexts(struct smb2_context *smb2,
                         break;
                 case SMB2_ENCRYPTION_CAP:
                         if (smb2_parse_encryption_context(smb2, rep,
-                                                          iov, offset + 8)) {
+                                                          iov, offset + 8, len)) {
                                 return -1;
                         }
                         break;
                 case SMB2_SIGNING_CAP:
+                        if (smb2_parse_signing_context(smb2, iov,
+                                                       offset + 8, len)) {
+                                return -1;
+                        }
+                        break;
                 case SMB2_COMPRESSION_CAP:
                 case SMB2_NETNAME_NEGOTIATE_CONTEXT_ID:
                 case SMB2_TRANSPORT_CAP:
@@ -390,13 +519,14 @@ smb2_process_negotiate_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate negotiate reply");
                 return -1;
         }
 
         pdu->payload = rep;
+        rep->cypher = 0;
 
         smb2_get_uint16(iov, 2, &rep->security_mode);
         smb2_get_uint16(iov, 4, &rep->dialect_revision);
@@ -415,7 +545,7 @@ smb2_process_negotiate_fixed(struct smb2_context *smb2,
                 smb2_set_error(smb2, "Security buffer extends beyond end of "
                                "PDU");
                 pdu->payload = NULL;
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
         smb2_get_uint16(iov, 6, &rep->negotiate_context_count);
@@ -429,7 +559,7 @@ smb2_process_negotiate_fixed(struct smb2_context *smb2,
                 smb2_set_error(smb2, "Security buffer overlaps with "
                                "negotiate reply header");
                 pdu->payload = NULL;
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
 
@@ -457,6 +587,7 @@ smb2_process_negotiate_variable(struct smb2_context *smb2,
         int offset;
 
         rep->security_buffer = &iov->buf[IOV_OFFSET];
+        smb2->signing_algorithm = SMB2_SIGNING_HMAC_SHA256;
 
         if (rep->dialect_revision < SMB2_VERSION_0311 ||
             !rep->negotiate_context_count) {
@@ -499,7 +630,7 @@ smb2_process_negotiate_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate negotiate request");
                 return -1;
@@ -536,6 +667,74 @@ smb2_parse_encryption_request_context(struct smb2_context *smb2,
                               struct smb2_iovec *iov,
                               int offset, int len)
 {
+        uint16_t count, cipher;
+        int i, j;
+
+        if (len < 2 || offset + len > (int)iov->len) {
+                smb2_set_error(smb2, "Bad encryption context in negotiate "
+                               "request");
+                return -1;
+        }
+        smb2_get_uint16(iov, offset, &count);
+        if (2 + 2 * count > len) {
+                smb2_set_error(smb2, "Bad cipher count in negotiate request");
+                return -1;
+        }
+
+        /* select the first cipher, in client order, that we support */
+        smb2->cypher = 0;
+        for (i = 0; i < count; i++) {
+                smb2_get_uint16(iov, offset + 2 + 2 * i, &cipher);
+                if (smb2->requested_cypher &&
+                    cipher != smb2->requested_cypher) {
+                        continue;
+                }
+                for (j = 0; j < (int)(sizeof(smb2_ciphers) /
+                                      sizeof(smb2_ciphers[0])); j++) {
+                        if (cipher == smb2_ciphers[j]) {
+                                smb2->cypher = cipher;
+                                return 0;
+                        }
+                }
+        }
+        return 0;
+}
+
+static int
+smb2_parse_signing_request_context(struct smb2_context *smb2,
+                              struct smb2_negotiate_request *req,
+                              struct smb2_iovec *iov,
+                              int offset, int len)
+{
+        uint16_t count, algorithm;
+        int i, j;
+
+        if (len < 2 || offset + len > (int)iov->len) {
+                smb2_set_error(smb2, "Bad signing context in negotiate "
+                               "request");
+                return -1;
+        }
+        smb2_get_uint16(iov, offset, &count);
+        if (2 + 2 * count > len) {
+                smb2_set_error(smb2, "Bad signing algorithm count in "
+                               "negotiate request");
+                return -1;
+        }
+
+        /* select the first algorithm, in client order, that we support
+         * and fall back to AES-CMAC
+         */
+        smb2->signing_algorithm = SMB2_SIGNING_AES_CMAC;
+        for (i = 0; i < count; i++) {
+                smb2_get_uint16(iov, offset + 2 + 2 * i, &algorithm);
+                for (j = 0; j < (int)(sizeof(smb2_signing_algorithms) /
+                                      sizeof(smb2_signing_algorithms[0])); j++) {
+                        if (algorithm == smb2_signing_algorithms[j]) {
+                                smb2->signing_algorithm = algorithm;
+                                return 0;
+                        }
+                }
+        }
         return 0;
 }
 
@@ -547,8 +746,8 @@ smb2_parse_netname_request_context(struct smb2_context *smb2,
 {
         char *client;
 
-        client = discard_const(smb2_utf16_to_utf8((uint16_t *)(void *)(iov->buf + offset), len / 2));
-        free(client);
+        client = discard_const(smb2_ctx_utf16_to_utf8(smb2, (uint16_t *)(void *)(iov->buf + offset), len / 2));
+        smb2_free(smb2, client);
         return 0;
 }
 
@@ -584,6 +783,11 @@ smb2_parse_negotiate_request_contexts(struct smb2_context *smb2,
                         }
                         break;
                 case SMB2_SIGNING_CAP:
+                        if (smb2_parse_signing_request_context(smb2, req,
+                                                          iov, offset + 8, len)) {
+                                return -1;
+                        }
+                        break;
                 case SMB2_COMPRESSION_CAP:
                 case SMB2_TRANSPORT_CAP:
                 case SMB2_RDMA_TRANSFORM_CAP:
@@ -65,14 +65,14 @@ smb2_encode_change_notify_request(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_CHANGE_NOTIFY_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate "
                                 "change-notify buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for change-notify request");
                 return -1;
@@ -121,14 +121,14 @@ smb2_encode_change_notify_reply(struct smb2_context *smb2,
         uint8_t *buf;
         struct smb2_iovec *iov;
         len = SMB2_CHANGE_NOTIFY_REPLY_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate "
                                 "change-notify reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for change-notify reply");
                 return -1;
@@ -145,7 +145,7 @@ smb2_encode_change_notify_reply(struct smb2_context *smb2,
 
         len = rep->output_buffer_length;
         len = PAD_TO_32BIT(len);
-        buf = malloc(len);
+        buf = smb2_malloc(smb2, len);
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate output buf");
                 return -1;
@@ -154,7 +154,7 @@ smb2_encode_change_notify_reply(struct smb2_context *smb2,
         iov = smb2_add_iovector(smb2, &pdu->out,
                                         buf,
                                         len,
-                                        free);
+                                        smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for change-notify output buffer");
                 return -1;
@@ -217,7 +217,7 @@ smb2_process_change_notify_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate "
                                "change-notify reply");
@@ -260,7 +260,7 @@ smb2_process_change_notify_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate "
                                 "change-notify request");
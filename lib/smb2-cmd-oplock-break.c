@@ -63,13 +63,13 @@ smb2_encode_oplock_break_acknowledgement(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_OPLOCK_BREAK_ACKNOWLEDGE_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate oplock request buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for oplock break ack");
                 return -1;
@@ -118,13 +118,13 @@ smb2_encode_oplock_break_reply(struct smb2_context *smb2,
 
         /* this encodes both notifications and responses */
         len = SMB2_OPLOCK_BREAK_REPLY_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate oplock reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for oplock break reply");
                 return -1;
@@ -173,13 +173,13 @@ smb2_encode_oplock_break_notification(struct smb2_context *smb2,
 
         /* this encodes both notifications and responses */
         len = SMB2_OPLOCK_BREAK_REPLY_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate oplock reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for oplock break notification");
                 return -1;
@@ -227,13 +227,13 @@ smb2_encode_lease_break_acknowledgement(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_LEASE_BREAK_ACKNOWLEDGE_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate lease notification buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for lease break ack");
                 return -1;
@@ -283,14 +283,14 @@ smb2_encode_lease_break_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_LEASE_BREAK_REPLY_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate "
                                 "lease-break reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for lease break reply");
                 return -1;
@@ -340,13 +340,13 @@ smb2_encode_lease_break_notification(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_LEASE_BREAK_NOTIFICATION_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate lease notification buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for lease break notification");
                 return -1;
@@ -400,7 +400,7 @@ smb2_process_oplock_break_fixed(struct smb2_context *smb2,
 
         smb2_get_uint16(iov, 0, &struct_size);
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate oplock-"
                                 "or lease break reply");
@@ -427,7 +427,7 @@ smb2_process_oplock_break_fixed(struct smb2_context *smb2,
                                SMB2_LEASE_BREAK_REPLY_SIZE,
                                struct_size);
                 pdu->payload = NULL;
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
 
@@ -486,7 +486,7 @@ smb2_process_oplock_break_request_fixed(struct smb2_context *smb2,
 
         smb2_get_uint16(iov, 0, &struct_size);
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate oplock-"
                                "lease-break request");
@@ -509,7 +509,7 @@ smb2_process_oplock_break_request_fixed(struct smb2_context *smb2,
                                SMB2_LEASE_BREAK_ACKNOWLEDGE_SIZE,
                                (int)struct_size);
                 pdu->payload = NULL;
-                free(req);
+                smb2_free(smb2, req);
                 return -1;
         }
         return 0;
@@ -82,7 +82,7 @@ smb2_decode_fileidfulldirectoryinformation(
         smb2_get_uint32(vec, 64, &fs->ea_size);
         smb2_get_uint64(vec, 72, &fs->file_id);
 
-        fs->name = smb2_utf16_to_utf8((uint16_t *)(void *)&vec->buf[80], name_len / 2);
+        fs->name = smb2_ctx_utf16_to_utf8(smb2, (uint16_t *)(void *)&vec->buf[80], name_len / 2);
 
         smb2_get_uint64(vec, 8, &t);
         smb2_win_to_timeval(t, &fs->creation_time);
@@ -110,22 +110,22 @@ smb2_encode_query_directory_request(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_QUERY_DIRECTORY_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate query buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for query-directory request");
-                free(name);
+                smb2_free(smb2, name);
                 return -1;
         }
 
         /* Name */
         if (req->name && req->name[0]) {
-                name = smb2_utf8_to_utf16(req->name);
+                name = smb2_ctx_utf8_to_utf16(smb2, req->name);
                 if (name == NULL) {
                         smb2_set_error(smb2, "Could not convert name into UTF-16");
                         return -1;
@@ -143,23 +143,23 @@ smb2_encode_query_directory_request(struct smb2_context *smb2,
 
         /* Name */
         if (name) {
-                buf = malloc(2 * name->len);
+                buf = smb2_malloc(smb2, 2 * name->len);
                 if (buf == NULL) {
                         smb2_set_error(smb2, "Failed to allocate qdir name");
-                        free(name);
+                        smb2_free(smb2, name);
                         return -1;
                 }
                 memcpy(buf, &name->val[0], 2 * name->len);
                 iov = smb2_add_iovector(smb2, &pdu->out,
                                         buf,
                                         2 * name->len,
-                                        free);
+                                        smb2_free_cb);
                 if (iov == NULL) {
                         smb2_set_error(smb2, "Failed to add iovector for query-directory name");
                         return -1;
                 }
         }
-        free(name);
+        smb2_free(smb2, name);
 
         return 0;
 }
@@ -218,13 +218,17 @@ smb2_encode_query_directory_reply(struct smb2_context *smb2,
         len = SMB2_QUERY_DIRECTORY_REPLY_SIZE & 0xfffe;
         len = PAD_TO_32BIT(len);
 
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate query reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
+        if (iov == NULL) {
+                smb2_set_error(smb2, "Failed to add iovector for query-directory reply");
+                return -1;
+        }
 
         fslen = rep->output_buffer_length;
         rep->output_buffer_offset = len + SMB2_HEADER_SIZE;
@@ -238,13 +242,13 @@ smb2_encode_query_directory_reply(struct smb2_context *smb2,
                                 fs = (struct smb2_fileidbothdirectoryinformation*)(void *)(rep->output_buffer + in_offset);
                                 fname_len = 0;
                                 if (fs->name && fs->name[0]) {
-                                        name = smb2_utf8_to_utf16(fs->name);
+                                        name = smb2_ctx_utf8_to_utf16(smb2, fs->name);
                                         if (name == NULL) {
                                                 smb2_set_error(smb2, "Could not convert name into UTF-16");
                                                 return -1;
                                         }
                                         fname_len = 2 * name->len;
-                                        free(name);
+                                        smb2_free(smb2, name);
                                 }
                                 switch (info_class)
                                 {
@@ -276,7 +280,7 @@ smb2_encode_query_directory_reply(struct smb2_context *smb2,
 
         len = rep->output_buffer_length;
         len = PAD_TO_32BIT(len);
-        buf = malloc(len);
+        buf = smb2_malloc(smb2, len);
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate output buf");
                 return -1;
@@ -285,7 +289,7 @@ smb2_encode_query_directory_reply(struct smb2_context *smb2,
         iov = smb2_add_iovector(smb2, &pdu->out,
                                         buf,
                                         len,
-                                        free);
+                                        smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for query-directory output buffer");
                 return -1;
@@ -306,7 +310,7 @@ smb2_encode_query_directory_reply(struct smb2_context *smb2,
                         fs = (struct smb2_fileidbothdirectoryinformation*)(void *)(rep->output_buffer + in_offset);
                         fname_len = 0;
                         if (fs->name && fs->name[0]) {
-                                name = smb2_utf8_to_utf16(fs->name);
+                                name = smb2_ctx_utf8_to_utf16(smb2, fs->name);
                                 if (name == NULL) {
                                         smb2_set_error(smb2, "Could not convert name into UTF-16");
                                         return -1;
@@ -380,7 +384,7 @@ smb2_encode_query_directory_reply(struct smb2_context *smb2,
                         }
 
                         if (name) {
-                                free(name);
+                                smb2_free(smb2, name);
                         }
 
                         offset += fs_size;
@@ -437,7 +441,7 @@ smb2_process_query_directory_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate query dir reply");
                 return -1;
@@ -450,7 +454,7 @@ smb2_process_query_directory_fixed(struct smb2_context *smb2,
             (rep->output_buffer_offset + rep->output_buffer_length > smb2->spl)) {
                 smb2_set_error(smb2, "Output buffer extends beyond end of "
                                "PDU");
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
 
@@ -462,7 +466,7 @@ smb2_process_query_directory_fixed(struct smb2_context *smb2,
             (SMB2_QUERY_INFO_REPLY_SIZE & 0xfffe)) {
                 smb2_set_error(smb2, "Output buffer overlaps with "
                                "Query Dir reply header");
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
 
@@ -505,7 +509,7 @@ smb2_process_query_directory_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate query dir request");
                 return -1;
@@ -524,7 +528,7 @@ smb2_process_query_directory_request_fixed(struct smb2_context *smb2,
             (req->file_name_offset + req->file_name_length > (uint16_t)smb2->spl)) {
                 smb2_set_error(smb2, "Filename extends beyond end of "
                                "PDU");
-                free(req);
+                smb2_free(smb2, req);
                 return -1;
         }
 
@@ -536,7 +540,7 @@ smb2_process_query_directory_request_fixed(struct smb2_context *smb2,
             (SMB2_QUERY_DIRECTORY_REQUEST_SIZE & 0xfffe)) {
                 smb2_set_error(smb2, "Name buffer overlaps with "
                                "Query Dir request header");
-                free(req);
+                smb2_free(smb2, req);
                 return -1;
         }
 
@@ -556,14 +560,14 @@ smb2_process_query_directory_request_variable(struct smb2_context *smb2,
         int name_byte_len;
 
         if (req->file_name_length > 0) {
-                req->name = smb2_utf16_to_utf8((uint16_t*)(void *)&iov->buf[IOVREQ_OFFSET], req->file_name_length / 2);
+                req->name = smb2_ctx_utf16_to_utf8(smb2, (uint16_t*)(void *)&iov->buf[IOVREQ_OFFSET], req->file_name_length / 2);
                 if (req->name) {
                         name_byte_len = strlen(req->name) + 1;
                         ptr = smb2_alloc_init(smb2, name_byte_len);
                         if (ptr) {
                                 memcpy(ptr, req->name, name_byte_len);
                         }
-                        free(discard_const(req->name));
+                        smb2_free(smb2, discard_const(req->name));
                         req->name = ptr;
                         if (!ptr) {
                                 smb2_set_error(smb2, "can not alloc name buffer");
@@ -61,7 +61,6 @@ smb2_encode_query_info_request(struct smb2_context *smb2,
                                struct smb2_query_info_request *req)
 {
         int len;
-        uint8_t *buf;
         struct smb2_iovec *iov;
 
         if (req->input_buffer_length > 0) {
@@ -70,13 +69,7 @@ smb2_encode_query_info_request(struct smb2_context *smb2,
         }
 
         len = SMB2_QUERY_INFO_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
-        if (buf == NULL) {
-                smb2_set_error(smb2, "Failed to allocate query buffer");
-                return -1;
-        }
-
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_fixed_iovector(smb2, pdu, len);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for query-info request");
                 return -1;
@@ -131,13 +124,13 @@ smb2_encode_query_info_reply(struct smb2_context *smb2,
                                 struct smb2_pdu *pdu,
                                 struct smb2_query_info_reply *rep)
 {
-        int len;
+        int len, cmd;
         uint8_t *buf;
         struct smb2_iovec *iov, *cmdiov;
         uint32_t created_output_buffer_length;
 
         len = SMB2_QUERY_INFO_REPLY_SIZE & 0xfffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate query reply buffer");
                 return -1;
@@ -148,11 +141,12 @@ smb2_encode_query_info_reply(struct smb2_context *smb2,
                 rep->output_buffer_offset = len + SMB2_HEADER_SIZE;
         }
 
-        cmdiov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        cmdiov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (cmdiov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for query-info reply header");
                 return -1;
         }
+        cmd = pdu->out.niov - 1;
 
         smb2_set_uint16(cmdiov, 0, SMB2_QUERY_INFO_REPLY_SIZE);
         smb2_set_uint16(cmdiov, 2, rep->output_buffer_offset);
@@ -163,7 +157,7 @@ smb2_encode_query_info_reply(struct smb2_context *smb2,
                 /* not sure exactly how long the encoding will be, some of them
                  * include variable data so add a whole lot of extra space
                  *  TODO - better estimate = sizeof C struct vs sizeof packed data! */
-                buf = malloc(len + 1024);
+                buf = smb2_malloc(smb2, len + 1024);
                 if (buf == NULL) {
                         smb2_set_error(smb2, "Failed to allocate output buffer");
                         return -1;
@@ -171,7 +165,7 @@ smb2_encode_query_info_reply(struct smb2_context *smb2,
                 iov = smb2_add_iovector(smb2, &pdu->out,
                                         buf,
                                         len + 1024,
-                                        free);
+                                        smb2_free_cb);
                 if (iov == NULL) {
                         smb2_set_error(smb2, "Failed to add iovector for query-info output buffer");
                         return -1;
@@ -329,6 +323,8 @@ smb2_encode_query_info_reply(struct smb2_context *smb2,
                 }
         }
 
+        /* adding the output buffer may have moved the vectors */
+        cmdiov = &pdu->out.iov[cmd];
         smb2_set_uint32(cmdiov, 4, rep->output_buffer_length);
         return 0;
 }
@@ -381,7 +377,7 @@ smb2_process_query_info_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate query info reply");
                 return -1;
@@ -395,7 +391,7 @@ smb2_process_query_info_fixed(struct smb2_context *smb2,
         if (opl < rep->output_buffer_offset) {
                 smb2_set_error(smb2, "Output offset/length wrapped.");
                 pdu->payload = NULL;
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
         if (rep->output_buffer_length) {
@@ -403,14 +399,14 @@ smb2_process_query_info_fixed(struct smb2_context *smb2,
                         smb2_set_error(smb2, "Output buffer extends beyond end of "
                                        "PDU");
                         pdu->payload = NULL;
-                        free(rep);
+                        smb2_free(smb2, rep);
                         return -1;
                 }
                 if (smb2->hdr.next_command && opl > smb2->hdr.next_command) {
                         smb2_set_error(smb2, "Current PDU extends into next "
                                        "chained PDU");
                         pdu->payload = NULL;
-                        free(rep);
+                        smb2_free(smb2, rep);
                         return -1;
                 }
         }
@@ -424,7 +420,7 @@ smb2_process_query_info_fixed(struct smb2_context *smb2,
                 smb2_set_error(smb2, "Output buffer overlaps with "
                                "Query Info reply header");
                 pdu->payload = NULL;
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
 
@@ -706,7 +702,7 @@ smb2_process_query_info_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate query info request");
                 return -1;
@@ -731,7 +727,7 @@ smb2_process_query_info_request_fixed(struct smb2_context *smb2,
                 smb2_set_error(smb2, "Input buffer overlaps with "
                                "Query Info request header");
                 pdu->payload = NULL;
-                free(req);
+                smb2_free(smb2, req);
                 return -1;
         }
 
@@ -39,6 +39,14 @@
 #include <stddef.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_SYS__IOVEC_H
+#include <sys/_iovec.h>
+#endif
+
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
@@ -65,13 +73,7 @@ smb2_encode_read_request(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_READ_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
-        if (buf == NULL) {
-                smb2_set_error(smb2, "Failed to allocate read buffer");
-                return -1;
-        }
-
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_fixed_iovector(smb2, pdu, len);
         if (iov == NULL) {
                 return -1;
         }
@@ -98,7 +100,7 @@ smb2_encode_read_request(struct smb2_context *smb2,
                         smb2_set_uint16(iov, 44, req->read_channel_info_offset);
 
                         len = PAD_TO_64BIT(req->read_channel_info_length);
-                        buf = malloc(len);
+                        buf = smb2_malloc(smb2, len);
                         if (buf == NULL) {
                                 smb2_set_error(smb2, "Failed to allocate read channel context");
                                 return -1;
@@ -109,7 +111,7 @@ smb2_encode_read_request(struct smb2_context *smb2,
                         iov = smb2_add_iovector(smb2, &pdu->out,
                                                         buf,
                                                         len,
-                                                        free);
+                                                        smb2_free_cb);
                         if (iov == NULL) {
                                 return -1;
                         }
@@ -179,6 +181,50 @@ smb2_cmd_read_async(struct smb2_context *smb2,
         return pdu;
 }
 
+/*
+ * Like smb2_cmd_read_async() but the data is scattered into iovcnt
+ * buffers. req->length must be the sum of their lengths.
+ */
+struct smb2_pdu *
+smb2_cmd_readv_async(struct smb2_context *smb2,
+                     struct smb2_read_request *req,
+                     const struct iovec *iov, int iovcnt,
+                     smb2_command_cb cb, void *cb_data)
+{
+        struct smb2_pdu *pdu;
+        int i;
+
+        pdu = smb2_allocate_pdu(smb2, SMB2_READ, cb, cb_data);
+        if (pdu == NULL) {
+                return NULL;
+        }
+
+        if (smb2_encode_read_request(smb2, pdu, req)) {
+                smb2_free_pdu(smb2, pdu);
+                return NULL;
+        }
+
+        for (i = 0; i < iovcnt; i++) {
+                if (smb2_add_iovector(smb2, &pdu->in, iov[i].iov_base,
+                                      iov[i].iov_len, NULL) == NULL) {
+                        smb2_free_pdu(smb2, pdu);
+                        return NULL;
+                }
+        }
+
+        if (smb2_pad_to_64bit(smb2, &pdu->out) != 0) {
+                smb2_free_pdu(smb2, pdu);
+                return NULL;
+        }
+
+        /* Adjust credit charge for large payloads */
+        if (smb2->supports_multi_credit) {
+                pdu->header.credit_charge = (req->length - 1) / 65536 + 1; /* 3.1.5.2 of [MS-SMB2] */
+        }
+
+        return pdu;
+}
+
 static int
 smb2_encode_read_reply(struct smb2_context *smb2,
                          struct smb2_pdu *pdu,
@@ -189,13 +235,13 @@ smb2_encode_read_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_READ_REPLY_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate read reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 return -1;
         }
@@ -210,7 +256,7 @@ smb2_encode_read_reply(struct smb2_context *smb2,
         smb2_set_uint32(iov, 8, rep->data_remaining);
 
         if (rep->data_length > 0 && rep->data) {
-                if (smb2_add_iovector(smb2, &pdu->out, rep->data, rep->data_length, free) == NULL) {
+                if (smb2_add_iovector(smb2, &pdu->out, rep->data, rep->data_length, smb2_free_cb) == NULL) {
                         return -1;
                 }
         }
@@ -260,7 +306,7 @@ smb2_process_read_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate read reply");
                 return -1;
@@ -281,7 +327,7 @@ smb2_process_read_fixed(struct smb2_context *smb2,
                                "Expected %d, got %d",
                                SMB2_HEADER_SIZE + 16, rep->data_offset);
                 pdu->payload = NULL;
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
 
@@ -296,7 +342,7 @@ static void free_read_reply(struct smb2_context *smb2, void * payload) {
 
     rep = (struct smb2_read_reply*)payload;
     if (rep->data_length != 0 && rep->data != NULL) {
-        free(rep->data);
+        smb2_free(smb2, rep->data);
     }
 }
 
@@ -337,7 +383,7 @@ smb2_process_read_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = calloc(1, sizeof(*req));
+        req = smb2_calloc(smb2, 1, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate read request");
                 return -1;
@@ -360,7 +406,7 @@ smb2_process_read_request_fixed(struct smb2_context *smb2,
         if (req->length > smb2->max_read_size) {
                 smb2_set_error(smb2, "can not read more than %d bytes", smb2->max_read_size);
                 pdu->payload = NULL;
-                free(req);
+                smb2_free(smb2, req);
                 return -1;
         }
 
@@ -371,7 +417,7 @@ smb2_process_read_request_fixed(struct smb2_context *smb2,
         if (req->read_channel_info_offset < SMB2_HEADER_SIZE + (SMB2_READ_REQUEST_SIZE & 0xfffe)) {
                 smb2_set_error(smb2, "channel info overlaps request", "");
                 pdu->payload = NULL;
-                free(req);
+                smb2_free(smb2, req);
                 return -1;
         }
 
@@ -65,14 +65,14 @@ smb2_encode_session_setup_request(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_SESSION_SETUP_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate session "
                                "setup buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for session setup request");
                 return -1;
@@ -89,7 +89,7 @@ smb2_encode_session_setup_request(struct smb2_context *smb2,
 
 
         /* Security buffer */
-        buf = malloc(req->security_buffer_length);
+        buf = smb2_malloc(smb2, req->security_buffer_length);
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate secbuf");
                 return -1;
@@ -98,7 +98,7 @@ smb2_encode_session_setup_request(struct smb2_context *smb2,
         iov = smb2_add_iovector(smb2, &pdu->out,
                                 buf,
                                 req->security_buffer_length,
-                                free);
+                                smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for session setup security buffer");
                 return -1;
@@ -143,13 +143,13 @@ smb2_encode_session_setup_reply(struct smb2_context *smb2,
         len = SMB2_SESSION_SETUP_REPLY_SIZE & 0xfffe;
         len = PAD_TO_32BIT(len);
 
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate session_setup buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for session setup reply");
                 return -1;
@@ -165,7 +165,7 @@ smb2_encode_session_setup_reply(struct smb2_context *smb2,
                 len = rep->security_buffer_length;
                 len = PAD_TO_32BIT(len);
                 /* Security buffer */
-                buf = malloc(len);
+                buf = smb2_malloc(smb2, len);
                 if (buf == NULL) {
                         smb2_set_error(smb2, "Failed to allocate secbuf");
                         return -1;
@@ -175,7 +175,7 @@ smb2_encode_session_setup_reply(struct smb2_context *smb2,
                 iov = smb2_add_iovector(smb2, &pdu->out,
                                         buf,
                                         len,
-                                        free);
+                                        smb2_free_cb);
                 if (iov == NULL) {
                         smb2_set_error(smb2, "Failed to add iovector for session setup reply buffer");
                         return -1;
@@ -231,7 +231,7 @@ smb2_process_session_setup_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate session setup reply");
                 return -1;
@@ -246,7 +246,7 @@ smb2_process_session_setup_fixed(struct smb2_context *smb2,
                 smb2_set_error(smb2, "Security buffer extends beyond end of "
                                "PDU");
                 pdu->payload = NULL;
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
         /* Update session ID to use for future PDUs */
@@ -260,7 +260,7 @@ smb2_process_session_setup_fixed(struct smb2_context *smb2,
                 smb2_set_error(smb2, "Security buffer overlaps with "
                                "Session Setup reply header");
                 pdu->payload = NULL;
-                free(rep);
+                smb2_free(smb2, rep);
                 return -1;
         }
 
@@ -300,7 +300,7 @@ smb2_process_session_setup_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate session setup request");
                 return -1;
@@ -69,13 +69,13 @@ smb2_encode_set_info_request(struct smb2_context *smb2,
         struct smb2_utf16 *name;
 
         len = SMB2_SET_INFO_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate set info buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for set-info request header");
                 return -1;
@@ -90,14 +90,14 @@ smb2_encode_set_info_request(struct smb2_context *smb2,
 
         if (smb2->passthrough) {
                 if (req->buffer_length) {
-                        buf = malloc(PAD_TO_32BIT(req->buffer_length));
+                        buf = smb2_malloc(smb2, PAD_TO_32BIT(req->buffer_length));
                         if (buf == NULL) {
                                 smb2_set_error(smb2, "Failed to allocate set "
                                                         "info data buffer");
                                 return -1;
                         }
                         memcpy(buf, req->input_data, req->buffer_length);
-                        iov = smb2_add_iovector(smb2, &pdu->out, buf, req->buffer_length, free);
+                        iov = smb2_add_iovector(smb2, &pdu->out, buf, req->buffer_length, smb2_free_cb);
                         if (iov == NULL) {
                                 smb2_set_error(smb2, "Failed to add iovector for set-info passthrough buffer");
                                 return -1;
@@ -115,14 +115,14 @@ smb2_encode_set_info_request(struct smb2_context *smb2,
                         len = 40;
                         smb2_set_uint32(iov, 4, len); /* buffer length */
 
-                        buf = calloc(len, sizeof(uint8_t));
+                        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
                         if (buf == NULL) {
                                 smb2_set_error(smb2, "Failed to allocate set "
                                                "info data buffer");
                                 return -1;
                         }
                         iov = smb2_add_iovector(smb2, &pdu->out, buf, len,
-                                                free);
+                                                smb2_free_cb);
                         if (iov == NULL) {
                                 smb2_set_error(smb2, "Failed to add iovector for set-info basic data");
                                 return -1;
@@ -133,14 +133,14 @@ smb2_encode_set_info_request(struct smb2_context *smb2,
                         len = 8;
                         smb2_set_uint32(iov, 4, len); /* buffer length */
 
-                        buf = calloc(len, sizeof(uint8_t));
+                        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
                         if (buf == NULL) {
                                 smb2_set_error(smb2, "Failed to allocate set "
                                                "info data buffer");
                                 return -1;
                         }
                         iov = smb2_add_iovector(smb2, &pdu->out, buf, len,
-                                                free);
+                                                smb2_free_cb);
                         if (iov == NULL) {
                                 smb2_set_error(smb2, "Failed to add iovector for set-info EOF data");
                                 return -1;
@@ -152,7 +152,7 @@ smb2_encode_set_info_request(struct smb2_context *smb2,
                 case SMB2_FILE_RENAME_INFORMATION:
                         rni = req->input_data;
 
-                        name = smb2_utf8_to_utf16((char *)(rni->file_name));
+                        name = smb2_ctx_utf8_to_utf16(smb2, (char *)(rni->file_name));
                         if (name == NULL) {
                                 smb2_set_error(smb2, "Could not convert name into UTF-16");
                                 return -1;
@@ -167,18 +167,18 @@ smb2_encode_set_info_request(struct smb2_context *smb2,
                         len = 28 + name->len * 2;
                         smb2_set_uint32(iov, 4, len); /* buffer length */
 
-                        buf = calloc(len, sizeof(uint8_t));
+                        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
                         if (buf == NULL) {
                                 smb2_set_error(smb2, "Failed to allocate set "
                                                "info data buffer");
-                                free(name);
+                                smb2_free(smb2, name);
                                 return -1;
                         }
                         iov = smb2_add_iovector(smb2, &pdu->out, buf, len,
-                                                free);
+                                                smb2_free_cb);
                         if (iov == NULL) {
                                 smb2_set_error(smb2, "Failed to add iovector for set-info rename data");
-                                free(name);
+                                smb2_free(smb2, name);
                                 return -1;
                         }
 
@@ -186,21 +186,21 @@ smb2_encode_set_info_request(struct smb2_context *smb2,
                         smb2_set_uint64(iov, 8, 0u);
                         smb2_set_uint32(iov, 16, name->len * 2);
                         memcpy(iov->buf + 20, name->val, name->len * 2);
-                        free(name);
+                        smb2_free(smb2, name);
 
                         break;
                 case SMB2_FILE_DISPOSITION_INFORMATION:
                         len = 1;
                         smb2_set_uint32(iov, 4, len); /* buffer length */
 
-                        buf = calloc(len, sizeof(uint8_t));
+                        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
                         if (buf == NULL) {
                                 smb2_set_error(smb2, "Failed to allocate set "
                                                "info data buffer");
                                 return -1;
                         }
                         iov = smb2_add_iovector(smb2, &pdu->out, buf, len,
-                                                free);
+                                                smb2_free_cb);
                         if (iov == NULL) {
                                 smb2_set_error(smb2, "Failed to add iovector for set-info disposition data");
                                 return -1;
@@ -262,13 +262,13 @@ smb2_encode_set_info_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_SET_INFO_REPLY_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate set info buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for set-info reply header");
                 return -1;
@@ -327,7 +327,7 @@ smb2_process_set_info_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate set-info request");
                 return -1;
@@ -65,14 +65,14 @@ smb2_encode_tree_connect_request(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_TREE_CONNECT_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate tree connect setup "
                                "buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for tree connect request");
                 return -1;
@@ -86,7 +86,7 @@ smb2_encode_tree_connect_request(struct smb2_context *smb2,
 
 
         /* Path */
-        buf = malloc(req->path_length);
+        buf = smb2_malloc(smb2, req->path_length);
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate tcon path");
                 return -1;
@@ -95,7 +95,7 @@ smb2_encode_tree_connect_request(struct smb2_context *smb2,
         iov = smb2_add_iovector(smb2, &pdu->out,
                                 buf,
                                 req->path_length,
-                                free);
+                                smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for tree connect path");
                 return -1;
@@ -139,14 +139,14 @@ smb2_encode_tree_connect_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_TREE_CONNECT_REPLY_SIZE;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate tree connect reply "
                                "buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for tree connect reply");
                 return -1;
@@ -213,7 +213,7 @@ smb2_process_tree_connect_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate tcon reply");
                 return -1;
@@ -251,7 +251,7 @@ smb2_process_tree_connect_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate tcon request");
                 return -1;
@@ -63,14 +63,14 @@ smb2_encode_tree_disconnect_request(struct smb2_context *smb2,
 
         len = 4;
 
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate tree disconnect "
                                "buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for tree disconnect request");
                 return -1;
@@ -114,14 +114,14 @@ smb2_encode_tree_disconnect_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_TREE_DISCONNECT_REPLY_SIZE;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate tree disconnect "
                                "reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 smb2_set_error(smb2, "Failed to add iovector for tree disconnect reply");
                 return -1;
@@ -39,6 +39,14 @@
 #include <stddef.h>
 #endif
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_SYS__IOVEC_H
+#include <sys/_iovec.h>
+#endif
+
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
@@ -65,13 +73,7 @@ smb2_encode_write_request(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_WRITE_REQUEST_SIZE & 0xfffffffe;
-        buf = calloc(len, sizeof(uint8_t));
-        if (buf == NULL) {
-                smb2_set_error(smb2, "Failed to allocate write buffer");
-                return -1;
-        }
-
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_fixed_iovector(smb2, pdu, len);
         if (iov == NULL) {
                 return -1;
         }
@@ -97,7 +99,7 @@ smb2_encode_write_request(struct smb2_context *smb2,
                         smb2_set_uint16(iov, 40, req->write_channel_info_offset);
 
                         len = PAD_TO_64BIT(req->write_channel_info_length);
-                        buf = malloc(len);
+                        buf = smb2_malloc(smb2, len);
                         if (buf == NULL) {
                                 smb2_set_error(smb2, "Failed to allocate write channel context");
                                 return -1;
@@ -108,7 +110,7 @@ smb2_encode_write_request(struct smb2_context *smb2,
                         iov = smb2_add_iovector(smb2, &pdu->out,
                                                         buf,
                                                         len,
-                                                        free);
+                                                        smb2_free_cb);
                         if (iov == NULL) {
                                 return -1;
                         }
@@ -159,6 +161,50 @@ smb2_cmd_write_async(struct smb2_context *smb2,
         return pdu;
 }
 
+/*
+ * Like smb2_cmd_write_async() but the data is gathered from iovcnt
+ * buffers. req->length must be the sum of their lengths.
+ */
+struct smb2_pdu *
+smb2_cmd_writev_async(struct smb2_context *smb2,
+                      struct smb2_write_request *req,
+                      const struct iovec *iov, int iovcnt,
+                      smb2_command_cb cb, void *cb_data)
+{
+        struct smb2_pdu *pdu;
+        int i;
+
+        pdu = smb2_allocate_pdu(smb2, SMB2_WRITE, cb, cb_data);
+        if (pdu == NULL) {
+                return NULL;
+        }
+
+        if (smb2_encode_write_request(smb2, pdu, req)) {
+                smb2_free_pdu(smb2, pdu);
+                return NULL;
+        }
+
+        if (smb2_pad_to_64bit(smb2, &pdu->out) != 0) {
+                smb2_free_pdu(smb2, pdu);
+                return NULL;
+        }
+
+        for (i = 0; i < iovcnt; i++) {
+                if (smb2_add_iovector(smb2, &pdu->out, iov[i].iov_base,
+                                      iov[i].iov_len, NULL) == NULL) {
+                        smb2_free_pdu(smb2, pdu);
+                        return NULL;
+                }
+        }
+
+        /* Adjust credit charge for large payloads */
+        if (smb2->supports_multi_credit) {
+                pdu->header.credit_charge = (req->length - 1) / 65536 + 1; /* 3.1.5.2 of [MS-SMB2] */
+        }
+
+        return pdu;
+}
+
 static int
 smb2_encode_write_reply(struct smb2_context *smb2,
                           struct smb2_pdu *pdu,
@@ -169,13 +215,13 @@ smb2_encode_write_reply(struct smb2_context *smb2,
         struct smb2_iovec *iov;
 
         len = SMB2_WRITE_REPLY_SIZE;
-        buf = calloc(len, sizeof(uint8_t));
+        buf = smb2_calloc(smb2, len, sizeof(uint8_t));
         if (buf == NULL) {
                 smb2_set_error(smb2, "Failed to allocate write reply buffer");
                 return -1;
         }
 
-        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, free);
+        iov = smb2_add_iovector(smb2, &pdu->out, buf, len, smb2_free_cb);
         if (iov == NULL) {
                 return -1;
         }
@@ -230,7 +276,7 @@ smb2_process_write_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        rep = malloc(sizeof(*rep));
+        rep = smb2_malloc(smb2, sizeof(*rep));
         if (rep == NULL) {
                 smb2_set_error(smb2, "Failed to allocate write reply");
                 return -1;
@@ -263,7 +309,7 @@ smb2_process_write_request_fixed(struct smb2_context *smb2,
                 return -1;
         }
 
-        req = malloc(sizeof(*req));
+        req = smb2_malloc(smb2, sizeof(*req));
         if (req == NULL) {
                 smb2_set_error(smb2, "Failed to allocate write request");
                 return -1;
@@ -285,7 +331,7 @@ smb2_process_write_request_fixed(struct smb2_context *smb2,
                 if (req->write_channel_info_offset < (SMB2_HEADER_SIZE + (SMB2_WRITE_REQUEST_SIZE & 0xfffe))) {
                         smb2_set_error(smb2, "channel info overlaps request");
                         pdu->payload = NULL;
-                        free(req);
+                        smb2_free(smb2, req);
                         return -1;
                 }
         }
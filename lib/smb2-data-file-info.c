@@ -171,7 +171,7 @@ smb2_decode_file_stream_info(struct smb2_context *smb2,
                                 name_len = (int)vec->len - (int)offset - 24;
                         }
                         if (name_len > 0) {
-                                name = smb2_utf16_to_utf8(
+                                name = smb2_ctx_utf16_to_utf8(smb2, 
                                         (uint16_t *)(void *)&vec->buf[offset + 24],
                                         name_len / 2);
                                 if (!name) {
@@ -180,11 +180,11 @@ smb2_decode_file_stream_info(struct smb2_context *smb2,
                                 fs->stream_name_length = strlen(name);
                                 fs->stream_name = smb2_alloc_data(smb2, memctx, fs->stream_name_length + 1);
                                 if (fs->stream_name == NULL) {
-                                        free(discard_const(name));
+                                        smb2_free(smb2, discard_const(name));
                                         return -1;
                                 }
                                 strcpy(discard_const(fs->stream_name), name);
-                                free(discard_const(name));
+                                smb2_free(smb2, discard_const(name));
                         } else {
                                 fs->stream_name = NULL;
                         }
@@ -227,12 +227,12 @@ smb2_encode_file_stream_info(struct smb2_context *smb2,
                 smb2_set_uint64(vec, offset + 16, fs->stream_allocation_size);
 
                 if (fs->stream_name) {
-                        name = smb2_utf8_to_utf16((const char*)fs->stream_name);
+                        name = smb2_ctx_utf8_to_utf16(smb2, (const char*)fs->stream_name);
                         if (name) {
                                 /* could be truncated */
                                 name_len = 2 * name->len;
                                 memcpy((uint16_t *)(void *)&vec->buf[offset + 24], name->val, name_len);
-                                free(name);
+                                smb2_free(smb2, name);
                         } else {
                                 return -1;
                         }
@@ -314,17 +314,17 @@ smb2_decode_file_all_info(struct smb2_context *smb2,
         smb2_get_uint32(vec, 96, &name_len);
 
         if (name_len > 0) {
-                name = smb2_utf16_to_utf8((uint16_t *)(void *)&vec->buf[100], name_len / 2);
+                name = smb2_ctx_utf16_to_utf8(smb2, (uint16_t *)(void *)&vec->buf[100], name_len / 2);
                 if (!name) {
                         return -1;
                 }
                 fs->name = smb2_alloc_data(smb2, memctx, strlen(name) + 1);
                 if (fs->name == NULL) {
-                        free(discard_const(name));
+                        smb2_free(smb2, discard_const(name));
                         return -1;
                 }
                 strcpy(discard_const(fs->name), name);
-                free(discard_const(name));
+                smb2_free(smb2, discard_const(name));
         } else {
                 fs->name = NULL;
         }
@@ -363,12 +363,12 @@ smb2_encode_file_all_info(struct smb2_context *smb2,
         smb2_set_uint32(vec, 88, fs->mode);
         smb2_set_uint32(vec, 92, fs->alignment_requirement);
         if (fs->name) {
-                name = smb2_utf8_to_utf16((const char*)fs->name);
+                name = smb2_ctx_utf8_to_utf16(smb2, (const char*)fs->name);
                 if (name) {
                         name_len = 2 * name->len;
                         smb2_set_uint32(vec, 96, name_len);
                         memcpy((uint16_t *)(void *)&vec->buf[100], name->val, name_len);
-                        free(name);
+                        smb2_free(smb2, name);
                         return 100 + name_len;
                 } else {
                         return -1;
@@ -466,18 +466,18 @@ smb2_decode_file_normalized_name_info(struct smb2_context *smb2,
                         name_len = vec->len - 4;
                 }
                 if (name_len > 0) {
-                        name = smb2_utf16_to_utf8((uint16_t *)(void *)&vec->buf[4], name_len / 2);
+                        name = smb2_ctx_utf16_to_utf8(smb2, (uint16_t *)(void *)&vec->buf[4], name_len / 2);
                         if (!name) {
                                 return -1;
                         }
                         name_len = strlen(name);
                         fs->name = smb2_alloc_data(smb2, memctx, name_len + 1);
                         if (fs->name == NULL) {
-                                free(discard_const(name));
+                                smb2_free(smb2, discard_const(name));
                                 return -1;
                         }
                         strcpy(discard_const(fs->name), name);
-                        free(discard_const(name));
+                        smb2_free(smb2, discard_const(name));
                 } else {
                         fs->name = NULL;
                 }
@@ -502,7 +502,7 @@ smb2_encode_file_normalized_name_info(struct smb2_context *smb2,
         }
 
         if (fs->name) {
-                name = smb2_utf8_to_utf16((const char*)fs->name);
+                name = smb2_ctx_utf8_to_utf16(smb2, (const char*)fs->name);
                 if (name) {
                         name_len = 2 * name->len;
                         if (fs->file_name_length < name_len) {
@@ -517,7 +517,7 @@ smb2_encode_file_normalized_name_info(struct smb2_context *smb2,
                                 memset(&vec->buf[4 + name_len], 0,
                                         fs->file_name_length - name_len);
                         }
-                        free(name);
+                        smb2_free(smb2, name);
                 } else {
                         return -1;
                 }
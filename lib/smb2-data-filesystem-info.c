@@ -68,15 +68,15 @@ smb2_decode_file_fs_volume_info(struct smb2_context *smb2,
         smb2_get_uint32(vec, 12, &fs->volume_label_length);
         smb2_get_uint8(vec,  16, &fs->supports_objects);
         smb2_get_uint8(vec,  17, &fs->reserved);
-        name = smb2_utf16_to_utf8((uint16_t *)(void *)&vec->buf[18],
+        name = smb2_ctx_utf16_to_utf8(smb2, (uint16_t *)(void *)&vec->buf[18],
                             fs->volume_label_length / 2);
         fs->volume_label = smb2_alloc_data(smb2, memctx, strlen(name) + 1);
         if (fs->volume_label == NULL) {
-                free(discard_const(name));
+                smb2_free(smb2, discard_const(name));
                 return -1;
         }
         strcpy(discard_const(fs->volume_label), name);
-        free(discard_const(name));
+        smb2_free(smb2, discard_const(name));
 
 	return 0;
 }
@@ -95,11 +95,11 @@ smb2_encode_file_fs_volume_info(struct smb2_context *smb2,
         smb2_set_uint32(vec,  8, fs->volume_serial_number);
         smb2_set_uint8(vec,  16, fs->supports_objects);
         smb2_set_uint8(vec,  17, fs->reserved);
-        name = smb2_utf8_to_utf16((char*)fs->volume_label);
+        name = smb2_ctx_utf8_to_utf16(smb2, (char*)fs->volume_label);
         name_len = 2 * name->len;
         smb2_set_uint32(vec, 12, name_len);
         memcpy(&vec->buf[18], name->val, name_len);
-        free(name);
+        smb2_free(smb2, name);
 
         return 18 + name_len;
 }
@@ -187,18 +187,18 @@ smb2_decode_file_fs_attribute_info(struct smb2_context *smb2,
         smb2_get_uint32(vec, 8, &name_len);
 
         if (name_len > 0) {
-                name = smb2_utf16_to_utf8((uint16_t *)(void *)&vec->buf[12], name_len / 2);
+                name = smb2_ctx_utf16_to_utf8(smb2, (uint16_t *)(void *)&vec->buf[12], name_len / 2);
                 if (!name) {
 
                         return -1;
                 }
                 fs->filesystem_name = smb2_alloc_data(smb2, memctx, strlen(name) + 1);
                 if (fs->filesystem_name == NULL) {
-                        free(discard_const(name));
+                        smb2_free(smb2, discard_const(name));
                         return -1;
                 }
                 strcpy(discard_const(fs->filesystem_name), name);
-                free(discard_const(name));
+                smb2_free(smb2, discard_const(name));
         }
         return 0;
 }
@@ -218,11 +218,11 @@ smb2_encode_file_fs_attribute_info(struct smb2_context *smb2,
         smb2_set_uint32(vec,  0, fs->filesystem_attributes);
         smb2_set_uint32(vec,  4, fs->maximum_component_name_length);
 
-        name = smb2_utf8_to_utf16((char*)fs->filesystem_name);
+        name = smb2_ctx_utf8_to_utf16(smb2, (char*)fs->filesystem_name);
         name_len = 2  * name->len;
         smb2_set_uint32(vec, 8, name_len);
         memcpy(&vec->buf[12], name->val, name_len);
-        free(name);
+        smb2_free(smb2, name);
         return 12 + name_len;
 }
 
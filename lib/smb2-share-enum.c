@@ -76,10 +76,10 @@ struct smb2nse {
 };
 
 static void
-nse_free(struct smb2nse *nse)
+nse_free(struct smb2_context *smb2, struct smb2nse *nse)
 {
-        free(discard_const(nse->se_req.ServerName.utf8));
-        free(nse);
+        smb2_free(smb2, discard_const(nse->se_req.ServerName.utf8));
+        smb2_free(smb2, nse);
 }
 
 static void
@@ -92,13 +92,13 @@ srvsvc_ioctl_cb(struct dcerpc_context *dce, int status,
 
         if (status != SMB2_STATUS_SUCCESS) {
                 nse->cb(smb2, status, NULL, nse->cb_data);
-                nse_free(nse);
+                nse_free(smb2, nse);
                 dcerpc_destroy_context(dce);
                 return;
         }
         
         nse->cb(smb2, rep->status, rep, nse->cb_data);
-        nse_free(nse);
+        nse_free(smb2, nse);
         dcerpc_destroy_context(dce);
 }
 
@@ -111,7 +111,7 @@ share_enum_bind_cb(struct dcerpc_context *dce, int status,
 
         if (status != SMB2_STATUS_SUCCESS) {
                 nse->cb(smb2, status, NULL, nse->cb_data);
-                nse_free(nse);
+                nse_free(smb2, nse);
                 dcerpc_destroy_context(dce);
                 return;
         }
@@ -124,7 +124,7 @@ share_enum_bind_cb(struct dcerpc_context *dce, int status,
                                    srvsvc_ioctl_cb, nse);
         if (status) {
                 nse->cb(smb2, status, NULL, nse->cb_data);
-                nse_free(nse);
+                nse_free(smb2, nse);
                 dcerpc_destroy_context(dce);
                 return;
         }
@@ -145,7 +145,7 @@ smb2_share_enum_async(struct smb2_context *smb2,
                 return -ENOMEM;
         }
         
-        nse = calloc(1, sizeof(struct smb2nse));
+        nse = smb2_calloc(smb2, 1, sizeof(struct smb2nse));
         if (nse == NULL) {
                 smb2_set_error(smb2, "Failed to allocate nse");
                 dcerpc_destroy_context(dce);
@@ -154,9 +154,9 @@ smb2_share_enum_async(struct smb2_context *smb2,
         nse->cb = cb;
         nse->cb_data = cb_data;
 
-        server = malloc(strlen(smb2->server) + 3);
+        server = smb2_malloc(smb2, strlen(smb2->server) + 3);
         if (server == NULL) {
-                free(nse);
+                smb2_free(smb2, nse);
                 smb2_set_error(smb2, "Failed to allocate server");
                 dcerpc_destroy_context(dce);
                 return -ENOMEM;
@@ -185,7 +185,7 @@ smb2_share_enum_async(struct smb2_context *smb2,
         rc = dcerpc_connect_context_async(dce, "srvsvc", &srvsvc_interface,
                                           share_enum_bind_cb, nse);
         if (rc) {
-                nse_free(nse);
+                nse_free(smb2, nse);
                 dcerpc_destroy_context(dce);
                 return rc;
         }
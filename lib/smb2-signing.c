@@ -62,105 +62,44 @@
 #define EBC 1
 #define CBC 1
 
-#include "aes.h"
-#include "sha.h"
-#include "sha-private.h"
+#include "crypto.h"
+#include "portable-endian.h"
 
-#define AES128_KEY_LEN     16
 #define AES_BLOCK_SIZE     16
 
-static
-int aes_cmac_shift_left(uint8_t data[AES128_KEY_LEN])
-{
-        int i = 0;
-        int cin = 0;
-        int cout = 0;
-
-        for (i = AES128_KEY_LEN - 1; i >= 0; i--) {
-            cout = ((int) data[i] & 0x80) >> 7;
-            data[i] = (data[i] << 1) | cin;
-            cin = cout;
-        }
-
-        return cout;
-}
-
-static
-void aes_cmac_xor(
-    uint8_t data[AES128_KEY_LEN],
-    const uint8_t value[AES128_KEY_LEN]
-    )
-{
-        int i = 0;
-
-        for (i = 0; i < AES128_KEY_LEN; i++) {
-            data[i] ^= value[i];
-        }
-}
-
-static
-void aes_cmac_sub_keys(
-    uint8_t key[AES128_KEY_LEN],
-    uint8_t sub_key1[AES128_KEY_LEN],
-    uint8_t sub_key2[AES128_KEY_LEN]
-    )
-{
-        uint8_t zero[AES128_KEY_LEN] = {0};
-        static const uint8_t rb[AES128_KEY_LEN] = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0x87};
-
-        AES128_ECB_encrypt(zero, key, sub_key1);
-        if (aes_cmac_shift_left(sub_key1)) {
-                aes_cmac_xor(sub_key1, rb);
-        }
-
-        memcpy(sub_key2, sub_key1, AES128_KEY_LEN);
-
-        if (aes_cmac_shift_left(sub_key2)) {
-                aes_cmac_xor(sub_key2, rb);
-        }
-}
-
-void smb3_aes_cmac_128(uint8_t key[AES128_KEY_LEN],
-                   uint8_t * msg,
-                   uint64_t msg_len,
-                   uint8_t mac[AES128_KEY_LEN]
-                  )
+/*
+ * AES-GMAC signing, SMB 3.1.1 with the signing capabilities context.
+ * The nonce is the MessageId followed by a 32 bit field where bit 0 is
+ * set for server responses and bit 1 for CANCEL requests.
+ */
+static void
+smb3_aes_gmac(struct smb2_context *smb2, struct smb2_iovec *iov,
+              size_t niov, uint8_t mac[AES_BLOCK_SIZE])
 {
-        uint8_t sub_key1[AES128_KEY_LEN] = {0};
-        uint8_t sub_key2[AES128_KEY_LEN] = {0};
-        uint8_t scratch[AES128_KEY_LEN] = {0};
-        uint64_t n = (msg_len + AES128_KEY_LEN - 1) / AES128_KEY_LEN;
-        uint64_t rem = msg_len % AES128_KEY_LEN;
-        uint64_t i = 0;
-        int is_last_block_complete = n != 0 && rem == 0;
-
-        if (n == 0) {
-                n = 1;
+        struct smb2_hash_ctx ctx;
+        uint8_t nonce[12];
+        uint32_t flags, role = 0;
+        uint16_t command;
+        size_t i;
+
+        memcpy(&nonce[0], &iov[0].buf[24], 8);
+        memcpy(&flags, &iov[0].buf[16], 4);
+        memcpy(&command, &iov[0].buf[12], 2);
+        if (le32toh(flags) & SMB2_FLAGS_SERVER_TO_REDIR) {
+                role |= 0x00000001;
         }
-
-        aes_cmac_sub_keys(key, sub_key1, sub_key2);
-
-        memset(mac, 0, AES128_KEY_LEN);
-
-        for (i = 0; i < n - 1; i++) {
-                aes_cmac_xor(mac, &msg[i*AES128_KEY_LEN]);
-                AES128_ECB_encrypt(mac, key, scratch);
-                memcpy(mac, scratch, AES128_KEY_LEN);
+        if (le16toh(command) == SMB2_CANCEL) {
+                role |= 0x00000002;
         }
+        role = htole32(role);
+        memcpy(&nonce[8], &role, 4);
 
-        if (is_last_block_complete) {
-                memcpy(scratch, &msg[i*AES128_KEY_LEN], AES128_KEY_LEN);
-                aes_cmac_xor(scratch, sub_key1);
-        } else {
-                memcpy(scratch, &msg[i*AES128_KEY_LEN], (size_t)rem);
-                scratch[rem] = 0x80;
-                memset(&scratch[rem + 1], 0, AES128_KEY_LEN - ((size_t)rem + 1));
-                aes_cmac_xor(scratch, sub_key2);
+        smb2_aes_mac_init(&ctx, smb2->crypto, SMB2_CRYPTO_AES_GMAC,
+                          smb2->signing_ks, nonce);
+        for (i = 0; i < niov; i++) {
+                smb2_hash_update(&ctx, iov[i].buf, iov[i].len);
         }
-
-        aes_cmac_xor(mac, scratch);
-        AES128_ECB_encrypt(mac, key, scratch);
-        memcpy(mac, scratch, AES128_KEY_LEN);
+        smb2_hash_final(&ctx, mac);
 }
 
 int
@@ -172,39 +111,38 @@ smb2_calc_signature(struct smb2_context *smb2, uint8_t *signature,
         memset(iov[0].buf + 48, 0, 16);
 
         if (smb2->dialect > SMB2_VERSION_0210) {
-                size_t i = 0;
-                size_t len = 0, offset = 0;
+                struct smb2_hash_ctx ctx;
                 uint8_t aes_mac[AES_BLOCK_SIZE];
-                /* combine the buffers into one */
-                uint8_t *msg = NULL;
+                size_t i;
 
-                for (i=0; i < niov; i++) {
-                        len += iov[i].len;
-                }
-                msg = (uint8_t *) malloc(len);
-                if (msg == NULL) {
-                        smb2_set_error(smb2, "Failed to allocate buffer for "
-                                       "signature calculation");
+                if (smb2->signing_ks == NULL) {
+                        smb2_set_error(smb2, "No signing key available");
                         return -1;
                 }
-
+                if (smb2->dialect >= SMB2_VERSION_0311 &&
+                    smb2->signing_algorithm == SMB2_SIGNING_AES_GMAC) {
+                        smb3_aes_gmac(smb2, iov, niov, aes_mac);
+                        memcpy(&signature[0], aes_mac, SMB2_SIGNATURE_SIZE);
+                        return 0;
+                }
+                smb2_aes_mac_init(&ctx, smb2->crypto, SMB2_CRYPTO_AES_CMAC,
+                                  smb2->signing_ks, NULL);
                 for (i=0; i < niov; i++) {
-                        memcpy(msg + offset, iov[i].buf, iov[i].len);
-                        offset += iov[i].len;
+                        smb2_hash_update(&ctx, iov[i].buf, iov[i].len);
                 }
-                smb3_aes_cmac_128(smb2->signing_key, msg, offset, aes_mac);
-                free(msg);
+                smb2_hash_final(&ctx, aes_mac);
                 memcpy(&signature[0], aes_mac, SMB2_SIGNATURE_SIZE);
         } else {
-                HMACContext ctx;
+                struct smb2_hash_ctx ctx;
                 uint8_t digest[USHAMaxHashSize];
                 size_t i;
 
-                hmacReset(&ctx, SHA256, &smb2->signing_key[0], SMB2_KEY_SIZE);
+                smb2_hash_init(&ctx, smb2->crypto, SMB2_CRYPTO_HMAC_SHA256,
+                               &smb2->signing_key[0], SMB2_KEY_SIZE);
                 for (i=0; i < niov; i++) {
-                        hmacInput(&ctx, iov[i].buf, iov[i].len);
+                        smb2_hash_update(&ctx, iov[i].buf, iov[i].len);
                 }
-                hmacResult(&ctx, digest);
+                smb2_hash_final(&ctx, digest);
                 memcpy(&signature[0], digest, SMB2_SIGNATURE_SIZE);
         }
 
@@ -57,16 +57,147 @@
 
 #include "portable-endian.h"
 
-#include "aes128ccm.h"
 #include "slist.h"
 #include "smb2.h"
 #include "libsmb2.h"
+#include "crypto.h"
 #include "libsmb2-raw.h"
 #include "libsmb2-private.h"
+#include "crypto-pool.h"
 #include "smb3-seal.h"
 
 static const char xfer[4] = {0xFD, 'S', 'M', 'B'};
 
+int
+smb3_cipher_supported(uint16_t cipher)
+{
+        switch (cipher) {
+        case SMB2_ENCRYPTION_AES_128_CCM:
+        case SMB2_ENCRYPTION_AES_128_GCM:
+        case SMB2_ENCRYPTION_AES_256_CCM:
+        case SMB2_ENCRYPTION_AES_256_GCM:
+                return 1;
+        }
+        return 0;
+}
+
+int
+smb3_cipher_key_size(uint16_t cipher)
+{
+        switch (cipher) {
+        case SMB2_ENCRYPTION_AES_256_CCM:
+        case SMB2_ENCRYPTION_AES_256_GCM:
+                return 32;
+        }
+        return 16;
+}
+
+/*
+ * Sealed PDUs are encrypted into a transmit buffer that is handed back
+ * once the PDU has been written. One buffer, the largest one seen so far,
+ * is kept per connection so that a stream of sealed PDUs does not
+ * allocate a new buffer for each of them.
+ */
+static uint8_t *
+smb3_get_crypt_buf(struct smb2_context *smb2, size_t len, size_t *size)
+{
+        uint8_t *buf;
+
+        if (smb2->crypt_buf != NULL && smb2->crypt_buf_size >= len) {
+                buf = smb2->crypt_buf;
+                *size = smb2->crypt_buf_size;
+                smb2->crypt_buf = NULL;
+                smb2->crypt_buf_size = 0;
+                return buf;
+        }
+        buf = smb2_malloc(smb2, len);
+        if (buf == NULL) {
+                smb2_set_error(smb2, "Failed to allocate encryption buffer");
+                return NULL;
+        }
+        *size = len;
+        return buf;
+}
+
+/*
+ * Large PDUs are sealed and unsealed on the crypto pool when there is one,
+ * see smb2_set_crypto_threads(). Anything smaller is not worth the
+ * handover to another thread.
+ */
+#define SMB3_CRYPTO_OFFLOAD_SIZE (32 * 1024)
+
+struct smb3_seal_job {
+        struct smb2_crypto_job job;
+        struct smb2_pdu *pdu;
+        const struct smb2_crypto_provider *p;
+        uint16_t cipher;
+        const struct smb2_key *ks;
+};
+
+/* Waits until a PDU that is sealed on the crypto pool is ready to be sent */
+void
+smb3_wait_seal(struct smb2_context *smb2, struct smb2_pdu *pdu)
+{
+        if (pdu->seal_job == NULL) {
+                return;
+        }
+        smb2_crypto_job_wait(smb2->crypto_pool, &pdu->seal_job->job);
+        smb2_free(smb2, pdu->seal_job);
+        pdu->seal_job = NULL;
+}
+
+void
+smb3_put_crypt_buf(struct smb2_context *smb2, struct smb2_pdu *pdu)
+{
+        smb3_wait_seal(smb2, pdu);
+        if (pdu->crypt == NULL) {
+                return;
+        }
+        if (smb2->crypt_buf_size < pdu->crypt_size) {
+                smb2_free(smb2, smb2->crypt_buf);
+                smb2->crypt_buf = pdu->crypt;
+                smb2->crypt_buf_size = pdu->crypt_size;
+        } else {
+                smb2_free(smb2, pdu->crypt);
+        }
+        pdu->crypt = NULL;
+        pdu->crypt_size = 0;
+}
+
+/*
+ * Encrypts straight from the vectors of the PDU chain into pdu->crypt,
+ * after the transform header. This may run on the crypto pool.
+ */
+static void
+smb3_seal_payload(const struct smb2_crypto_provider *p, uint16_t cipher,
+                  const struct smb2_key *ks, struct smb2_pdu *pdu)
+{
+        struct smb2_aead_ctx ctx;
+        struct smb2_pdu *tmp_pdu;
+        uint32_t spl = 52;
+        int i;
+
+        smb2_aead_init(&ctx, p, cipher, ks, &pdu->crypt[20],
+                       &pdu->crypt[20], 32, pdu->crypt_len - 52, 1);
+        for (tmp_pdu = pdu; tmp_pdu; tmp_pdu = tmp_pdu->next_compound) {
+                for (i = 0; i < tmp_pdu->out.niov; i++) {
+                        smb2_aead_update(&ctx, tmp_pdu->out.iov[i].buf,
+                                         &pdu->crypt[spl],
+                                         tmp_pdu->out.iov[i].len);
+                        spl += (uint32_t)tmp_pdu->out.iov[i].len;
+                }
+        }
+        smb2_aead_final(&ctx, &pdu->crypt[4]);
+}
+
+static void
+smb3_seal_job_fn(struct smb2_crypto_job *job)
+{
+        struct smb3_seal_job *sj = (struct smb3_seal_job *)job;
+
+        smb3_seal_payload(sj->p, sj->cipher, sj->ks, sj->pdu);
+}
+
 int
 smb3_encrypt_pdu(struct smb2_context *smb2,
                  struct smb2_pdu *pdu)
@@ -75,6 +206,8 @@ smb3_encrypt_pdu(struct smb2_context *smb2,
         uint32_t spl, u32;
         int i;
         uint16_t u16;
+        uint64_t u64;
+        const struct smb2_key *ks;
 
         if (!smb2->seal) {
                 return 0;
@@ -82,6 +215,18 @@ smb3_encrypt_pdu(struct smb2_context *smb2,
         if (!pdu->seal) {
                 return 0;
         }
+        if (!smb3_cipher_supported(smb2->cypher)) {
+                smb2_set_error(smb2, "No supported cipher negotiated");
+                pdu->seal = 0;
+                return -1;
+        }
+        /* ServerIn is the client to server key */
+        ks = smb2_is_server(smb2) ? smb2->serverout_ks : smb2->serverin_ks;
+        if (ks == NULL) {
+                smb2_set_error(smb2, "No encryption key available");
+                pdu->seal = 0;
+                return -1;
+        }
 
         spl = 52;  /* transform header */
         for (tmp_pdu = pdu; tmp_pdu; tmp_pdu = tmp_pdu->next_compound) {
@@ -89,77 +234,508 @@ smb3_encrypt_pdu(struct smb2_context *smb2,
                         spl += (uint32_t)tmp_pdu->out.iov[i].len;
                 }
         }
-        pdu->crypt = calloc(spl, sizeof(uint8_t));
+        pdu->crypt = smb3_get_crypt_buf(smb2, spl, &pdu->crypt_size);
         if (pdu->crypt == NULL) {
                 pdu->seal = 0;
                 return -1;
         }
+        pdu->crypt_len = spl;
 
+        /* The nonce only has to be unique for the key, which is derived
+         * for each session, so a counter will do. Only this side of the
+         * connection encrypts with this key.
+         */
+        memset(&pdu->crypt[0], 0, 52);
         memcpy(&pdu->crypt[0], xfer, 4);
-        for (i = 20; i < 31; i++) {
-                pdu->crypt[i] = random()&0xff;
-        }
+        u64 = htole64(smb2->nonce_counter);
+        smb2->nonce_counter++;
+        memcpy(&pdu->crypt[20], &u64, 8);
         u32 = htole32(spl - 52);
         memcpy(&pdu->crypt[36], &u32, 4);
         u16 = htole16(SMB_ENCRYPTION_AES128_CCM);
         memcpy(&pdu->crypt[42], &u16, 2);
         memcpy(&pdu->crypt[44], &smb2->session_id, 8);
 
-        spl = 52;  /* transform header */
-        for (tmp_pdu = pdu; tmp_pdu; tmp_pdu = tmp_pdu->next_compound) {
-                for (i = 0; i < tmp_pdu->out.niov; i++) {
-                        memcpy(&pdu->crypt[spl], tmp_pdu->out.iov[i].buf,
-                               tmp_pdu->out.iov[i].len);
-                        spl += (uint32_t)tmp_pdu->out.iov[i].len;
+        /* The PDU waits in the outqueue, see smb3_wait_seal(), while it
+         * is sealed on the pool. If there is no memory for the job it is
+         * sealed here instead.
+         */
+        if (smb2->crypto_pool && spl - 52 >= SMB3_CRYPTO_OFFLOAD_SIZE) {
+                pdu->seal_job = smb2_malloc(smb2, sizeof(*pdu->seal_job));
+                if (pdu->seal_job != NULL) {
+                        pdu->seal_job->job.fn = smb3_seal_job_fn;
+                        pdu->seal_job->pdu = pdu;
+                        pdu->seal_job->p = smb2->crypto;
+                        pdu->seal_job->cipher = smb2->cypher;
+                        pdu->seal_job->ks = ks;
+                        smb2_crypto_pool_submit(smb2->crypto_pool,
+                                                &pdu->seal_job->job);
+                        return 0;
                 }
         }
+        smb3_seal_payload(smb2->crypto, smb2->cypher, ks, pdu);
 
-        aes128ccm_encrypt(smb2->serverin_key,
-                          &pdu->crypt[20], 11,
-                          &pdu->crypt[20], 32,
-                          &pdu->crypt[52], spl - 52,
-                          &pdu->crypt[4], 16);
-        pdu->crypt_len = spl;
+        return 0;
+}
+
+/*
+ * Sealed PDUs are decrypted while they are received. The start of the
+ * payload, enough for an SMB2 header and the fixed part of a READ reply,
+ * is read and decrypted first. If it is the reply to one of our READs the
+ * data is then read and decrypted straight into the buffer that was
+ * passed to smb2_cmd_read_async(). Everything else is read into enc_buf
+ * which is kept on the context for the next PDU.
+ * Nothing is passed on until the whole payload has been read and the
+ * tag has been checked.
+ */
+#define SMB3_DECRYPT_HEAD (SMB2_HEADER_SIZE + 16)
 
+static void
+smb3_decrypt_update(struct smb2_aead_ctx *ctx, uint8_t *buf, size_t len)
+{
+        smb2_aead_update(ctx, buf, buf, len);
+}
+
+/* Grows enc_buf to at least len bytes, keeping the first keep bytes */
+static int
+smb3_reserve_enc_buf(struct smb2_context *smb2, size_t len, size_t keep)
+{
+        uint8_t *buf;
+
+        if (smb2->enc_buf_size >= len) {
+                return 0;
+        }
+        buf = smb2_malloc(smb2, len);
+        if (buf == NULL) {
+                smb2_set_error(smb2, "Failed to allocate decryption buffer");
+                return -1;
+        }
+        if (keep) {
+                memcpy(buf, smb2->enc_buf, keep);
+        }
+        smb2_free(smb2, smb2->enc_buf);
+        smb2->enc_buf = buf;
+        smb2->enc_buf_size = len;
         return 0;
 }
 
 int
-smb3_decrypt_pdu(struct smb2_context *smb2)
+smb3_decrypt_start(struct smb2_context *smb2)
 {
-        int rc;
+        uint8_t *hdr = smb2->in.iov[smb2->in.niov - 1].buf;
+        struct smb2_aead_ctx *ctx;
+        const struct smb2_key *ks;
+        size_t len, hlen;
 
-        if (aes128ccm_decrypt(smb2->serverout_key,
-                              &smb2->in.iov[smb2->in.niov - 2].buf[20], 11,
-                              &smb2->in.iov[smb2->in.niov - 2].buf[20], 32,
-                              &smb2->in.iov[smb2->in.niov - 1].buf[0],
-                              smb2->in.iov[smb2->in.niov - 1].len,
-                              &smb2->in.iov[smb2->in.niov - 2].buf[4], 16)) {
-                smb2_set_error(smb2, "Failed to decrypt PDU");
+        if (smb2->spl < 52 + SMB2_HEADER_SIZE) {
+                smb2_set_error(smb2, "Encrypted PDU is too short");
+                return -1;
+        }
+        len = smb2->spl - 52;
+        if (!smb3_cipher_supported(smb2->cypher)) {
+                smb2_set_error(smb2, "No supported cipher negotiated");
+                return -1;
+        }
+        ks = smb2_is_server(smb2) ? smb2->serverin_ks : smb2->serverout_ks;
+        if (ks == NULL) {
+                smb2_set_error(smb2, "No encryption key available");
                 return -1;
         }
+        if (smb2->dec_ctx == NULL) {
+                smb2->dec_ctx = smb2_calloc(smb2, 1, sizeof(*smb2->dec_ctx));
+                if (smb2->dec_ctx == NULL) {
+                        smb2_set_error(smb2, "Failed to allocate decryption "
+                                       "context");
+                        return -1;
+                }
+        }
+        ctx = smb2->dec_ctx;
+
+        /* a PDU that failed half way through may have left state behind */
+        smb2_aead_free(ctx);
+        smb2_aead_init(ctx, smb2->crypto, smb2->cypher, ks, &hdr[20],
+                       &hdr[20], 32, len, 0);
+
+        /* The first 12 bytes of the payload were read with the header */
+        hlen = len < SMB3_DECRYPT_HEAD ? len : SMB3_DECRYPT_HEAD;
+        if (smb3_reserve_enc_buf(smb2, hlen, 0)) {
+                return -1;
+        }
+        memcpy(smb2->enc_buf, &hdr[52], 12);
+        if (smb2_add_iovector(smb2, &smb2->in, smb2->enc_buf, hlen,
+                              NULL) == NULL) {
+                smb2_set_error(smb2, "Failed to add iovector for TRFM "
+                               "payload");
+                return -1;
+        }
+        return 0;
+}
+
+/*
+ * Returns the READ that the decrypted start of the payload is the reply
+ * to, if its data can be decrypted in place in the buffer of the caller.
+ */
+static struct smb2_pdu *
+smb3_find_read_pdu(struct smb2_context *smb2, size_t hlen, size_t len,
+                   uint32_t *data_length)
+{
+        static const uint8_t smb2sig[4] = {0xFE, 'S', 'M', 'B'};
+        uint8_t *buf = smb2->enc_buf;
+        struct smb2_pdu *pdu;
+        uint64_t message_id;
+        uint32_t u32;
+        uint16_t u16;
+        size_t num = 0;
+        int i;
 
-        if (smb2->in.num_done == 0) {
-                smb2->enc = smb2->in.iov[smb2->in.niov - 1].buf;
-                smb2->enc_len = smb2->in.iov[smb2->in.niov - 1].len;
-                smb2->enc_pos = 0;
-                smb2->in.iov[smb2->in.niov - 1].free = NULL;
-                smb2_free_iovector(smb2, &smb2->in);
-
-                smb2->spl = (uint32_t)smb2->enc_len;
-                smb2->recv_state = SMB2_RECV_HEADER;
-                if (smb2_add_iovector(smb2, &smb2->in, &smb2->header[0],
-                                       SMB2_HEADER_SIZE, NULL) == NULL) {
-                        smb2_set_error(smb2, "Failed to add iovector for decrypted header");
-                        free(smb2->enc);
-                        smb2->enc = NULL;
+        if (smb2_is_server(smb2) || hlen < SMB3_DECRYPT_HEAD ||
+            memcmp(buf, smb2sig, 4)) {
+                return NULL;
+        }
+        memcpy(&u16, &buf[12], 2);
+        if (le16toh(u16) != SMB2_READ) {
+                return NULL;
+        }
+        memcpy(&u32, &buf[8], 4);
+        if (le32toh(u32) != SMB2_STATUS_SUCCESS) {
+                return NULL;
+        }
+        /* only single replies, compounds go the normal way */
+        memcpy(&u32, &buf[20], 4);
+        if (u32 != 0) {
+                return NULL;
+        }
+        memcpy(&message_id, &buf[24], 8);
+        pdu = smb2_find_pdu(smb2, le64toh(message_id));
+        if (pdu == NULL || pdu->header.command != SMB2_READ) {
+                return NULL;
+        }
+        if (pdu->prev_compound_mid &&
+            smb2_find_pdu(smb2, pdu->prev_compound_mid)) {
+                return NULL;
+        }
+
+        if (buf[SMB2_HEADER_SIZE + 2] != SMB2_HEADER_SIZE + 16) {
+                return NULL;
+        }
+        memcpy(&u32, &buf[SMB2_HEADER_SIZE + 4], 4);
+        *data_length = le32toh(u32);
+        if (*data_length == 0 || *data_length > len - hlen) {
+                return NULL;
+        }
+        for (i = 0; i < pdu->in.niov; i++) {
+                num += pdu->in.iov[i].len;
+        }
+        if (num < *data_length) {
+                return NULL;
+        }
+        return pdu;
+}
+
+int
+smb3_decrypt_head(struct smb2_context *smb2)
+{
+        struct smb2_iovec *head = &smb2->in.iov[smb2->in.niov - 1];
+        struct smb2_pdu *pdu;
+        size_t hlen = head->len;
+        size_t len = smb2->spl - 52;
+        size_t num;
+        uint32_t data_length = 0;
+        int i;
+
+        smb3_decrypt_update(smb2->dec_ctx, smb2->enc_buf, hlen);
+
+        smb2_free_iovector(smb2, &smb2->enc);
+        pdu = smb3_find_read_pdu(smb2, hlen, len, &data_length);
+        if (pdu == NULL) {
+                if (smb3_reserve_enc_buf(smb2, len, hlen)) {
+                        return -1;
+                }
+                head->buf = smb2->enc_buf;
+                if (len > hlen &&
+                    smb2_add_iovector(smb2, &smb2->in, &smb2->enc_buf[hlen],
+                                      len - hlen, NULL) == NULL) {
                         return -1;
                 }
+                if (smb2_add_iovector(smb2, &smb2->enc, smb2->enc_buf,
+                                      len, NULL) == NULL) {
+                        return -1;
+                }
+                return 0;
+        }
+
+        len -= hlen + data_length;      /* padding after the data */
+        if (smb3_reserve_enc_buf(smb2, hlen + len, hlen)) {
+                return -1;
+        }
+        head->buf = smb2->enc_buf;
+        if (smb2_add_iovector(smb2, &smb2->enc, smb2->enc_buf,
+                              hlen, NULL) == NULL) {
+                return -1;
+        }
+        for (i = 0; data_length; i++) {
+                num = pdu->in.iov[i].len;
+                if (num > data_length) {
+                        num = data_length;
+                }
+                if (smb2_add_iovector(smb2, &smb2->in, pdu->in.iov[i].buf,
+                                      num, NULL) == NULL ||
+                    smb2_add_iovector(smb2, &smb2->enc, pdu->in.iov[i].buf,
+                                      num, NULL) == NULL) {
+                        return -1;
+                }
+                data_length -= (uint32_t)num;
+        }
+        if (len) {
+                if (smb2_add_iovector(smb2, &smb2->in, &smb2->enc_buf[hlen],
+                                      len, NULL) == NULL ||
+                    smb2_add_iovector(smb2, &smb2->enc, &smb2->enc_buf[hlen],
+                                      len, NULL) == NULL) {
+                        return -1;
+                }
+        }
+
+        /* The caller's buffer is now in use, take the PDU off the wait
+         * queue so that it can not time out or be cancelled under us.
+         * smb2_read_data() picks it up from smb2->pdu.
+         */
+        smb2_waitqueue_remove(smb2, pdu);
+        if (smb2->pdu) {
+                smb2_free_pdu(smb2, smb2->pdu);
+        }
+        smb2->pdu = pdu;
+        return 0;
+}
+
+/*
+ * Decrypts the rest of the payload described by enc and checks the tag.
+ * This may run on the crypto pool.
+ */
+static int
+smb3_decrypt_rest(struct smb2_aead_ctx *ctx, struct smb2_io_vectors *enc,
+                  size_t len, uint8_t *m)
+{
+        size_t pos;
+        int i;
+
+        /* The start of the payload was decrypted by smb3_decrypt_head() */
+        pos = len < SMB3_DECRYPT_HEAD ? len : SMB3_DECRYPT_HEAD;
+        for (i = 0; i < enc->niov; i++) {
+                struct smb2_iovec *v = &enc->iov[i];
+
+                if (pos >= v->len) {
+                        pos -= v->len;
+                        continue;
+                }
+                smb3_decrypt_update(ctx, &v->buf[pos], v->len - pos);
+                pos = 0;
+        }
+        return smb2_aead_final(ctx, m);
+}
+
+/* Parses the decrypted payload in smb2->enc */
+static int
+smb3_process_payload(struct smb2_context *smb2, size_t len)
+{
+        int rc;
+
+        /* A server replies sealed once the client has started sealing */
+        if (smb2_is_server(smb2) && !smb2->seal) {
+                smb2->seal = 1;
+                smb2->sign = 0;
+        }
+
+        smb2_free_iovector(smb2, &smb2->in);
+        smb2->spl = (uint32_t)len;
+        smb2->recv_state = SMB2_RECV_HEADER;
+        if (smb2_add_iovector(smb2, &smb2->in, &smb2->header[0],
+                              SMB2_HEADER_SIZE, NULL) == NULL) {
+                smb2_set_error(smb2, "Failed to add iovector for decrypted header");
+                return -1;
         }
 
         rc = smb2_read_from_buf(smb2);
-        free(smb2->enc);
-        smb2->enc = NULL;
+        smb2_free_iovector(smb2, &smb2->enc);
 
         return rc;
 }
+
+/*
+ * A sealed PDU that has been received while the crypto pool is in use.
+ * It owns the buffers that smb2->enc pointed to, and the READ that it
+ * is the reply to if that was taken off the wait queue.
+ */
+struct smb3_rx_job {
+        struct smb2_crypto_job job;
+        struct smb3_rx_job *next;
+        struct smb2_aead_ctx ctx;
+        struct smb2_io_vectors enc;
+        uint8_t *buf;
+        size_t buf_size;
+        size_t len;
+        uint8_t m[16];
+        struct smb2_pdu *pdu;
+        int rc;
+};
+
+static void
+smb3_rx_job_fn(struct smb2_crypto_job *job)
+{
+        struct smb3_rx_job *rx = (struct smb3_rx_job *)job;
+
+        rx->rc = smb3_decrypt_rest(&rx->ctx, &rx->enc, rx->len, rx->m);
+}
+
+static void
+smb3_free_rx_job(struct smb2_context *smb2, struct smb3_rx_job *rx)
+{
+        /* not processed, let the normal teardown deal with the PDU */
+        if (rx->pdu) {
+                smb2_waitqueue_add(smb2, rx->pdu);
+        }
+        smb2_free_iovector(smb2, &rx->enc);
+        if (smb2->enc_buf_size < rx->buf_size) {
+                smb2_free(smb2, smb2->enc_buf);
+                smb2->enc_buf = rx->buf;
+                smb2->enc_buf_size = rx->buf_size;
+        } else {
+                smb2_free(smb2, rx->buf);
+        }
+        smb2_free(smb2, rx);
+}
+
+/*
+ * Moves the PDU that was just received onto the rx list. Large ones are
+ * decrypted on the crypto pool, small ones right away, they only wait
+ * on the list so that they are processed in order.
+ */
+static int
+smb3_queue_rx(struct smb2_context *smb2)
+{
+        struct smb3_rx_job *rx;
+        int i;
+
+        rx = smb2_calloc(smb2, 1, sizeof(*rx));
+        if (rx == NULL) {
+                smb2_set_error(smb2, "Failed to allocate decryption job");
+                return -1;
+        }
+        for (i = 0; i < smb2->enc.niov; i++) {
+                if (smb2_add_iovector(smb2, &rx->enc, smb2->enc.iov[i].buf,
+                                      smb2->enc.iov[i].len, NULL) == NULL) {
+                        smb2_free_iovector(smb2, &rx->enc);
+                        smb2_free(smb2, rx);
+                        return -1;
+                }
+        }
+        smb2_free_iovector(smb2, &smb2->enc);
+        /* the job takes over the state of the decryption */
+        smb2_aead_move(&rx->ctx, smb2->dec_ctx);
+        rx->buf = smb2->enc_buf;
+        rx->buf_size = smb2->enc_buf_size;
+        smb2->enc_buf = NULL;
+        smb2->enc_buf_size = 0;
+        rx->len = smb2->spl - 52;
+        memcpy(rx->m, &smb2->header[4], 16);
+        if (!smb2_is_server(smb2)) {
+                rx->pdu = smb2->pdu;
+                smb2->pdu = NULL;
+        }
+
+        if (smb2->rx_tail) {
+                smb2->rx_tail->next = rx;
+        } else {
+                smb2->rx_head = rx;
+        }
+        smb2->rx_tail = rx;
+
+        rx->job.fn = smb3_rx_job_fn;
+        if (rx->len >= SMB3_CRYPTO_OFFLOAD_SIZE) {
+                smb2_crypto_pool_submit(smb2->crypto_pool, &rx->job);
+        } else {
+                smb3_rx_job_fn(&rx->job);
+                rx->job.done = 1;
+        }
+        return 0;
+}
+
+int
+smb3_dispatch_rx(struct smb2_context *smb2, int wait)
+{
+        struct smb3_rx_job *rx;
+        int i, rc;
+
+        while ((rx = smb2->rx_head) != NULL) {
+                if (!smb2_crypto_job_done(smb2->crypto_pool, &rx->job)) {
+                        if (!wait) {
+                                return 0;
+                        }
+                        smb2_crypto_job_wait(smb2->crypto_pool, &rx->job);
+                }
+                smb2->rx_head = rx->next;
+                if (smb2->rx_head == NULL) {
+                        smb2->rx_tail = NULL;
+                }
+
+                rc = rx->rc;
+                if (rc) {
+                        smb2_set_error(smb2, "Failed to decrypt PDU");
+                }
+                smb2_free_iovector(smb2, &smb2->enc);
+                for (i = 0; rc == 0 && i < rx->enc.niov; i++) {
+                        if (smb2_add_iovector(smb2, &smb2->enc,
+                                              rx->enc.iov[i].buf,
+                                              rx->enc.iov[i].len,
+                                              NULL) == NULL) {
+                                rc = -1;
+                        }
+                }
+                if (rc == 0 && rx->pdu) {
+                        if (smb2->pdu) {
+                                smb2_free_pdu(smb2, smb2->pdu);
+                        }
+                        smb2->pdu = rx->pdu;
+                        rx->pdu = NULL;
+                }
+                if (rc == 0) {
+                        rc = smb3_process_payload(smb2, rx->len);
+                }
+                smb3_free_rx_job(smb2, rx);
+                if (rc) {
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+void
+smb3_flush_rx(struct smb2_context *smb2)
+{
+        struct smb3_rx_job *rx;
+
+        while ((rx = smb2->rx_head) != NULL) {
+                smb2_crypto_job_wait(smb2->crypto_pool, &rx->job);
+                smb2->rx_head = rx->next;
+                smb3_free_rx_job(smb2, rx);
+        }
+        smb2->rx_tail = NULL;
+}
+
+int
+smb3_decrypt_pdu(struct smb2_context *smb2)
+{
+        /* Once one PDU is on the rx list all of them have to go there,
+         * to keep them in order.
+         */
+        if (smb2->crypto_pool &&
+            (smb2->rx_head || smb2->spl - 52 >= SMB3_CRYPTO_OFFLOAD_SIZE)) {
+                return smb3_queue_rx(smb2);
+        }
+
+        if (smb3_decrypt_rest(smb2->dec_ctx, &smb2->enc, smb2->spl - 52,
+                              &smb2->header[4])) {
+                smb2_set_error(smb2, "Failed to decrypt PDU");
+                return -1;
+        }
+        return smb3_process_payload(smb2, smb2->spl - 52);
+}
@@ -34,7 +34,23 @@ int
 smb3_encrypt_pdu(struct smb2_context *smb2,
                  struct smb2_pdu *pdu);
 int
+smb3_decrypt_start(struct smb2_context *smb2);
+int
+smb3_decrypt_head(struct smb2_context *smb2);
+int
 smb3_decrypt_pdu(struct smb2_context *smb2);
+int
+smb3_dispatch_rx(struct smb2_context *smb2, int wait);
+void
+smb3_flush_rx(struct smb2_context *smb2);
+void
+smb3_wait_seal(struct smb2_context *smb2, struct smb2_pdu *pdu);
+void
+smb3_put_crypt_buf(struct smb2_context *smb2, struct smb2_pdu *pdu);
+int
+smb3_cipher_supported(uint16_t cipher);
+int
+smb3_cipher_key_size(uint16_t cipher);
 
 #ifdef __cplusplus
 }
@@ -100,6 +100,7 @@
 #endif
 
 #include <errno.h>
+#include <limits.h>
 
 #include "compat.h"
 
@@ -109,6 +110,8 @@
 #include "smb3-seal.h"
 #include "libsmb2-private.h"
 #include "portable-endian.h"
+#include "socket.h"
+#include "write-behind.h"
 #include <errno.h>
 
 #define MAX_URL_SIZE 1024
@@ -118,6 +121,13 @@
  * Since the smb is most likely used on local network, use an aggressive
  * timeout of 100ms. */
 #define HAPPY_EYEBALLS_TIMEOUT 100
+
+/* Never hand writev() more vectors than the platform accepts */
+#if defined(IOV_MAX) && IOV_MAX < SMB2_MAX_VECTORS
+#define SMB2_MAX_WRITE_VECTORS IOV_MAX
+#else
+#define SMB2_MAX_WRITE_VECTORS SMB2_MAX_VECTORS
+#endif
 #if !defined(HAVE_LINGER)
 struct linger
 {
@@ -142,9 +152,9 @@ smb2_close_connecting_fds(struct smb2_context *smb2)
                 if (smb2->change_fd) {
                         smb2->change_fd(smb2, fd, SMB2_DEL_FD);
                 }
-                close(fd);
+                smb2->transport->close(smb2, fd, smb2->transport_opaque);
         }
-        free(smb2->connecting_fds);
+        smb2_free(smb2, smb2->connecting_fds);
         smb2->connecting_fds = NULL;
         smb2->connecting_fds_count = 0;
 
@@ -188,8 +198,8 @@ smb2_which_events(struct smb2_context *smb2)
 {
         int events = SMB2_VALID_SOCKET(smb2->fd) ? POLLIN : POLLOUT;
 
-        if (smb2->outqueue != NULL &&
-            smb2_get_credit_charge(smb2, smb2->outqueue) <= smb2->credits) {
+        if (smb2->outqueue.head != NULL &&
+            smb2_get_credit_charge(smb2, smb2->outqueue.head) <= smb2->credits) {
                 events |= POLLOUT;
         }
 
@@ -221,76 +231,208 @@ smb2_get_fds(struct smb2_context *smb2, size_t *fd_count, int *timeout)
         }
 }
 
+/*
+ * Appends buf to the batch, leaving out the first *skip bytes which have
+ * already been written.
+ * Returns 0 if the batch has no room left for the vector.
+ */
+static int
+smb2_batch_add_iov(struct smb2_write_batch *batch, void *buf, size_t len,
+                   size_t *skip)
+{
+        if (*skip >= len) {
+                *skip -= len;
+                return 1;
+        }
+        if (batch->niov >= SMB2_MAX_WRITE_VECTORS) {
+                return 0;
+        }
+        batch->iov[batch->niov].iov_base = (char *)buf + *skip;
+#if defined(_WIN32) || defined(_XBOX)
+        batch->iov[batch->niov].iov_len = (unsigned long)(len - *skip);
+#else
+        batch->iov[batch->niov].iov_len = len - *skip;
+#endif
+        batch->niov++;
+        *skip = 0;
+        return 1;
+}
+
+/*
+ * Gathers as many of the queued PDUs as we have credits and vectors for so
+ * they can be sent with a single writev(). Only the PDU at the head of the
+ * outqueue can have been partially written before, it is always the first
+ * one in the batch.
+ * A first PDU that has more vectors than writev() accepts is sent in
+ * several goes: the batch then only holds the part of it that fits and
+ * the rest is picked up by the next batch once num_done has moved on.
+ * Returns the number of PDUs in the batch, 0 if there is nothing we can send
+ * right now.
+ */
 int
-smb2_write_to_socket(struct smb2_context *smb2)
+smb2_prepare_write_batch(struct smb2_context *smb2,
+                         struct smb2_write_batch *batch)
 {
-        struct smb2_pdu *pdu;
+        struct smb2_pdu *pdu, *tmp_pdu;
+        size_t skip;
+        int i, full = 0, npdus = 0;
+        uint32_t credit_charge, credits = 0;
 
-        if (!SMB2_VALID_SOCKET(smb2->fd)) {
-                smb2_set_error(smb2, "trying to write but not connected");
-                return -1;
-        }
-        while ((pdu = smb2->outqueue) != NULL) {
-                struct iovec iov[SMB2_MAX_VECTORS] _U_;
-                struct iovec *tmpiov;
-                struct smb2_pdu *tmp_pdu;
-                size_t num_done = pdu->out.num_done;
-                int i, niov = 1;
-                ssize_t count;
-                uint32_t spl = 0, tmp_spl, credit_charge;
+        batch->niov = 0;
+        for (pdu = smb2->outqueue.head;
+             pdu && npdus < SMB2_MAX_WRITE_PDUS && !full;
+             pdu = pdu->next) {
+                int pdu_niov = 1;
 
                 credit_charge = smb2_get_credit_charge(smb2, pdu);
-                if (credit_charge > (uint32_t)smb2->credits) {
-                        return 0;
+                if (credits + credit_charge > (uint32_t)smb2->credits) {
+                        break;
                 }
 
                 if (pdu->seal) {
-                        niov = 2;
-                        spl = pdu->crypt_len;
-                        iov[1].iov_base = pdu->crypt;
-                        iov[1].iov_len  = pdu->crypt_len;
+                        pdu_niov++;
                 } else {
-                        /* Copy all the vectors from all PDUs in the
-                         * compound set.
+                        for (tmp_pdu = pdu; tmp_pdu;
+                             tmp_pdu = tmp_pdu->next_compound) {
+                                pdu_niov += tmp_pdu->out.niov;
+                        }
+                }
+                if (npdus &&
+                    batch->niov + pdu_niov > SMB2_MAX_WRITE_VECTORS) {
+                        break;
+                }
+                credits += credit_charge;
+
+                /* The SPL goes first so we need the length of the whole
+                 * PDU before we add any of its vectors.
+                 */
+                if (pdu->seal) {
+                        /* the payload may still be sealed on the crypto
+                         * pool.
                          */
+                        smb3_wait_seal(smb2, pdu);
+                        batch->spl[npdus] = pdu->crypt_len;
+                } else {
+                        batch->spl[npdus] = 0;
                         for (tmp_pdu = pdu; tmp_pdu;
                              tmp_pdu = tmp_pdu->next_compound) {
-                                for (i = 0; i < tmp_pdu->out.niov;
-                                     i++, niov++) {
-                                        iov[niov].iov_base = tmp_pdu->out.iov[i].buf;
-#if defined(_WIN32) || defined(_XBOX)
-                                        iov[niov].iov_len = (unsigned long)tmp_pdu->out.iov[i].len;
-#else
-                                        iov[niov].iov_len = (size_t)tmp_pdu->out.iov[i].len;
-#endif
-                                        spl += (uint32_t)tmp_pdu->out.iov[i].len;
+                                for (i = 0; i < tmp_pdu->out.niov; i++) {
+                                        batch->spl[npdus] += (uint32_t)tmp_pdu->out.iov[i].len;
                                 }
                         }
                 }
+                batch->tmp_spl[npdus] = htobe32(batch->spl[npdus]);
 
-                /* Add the SPL vector as the first vector */
-                tmp_spl = htobe32(spl);
-                iov[0].iov_base = &tmp_spl;
-                iov[0].iov_len = SMB2_SPL_SIZE;
+                /* Skip what we have already written of the first PDU */
+                skip = npdus ? 0 : pdu->out.num_done;
+                batch->pdus[npdus++] = pdu;
 
-                tmpiov = iov;
+                full = !smb2_batch_add_iov(batch, &batch->tmp_spl[npdus - 1],
+                                           SMB2_SPL_SIZE, &skip);
+                if (pdu->seal) {
+                        full = full || !smb2_batch_add_iov(batch, pdu->crypt,
+                                                           pdu->crypt_len,
+                                                           &skip);
+                        continue;
+                }
+                /* Copy all the vectors from all PDUs in the compound set */
+                for (tmp_pdu = pdu; tmp_pdu && !full;
+                     tmp_pdu = tmp_pdu->next_compound) {
+                        for (i = 0; i < tmp_pdu->out.niov && !full; i++) {
+                                full = !smb2_batch_add_iov(batch,
+                                                           tmp_pdu->out.iov[i].buf,
+                                                           tmp_pdu->out.iov[i].len,
+                                                           &skip);
+                        }
+                }
+        }
+        batch->npdus = npdus;
+        batch->tmpiov = batch->iov;
 
-                /* Skip the vectors we have already written */
-                while (num_done >= tmpiov->iov_len) {
-                        num_done -= tmpiov->iov_len;
-                        tmpiov++;
-                        niov--;
+        return npdus;
+}
+
+/*
+ * Accounts for count bytes of the batch having been written, PDU by PDU.
+ * PDUs that have been sent completely are moved from the outqueue to the
+ * waitqueue.
+ */
+void
+smb2_complete_write_batch(struct smb2_context *smb2,
+                          struct smb2_write_batch *batch, size_t count)
+{
+        struct smb2_pdu *pdu, *tmp_pdu;
+        size_t len;
+        int i, completed = 0;
+
+        for (i = 0; i < batch->npdus && count > 0; i++) {
+                pdu = batch->pdus[i];
+                len = SMB2_SPL_SIZE + batch->spl[i] - pdu->out.num_done;
+                if (count < len) {
+                        pdu->out.num_done += count;
+                        break;
                 }
+                count -= len;
+                pdu->out.num_done += len;
+
+                smb2_outqueue_remove(smb2, pdu);
+                completed++;
+                /* the encrypted copy is no longer needed */
+                smb3_put_crypt_buf(smb2, pdu);
+                while (pdu) {
+                        tmp_pdu = pdu->next_compound;
+
+                        /* As we have now sent all the PDUs we
+                         * can remove the chaining.
+                         * On the receive side we will treat all
+                         * PDUs as individual PDUs.
+                         */
+                        pdu->next_compound = NULL;
 
-                /* Adjust the first vector to send */
-                tmpiov->iov_base = (char *)tmpiov->iov_base + num_done;
-#if defined(_WIN32) || defined(_XBOX)
-                tmpiov->iov_len -= (unsigned long)num_done;
-#else
-                tmpiov->iov_len -= (size_t)num_done;
+                        if (!smb2_is_server(smb2)) {
+                                smb2->credits -= smb2_get_real_credit_charge_for_one_pdu(smb2, &pdu->header);
+                                /* queue requests we send to correlate replies with */
+                                smb2_waitqueue_add(smb2, pdu);
+                        }
+                        else {
+                                /* alway allow writing replies */
+                                smb2->credits = 128;
+                                /* no longer need this reply we've sent */
+                                smb2_free_pdu(smb2, pdu);
+                        }
+                        pdu = tmp_pdu;
+                }
+        }
+        if (completed) {
+                smb2_change_events(smb2, smb2->fd, smb2_which_events(smb2));
+        }
+}
+
+int
+smb2_write_to_socket(struct smb2_context *smb2)
+{
+        struct smb2_write_batch batch;
+        ssize_t count;
+        int rc;
+
+        if (!SMB2_VALID_SOCKET(smb2->fd)) {
+                smb2_set_error(smb2, "trying to write but not connected");
+                return -1;
+        }
+#ifdef HAVE_IO_URING
+        if (smb2->uring) {
+                return smb2_uring_write(smb2);
+        }
 #endif
-                count = writev(smb2->fd, tmpiov, niov);
+        while (smb2->outqueue.head != NULL) {
+                rc = smb2_prepare_write_batch(smb2, &batch);
+                if (rc <= 0) {
+                        return rc;
+                }
 
+                count = smb2->transport->writev(smb2, batch.tmpiov,
+                                                batch.niov,
+                                                smb2->transport_opaque);
                 if (count == -1) {
                         if (errno == EAGAIN || errno == EWOULDBLOCK) {
                                 return 0;
@@ -301,35 +443,7 @@ smb2_write_to_socket(struct smb2_context *smb2)
                         return -1;
                 }
 
-                pdu->out.num_done += (size_t)count;
-
-                if (pdu->out.num_done == SMB2_SPL_SIZE + spl) {
-                        SMB2_LIST_REMOVE(&smb2->outqueue, pdu);
-                        smb2_change_events(smb2, smb2->fd, smb2_which_events(smb2));
-                        while (pdu) {
-                                tmp_pdu = pdu->next_compound;
-
-                                /* As we have now sent all the PDUs we
-                                 * can remove the chaining.
-                                 * On the receive side we will treat all
-                                 * PDUs as individual PDUs.
-                                 */
-                                pdu->next_compound = NULL;
-
-                                if (!smb2_is_server(smb2)) {
-                                        smb2->credits -= smb2_get_real_credit_charge_for_one_pdu(smb2, &pdu->header);
-                                        /* queue requests we send to correlate replies with */
-                                        SMB2_LIST_ADD_END(&smb2->waitqueue, pdu);
-                                }
-                                else {
-                                        /* alway allow writing replies */
-                                        smb2->credits = 128;
-                                        /* no longer need this reply we've sent */
-                                        smb2_free_pdu(smb2, pdu);
-                                }
-                                pdu = tmp_pdu;
-                        }
-                }
+                smb2_complete_write_batch(smb2, &batch, (size_t)count);
         }
         return 0;
 }
@@ -421,22 +535,11 @@ read_more_data:
         case SMB2_RECV_HEADER:
                 if (!memcmp(smb2->in.iov[smb2->in.niov - 1].buf, smb3tfrm, 4)) {
                         smb2->in.iov[smb2->in.niov - 1].len = 52;
-                        len = smb2->spl - 52;
                         smb2->in.total_size -= 12;
-                        {
-                                uint8_t *tmp = malloc(len);
-                                if (tmp == NULL) {
-                                        smb2_set_error(smb2, "malloc failed while adding TRFM payload");
-                                        return -1;
-                                }
-                                if (smb2_add_iovector(smb2, &smb2->in,tmp,len, free) == NULL) {
-                                        smb2_set_error(smb2, "Failed to add iovector for TRFM payload");
-                                        return -1;
-                                }
+                        if (smb3_decrypt_start(smb2) < 0) {
+                                return -1;
                         }
-                        memcpy(smb2->in.iov[smb2->in.niov - 1].buf,
-                               &smb2->in.iov[smb2->in.niov - 2].buf[52], 12);
-                        smb2->recv_state = SMB2_RECV_TRFM;
+                        smb2->recv_state = SMB2_RECV_TRFM_HEAD;
                         goto read_more_data;
                 }
                 if (smb2_decode_header(smb2, &smb2->in.iov[smb2->in.niov - 1],
@@ -469,7 +572,7 @@ read_more_data:
                         while (count > 0);
 
                         /* put on wait queue so queue_pdu doesn't complain */
-                        SMB2_LIST_ADD_END(&smb2->waitqueue, pdu);
+                        smb2_waitqueue_add(smb2, pdu);
 
                         smb2->in.num_done = 0;
                         pdu->cb(smb2, smb2->hdr.status, pdu->payload, pdu->cb_data);
@@ -513,12 +616,12 @@ read_more_data:
                         /* Add padding before the next PDU */
                         smb2->recv_state = SMB2_RECV_PAD;
                         {
-                                uint8_t *tmp = malloc(len);
+                                uint8_t *tmp = smb2_malloc(smb2, len);
                                 if (tmp == NULL) {
                                         smb2_set_error(smb2, "malloc failed while adding PENDING padding");
                                         return -1;
                                 }
-                                if (smb2_add_iovector(smb2, &smb2->in,tmp, len, free) == NULL) {
+                                if (smb2_add_iovector(smb2, &smb2->in,tmp, len, smb2_free_cb) == NULL) {
                                         return -1;
                                 }
                         }
@@ -547,6 +650,12 @@ read_more_data:
                         }
                         pdu->header.credit_charge = smb2->hdr.credit_charge;
                         pdu->header.credit_request_response = smb2->hdr.credit_request_response;
+                } else if (has_xfrmhdr && smb2->pdu &&
+                           smb2->pdu->header.message_id == smb2->hdr.message_id) {
+                        /* A sealed READ reply that smb3_decrypt_head()
+                         * already took off the wait queue.
+                         */
+                        pdu = smb2->pdu;
                 } else {
                         if ((smb2->hdr.command != SMB2_OPLOCK_BREAK) ||
                                         (smb2->hdr.message_id != 0xffffffffffffffffULL)) {
@@ -566,12 +675,12 @@ read_more_data:
                                         }
                                         smb2->recv_state = SMB2_RECV_UNKNOWN;
                                         {
-                                                uint8_t *tmp = malloc(len);
+                                                uint8_t *tmp = smb2_malloc(smb2, len);
                                                 if (tmp == NULL) {
                                                         smb2_set_error(smb2, "malloc failed while adding UNKNOWN padding");
                                                         return -1;
                                                 }
-                                                if (smb2_add_iovector(smb2, &smb2->in, tmp, len, free) == NULL) {
+                                                if (smb2_add_iovector(smb2, &smb2->in, tmp, len, smb2_free_cb) == NULL) {
                                                         return -1;
                                                 }
                                         }
@@ -587,7 +696,7 @@ read_more_data:
                                         return -1;
                                 }
 
-                                SMB2_LIST_REMOVE(&smb2->waitqueue, pdu);
+                                smb2_waitqueue_remove(smb2, pdu);
                         } else {
                                 /* oplock and lease break notifications won't have a pdu so make one
                                  * oplock replies (that are NOT notifications, i.e. have a valid message_id)
@@ -613,14 +722,14 @@ read_more_data:
                 smb2->recv_state = SMB2_RECV_FIXED;
                 {
                         size_t alen = len & 0xfffe;
-                        uint8_t *tmp = malloc(alen);
+                        uint8_t *tmp = smb2_malloc(smb2, alen);
                         if (tmp == NULL) {
                                 smb2_set_error(smb2, "malloc failed while adding FIXED payload");
                                 return -1;
                         }
                         if (smb2_add_iovector(smb2, &smb2->in,
                                   tmp,
-                                  alen, free) == NULL) {
+                                  alen, smb2_free_cb) == NULL) {
                                 return -1;
                         }
                 }
@@ -657,14 +766,14 @@ read_more_data:
                         if (len > 0) {
                                 smb2->recv_state = SMB2_RECV_VARIABLE;
                                 {
-                                        uint8_t *tmp = malloc(len);
+                                        uint8_t *tmp = smb2_malloc(smb2, len);
                                         if (tmp == NULL) {
                                                 smb2_set_error(smb2, "malloc failed while adding VARIABLE tail");
                                                 return -1;
                                         }
                                         if (smb2_add_iovector(smb2, &smb2->in,
                                                   tmp,
-                                                  len, free) == NULL) {
+                                                  len, smb2_free_cb) == NULL) {
                                                 return -1;
                                         }
                                 }
@@ -682,7 +791,7 @@ read_more_data:
                          * We never read the SPL when handling decrypted
                          * payloads.
                          */
-                        if (smb2->enc) {
+                        if (has_xfrmhdr) {
                                 len -= SMB2_SPL_SIZE;
                         }
                 }
@@ -696,14 +805,14 @@ read_more_data:
                         /* Add padding before the next PDU */
                         smb2->recv_state = SMB2_RECV_PAD;
                         {
-                                uint8_t *tmp = malloc(len);
+                                uint8_t *tmp = smb2_malloc(smb2, len);
                                 if (tmp == NULL) {
                                         smb2_set_error(smb2, "malloc failed while adding PAD");
                                         return -1;
                                 }
                                 if (smb2_add_iovector(smb2, &smb2->in,
                                           tmp,
-                                          len, free) == NULL) {
+                                          len, smb2_free_cb) == NULL) {
                                         return -1;
                                 }
                         }
@@ -731,7 +840,7 @@ read_more_data:
                          * We never read the SPL when handling decrypted
                          * payloads.
                          */
-                        if (smb2->enc) {
+                        if (has_xfrmhdr) {
                                 len -= SMB2_SPL_SIZE;
                         }
                 }
@@ -744,14 +853,14 @@ read_more_data:
                 if (len > 0) {
                         /* Add padding before the next PDU */
                         smb2->recv_state = SMB2_RECV_PAD;
-                        uint8_t * tmp = malloc(len);
+                        uint8_t * tmp = smb2_malloc(smb2, len);
                         if (tmp == NULL) {
                             smb2_set_error(smb2, "malloc failed while adding PAD");
                             return -1;
                         }
                         if (smb2_add_iovector(smb2, &smb2->in,
                                               tmp,
-                                              len, free) == NULL) {
+                                              len, smb2_free_cb) == NULL) {
                                 smb2_set_error(smb2, "Failed to add iovector for PAD");
                                 return -1;
                         }
@@ -766,6 +875,17 @@ read_more_data:
                  * PDU. Break out of the switch and invoke the callback.
                  */
                 break;
+        case SMB2_RECV_TRFM_HEAD:
+                if (smb3_decrypt_head(smb2) < 0) {
+                        smb2_set_error(smb2, "Failed to decrypt pdu: %s",
+                                       smb2_get_error(smb2));
+                        return -1;
+                }
+                smb2->recv_state = SMB2_RECV_TRFM;
+                if (smb2->in.num_done < smb2->in.total_size) {
+                        goto read_more_data;
+                }
+                /* Fall through. */
         case SMB2_RECV_TRFM:
                 /* We are finished reading the full payload for the
                  * encrypted packet.
@@ -843,7 +963,7 @@ read_more_data:
 
         if (smb2_is_server(smb2)) {
                 /* queue requests to correlate our replies we send back later */
-                SMB2_LIST_ADD_END(&smb2->waitqueue, pdu);
+                smb2_waitqueue_add(smb2, pdu);
                 pdu->cb(smb2, smb2->hdr.status, pdu->payload, pdu->cb_data);
                 smb2->pdu = smb2->next_pdu;
                 smb2->next_pdu = NULL;
@@ -875,24 +995,144 @@ read_more_data:
         return 0;
 }
 
+/*
+ * Reads from the socket go through a per-connection receive buffer so that
+ * a single readv() can pick up several PDUs. The vectors that were asked
+ * for are passed straight to readv() with the receive buffer appended as
+ * the last vector, so large payloads still land directly in their final
+ * destination and only the surplus ends up in the buffer. Later calls are
+ * then served from the buffer without a syscall until it runs dry.
+ */
+ssize_t
+smb2_readv_from_recv_buf(struct smb2_context *smb2,
+                         const struct iovec *iov, int iovcnt)
+{
+        size_t i, len, count = 0;
+
+        for (i = 0; (int)i < iovcnt; i++) {
+                len = iov[i].iov_len;
+                if (len > smb2->recv_buf_len - smb2->recv_buf_pos) {
+                        len = smb2->recv_buf_len - smb2->recv_buf_pos;
+                }
+                memcpy(iov[i].iov_base,
+                       &smb2->recv_buf[smb2->recv_buf_pos], len);
+                smb2->recv_buf_pos += len;
+                count += len;
+        }
+        return (ssize_t)count;
+}
+
+/*
+ * Sets up out[] for reading iov followed by the receive buffer. Returns the
+ * number of vectors and the number of bytes asked for in *count.
+ */
+int
+smb2_setup_recv_iovec(struct smb2_context *smb2,
+                      const struct iovec *iov, int iovcnt,
+                      struct iovec *out, size_t *count)
+{
+        int i;
+
+        *count = 0;
+        if (iovcnt > SMB2_MAX_VECTORS) {
+                iovcnt = SMB2_MAX_VECTORS;
+        }
+        for (i = 0; i < iovcnt; i++) {
+                out[i] = iov[i];
+                *count += iov[i].iov_len;
+        }
+        if (smb2->recv_buf_size == 0) {
+                return iovcnt;
+        }
+
+        if (smb2->recv_buf == NULL) {
+                smb2->recv_buf = smb2_malloc(smb2, smb2->recv_buf_size);
+                if (smb2->recv_buf == NULL) {
+                        errno = ENOMEM;
+                        return -1;
+                }
+        }
+        out[i].iov_base = smb2->recv_buf;
+#if defined(_WIN32) || defined(_XBOX)
+        out[i].iov_len = (unsigned long)smb2->recv_buf_size;
+#else
+        out[i].iov_len = smb2->recv_buf_size;
+#endif
+        return iovcnt + 1;
+}
+
+/*
+ * Called with the number of bytes read into the vectors from
+ * smb2_setup_recv_iovec(). Anything beyond what was asked for went into the
+ * receive buffer.
+ */
+ssize_t
+smb2_recv_iovec_done(struct smb2_context *smb2, ssize_t rc, size_t count)
+{
+        if (rc > (ssize_t)count) {
+                smb2->recv_buf_pos = 0;
+                smb2->recv_buf_len = (size_t)rc - count;
+                rc = (ssize_t)count;
+        }
+        return rc;
+}
+
 static ssize_t smb2_readv_from_socket(struct smb2_context *smb2,
                                       const struct iovec *iov, int iovcnt)
 {
-        ssize_t rc = readv(smb2->fd, (struct iovec*) iov, iovcnt);
-        return rc;
+        struct iovec tmpiov[SMB2_MAX_VECTORS + 1];
+        size_t count;
+        int niov;
+
+        if (smb2->recv_buf_pos < smb2->recv_buf_len) {
+                return smb2_readv_from_recv_buf(smb2, iov, iovcnt);
+        }
+
+        niov = smb2_setup_recv_iovec(smb2, iov, iovcnt, tmpiov, &count);
+        if (niov < 0) {
+                return -1;
+        }
+        return smb2_recv_iovec_done(smb2,
+                                    smb2->transport->readv(smb2, tmpiov, niov,
+                                                           smb2->transport_opaque),
+                                    count);
 }
 
-static int
+int
 smb2_read_from_socket(struct smb2_context *smb2)
 {
+        read_func func = smb2_readv_from_socket;
         int count;
 
+#ifdef HAVE_IO_URING
+        if (smb2->uring) {
+                func = smb2_uring_readv;
+        }
+#endif
         while(1) {
+                /* a callback may have closed the context, keep the error
+                 * it set instead of failing the next read.
+                 */
+                if (!SMB2_VALID_SOCKET(smb2->fd)) {
+                        return 0;
+                }
+
                 /* initialize the input vectors to the spl and the header
                  * which are both static data in the smb2 context.
                  * additional vectors will be added when we can map this to
                  * the corresponding pdu.
                  */
+                if (smb2->in.num_done == 0 && smb2->rx_head) {
+                        /* process sealed PDUs that the crypto pool has
+                         * finished with, in the order they arrived.
+                         */
+                        if (smb3_dispatch_rx(smb2, 0) < 0) {
+                                return -1;
+                        }
+                        if (!SMB2_VALID_SOCKET(smb2->fd)) {
+                                return 0;
+                        }
+                }
                 if (smb2->in.num_done == 0) {
                         smb2->recv_state = SMB2_RECV_SPL;
                         smb2->spl = 0;
@@ -905,8 +1145,14 @@ smb2_read_from_socket(struct smb2_context *smb2)
                         }
                 }
 
-                count = smb2_read_data(smb2, smb2_readv_from_socket, 0);
+                count = smb2_read_data(smb2, func, 0);
                 if (count == -EAGAIN) {
+                        /* nothing more to read, do not leave decrypted
+                         * PDUs waiting until the server sends more.
+                         */
+                        if (smb2->in.num_done == 0 && smb2->rx_head) {
+                                return smb3_dispatch_rx(smb2, 1);
+                        }
                         return 0;
                 }
                 if (count) {
@@ -915,20 +1161,47 @@ smb2_read_from_socket(struct smb2_context *smb2)
         }
 }
 
+/*
+ * Reads the decrypted payload described by smb2->enc. Data that was
+ * decrypted in place in the buffer of a READ is already where it is
+ * being read to and is not copied.
+ */
 static ssize_t smb2_readv_from_buf(struct smb2_context *smb2,
                                    const struct iovec *iov, int iovcnt)
 {
-        size_t i, len;
+        struct smb2_iovec *v;
+        size_t i, len, pos, done;
         ssize_t count = 0;
+        uint8_t *src;
+        int s;
 
         for (i=0;(int)i<iovcnt;i++){
-                len = iov[i].iov_len;
-                if (len > smb2->enc_len - smb2->enc_pos) {
-                        len = smb2->enc_len - smb2->enc_pos;
+                done = 0;
+                while (done < iov[i].iov_len) {
+                        pos = smb2->enc.num_done;
+                        for (s = 0; s < smb2->enc.niov; s++) {
+                                if (pos < smb2->enc.iov[s].len) {
+                                        break;
+                                }
+                                pos -= smb2->enc.iov[s].len;
+                        }
+                        if (s == smb2->enc.niov) {
+                                return count;
+                        }
+                        v = &smb2->enc.iov[s];
+                        len = iov[i].iov_len - done;
+                        if (len > v->len - pos) {
+                                len = v->len - pos;
+                        }
+                        src = &v->buf[pos];
+                        if (src != (uint8_t *)iov[i].iov_base + done) {
+                                memcpy((uint8_t *)iov[i].iov_base + done,
+                                       src, len);
+                        }
+                        smb2->enc.num_done += len;
+                        done += len;
+                        count += len;
                 }
-                memcpy(iov[i].iov_base, &smb2->enc[smb2->enc_pos], len);
-                smb2->enc_pos += (int)len;
-                count += len;
         }
         return count;
 }
@@ -939,12 +1212,33 @@ smb2_read_from_buf(struct smb2_context *smb2)
         return smb2_read_data(smb2, smb2_readv_from_buf, 1);
 }
 
+/*
+ * Closes the connected socket. Anything still in the receive buffer
+ * belongs to the old connection and is dropped.
+ */
+void
+smb2_close_socket(struct smb2_context *smb2)
+{
+#ifdef HAVE_IO_URING
+        if (smb2->uring) {
+                smb2_uring_cancel(smb2);
+        }
+#endif
+        if (smb2->change_fd) {
+                smb2->change_fd(smb2, smb2->fd, SMB2_DEL_FD);
+        }
+        smb2->transport->close(smb2, smb2->fd, smb2->transport_opaque);
+        smb2->fd = SMB2_INVALID_SOCKET;
+        smb2->recv_buf_pos = smb2->recv_buf_len = 0;
+        smb3_flush_rx(smb2);
+}
+
 static void
 smb2_close_connecting_fd(struct smb2_context *smb2, t_socket fd)
 {
         size_t i;
 
-        close(fd);
+        smb2->transport->close(smb2, fd, smb2->transport_opaque);
         /* Remove the fd from the connecting_fds array */
         for (i = 0; i < smb2->connecting_fds_count; ++i) {
                 if (fd == smb2->connecting_fds[i]) {
@@ -1002,6 +1296,9 @@ smb2_service_fd(struct smb2_context *smb2, t_socket fd, int revents)
                         if (err == 0) {
                                 return 0;
                         }
+                } else if (smb2->transport != &smb2_tcp_transport) {
+                        smb2_set_error(smb2, "smb2_service: POLLERR, "
+                                        "transport error.");
                 } else if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *)&err, &err_size) != 0 || err != 0) {
                         if (err == 0) {
                                 err = errno;
@@ -1032,7 +1329,11 @@ smb2_service_fd(struct smb2_context *smb2, t_socket fd, int revents)
                 int err = 0;
                 socklen_t err_size = sizeof(err);
 
-                if (getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *)&err, &err_size) != 0 || err != 0) {
+                /* Only TCP sockets can tell us why the connect failed,
+                 * other transports report errors when reading or writing.
+                 */
+                if (smb2->transport == &smb2_tcp_transport &&
+                    (getsockopt(fd, SOL_SOCKET, SO_ERROR, (char *)&err, &err_size) != 0 || err != 0)) {
                         if (err == 0) {
                                 err = errno;
                         }
@@ -1060,6 +1361,7 @@ smb2_service_fd(struct smb2_context *smb2, t_socket fd, int revents)
                         goto out;
                 }
                 smb2->fd = fd;
+                smb2->recv_buf_pos = smb2->recv_buf_len = 0;
 
                 smb2_close_connecting_fds(smb2);
 
@@ -1078,7 +1380,12 @@ smb2_service_fd(struct smb2_context *smb2, t_socket fd, int revents)
                 }
         }
 
-        if (revents & POLLOUT && smb2->outqueue != NULL) {
+        /* Also flush after reading as the callbacks have likely queued
+         * new requests.
+         */
+        if (smb2->outqueue.head != NULL &&
+            (revents & POLLOUT ||
+             (revents & POLLIN && SMB2_VALID_SOCKET(smb2->fd)))) {
                 if (smb2_write_to_socket(smb2) != 0) {
                         ret = -1;
                         goto out;
@@ -1089,6 +1396,9 @@ smb2_service_fd(struct smb2_context *smb2, t_socket fd, int revents)
         if (smb2->timeout) {
                 smb2_timeout_pdus(smb2);
         }
+        if (smb2->write_behinds) {
+                smb2_wb_expire(smb2);
+        }
         return ret;
 }
 
@@ -1287,22 +1597,20 @@ static void interleave_addrinfo(struct addrinfo *base)
         }
 }
 
-int
-smb2_connect_async(struct smb2_context *smb2, const char *server,
-                   smb2_command_cb cb, void *private_data)
+/*
+ * Resolves the server and starts connecting to its addresses. The sockets
+ * are added to connecting_fds as we go, see smb2_connect_async_next_addr().
+ */
+static int
+smb2_tcp_connect(struct smb2_context *smb2, const char *server,
+                 t_socket *fd, void *opaque)
 {
         char *addr, *host, *port;
         int err;
         size_t addr_count = 0;
         const struct addrinfo *ai;
 
-        if (SMB2_VALID_SOCKET(smb2->fd)) {
-                smb2_set_error(smb2, "Trying to connect but already "
-                               "connected.");
-                return -EINVAL;
-        }
-
-        addr = strdup(server);
+        addr = smb2_strdup(smb2, server);
         if (addr == NULL) {
                 smb2_set_error(smb2, "Out-of-memory: "
                                "Failed to strdup server address.");
@@ -1318,7 +1626,7 @@ smb2_connect_async(struct smb2_context *smb2, const char *server,
                 host++;
                 str = strchr(host, ']');
                 if (str == NULL) {
-                        free(addr);
+                        smb2_free(smb2, addr);
                         smb2_set_error(smb2, "Invalid address:%s  "
                                 "Missing ']' in IPv6 address", server);
                         return -EINVAL;
@@ -1337,7 +1645,7 @@ smb2_connect_async(struct smb2_context *smb2, const char *server,
         /* is it a hostname ? */
         err = getaddrinfo(host, port, NULL, &smb2->addrinfos);
         if (err != 0) {
-                free(addr);
+                smb2_free(smb2, addr);
 #if defined(_WINDOWS) || defined(_XBOX)
                 if (err == WSANOTINITIALISED)
                 {
@@ -1376,14 +1684,14 @@ smb2_connect_async(struct smb2_context *smb2, const char *server,
                         return -EINVAL;
                 }
         }
-        free(addr);
+        smb2_free(smb2, addr);
 
         interleave_addrinfo(smb2->addrinfos);
 
         /* Allocate connecting fds array */
         for (ai = smb2->addrinfos; ai != NULL; ai = ai->ai_next)
                 addr_count++;
-        smb2->connecting_fds = malloc(sizeof(t_socket) * addr_count);
+        smb2->connecting_fds = smb2_malloc(smb2, sizeof(t_socket) * addr_count);
         if (smb2->connecting_fds == NULL) {
                 freeaddrinfo(smb2->addrinfos);
                 smb2->addrinfos = NULL;
@@ -1393,10 +1701,9 @@ smb2_connect_async(struct smb2_context *smb2, const char *server,
         err = smb2_connect_async_next_addr(smb2, smb2->addrinfos);
 
         if (err == 0) {
-                smb2->connect_cb   = cb;
-                smb2->connect_data = private_data;
+                *fd = smb2->connecting_fds[0];
         } else {
-                free(smb2->connecting_fds);
+                smb2_free(smb2, smb2->connecting_fds);
                 smb2->connecting_fds = NULL;
                 freeaddrinfo(smb2->addrinfos);
                 smb2->addrinfos = NULL;
@@ -1406,6 +1713,77 @@ smb2_connect_async(struct smb2_context *smb2, const char *server,
         return err;
 }
 
+int
+smb2_connect_async(struct smb2_context *smb2, const char *server,
+                   smb2_command_cb cb, void *private_data)
+{
+        t_socket fd = SMB2_INVALID_SOCKET;
+        int err;
+
+        if (SMB2_VALID_SOCKET(smb2->fd)) {
+                smb2_set_error(smb2, "Trying to connect but already "
+                               "connected.");
+                return -EINVAL;
+        }
+
+        err = smb2->transport->connect(smb2, server, &fd,
+                                       smb2->transport_opaque);
+        if (err != 0) {
+                return err;
+        }
+
+        /* TCP registers its sockets itself, other transports give us
+         * the single fd to wait on.
+         */
+        if (smb2->connecting_fds_count == 0) {
+                smb2->connecting_fds = smb2_malloc(smb2, sizeof(t_socket));
+                if (smb2->connecting_fds == NULL) {
+                        smb2->transport->close(smb2, fd,
+                                               smb2->transport_opaque);
+                        smb2_set_error(smb2, "Failed to allocate "
+                                       "connecting fds");
+                        return -ENOMEM;
+                }
+                smb2->connecting_fds[smb2->connecting_fds_count++] = fd;
+                if (smb2->change_fd) {
+                        smb2->change_fd(smb2, fd, SMB2_ADD_FD);
+                        smb2_change_events(smb2, fd, POLLOUT);
+                }
+        }
+
+        smb2->connect_cb   = cb;
+        smb2->connect_data = private_data;
+
+        return 0;
+}
+
+static ssize_t
+smb2_tcp_readv(struct smb2_context *smb2, const struct iovec *iov, int iovcnt,
+               void *opaque)
+{
+        return readv(smb2->fd, iov, iovcnt);
+}
+
+static ssize_t
+smb2_tcp_writev(struct smb2_context *smb2, const struct iovec *iov, int iovcnt,
+                void *opaque)
+{
+        return writev(smb2->fd, iov, iovcnt);
+}
+
+static void
+smb2_tcp_close(struct smb2_context *smb2, t_socket fd, void *opaque)
+{
+        close(fd);
+}
+
+const struct smb2_transport smb2_tcp_transport = {
+        smb2_tcp_connect,
+        smb2_tcp_readv,
+        smb2_tcp_writev,
+        smb2_tcp_close
+};
+
 int
 smb2_bind_and_listen(const uint16_t port, const int max_connections, int *out_fd)
 {
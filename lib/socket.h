@@ -0,0 +1,68 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+#ifndef _SOCKET_H_
+#define _SOCKET_H_
+
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Maximum number of queued PDUs we send with a single writev() */
+#define SMB2_MAX_WRITE_PDUS 64
+
+/* Queued PDUs gathered into a single set of vectors for sending */
+struct smb2_write_batch {
+        struct iovec iov[SMB2_MAX_VECTORS];
+        struct smb2_pdu *pdus[SMB2_MAX_WRITE_PDUS];
+        /* length of each PDU and the big endian copy we send */
+        uint32_t spl[SMB2_MAX_WRITE_PDUS];
+        uint32_t tmp_spl[SMB2_MAX_WRITE_PDUS];
+        /* the part of iov that still has to be written */
+        struct iovec *tmpiov;
+        int niov;
+        int npdus;
+};
+
+int smb2_prepare_write_batch(struct smb2_context *smb2,
+                             struct smb2_write_batch *batch);
+void smb2_complete_write_batch(struct smb2_context *smb2,
+                               struct smb2_write_batch *batch, size_t count);
+
+int smb2_read_from_socket(struct smb2_context *smb2);
+ssize_t smb2_readv_from_recv_buf(struct smb2_context *smb2,
+                                 const struct iovec *iov, int iovcnt);
+int smb2_setup_recv_iovec(struct smb2_context *smb2,
+                          const struct iovec *iov, int iovcnt,
+                          struct iovec *out, size_t *count);
+ssize_t smb2_recv_iovec_done(struct smb2_context *smb2, ssize_t rc,
+                             size_t count);
+
+#ifdef HAVE_IO_URING
+/* io_uring backend, see uring.c */
+ssize_t smb2_uring_readv(struct smb2_context *smb2,
+                         const struct iovec *iov, int iovcnt);
+int smb2_uring_write(struct smb2_context *smb2);
+void smb2_uring_cancel(struct smb2_context *smb2);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _SOCKET_H_ */
@@ -115,7 +115,7 @@ smb2_spnego_create_negotiate_reply_blob(struct smb2_context *smb2, int allow_ntl
         int pos[6];
 
         alloc_len = 5 * sizeof oid_gss_mech_spnego;
-        neg_init = calloc(1, alloc_len);
+        neg_init = smb2_calloc(smb2, 1, alloc_len);
         if (neg_init == NULL) {
                 smb2_set_error(smb2, "Failed to allocate negotiate token init");
                 return 0;
@@ -185,7 +185,7 @@ int smb2_spnego_wrap_gssapi(struct smb2_context *smb2,
         int pos[8];
 
         alloc_len = 256 + 4 * token_len;
-        neg_init = calloc(1, alloc_len);
+        neg_init = smb2_calloc(smb2, 1, alloc_len);
         if (neg_init == NULL) {
                 smb2_set_error(smb2, "Failed to allocate spnego wrapper");
                 return 0;
@@ -276,7 +276,7 @@ smb2_spnego_wrap_ntlmssp_challenge(struct smb2_context *smb2, const uint8_t *ntl
         uint8_t neg_result = 1;
 
         alloc_len = 64 + 2 * token_len;
-        neg_init = calloc(1, alloc_len);
+        neg_init = smb2_calloc(smb2, 1, alloc_len);
         if (neg_init == NULL) {
                 smb2_set_error(smb2, "Failed to allocate spnego wrapper");
                 return 0;
@@ -349,7 +349,7 @@ smb2_spnego_wrap_ntlmssp_auth(struct smb2_context *smb2, const uint8_t *ntlmssp_
         int pos[6];
 
         alloc_len = 64 + 2 * token_len;
-        neg_token = calloc(1, alloc_len);
+        neg_token = smb2_calloc(smb2, 1, alloc_len);
         if (neg_token == NULL) {
                 smb2_set_error(smb2, "Failed to allocate spnego wrapper");
                 return 0;
@@ -404,7 +404,7 @@ smb2_spnego_wrap_authenticate_result(struct smb2_context *smb2, const int author
         uint8_t result_code = 3; /* accept-fail */
 
         alloc_len = 128;
-        neg_targ = calloc(1, alloc_len);
+        neg_targ = smb2_calloc(smb2, 1, alloc_len);
         if (neg_targ == NULL) {
                 smb2_set_error(smb2, "Failed to allocate spnego wrapper");
                 return -ENOMEM;
@@ -47,6 +47,14 @@
 
 #include "compat.h"
 
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_SYS__IOVEC_H
+#include <sys/_iovec.h>
+#endif
+
 #ifdef HAVE_TIME_H
 #include <time.h>
 #endif
@@ -105,7 +113,7 @@ static void connect_cb(struct smb2_context *smb2, int status,
 
         if (cb_data->status == SMB2_STATUS_CANCELLED) {
                 if (cb_data != &smb2->connect_cb_data) {
-                        free(cb_data);
+                        smb2_free(smb2, cb_data);
                 }
                 return;
         }
@@ -194,7 +202,7 @@ struct smb2dir *smb2_opendir(struct smb2_context *smb2, const char *path)
         struct sync_cb_data *cb_data;
         struct smb2dir *dir;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return NULL;
@@ -203,12 +211,12 @@ struct smb2dir *smb2_opendir(struct smb2_context *smb2, const char *path)
 	pdu = smb2_opendir_async_pdu(smb2, path, opendir_cb, cb_data, NULL);
         if (pdu == NULL) {
 		smb2_set_error(smb2, "smb2_opendir_async failed");
-                free(cb_data);
+                smb2_free(smb2, cb_data);
 		return NULL;
 	}
 
 	if (wait_for_reply(smb2, cb_data) < 0) {
-                free(cb_data);
+                smb2_free(smb2, cb_data);
                 smb2_free_pdu(smb2, pdu);
                 return NULL;
         }
@@ -216,9 +224,9 @@ struct smb2dir *smb2_opendir(struct smb2_context *smb2, const char *path)
 	dir = cb_data->ptr;
         if (dir) {
                 /* Give ownership of cb_data to dir. It will be freed when dir is freed */
-                dir->free_cb_data = free;
+                dir->free_cb_data = smb2_free_cb;
         } else {
-                free(cb_data);
+                smb2_free(smb2, cb_data);
         }
         smb2_free_pdu(smb2, pdu);
         return dir;
@@ -242,28 +250,28 @@ struct smb2fh *smb2_open(struct smb2_context *smb2, const char *path, int flags)
         struct sync_cb_data *cb_data;
         void *ptr;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return NULL;
         }
 
-        /* pdu takes ownership of cb_data and will free it when the pdu is freed */
-	pdu = smb2_open_async_pdu(smb2, path, flags, open_cb, cb_data, free);
+	pdu = smb2_open_async_pdu(smb2, path, flags, open_cb, cb_data, NULL);
         if (pdu == NULL) {
 		smb2_set_error(smb2, "smb2_open_async failed");
-                free(cb_data);
+                smb2_free(smb2, cb_data);
 		return NULL;
 	}
 
 	if (wait_for_reply(smb2, cb_data) < 0) {
                 smb2_free_pdu(smb2, pdu);
+                smb2_free(smb2, cb_data);
                 return NULL;
         }
 
 	ptr = cb_data->ptr;
-        cb_data->ptr = NULL;
         smb2_free_pdu(smb2, pdu);
+        smb2_free(smb2, cb_data);
         return ptr;
 }
 
@@ -279,7 +287,7 @@ static void close_cb(struct smb2_context *smb2, int status,
                 return;
         }
         if (cb_data->status == SMB2_STATUS_CANCELLED) {
-                free(cb_data);
+                smb2_free(smb2, cb_data);
                 return;
         }
 
@@ -292,7 +300,7 @@ int smb2_close(struct smb2_context *smb2, struct smb2fh *fh)
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -311,7 +319,7 @@ int smb2_close(struct smb2_context *smb2, struct smb2fh *fh)
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -325,7 +333,7 @@ static void fsync_cb(struct smb2_context *smb2, int status,
         struct sync_cb_data *cb_data = private_data;
 
         if (cb_data->status == SMB2_STATUS_CANCELLED) {
-                free(cb_data);
+                smb2_free(smb2, cb_data);
                 return;
         }
 
@@ -338,7 +346,7 @@ int smb2_fsync(struct smb2_context *smb2, struct smb2fh *fh)
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -357,7 +365,7 @@ int smb2_fsync(struct smb2_context *smb2, struct smb2fh *fh)
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -371,7 +379,7 @@ static void generic_status_cb(struct smb2_context *smb2, int status,
         struct sync_cb_data *cb_data = private_data;
 
         if (cb_data->status == SMB2_STATUS_CANCELLED) {
-                free(cb_data);
+                smb2_free(smb2, cb_data);
                 return;
         }
 
@@ -385,7 +393,7 @@ int smb2_pread(struct smb2_context *smb2, struct smb2fh *fh,
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -405,7 +413,7 @@ int smb2_pread(struct smb2_context *smb2, struct smb2fh *fh,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -416,7 +424,7 @@ int smb2_pwrite(struct smb2_context *smb2, struct smb2fh *fh,
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -436,18 +444,142 @@ int smb2_pwrite(struct smb2_context *smb2, struct smb2fh *fh,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
 
+int smb2_preadv(struct smb2_context *smb2, struct smb2fh *fh,
+                const struct iovec *iov, int iovcnt, uint64_t offset)
+{
+        struct sync_cb_data *cb_data;
+        int rc = 0;
+
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
+        if (cb_data == NULL) {
+                smb2_set_error(smb2, "Failed to allocate sync_cb_data");
+                return -ENOMEM;
+        }
+
+        rc = smb2_preadv_async(smb2, fh, iov, iovcnt, offset,
+                               generic_status_cb, cb_data);
+        if (rc < 0) {
+                goto out;
+        }
+
+        rc = wait_for_reply(smb2, cb_data);
+        if (rc < 0) {
+                cb_data->status = SMB2_STATUS_CANCELLED;
+                return rc;
+        }
+
+        rc = cb_data->status;
+ out:
+        smb2_free(smb2, cb_data);
+
+        return rc;
+}
+
+int smb2_pwritev(struct smb2_context *smb2, struct smb2fh *fh,
+                 const struct iovec *iov, int iovcnt, uint64_t offset)
+{
+        struct sync_cb_data *cb_data;
+        int rc = 0;
+
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
+        if (cb_data == NULL) {
+                smb2_set_error(smb2, "Failed to allocate sync_cb_data");
+                return -ENOMEM;
+        }
+
+        rc = smb2_pwritev_async(smb2, fh, iov, iovcnt, offset,
+                                generic_status_cb, cb_data);
+        if (rc < 0) {
+                goto out;
+        }
+
+        rc = wait_for_reply(smb2, cb_data);
+        if (rc < 0) {
+                cb_data->status = SMB2_STATUS_CANCELLED;
+                return rc;
+        }
+
+        rc = cb_data->status;
+ out:
+        smb2_free(smb2, cb_data);
+
+        return rc;
+}
+
+static void copy_range_cb(struct smb2_context *smb2, int status,
+                          void *command_data, void *private_data)
+{
+        struct sync_cb_data *cb_data = private_data;
+        struct smb2_copy_range_cb_data *cr = command_data;
+
+        if (cb_data->status == SMB2_STATUS_CANCELLED) {
+                smb2_free(smb2, cb_data->ptr);
+                smb2_free(smb2, cb_data);
+                return;
+        }
+
+        cb_data->is_finished = 1;
+        cb_data->status = status;
+        if (status == 0) {
+                *(uint64_t *)cb_data->ptr = cr->count;
+        }
+}
+
+int64_t smb2_copy_range(struct smb2_context *smb2,
+                        struct smb2fh *src, uint64_t src_offset,
+                        struct smb2fh *dst, uint64_t dst_offset,
+                        uint64_t count)
+{
+        struct sync_cb_data *cb_data;
+        int64_t rc = 0;
+
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
+        if (cb_data == NULL) {
+                smb2_set_error(smb2, "Failed to allocate sync_cb_data");
+                return -ENOMEM;
+        }
+        cb_data->ptr = smb2_calloc(smb2, 1, sizeof(uint64_t));
+        if (cb_data->ptr == NULL) {
+                smb2_set_error(smb2, "Failed to allocate sync_cb_data");
+                smb2_free(smb2, cb_data);
+                return -ENOMEM;
+        }
+
+        rc = smb2_copy_range_async(smb2, src, src_offset, dst, dst_offset,
+                                   count, copy_range_cb, cb_data);
+        if (rc < 0) {
+                goto out;
+        }
+
+        rc = wait_for_reply(smb2, cb_data);
+        if (rc < 0) {
+                cb_data->status = SMB2_STATUS_CANCELLED;
+                return rc;
+        }
+
+        rc = cb_data->status;
+        if (rc == 0) {
+                rc = *(uint64_t *)cb_data->ptr;
+        }
+ out:
+        smb2_free(smb2, cb_data->ptr);
+        smb2_free(smb2, cb_data);
+
+        return rc;
+}
+
 int smb2_read(struct smb2_context *smb2, struct smb2fh *fh,
               uint8_t *buf, uint32_t count)
 {
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -467,7 +599,7 @@ int smb2_read(struct smb2_context *smb2, struct smb2fh *fh,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -478,7 +610,7 @@ int smb2_write(struct smb2_context *smb2, struct smb2fh *fh,
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -498,7 +630,7 @@ int smb2_write(struct smb2_context *smb2, struct smb2fh *fh,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -508,7 +640,7 @@ int smb2_unlink(struct smb2_context *smb2, const char *path)
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -528,7 +660,7 @@ int smb2_unlink(struct smb2_context *smb2, const char *path)
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -538,7 +670,7 @@ int smb2_rmdir(struct smb2_context *smb2, const char *path)
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -558,7 +690,7 @@ int smb2_rmdir(struct smb2_context *smb2, const char *path)
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -568,7 +700,7 @@ int smb2_mkdir(struct smb2_context *smb2, const char *path)
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -588,7 +720,7 @@ int smb2_mkdir(struct smb2_context *smb2, const char *path)
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -599,7 +731,7 @@ int smb2_fstat(struct smb2_context *smb2, struct smb2fh *fh,
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -619,7 +751,7 @@ int smb2_fstat(struct smb2_context *smb2, struct smb2fh *fh,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -630,7 +762,7 @@ int smb2_stat(struct smb2_context *smb2, const char *path,
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -650,7 +782,7 @@ int smb2_stat(struct smb2_context *smb2, const char *path,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -661,7 +793,7 @@ int smb2_rename(struct smb2_context *smb2, const char *oldpath,
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -681,7 +813,7 @@ int smb2_rename(struct smb2_context *smb2, const char *oldpath,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -692,7 +824,7 @@ int smb2_statvfs(struct smb2_context *smb2, const char *path,
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -712,7 +844,7 @@ int smb2_statvfs(struct smb2_context *smb2, const char *path,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -723,7 +855,7 @@ int smb2_truncate(struct smb2_context *smb2, const char *path,
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -743,7 +875,7 @@ int smb2_truncate(struct smb2_context *smb2, const char *path,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -754,7 +886,7 @@ int smb2_ftruncate(struct smb2_context *smb2, struct smb2fh *fh,
         struct sync_cb_data *cb_data;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -774,7 +906,7 @@ int smb2_ftruncate(struct smb2_context *smb2, struct smb2fh *fh,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -791,7 +923,7 @@ static void readlink_cb(struct smb2_context *smb2, int status,
         struct readlink_cb_data *rl_data = cb_data->ptr;
         
         if (cb_data->status == SMB2_STATUS_CANCELLED) {
-                free(cb_data);
+                smb2_free(smb2, cb_data);
                 return;
         }
 
@@ -807,7 +939,7 @@ int smb2_readlink(struct smb2_context *smb2, const char *path,
         struct readlink_cb_data rl_data _U_;
         int rc = 0;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -831,7 +963,7 @@ int smb2_readlink(struct smb2_context *smb2, const char *path,
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -842,7 +974,7 @@ static void echo_cb(struct smb2_context *smb2, int status,
         struct sync_cb_data *cb_data = private_data;
 
         if (cb_data->status == SMB2_STATUS_CANCELLED) {
-                free(cb_data);
+                smb2_free(smb2, cb_data);
                 return;
         }
 
@@ -863,7 +995,7 @@ int smb2_echo(struct smb2_context *smb2)
                 return -ENOMEM;
         }
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return -ENOMEM;
@@ -882,7 +1014,7 @@ int smb2_echo(struct smb2_context *smb2)
 
         rc = cb_data->status;
  out:
-        free(cb_data);
+        smb2_free(smb2, cb_data);
 
 	return rc;
 }
@@ -909,7 +1041,7 @@ struct smb2_file_notify_change_information *smb2_notify_change(struct smb2_conte
         struct sync_cb_data *cb_data;
         void *ptr;
 
-        cb_data = calloc(1, sizeof(struct sync_cb_data));
+        cb_data = smb2_calloc(smb2, 1, sizeof(struct sync_cb_data));
         if (cb_data == NULL) {
                 smb2_set_error(smb2, "Failed to allocate sync_cb_data");
                 return NULL;
@@ -918,17 +1050,17 @@ struct smb2_file_notify_change_information *smb2_notify_change(struct smb2_conte
 	if (smb2_notify_change_async(smb2, path, flags, filter, 0,
                                sync_notify_change_cb, cb_data) != 0) {
 		smb2_set_error(smb2, "smb2_notify_change failed");
-                free(cb_data);
+                smb2_free(smb2, cb_data);
 		return NULL;
 	}
 
 	if (wait_for_reply(smb2, cb_data) < 0) {
                 cb_data->status = SMB2_STATUS_CANCELLED;
-                free(cb_data);
+                smb2_free(smb2, cb_data);
                 return NULL;
         }
 
 	ptr = cb_data->ptr;
-        free(cb_data);
+        smb2_free(smb2, cb_data);
         return ptr;
 }
@@ -68,3 +68,17 @@ smb2_win_to_timeval(uint64_t smb2_time, struct smb2_timeval *tv)
         tv->tv_usec = (smb2_time / 10) % 1000000;
         tv->tv_sec  = (smb2_time - 116444736000000000) / 10000000;
 }
+
+/* In microseconds, only good for measuring intervals */
+uint64_t
+smb2_monotonic_usec(void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+        return (uint64_t)time(NULL) * 1000000;
+#endif
+}
@@ -164,7 +164,7 @@ validate_utf8_str(const char *utf8)
 
 /* Convert a UTF8 string into UTF-16LE */
 struct smb2_utf16 *
-smb2_utf8_to_utf16(const char *utf8)
+smb2_ctx_utf8_to_utf16(struct smb2_context *smb2, const char *utf8)
 {
         struct smb2_utf16 *utf16;
         int i, len;
@@ -174,7 +174,7 @@ smb2_utf8_to_utf16(const char *utf8)
                 return NULL;
         }
 
-        utf16 = (struct smb2_utf16 *)(malloc(offsetof(struct smb2_utf16, val) + 2 * len));
+        utf16 = (struct smb2_utf16 *)(smb2_malloc(smb2, offsetof(struct smb2_utf16, val) + 2 * len));
         if (utf16 == NULL) {
                 return NULL;
         }
@@ -245,7 +245,8 @@ utf16_size(const uint16_t *utf16, size_t utf16_len)
  * Convert a UTF-16LE string into UTF8
  */
 const char *
-smb2_utf16_to_utf8(const uint16_t *utf16, size_t utf16_len)
+smb2_ctx_utf16_to_utf8(struct smb2_context *smb2, const uint16_t *utf16,
+                       size_t utf16_len)
 {
         int utf8_len = 1;
         char *str, *tmp;
@@ -253,7 +254,7 @@ smb2_utf16_to_utf8(const uint16_t *utf16, size_t utf16_len)
         
         /* How many bytes do we need for utf8 ? */
         utf8_len += utf16_size(utf16, utf16_len);
-        str = tmp = (char*)malloc(utf8_len);
+        str = tmp = (char*)smb2_malloc(smb2, utf8_len);
         if (str == NULL) {
                 return NULL;
         }
@@ -305,3 +306,15 @@ smb2_utf16_to_utf8(const uint16_t *utf16, size_t utf16_len)
 
         return str;
 }
+
+struct smb2_utf16 *
+smb2_utf8_to_utf16(const char *utf8)
+{
+        return smb2_ctx_utf8_to_utf16(NULL, utf8);
+}
+
+const char *
+smb2_utf16_to_utf8(const uint16_t *utf16, size_t utf16_len)
+{
+        return smb2_ctx_utf16_to_utf8(NULL, utf16, utf16_len);
+}
@@ -0,0 +1,888 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_POLL_H
+#include <poll.h>
+#endif
+
+#ifdef HAVE_SYS_SOCKET_H
+#include <sys/socket.h>
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#ifdef HAVE_SYS_TYPES_H
+#include <sys/types.h>
+#endif
+
+#ifdef HAVE_SYS_UIO_H
+#include <sys/uio.h>
+#endif
+
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+
+#include <errno.h>
+
+#include "compat.h"
+
+#include "slist.h"
+#include "smb2.h"
+#include "libsmb2.h"
+#include "libsmb2-private.h"
+#include "socket.h"
+#include "write-behind.h"
+
+#ifdef HAVE_IO_URING
+
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+/*
+ * The ring is driven with the raw io_uring syscalls so we do not need
+ * liburing.
+ *
+ * Every context on the ring has at most one receive, one send and, while
+ * connecting, one poll in flight. Receives go into the receive buffer of
+ * the context unless the state machine asks for a large payload, in which
+ * case the payload vectors are passed to the kernel directly followed by
+ * the receive buffer, just like smb2_readv_from_socket() does.
+ */
+
+/* Payloads of at least this size are received directly into their
+ * destination instead of going through the receive buffer.
+ */
+#define SMB2_URING_DIRECT_SIZE 4096
+
+/* While cancelling we wait this many ms for completions at a time, and
+ * give up on the cancel requests after this many waits.
+ */
+#define SMB2_URING_CANCEL_WAIT 100
+#define SMB2_URING_CANCEL_TRIES 10
+
+struct smb2_uring_conn;
+
+/* Each context has a poll, a receive and a send of its own */
+#define SMB2_URING_OPS_PER_CONN 3
+
+/* The user_data of each SQE points to one of these */
+struct smb2_uring_op {
+        struct smb2_uring_conn *conn;
+        int fd;
+        int busy;
+};
+
+struct smb2_uring_conn {
+        struct smb2_uring_conn *next;
+        struct smb2_uring *ring;
+        struct smb2_context *smb2;
+        smb2_command_cb cb;
+        void *cb_data;
+        /* removed while the ring was walking its contexts, freed once
+         * the walk is done.
+         */
+        int removed;
+
+        struct smb2_uring_op poll;
+        struct smb2_uring_op recv;
+        struct smb2_uring_op send;
+
+        /* Vectors of the receive in flight and how many bytes of it are
+         * for the state machine rather than the receive buffer.
+         */
+        struct iovec rx_iov[SMB2_MAX_VECTORS + 1];
+        size_t rx_count;
+        /* Result of a direct receive, handed to the state machine by
+         * the next call to smb2_uring_readv().
+         */
+        int rx_ready;
+        ssize_t rx_res;
+
+        struct smb2_write_batch tx;
+};
+
+struct smb2_uring {
+        int fd;
+
+        void *sq_ptr;
+        size_t sq_size;
+        unsigned *sq_head;
+        unsigned *sq_tail;
+        unsigned *sq_array;
+        unsigned sq_mask;
+        unsigned sq_entries;
+        struct io_uring_sqe *sqes;
+        size_t sqes_size;
+
+        void *cq_ptr;
+        size_t cq_size;
+        unsigned *cq_head;
+        unsigned *cq_tail;
+        unsigned cq_mask;
+        struct io_uring_cqe *cqes;
+
+        /* Completions for other contexts that were reaped while we waited
+         * for a cancellation, processed by the next smb2_service_uring().
+         * Every op has at most one completion outstanding so there is
+         * room reserved for all the ops of all the contexts, deferring
+         * a completion can not fail.
+         */
+        struct io_uring_cqe *deferred;
+        int deferred_len;
+        int deferred_size;
+
+        struct smb2_uring_conn *conns;
+        int num_conns;
+        /* Callbacks run while we walk conns can remove any context, so
+         * while walking removed contexts are only marked.
+         */
+        int walking;
+};
+
+static int
+smb2_uring_enter(struct smb2_uring *ring, unsigned int min_complete,
+                 int timeout)
+{
+        struct io_uring_getevents_arg arg;
+        struct __kernel_timespec ts;
+        unsigned int flags = 0;
+        unsigned int to_submit;
+        int rc;
+
+        to_submit = *ring->sq_tail -
+                __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        if (to_submit == 0 && min_complete == 0) {
+                return 0;
+        }
+
+        memset(&arg, 0, sizeof(arg));
+        if (min_complete) {
+                flags |= IORING_ENTER_GETEVENTS;
+                if (timeout >= 0) {
+                        ts.tv_sec = timeout / 1000;
+                        ts.tv_nsec = (timeout % 1000) * 1000000;
+                        arg.ts = (uint64_t)(uintptr_t)&ts;
+                }
+                flags |= IORING_ENTER_EXT_ARG;
+        }
+
+        rc = (int)syscall(__NR_io_uring_enter, ring->fd, to_submit,
+                          min_complete, flags,
+                          (flags & IORING_ENTER_EXT_ARG) ? &arg : NULL,
+                          sizeof(arg));
+        if (rc < 0) {
+                if (errno == ETIME || errno == EINTR || errno == EAGAIN ||
+                    errno == EBUSY) {
+                        return 0;
+                }
+                return -errno;
+        }
+        return 0;
+}
+
+static int
+smb2_uring_push(struct smb2_uring *ring, const struct io_uring_sqe *sqe)
+{
+        unsigned int tail = *ring->sq_tail;
+        unsigned int idx;
+
+        if (tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+            ring->sq_entries) {
+                /* The submission queue is full, hand it to the kernel */
+                if (smb2_uring_enter(ring, 0, 0) < 0 ||
+                    tail - __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) >=
+                    ring->sq_entries) {
+                        return -1;
+                }
+        }
+
+        idx = tail & ring->sq_mask;
+        ring->sqes[idx] = *sqe;
+        ring->sq_array[idx] = idx;
+        __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+        return 0;
+}
+
+static int
+smb2_uring_pop(struct smb2_uring *ring, struct io_uring_cqe *cqe)
+{
+        unsigned int head = *ring->cq_head;
+
+        if (head == __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+                return 0;
+        }
+        *cqe = ring->cqes[head & ring->cq_mask];
+        __atomic_store_n(ring->cq_head, head + 1, __ATOMIC_RELEASE);
+
+        return 1;
+}
+
+static int
+smb2_uring_submit_op(struct smb2_uring_conn *conn, struct smb2_uring_op *op,
+                     int opcode, int fd, const void *addr, unsigned int len)
+{
+        struct io_uring_sqe sqe;
+
+        memset(&sqe, 0, sizeof(sqe));
+        sqe.opcode = (uint8_t)opcode;
+        sqe.fd = fd;
+        sqe.addr = (uint64_t)(uintptr_t)addr;
+        sqe.len = len;
+        sqe.user_data = (uint64_t)(uintptr_t)op;
+        if (opcode == IORING_OP_POLL_ADD) {
+                sqe.poll32_events = POLLOUT;
+        }
+        if (smb2_uring_push(conn->ring, &sqe) < 0) {
+                return -1;
+        }
+        op->fd = fd;
+        op->busy = 1;
+
+        return 0;
+}
+
+ssize_t
+smb2_uring_readv(struct smb2_context *smb2, const struct iovec *iov,
+                 int iovcnt)
+{
+        struct smb2_uring_conn *conn = smb2->uring;
+        struct iovec *rx_iov = conn->rx_iov;
+        int niov;
+
+        if (conn->rx_ready) {
+                conn->rx_ready = 0;
+                if (conn->rx_res < 0) {
+                        errno = (int)-conn->rx_res;
+                        return -1;
+                }
+                return conn->rx_res;
+        }
+
+        if (smb2->recv_buf_pos < smb2->recv_buf_len) {
+                return smb2_readv_from_recv_buf(smb2, iov, iovcnt);
+        }
+
+        if (!conn->recv.busy) {
+                niov = smb2_setup_recv_iovec(smb2, iov, iovcnt,
+                                             rx_iov, &conn->rx_count);
+                if (niov < 0) {
+                        return -1;
+                }
+                if (conn->rx_count < SMB2_URING_DIRECT_SIZE) {
+                        /* Small reads go through the receive buffer
+                         * only, the state machine resets some of the
+                         * small vectors while we wait.
+                         */
+                        rx_iov += niov - 1;
+                        niov = 1;
+                        conn->rx_count = 0;
+                }
+                if (smb2_uring_submit_op(conn, &conn->recv, IORING_OP_READV,
+                                         smb2->fd, rx_iov, niov) < 0) {
+                        errno = EBUSY;
+                        return -1;
+                }
+        }
+
+        errno = EAGAIN;
+        return -1;
+}
+
+int
+smb2_uring_write(struct smb2_context *smb2)
+{
+        struct smb2_uring_conn *conn = smb2->uring;
+        int rc;
+
+        if (conn->send.busy || smb2->outqueue.head == NULL) {
+                return 0;
+        }
+
+        rc = smb2_prepare_write_batch(smb2, &conn->tx);
+        if (rc <= 0) {
+                return rc;
+        }
+
+        /* If the submission queue is full we try again from
+         * smb2_service_uring().
+         */
+        smb2_uring_submit_op(conn, &conn->send, IORING_OP_WRITEV, smb2->fd,
+                             conn->tx.tmpiov, conn->tx.niov);
+
+        return 0;
+}
+
+/*
+ * Makes room to defer the completions of num_conns contexts.
+ */
+static int
+smb2_uring_reserve(struct smb2_uring *ring, int num_conns)
+{
+        struct io_uring_cqe *deferred;
+        int size = num_conns * SMB2_URING_OPS_PER_CONN;
+
+        if (size <= ring->deferred_size) {
+                return 0;
+        }
+        deferred = smb2_malloc(NULL, size * sizeof(struct io_uring_cqe));
+        if (deferred == NULL) {
+                return -1;
+        }
+        if (ring->deferred_len) {
+                memcpy(deferred, ring->deferred, ring->deferred_len *
+                       sizeof(struct io_uring_cqe));
+        }
+        smb2_free(NULL, ring->deferred);
+        ring->deferred = deferred;
+        ring->deferred_size = size;
+
+        return 0;
+}
+
+static void
+smb2_uring_defer(struct smb2_uring *ring, const struct io_uring_cqe *cqe)
+{
+        ring->deferred[ring->deferred_len++] = *cqe;
+}
+
+#define smb2_uring_cqe_op(cqe) \
+        ((struct smb2_uring_op *)(uintptr_t)(cqe)->user_data)
+
+/*
+ * Reaps the completions that are ready. Those of conn are dropped, the
+ * others are kept for the next smb2_service_uring().
+ */
+static void
+smb2_uring_reap_cancelled(struct smb2_uring *ring,
+                          struct smb2_uring_conn *conn)
+{
+        struct smb2_uring_op *op;
+        struct io_uring_cqe cqe;
+
+        while (smb2_uring_pop(ring, &cqe)) {
+                op = smb2_uring_cqe_op(&cqe);
+                if (op == NULL) {
+                        /* completion of the cancel request */
+                        continue;
+                }
+                if (op->conn == conn) {
+                        op->busy = 0;
+                        continue;
+                }
+                smb2_uring_defer(ring, &cqe);
+        }
+}
+
+/*
+ * Cancels everything the context has in flight and waits for it to
+ * complete, the kernel must be done with our buffers before we return.
+ * If a cancel request can not be queued or does not take effect in time
+ * the sockets are shut down, which completes any I/O still pending on
+ * them.
+ */
+void
+smb2_uring_cancel(struct smb2_context *smb2)
+{
+        struct smb2_uring_conn *conn = smb2->uring;
+        struct smb2_uring *ring = conn->ring;
+        struct smb2_uring_op *ops[3];
+        struct smb2_uring_op *op;
+        struct io_uring_sqe sqe;
+        int i, j, tries, shut = 0;
+
+        ops[0] = &conn->poll;
+        ops[1] = &conn->recv;
+        ops[2] = &conn->send;
+
+        /* Drop completions for this context we have already reaped */
+        for (i = 0, j = 0; i < ring->deferred_len; i++) {
+                op = smb2_uring_cqe_op(&ring->deferred[i]);
+                if (op->conn == conn) {
+                        op->busy = 0;
+                        continue;
+                }
+                ring->deferred[j++] = ring->deferred[i];
+        }
+        ring->deferred_len = j;
+
+        for (i = 0; i < 3 && !shut; i++) {
+                if (!ops[i]->busy) {
+                        continue;
+                }
+                memset(&sqe, 0, sizeof(sqe));
+                sqe.opcode = IORING_OP_ASYNC_CANCEL;
+                sqe.fd = -1;
+                sqe.addr = (uint64_t)(uintptr_t)ops[i];
+                for (tries = 0; smb2_uring_push(ring, &sqe) < 0; tries++) {
+                        if (tries == SMB2_URING_CANCEL_TRIES) {
+                                shut = 1;
+                                break;
+                        }
+                        /* The submission queue is full and the kernel
+                         * did not take it, make room by reaping.
+                         */
+                        if (smb2_uring_enter(ring, 1,
+                                             SMB2_URING_CANCEL_WAIT) < 0) {
+                                shut = 1;
+                                break;
+                        }
+                        smb2_uring_reap_cancelled(ring, conn);
+                }
+        }
+
+        tries = 0;
+        while (conn->poll.busy || conn->recv.busy || conn->send.busy) {
+                if (shut == 1) {
+                        smb2_set_error(smb2, "Could not cancel io_uring "
+                                       "I/O, shutting the socket down");
+                        for (i = 0; i < 3; i++) {
+                                if (ops[i]->busy) {
+                                        shutdown(ops[i]->fd, SHUT_RDWR);
+                                }
+                        }
+                        shut = 2;
+                }
+                if (smb2_uring_enter(ring, 1, SMB2_URING_CANCEL_WAIT) < 0) {
+                        break;
+                }
+                smb2_uring_reap_cancelled(ring, conn);
+                if (!shut && ++tries == SMB2_URING_CANCEL_TRIES) {
+                        shut = 1;
+                }
+        }
+        conn->rx_ready = 0;
+}
+
+static void
+smb2_uring_fail(struct smb2_uring_conn *conn)
+{
+        struct smb2_context *smb2 = conn->smb2;
+        smb2_command_cb cb = conn->cb;
+        void *cb_data = conn->cb_data;
+
+        smb2_uring_remove_context(smb2);
+        if (cb) {
+                cb(smb2, -1, NULL, cb_data);
+        }
+}
+
+static void
+smb2_uring_complete(struct smb2_uring *ring, const struct io_uring_cqe *cqe)
+{
+        struct smb2_uring_op *op = smb2_uring_cqe_op(cqe);
+        struct smb2_uring_conn *conn;
+        struct smb2_context *smb2;
+        ssize_t rc;
+
+        if (op == NULL) {
+                return;
+        }
+        op->busy = 0;
+        conn = op->conn;
+        smb2 = conn->smb2;
+
+        if (op == &conn->poll) {
+                if (smb2_service(smb2, cqe->res < 0 ? POLLERR :
+                                 cqe->res) < 0) {
+                        smb2_uring_fail(conn);
+                }
+                return;
+        }
+
+        if (op == &conn->recv) {
+                if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+                        return;
+                }
+                rc = cqe->res;
+                if (rc > 0) {
+                        rc = smb2_recv_iovec_done(smb2, rc, conn->rx_count);
+                }
+                /* Unless we only received into the receive buffer the
+                 * result goes to the state machine.
+                 */
+                if (cqe->res <= 0 || conn->rx_count) {
+                        conn->rx_ready = 1;
+                        conn->rx_res = rc;
+                }
+                if (smb2_read_from_socket(smb2) != 0) {
+                        smb2_uring_fail(conn);
+                }
+                return;
+        }
+
+        /* send */
+        if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+                return;
+        }
+        if (cqe->res < 0) {
+                smb2_set_error(smb2, "Error when writing to socket :%d",
+                               -cqe->res);
+                smb2_uring_fail(conn);
+                return;
+        }
+        smb2_complete_write_batch(smb2, &conn->tx, (size_t)cqe->res);
+}
+
+/*
+ * Makes sure every context has the I/O it needs in flight.
+ */
+static void
+smb2_uring_arm(struct smb2_uring *ring)
+{
+        struct smb2_uring_conn *conn, *next;
+        struct smb2_context *smb2;
+
+        for (conn = ring->conns; conn; conn = next) {
+                next = conn->next;
+                if (conn->removed) {
+                        continue;
+                }
+                smb2 = conn->smb2;
+
+                if (!SMB2_VALID_SOCKET(smb2->fd)) {
+                        if (smb2->connecting_fds_count && !conn->poll.busy) {
+                                smb2_uring_submit_op(conn, &conn->poll,
+                                                     IORING_OP_POLL_ADD,
+                                                     smb2->connecting_fds[0],
+                                                     NULL, 0);
+                        }
+                        continue;
+                }
+                if (!conn->recv.busy && !conn->rx_ready) {
+                        if (smb2_read_from_socket(smb2) != 0) {
+                                smb2_uring_fail(conn);
+                                continue;
+                        }
+                }
+                if (smb2_uring_write(smb2) != 0) {
+                        smb2_uring_fail(conn);
+                }
+        }
+}
+
+struct smb2_uring *
+smb2_uring_init(unsigned int entries)
+{
+        struct io_uring_params p;
+        struct smb2_uring *ring;
+        int err;
+
+        ring = smb2_calloc(NULL, 1, sizeof(struct smb2_uring));
+        if (ring == NULL) {
+                errno = ENOMEM;
+                return NULL;
+        }
+
+        memset(&p, 0, sizeof(p));
+        ring->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+        if (ring->fd < 0) {
+                err = errno;
+                smb2_free(NULL, ring);
+                errno = err;
+                return NULL;
+        }
+        if (!(p.features & IORING_FEAT_EXT_ARG)) {
+                close(ring->fd);
+                smb2_free(NULL, ring);
+                errno = ENOSYS;
+                return NULL;
+        }
+
+        ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        ring->cq_size = p.cq_off.cqes +
+                p.cq_entries * sizeof(struct io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+                if (ring->cq_size > ring->sq_size) {
+                        ring->sq_size = ring->cq_size;
+                }
+                ring->cq_size = 0;
+        }
+        ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd,
+                            IORING_OFF_SQ_RING);
+        if (ring->sq_ptr == MAP_FAILED) {
+                goto failed;
+        }
+        if (ring->cq_size) {
+                ring->cq_ptr = mmap(NULL, ring->cq_size,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE, ring->fd,
+                                    IORING_OFF_CQ_RING);
+                if (ring->cq_ptr == MAP_FAILED) {
+                        munmap(ring->sq_ptr, ring->sq_size);
+                        goto failed;
+                }
+        } else {
+                ring->cq_ptr = ring->sq_ptr;
+        }
+        ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+        ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, ring->fd,
+                          IORING_OFF_SQES);
+        if (ring->sqes == MAP_FAILED) {
+                if (ring->cq_size) {
+                        munmap(ring->cq_ptr, ring->cq_size);
+                }
+                munmap(ring->sq_ptr, ring->sq_size);
+                goto failed;
+        }
+
+        ring->sq_head = (unsigned *)((char *)ring->sq_ptr + p.sq_off.head);
+        ring->sq_tail = (unsigned *)((char *)ring->sq_ptr + p.sq_off.tail);
+        ring->sq_array = (unsigned *)((char *)ring->sq_ptr + p.sq_off.array);
+        ring->sq_mask = *(unsigned *)((char *)ring->sq_ptr +
+                                      p.sq_off.ring_mask);
+        ring->sq_entries = p.sq_entries;
+        ring->cq_head = (unsigned *)((char *)ring->cq_ptr + p.cq_off.head);
+        ring->cq_tail = (unsigned *)((char *)ring->cq_ptr + p.cq_off.tail);
+        ring->cq_mask = *(unsigned *)((char *)ring->cq_ptr +
+                                      p.cq_off.ring_mask);
+        ring->cqes = (struct io_uring_cqe *)((char *)ring->cq_ptr +
+                                             p.cq_off.cqes);
+
+        return ring;
+
+ failed:
+        err = errno;
+        close(ring->fd);
+        smb2_free(NULL, ring);
+        errno = err;
+        return NULL;
+}
+
+/* Frees the contexts that were removed while we walked the ring */
+static void
+smb2_uring_free_removed(struct smb2_uring *ring)
+{
+        struct smb2_uring_conn *conn, *next;
+
+        for (conn = ring->conns; conn; conn = next) {
+                next = conn->next;
+                if (conn->removed) {
+                        SMB2_LIST_REMOVE(&ring->conns, conn);
+                        ring->num_conns--;
+                        smb2_free(NULL, conn);
+                }
+        }
+}
+
+void
+smb2_uring_destroy(struct smb2_uring *ring)
+{
+        if (ring == NULL) {
+                return;
+        }
+
+        smb2_uring_free_removed(ring);
+        while (ring->conns) {
+                smb2_uring_remove_context(ring->conns->smb2);
+        }
+
+        munmap(ring->sqes, ring->sqes_size);
+        if (ring->cq_size) {
+                munmap(ring->cq_ptr, ring->cq_size);
+        }
+        munmap(ring->sq_ptr, ring->sq_size);
+        close(ring->fd);
+        smb2_free(NULL, ring->deferred);
+        smb2_free(NULL, ring);
+}
+
+int
+smb2_uring_add_context(struct smb2_uring *ring, struct smb2_context *smb2,
+                       smb2_command_cb cb, void *cb_data)
+{
+        struct smb2_uring_conn *conn;
+
+        if (smb2->uring) {
+                smb2_set_error(smb2, "Context is already attached to an "
+                               "io_uring");
+                return -EBUSY;
+        }
+        if (smb2->transport != &smb2_tcp_transport) {
+                smb2_set_error(smb2, "Only TCP connections can be attached "
+                               "to an io_uring");
+                return -EINVAL;
+        }
+
+        if (smb2_uring_reserve(ring, ring->num_conns + 1) < 0) {
+                smb2_set_error(smb2, "Failed to allocate io_uring "
+                               "completions");
+                return -ENOMEM;
+        }
+
+        /* Like the ring itself this is not tied to the context, a
+         * context destroyed from a callback leaves it behind until the
+         * ring is done walking.
+         */
+        conn = smb2_calloc(NULL, 1, sizeof(struct smb2_uring_conn));
+        if (conn == NULL) {
+                smb2_set_error(smb2, "Failed to allocate io_uring "
+                               "connection");
+                return -ENOMEM;
+        }
+        conn->ring = ring;
+        conn->smb2 = smb2;
+        conn->cb = cb;
+        conn->cb_data = cb_data;
+        conn->poll.conn = conn;
+        conn->recv.conn = conn;
+        conn->send.conn = conn;
+
+        /* Small reads always go through the receive buffer */
+        if (smb2->recv_buf_size == 0) {
+                smb2->recv_buf_size = SMB2_DEFAULT_RECV_BUFFER_SIZE;
+        }
+
+        SMB2_LIST_ADD(&ring->conns, conn);
+        ring->num_conns++;
+        smb2->uring = conn;
+
+        return 0;
+}
+
+int
+smb2_uring_remove_context(struct smb2_context *smb2)
+{
+        struct smb2_uring_conn *conn = smb2->uring;
+
+        if (conn == NULL) {
+                return 0;
+        }
+
+        smb2_uring_cancel(smb2);
+        smb2->uring = NULL;
+        if (conn->ring->walking) {
+                conn->removed = 1;
+                conn->smb2 = NULL;
+                return 0;
+        }
+        SMB2_LIST_REMOVE(&conn->ring->conns, conn);
+        conn->ring->num_conns--;
+        smb2_free(NULL, conn);
+
+        return 0;
+}
+
+int
+smb2_service_uring(struct smb2_uring *ring, int timeout)
+{
+        struct smb2_uring_conn *conn, *next;
+        struct io_uring_cqe cqe;
+        int i, rc;
+
+        /* Completions reaped while cancelling. Processing them can cancel
+         * more, so take them one at a time.
+         */
+        for (i = 0; i < ring->deferred_len; ) {
+                cqe = ring->deferred[i];
+                memmove(&ring->deferred[i], &ring->deferred[i + 1],
+                        (ring->deferred_len - i - 1) *
+                        sizeof(struct io_uring_cqe));
+                ring->deferred_len--;
+                smb2_uring_complete(ring, &cqe);
+        }
+
+        ring->walking++;
+        smb2_uring_arm(ring);
+        ring->walking--;
+        smb2_uring_free_removed(ring);
+
+        rc = smb2_uring_enter(ring, timeout ? 1 : 0, timeout);
+        if (rc < 0) {
+                return rc;
+        }
+
+        while (smb2_uring_pop(ring, &cqe)) {
+                smb2_uring_complete(ring, &cqe);
+        }
+
+        ring->walking++;
+        for (conn = ring->conns; conn; conn = next) {
+                next = conn->next;
+                if (conn->removed) {
+                        continue;
+                }
+                if (conn->smb2->timeout) {
+                        smb2_timeout_pdus(conn->smb2);
+                }
+                if (!conn->removed && conn->smb2->write_behinds) {
+                        smb2_wb_expire(conn->smb2);
+                }
+        }
+        ring->walking--;
+        smb2_uring_free_removed(ring);
+
+        return 0;
+}
+
+#else /* HAVE_IO_URING */
+
+struct smb2_uring *
+smb2_uring_init(unsigned int entries)
+{
+        errno = ENOSYS;
+        return NULL;
+}
+
+void
+smb2_uring_destroy(struct smb2_uring *ring)
+{
+}
+
+int
+smb2_uring_add_context(struct smb2_uring *ring, struct smb2_context *smb2,
+                       smb2_command_cb cb, void *cb_data)
+{
+        smb2_set_error(smb2, "libsmb2 was built without io_uring support");
+        return -ENOSYS;
+}
+
+int
+smb2_uring_remove_context(struct smb2_context *smb2)
+{
+        return 0;
+}
+
+int
+smb2_service_uring(struct smb2_uring *ring, int timeout)
+{
+        return -ENOSYS;
+}
+
+#endif /* HAVE_IO_URING */
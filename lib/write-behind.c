@@ -0,0 +1,811 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#ifdef HAVE_STDINT_H
+#include <stdint.h>
+#endif
+
+#ifdef STDC_HEADERS
+#include <stddef.h>
+#endif
+
+#ifdef HAVE_STDLIB_H
+#include <stdlib.h>
+#endif
+
+#ifdef HAVE_STRING_H
+#include <string.h>
+#endif
+
+#include <errno.h>
+
+#include "compat.h"
+
+#include "slist.h"
+#include "smb2.h"
+#include "libsmb2.h"
+#include "libsmb2-raw.h"
+#include "libsmb2-private.h"
+#include "read-ahead.h"
+#include "write-behind.h"
+
+/*
+ * Writes are copied into extents, each a buffer for one WRITE PDU of up
+ * to max_write_size bytes. Writes that are adjacent to or overlap the
+ * extent being filled are merged into it. Once it is full, or the next
+ * write lands elsewhere, the extent is sent and a new one is started.
+ * The application's callback is invoked as soon as its data is copied.
+ *
+ * Extents are sent as soon as they are closed, so several are in
+ * flight at a time, except that an extent which overlaps one that was
+ * closed before it waits for that one to complete so the server sees
+ * the writes in order.
+ *
+ * A WRITE that fails sets an error that is returned by the next write,
+ * fsync or close of the handle.
+ */
+
+#define WB_MAX_CHUNK (1024 * 1024)
+#define WB_MIN_CHUNK 4096
+
+#define WB_OPEN         0
+#define WB_QUEUED       1
+#define WB_IN_FLIGHT    2
+
+struct wb_extent {
+        struct wb_extent *next;
+        /* NULL once dropped while in flight, the callback then frees it */
+        struct smb2_write_behind *wb;
+        uint64_t seq;
+        uint64_t offset;
+        uint32_t len;
+        uint32_t size;
+        int state;
+        uint8_t buf[1];
+};
+
+/* A write that waits for a free extent */
+struct wb_writer {
+        struct wb_writer *next;
+        smb2_command_cb cb;
+        void *cb_data;
+        struct smb2_write_cb_data write_cb_data;
+        uint32_t copied;
+};
+
+#define WB_FSYNC        0
+#define WB_CLOSE        1
+#define WB_READ         2
+#define WB_TRUNCATE     3
+
+/* An fsync, close, read or truncate that waits for the writes before it.
+ * A truncate keeps the length in read_cb_data.offset.
+ */
+struct wb_flusher {
+        struct wb_flusher *next;
+        int op;
+        uint64_t seq;
+        smb2_command_cb cb;
+        void *cb_data;
+        struct smb2_read_cb_data read_cb_data;
+};
+
+/* Reports an earlier write error through the callback of a close */
+struct wb_close_data {
+        smb2_command_cb cb;
+        void *cb_data;
+        int err;
+};
+
+struct smb2_write_behind {
+        struct smb2_write_behind *next;
+        /* NULL once the handle is closed */
+        struct smb2fh *fh;
+
+        uint32_t chunk_size;
+        int num_chunks;
+        /* in us, 0 for no time limit */
+        uint64_t max_delay;
+
+        /* oldest first, the last one may be open */
+        struct wb_extent *extents;
+        struct wb_extent *extents_tail;
+        int num_extents;
+        struct wb_extent *free_extents;
+        /* of the newest extent */
+        uint64_t seq;
+        /* when the open extent got its first data */
+        uint64_t dirty_since;
+
+        struct wb_writer *writers;
+        struct wb_writer *writers_tail;
+        struct wb_flusher *flushers;
+        struct wb_flusher *flushers_tail;
+
+        /* -errno of a write that failed, until it is reported */
+        int error;
+
+        /* callbacks are being invoked, freeing has to wait */
+        int serving;
+        int freed;
+};
+
+static void wb_progress(struct smb2_context *smb2,
+                        struct smb2_write_behind *wb);
+
+static void
+wb_set_error(struct smb2_write_behind *wb, int err)
+{
+        if (wb->error == 0) {
+                wb->error = err;
+        }
+}
+
+static void
+wb_unlink(struct smb2_write_behind *wb, struct wb_extent *e)
+{
+        struct wb_extent *prev = NULL, *tmp;
+
+        for (tmp = wb->extents; tmp != e; tmp = tmp->next) {
+                prev = tmp;
+        }
+        if (prev) {
+                prev->next = e->next;
+        } else {
+                wb->extents = e->next;
+        }
+        if (wb->extents_tail == e) {
+                wb->extents_tail = prev;
+        }
+        wb->num_extents--;
+}
+
+static void
+wb_recycle(struct smb2_write_behind *wb, struct wb_extent *e)
+{
+        e->next = wb->free_extents;
+        wb->free_extents = e;
+}
+
+static struct wb_extent *
+wb_open_extent(struct smb2_write_behind *wb)
+{
+        if (wb->extents_tail && wb->extents_tail->state == WB_OPEN) {
+                return wb->extents_tail;
+        }
+        return NULL;
+}
+
+/* Closes the extent being filled, it is sent by wb_issue() */
+static void
+wb_close_open(struct smb2_write_behind *wb)
+{
+        struct wb_extent *e = wb_open_extent(wb);
+
+        if (e) {
+                e->state = WB_QUEUED;
+        }
+}
+
+static void
+wb_extent_cb(struct smb2_context *smb2, int status,
+             void *command_data, void *private_data)
+{
+        struct wb_extent *e = private_data;
+        struct smb2_write_behind *wb = e->wb;
+        struct smb2_write_reply *rep = command_data;
+
+        if (wb == NULL) {
+                smb2_free(smb2, e);
+                return;
+        }
+
+        if (status) {
+                smb2_set_nterror(smb2, status, "Write failed with (0x%08x) %s",
+                               status, nterror_to_str(status));
+                wb_set_error(wb, -nterror_to_errno(status));
+        } else if (rep->count < e->len) {
+                smb2_set_error(smb2, "Short write, %u of %u bytes at "
+                               "offset %llu", rep->count, e->len,
+                               (unsigned long long)e->offset);
+                wb_set_error(wb, -EIO);
+        }
+        wb_unlink(wb, e);
+        wb_recycle(wb, e);
+        /* it may have read ahead what was just overwritten */
+        if (wb->fh->ra) {
+                smb2_ra_invalidate(smb2, wb->fh->ra);
+        }
+
+        wb_progress(smb2, wb);
+}
+
+static int
+wb_overlaps(struct wb_extent *a, uint64_t offset, uint64_t len)
+{
+        return a->offset < offset + len && offset < a->offset + a->len;
+}
+
+/* Sends the closed extents that do not overlap an earlier one */
+static void
+wb_issue(struct smb2_context *smb2, struct smb2_write_behind *wb)
+{
+        struct smb2_write_request req;
+        struct wb_extent *e, *next, *prev;
+        struct smb2_pdu *pdu;
+
+        /* the context is being torn down */
+        if (!SMB2_VALID_SOCKET(smb2->fd)) {
+                return;
+        }
+        for (e = wb->extents; e; e = next) {
+                next = e->next;
+                if (e->state != WB_QUEUED) {
+                        continue;
+                }
+                for (prev = wb->extents; prev != e; prev = prev->next) {
+                        if (wb_overlaps(prev, e->offset, e->len)) {
+                                break;
+                        }
+                }
+                if (prev != e) {
+                        continue;
+                }
+
+                memset(&req, 0, sizeof(struct smb2_write_request));
+                req.length = e->len;
+                req.offset = e->offset;
+                req.buf = e->buf;
+                memcpy(req.file_id, wb->fh->file_id, SMB2_FD_SIZE);
+                req.channel = SMB2_CHANNEL_NONE;
+
+                pdu = smb2_cmd_write_async(smb2, &req, 0, wb_extent_cb, e);
+                if (pdu == NULL) {
+                        /* the data is lost, the error says so */
+                        smb2_set_error(smb2, "Failed to create write "
+                                       "command");
+                        wb_set_error(wb, -ENOMEM);
+                        wb_unlink(wb, e);
+                        wb_recycle(wb, e);
+                        continue;
+                }
+                e->state = WB_IN_FLIGHT;
+                smb2_queue_pdu(smb2, pdu);
+        }
+}
+
+static void
+wb_complete_writer(struct smb2_context *smb2, struct smb2_write_behind *wb,
+                   int status)
+{
+        struct wb_writer *w = wb->writers;
+
+        wb->writers = w->next;
+        if (wb->writers == NULL) {
+                wb->writers_tail = NULL;
+        }
+        w->cb(smb2, status, &w->write_cb_data, w->cb_data);
+        smb2_free(smb2, w);
+}
+
+/* Copies the waiting writes into extents while there are free ones */
+static void
+wb_serve_writers(struct smb2_context *smb2, struct smb2_write_behind *wb)
+{
+        struct wb_writer *w;
+        struct wb_extent *e;
+        uint64_t pos;
+        uint32_t n;
+
+        while (!wb->freed && (w = wb->writers) != NULL) {
+                if (w->copied == w->write_cb_data.count) {
+                        wb_complete_writer(smb2, wb, w->copied);
+                        continue;
+                }
+                pos = w->write_cb_data.offset + w->copied;
+
+                e = wb_open_extent(wb);
+                if (e && pos >= e->offset && pos <= e->offset + e->len &&
+                    pos < e->offset + e->size) {
+                        n = (uint32_t)(e->offset + e->size - pos);
+                        if (n > w->write_cb_data.count - w->copied) {
+                                n = w->write_cb_data.count - w->copied;
+                        }
+                        memcpy(e->buf + (pos - e->offset),
+                               w->write_cb_data.buf + w->copied, n);
+                        if (pos + n > e->offset + e->len) {
+                                e->len = (uint32_t)(pos + n - e->offset);
+                        }
+                        w->copied += n;
+                        if (e->len == e->size) {
+                                e->state = WB_QUEUED;
+                        }
+                        continue;
+                }
+
+                wb_close_open(wb);
+                if (wb->num_extents >= wb->num_chunks) {
+                        /* wait for one to complete */
+                        break;
+                }
+                e = wb->free_extents;
+                if (e) {
+                        wb->free_extents = e->next;
+                } else {
+                        e = smb2_malloc(smb2, offsetof(struct wb_extent, buf) +
+                                        wb->chunk_size);
+                        if (e == NULL) {
+                                smb2_set_error(smb2, "Failed to allocate "
+                                               "write buffer");
+                                wb_complete_writer(smb2, wb, w->copied ?
+                                                   (int)w->copied : -ENOMEM);
+                                continue;
+                        }
+                }
+                e->next = NULL;
+                e->wb = wb;
+                e->seq = ++wb->seq;
+                e->offset = pos;
+                e->len = 0;
+                e->size = smb2_max_io_size(smb2, wb->chunk_size);
+                if (e->size == 0) {
+                        e->size = wb->chunk_size;
+                }
+                e->state = WB_OPEN;
+                if (wb->extents_tail) {
+                        wb->extents_tail->next = e;
+                } else {
+                        wb->extents = e;
+                }
+                wb->extents_tail = e;
+                wb->num_extents++;
+                wb->dirty_since = smb2_monotonic_usec();
+        }
+}
+
+static void
+wb_close_cb(struct smb2_context *smb2, int status,
+            void *command_data, void *private_data)
+{
+        struct wb_close_data *cd = private_data;
+
+        cd->cb(smb2, status ? status : cd->err, command_data, cd->cb_data);
+        smb2_free(smb2, cd);
+}
+
+static void
+wb_run_flusher(struct smb2_context *smb2, struct smb2_write_behind *wb,
+               struct wb_flusher *f)
+{
+        struct smb2fh *fh = wb->fh;
+        struct wb_close_data *cd;
+        int err = wb->error;
+        int rc = 0;
+
+        switch (f->op) {
+        case WB_READ:
+                /* bypass the write-behind, the data is on the server now */
+                fh->wb = NULL;
+                rc = smb2_pread_async(smb2, fh, f->read_cb_data.buf,
+                                      f->read_cb_data.count,
+                                      f->read_cb_data.offset,
+                                      f->cb, f->cb_data);
+                fh->wb = wb;
+                if (rc < 0) {
+                        f->cb(smb2, rc, &f->read_cb_data, f->cb_data);
+                }
+                break;
+        case WB_FSYNC:
+                if (err) {
+                        wb->error = 0;
+                        f->cb(smb2, err, NULL, f->cb_data);
+                        break;
+                }
+                fh->wb = NULL;
+                rc = smb2_fsync_async(smb2, fh, f->cb, f->cb_data);
+                fh->wb = wb;
+                if (rc < 0) {
+                        f->cb(smb2, rc, NULL, f->cb_data);
+                }
+                break;
+        case WB_TRUNCATE:
+                fh->wb = NULL;
+                rc = smb2_ftruncate_async(smb2, fh, f->read_cb_data.offset,
+                                          f->cb, f->cb_data);
+                fh->wb = wb;
+                if (rc < 0) {
+                        f->cb(smb2, rc, NULL, f->cb_data);
+                }
+                break;
+        case WB_CLOSE:
+                fh->wb = NULL;
+                smb2_wb_free(smb2, wb);
+                if (err) {
+                        cd = smb2_calloc(smb2, 1,
+                                         sizeof(struct wb_close_data));
+                        if (cd == NULL) {
+                                f->cb(smb2, -ENOMEM, NULL, f->cb_data);
+                                break;
+                        }
+                        cd->cb = f->cb;
+                        cd->cb_data = f->cb_data;
+                        cd->err = err;
+                        rc = smb2_close_async(smb2, fh, wb_close_cb, cd);
+                        if (rc < 0) {
+                                smb2_free(smb2, cd);
+                        }
+                } else {
+                        rc = smb2_close_async(smb2, fh, f->cb, f->cb_data);
+                }
+                if (rc < 0) {
+                        f->cb(smb2, rc, NULL, f->cb_data);
+                }
+                break;
+        }
+}
+
+/* Runs the flushers that no longer have earlier writes to wait for */
+static void
+wb_run_flushers(struct smb2_context *smb2, struct smb2_write_behind *wb)
+{
+        struct wb_flusher *f;
+
+        while (!wb->freed && (f = wb->flushers) != NULL) {
+                if (wb->extents && wb->extents->seq <= f->seq) {
+                        break;
+                }
+                /* a close also waits for the writes that wait for room */
+                if (f->op == WB_CLOSE && (wb->writers || wb->extents)) {
+                        break;
+                }
+                wb->flushers = f->next;
+                if (wb->flushers == NULL) {
+                        wb->flushers_tail = NULL;
+                }
+                wb_run_flusher(smb2, wb, f);
+                smb2_free(smb2, f);
+        }
+}
+
+static void
+wb_release(struct smb2_context *smb2, struct smb2_write_behind *wb)
+{
+        struct wb_extent *e;
+
+        while ((e = wb->free_extents) != NULL) {
+                wb->free_extents = e->next;
+                smb2_free(smb2, e);
+        }
+        smb2_free(smb2, wb);
+}
+
+static void
+wb_progress(struct smb2_context *smb2, struct smb2_write_behind *wb)
+{
+        struct wb_extent *e;
+
+        wb->serving++;
+        wb_serve_writers(smb2, wb);
+        if (!wb->freed) {
+                e = wb_open_extent(wb);
+                /* nothing is merged into it while a flush waits */
+                if (e && (wb->flushers || (wb->max_delay &&
+                    smb2_monotonic_usec() - wb->dirty_since >=
+                    wb->max_delay))) {
+                        e->state = WB_QUEUED;
+                }
+                wb_issue(smb2, wb);
+        }
+        wb_run_flushers(smb2, wb);
+        wb->serving--;
+
+        if (wb->freed && wb->serving == 0) {
+                wb_release(smb2, wb);
+        }
+}
+
+int
+smb2_wb_pwrite(struct smb2_context *smb2, struct smb2fh *fh,
+               const uint8_t *buf, uint32_t count, uint64_t offset,
+               smb2_command_cb cb, void *cb_data)
+{
+        struct smb2_write_behind *wb = fh->wb;
+        struct wb_writer *w;
+        int err;
+
+        if (wb->error) {
+                err = wb->error;
+                wb->error = 0;
+                smb2_set_error(smb2, "An earlier write to the file failed");
+                return err;
+        }
+        if (count == 0) {
+                return 1;
+        }
+
+        w = smb2_calloc(smb2, 1, sizeof(struct wb_writer));
+        if (w == NULL) {
+                smb2_set_error(smb2, "Failed to allocate wb_writer");
+                return -ENOMEM;
+        }
+        w->cb = cb;
+        w->cb_data = cb_data;
+        w->write_cb_data.fh = fh;
+        w->write_cb_data.buf = buf;
+        w->write_cb_data.count = count;
+        w->write_cb_data.offset = offset;
+        if (wb->writers_tail) {
+                wb->writers_tail->next = w;
+        } else {
+                wb->writers = w;
+        }
+        wb->writers_tail = w;
+        /* for smb2_write_async(), even if it has to wait for room */
+        fh->offset = offset + count;
+
+        wb_progress(smb2, wb);
+        return 0;
+}
+
+static int
+wb_flush(struct smb2_context *smb2, struct smb2fh *fh, int op,
+         uint8_t *buf, uint32_t count, uint64_t offset,
+         smb2_command_cb cb, void *cb_data)
+{
+        struct smb2_write_behind *wb = fh->wb;
+        struct wb_flusher *f;
+
+        f = smb2_calloc(smb2, 1, sizeof(struct wb_flusher));
+        if (f == NULL) {
+                smb2_set_error(smb2, "Failed to allocate wb_flusher");
+                return -ENOMEM;
+        }
+        f->op = op;
+        f->seq = wb->seq;
+        f->cb = cb;
+        f->cb_data = cb_data;
+        f->read_cb_data.fh = fh;
+        f->read_cb_data.buf = buf;
+        f->read_cb_data.count = count;
+        f->read_cb_data.offset = offset;
+        if (wb->flushers_tail) {
+                wb->flushers_tail->next = f;
+        } else {
+                wb->flushers = f;
+        }
+        wb->flushers_tail = f;
+
+        wb_progress(smb2, wb);
+        return 0;
+}
+
+int
+smb2_wb_pread(struct smb2_context *smb2, struct smb2fh *fh,
+              uint8_t *buf, uint32_t count, uint64_t offset,
+              smb2_command_cb cb, void *cb_data)
+{
+        struct wb_extent *e;
+
+        for (e = fh->wb->extents; e; e = e->next) {
+                if (wb_overlaps(e, offset, count)) {
+                        break;
+                }
+        }
+        if (e == NULL && fh->wb->flushers == NULL) {
+                return 1;
+        }
+        return wb_flush(smb2, fh, WB_READ, buf, count, offset, cb, cb_data);
+}
+
+int
+smb2_wb_fsync(struct smb2_context *smb2, struct smb2fh *fh,
+              smb2_command_cb cb, void *cb_data)
+{
+        struct smb2_write_behind *wb = fh->wb;
+        int err;
+
+        if (wb->extents == NULL && wb->flushers == NULL) {
+                if (wb->error) {
+                        err = wb->error;
+                        wb->error = 0;
+                        smb2_set_error(smb2, "An earlier write to the file "
+                                       "failed");
+                        return err;
+                }
+                return 1;
+        }
+        return wb_flush(smb2, fh, WB_FSYNC, NULL, 0, 0, cb, cb_data);
+}
+
+int
+smb2_wb_ftruncate(struct smb2_context *smb2, struct smb2fh *fh,
+                  uint64_t length, smb2_command_cb cb, void *cb_data)
+{
+        if (fh->wb->extents == NULL && fh->wb->flushers == NULL) {
+                return 1;
+        }
+        return wb_flush(smb2, fh, WB_TRUNCATE, NULL, 0, length,
+                        cb, cb_data);
+}
+
+int
+smb2_wb_close(struct smb2_context *smb2, struct smb2fh *fh,
+              smb2_command_cb cb, void *cb_data)
+{
+        struct smb2_write_behind *wb = fh->wb;
+
+        if (wb->extents == NULL && wb->flushers == NULL &&
+            wb->writers == NULL && wb->error == 0) {
+                fh->wb = NULL;
+                smb2_wb_free(smb2, wb);
+                return 1;
+        }
+        return wb_flush(smb2, fh, WB_CLOSE, NULL, 0, 0, cb, cb_data);
+}
+
+void
+smb2_wb_break(struct smb2_context *smb2,
+              struct smb2_oplock_or_lease_break_reply *rep)
+{
+        struct smb2_write_behind *wb, *next;
+
+        for (wb = smb2->write_behinds; wb; wb = next) {
+                next = wb->next;
+                if (smb2_fh_break_matches(wb->fh, rep) &&
+                    wb_open_extent(wb)) {
+                        wb_close_open(wb);
+                        wb_progress(smb2, wb);
+                }
+        }
+}
+
+void
+smb2_wb_expire(struct smb2_context *smb2)
+{
+        struct smb2_write_behind *wb, *next;
+        uint64_t now = smb2_monotonic_usec();
+
+        for (wb = smb2->write_behinds; wb; wb = next) {
+                next = wb->next;
+                if (wb->max_delay && wb_open_extent(wb) &&
+                    now - wb->dirty_since >= wb->max_delay) {
+                        wb_progress(smb2, wb);
+                }
+        }
+}
+
+void
+smb2_wb_free(struct smb2_context *smb2, struct smb2_write_behind *wb)
+{
+        struct wb_extent *e;
+        struct wb_flusher *f;
+
+        SMB2_LIST_REMOVE(&smb2->write_behinds, wb);
+        wb->fh = NULL;
+        wb->freed = 1;
+
+        while ((e = wb->extents) != NULL) {
+                wb->extents = e->next;
+                if (e->state == WB_IN_FLIGHT) {
+                        e->wb = NULL;
+                } else {
+                        wb_recycle(wb, e);
+                }
+        }
+        wb->extents_tail = NULL;
+        wb->num_extents = 0;
+
+        wb->serving++;
+        while (wb->writers) {
+                wb_complete_writer(smb2, wb, -EBADF);
+        }
+        while ((f = wb->flushers) != NULL) {
+                wb->flushers = f->next;
+                f->cb(smb2, -EBADF, f->op == WB_READ ?
+                      &f->read_cb_data : NULL, f->cb_data);
+                smb2_free(smb2, f);
+        }
+        wb->flushers_tail = NULL;
+        wb->serving--;
+
+        if (wb->serving == 0) {
+                wb_release(smb2, wb);
+        }
+}
+
+void
+smb2_wb_destroy_all(struct smb2_context *smb2)
+{
+        struct smb2_write_behind *wb;
+
+        while ((wb = smb2->write_behinds) != NULL) {
+                wb->fh->wb = NULL;
+                smb2_wb_free(smb2, wb);
+        }
+}
+
+int
+smb2_set_write_behind(struct smb2_context *smb2, struct smb2fh *fh,
+                      uint32_t max_bytes, uint32_t max_delay_ms)
+{
+        struct smb2_write_behind *wb;
+        uint32_t chunk_size;
+        int err;
+
+        if (smb2 == NULL) {
+                return -EINVAL;
+        }
+        if (fh == NULL) {
+                smb2_set_error(smb2, "File handle was NULL");
+                return -EINVAL;
+        }
+        if (fh->wb) {
+                wb = fh->wb;
+                if (wb->extents || wb->writers || wb->flushers) {
+                        smb2_set_error(smb2, "Writes are still buffered, "
+                                       "call smb2_fsync() first");
+                        return -EBUSY;
+                }
+                err = wb->error;
+                fh->wb = NULL;
+                smb2_wb_free(smb2, wb);
+                if (err) {
+                        smb2_set_error(smb2, "An earlier write to the file "
+                                       "failed");
+                        return err;
+                }
+        }
+        if (max_bytes == 0) {
+                return 0;
+        }
+
+        chunk_size = smb2->max_write_size ? smb2->max_write_size : 65536;
+        if (chunk_size > WB_MAX_CHUNK) {
+                chunk_size = WB_MAX_CHUNK;
+        }
+        if (chunk_size > max_bytes / 2) {
+                chunk_size = max_bytes / 2;
+        }
+        if (chunk_size < WB_MIN_CHUNK) {
+                chunk_size = WB_MIN_CHUNK;
+        }
+
+        wb = smb2_calloc(smb2, 1, sizeof(struct smb2_write_behind));
+        if (wb == NULL) {
+                smb2_set_error(smb2, "Failed to allocate write-behind");
+                return -ENOMEM;
+        }
+        wb->fh = fh;
+        wb->chunk_size = chunk_size;
+        wb->num_chunks = max_bytes / chunk_size;
+        if (wb->num_chunks < 2) {
+                wb->num_chunks = 2;
+        }
+        wb->max_delay = (uint64_t)max_delay_ms * 1000;
+
+        SMB2_LIST_ADD(&smb2->write_behinds, wb);
+        fh->wb = wb;
+        return 0;
+}
@@ -0,0 +1,73 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef _WRITE_BEHIND_H_
+#define _WRITE_BEHIND_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Buffering of writes for a file handle, see smb2_set_write_behind().
+ *
+ * The hooks below return 0 if they took care of the request, in which
+ * case the callback may be invoked before they return, 1 if the request
+ * should be sent as usual, or -errno.
+ */
+
+/* Called by smb2_pwrite_async() */
+int smb2_wb_pwrite(struct smb2_context *smb2, struct smb2fh *fh,
+                   const uint8_t *buf, uint32_t count, uint64_t offset,
+                   smb2_command_cb cb, void *cb_data);
+
+/* Called by smb2_pread_async(), waits for buffered writes it overlaps */
+int smb2_wb_pread(struct smb2_context *smb2, struct smb2fh *fh,
+                  uint8_t *buf, uint32_t count, uint64_t offset,
+                  smb2_command_cb cb, void *cb_data);
+
+/* Called by smb2_fsync_async(), waits for all buffered writes */
+int smb2_wb_fsync(struct smb2_context *smb2, struct smb2fh *fh,
+                  smb2_command_cb cb, void *cb_data);
+
+/* Called by smb2_ftruncate_async(), waits for all buffered writes */
+int smb2_wb_ftruncate(struct smb2_context *smb2, struct smb2fh *fh,
+                      uint64_t length, smb2_command_cb cb, void *cb_data);
+
+/* Called by smb2_close_async(), waits for all buffered writes */
+int smb2_wb_close(struct smb2_context *smb2, struct smb2fh *fh,
+                  smb2_command_cb cb, void *cb_data);
+
+/* Called when the handle is freed */
+void smb2_wb_free(struct smb2_context *smb2, struct smb2_write_behind *wb);
+
+/* Sends the buffered writes of the handles that a break is for */
+void smb2_wb_break(struct smb2_context *smb2,
+                   struct smb2_oplock_or_lease_break_reply *rep);
+
+/* Sends the buffered writes that are older than their handle allows */
+void smb2_wb_expire(struct smb2_context *smb2);
+
+/* Frees the write-behind of all handles, once all PDUs are gone */
+void smb2_wb_destroy_all(struct smb2_context *smb2);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _WRITE_BEHIND_H_ */
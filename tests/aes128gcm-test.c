@@ -0,0 +1,431 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * AES-128-GCM and AES-256-GCM test vectors from the original GCM
+ * specification (McGrew and Viega, test cases 2 to 4 and 14 to 16),
+ * followed by a round trip of all lengths up to a few blocks so that the
+ * partial block and the 4 block paths are both covered.
+ * Finally AES-GCM and AES-GMAC fed in pieces of different sizes are
+ * checked against the one shot functions.
+ * AES-256-CCM is checked against vectors generated with OpenSSL, with
+ * the 11 byte nonce and 16 byte tag that SMB3 uses as well as shorter
+ * ones, and with the same round trip.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "aes.h"
+#include "aes128ccm.h"
+#include "aes128gcm.h"
+
+struct gcm_vector {
+        const char *key;
+        const char *iv;
+        const char *aad;
+        const char *p;
+        const char *c;
+        const char *tag;
+};
+
+static struct gcm_vector vectors[] = {
+        {
+                "00000000000000000000000000000000",
+                "000000000000000000000000",
+                "",
+                "00000000000000000000000000000000",
+                "0388dace60b6a392f328c2b971b2fe78",
+                "ab6e47d42cec13bdf53a67b21257bddf"
+        },
+        {
+                "feffe9928665731c6d6a8f9467308308",
+                "cafebabefacedbaddecaf888",
+                "",
+                "d9313225f88406e5a55909c5aff5269a"
+                "86a7a9531534f7da2e4c303d8a318a72"
+                "1c3c0c95956809532fcf0e2449a6b525"
+                "b16aedf5aa0de657ba637b391aafd255",
+                "42831ec2217774244b7221b784d0d49c"
+                "e3aa212f2c02a4e035c17e2329aca12e"
+                "21d514b25466931c7d8f6a5aac84aa05"
+                "1ba30b396a0aac973d58e091473f5985",
+                "4d5c2af327cd64a62cf35abd2ba6fab4"
+        },
+        {
+                "feffe9928665731c6d6a8f9467308308",
+                "cafebabefacedbaddecaf888",
+                "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+                "d9313225f88406e5a55909c5aff5269a"
+                "86a7a9531534f7da2e4c303d8a318a72"
+                "1c3c0c95956809532fcf0e2449a6b525"
+                "b16aedf5aa0de657ba637b39",
+                "42831ec2217774244b7221b784d0d49c"
+                "e3aa212f2c02a4e035c17e2329aca12e"
+                "21d514b25466931c7d8f6a5aac84aa05"
+                "1ba30b396a0aac973d58e091",
+                "5bc94fbc3221a5db94fae95ae7121a47"
+        },
+        {
+                "00000000000000000000000000000000"
+                "00000000000000000000000000000000",
+                "000000000000000000000000",
+                "",
+                "00000000000000000000000000000000",
+                "cea7403d4d606b6e074ec5d3baf39d18",
+                "d0d1c8a799996bf0265b98b5d48ab919"
+        },
+        {
+                "feffe9928665731c6d6a8f9467308308"
+                "feffe9928665731c6d6a8f9467308308",
+                "cafebabefacedbaddecaf888",
+                "",
+                "d9313225f88406e5a55909c5aff5269a"
+                "86a7a9531534f7da2e4c303d8a318a72"
+                "1c3c0c95956809532fcf0e2449a6b525"
+                "b16aedf5aa0de657ba637b391aafd255",
+                "522dc1f099567d07f47f37a32a84427d"
+                "643a8cdcbfe5c0c97598a2bd2555d1aa"
+                "8cb08e48590dbb3da7b08b1056828838"
+                "c5f61e6393ba7a0abcc9f662898015ad",
+                "b094dac5d93471bdec1a502270e3cc6c"
+        },
+        {
+                "feffe9928665731c6d6a8f9467308308"
+                "feffe9928665731c6d6a8f9467308308",
+                "cafebabefacedbaddecaf888",
+                "feedfacedeadbeeffeedfacedeadbeefabaddad2",
+                "d9313225f88406e5a55909c5aff5269a"
+                "86a7a9531534f7da2e4c303d8a318a72"
+                "1c3c0c95956809532fcf0e2449a6b525"
+                "b16aedf5aa0de657ba637b39",
+                "522dc1f099567d07f47f37a32a84427d"
+                "643a8cdcbfe5c0c97598a2bd2555d1aa"
+                "8cb08e48590dbb3da7b08b1056828838"
+                "c5f61e6393ba7a0abcc9f662",
+                "76fc6ece0f4e1768cddf8853bb2d551b"
+        },
+};
+
+/* iv is the nonce, which is 7 to 13 bytes for CCM */
+static struct gcm_vector ccm256_vectors[] = {
+        {
+                "404142434445464748494a4b4c4d4e4f"
+                "505152535455565758595a5b5c5d5e5f",
+                "10111213141516",
+                "0001020304050607",
+                "20212223",
+                "8ab1a874",
+                "95fc0820"
+        },
+        {
+                "404142434445464748494a4b4c4d4e4f"
+                "505152535455565758595a5b5c5d5e5f",
+                "101112131415161718191a",
+                "000102030405060708090a0b0c0d0e0f"
+                "101112131415161718191a1b1c1d1e1f",
+                "202122232425262728292a2b2c2d2e2f"
+                "303132333435363738393a3b3c3d3e3f"
+                "4041424344",
+                "05be4fa985289932bcf824709a4950dd"
+                "790fa62950bfbf50a8e8e4f98b598e51"
+                "dc5ffee1d2",
+                "235b06d882a1ce259277c6d93f227fa6"
+        },
+        {
+                "000d1a2734414e5b6875828f9ca9b6c3"
+                "d0ddeaf704111e2b3845525f6c798693",
+                "00070e151c232a31383f46",
+                "000102030405060708090a0b0c0d0e0f"
+                "10111213",
+                "",
+                "",
+                "1ad6480f98faa0c600ce2e80561b820f"
+        },
+        {
+                "000d1a2734414e5b6875828f9ca9b6c3"
+                "d0ddeaf704111e2b3845525f6c798693",
+                "00070e151c232a31383f46",
+                "",
+                "202122232425262728292a2b2c2d2e2f"
+                "303132333435363738393a3b3c3d3e3f"
+                "404142434445464748494a4b4c4d4e4f"
+                "505152535455565758595a5b5c5d5e5f",
+                "29a1258bd279ac6e4f6cad12c63e2ecd"
+                "9c9314bd3058dbbdffe6b6a25e7804c9"
+                "0b41b82af8b67eda936062b028a78e41"
+                "64610697c7da008782931a6bbf9485ef",
+                "3e5f0b62ce3488df59f2fc3526002756"
+        },
+};
+
+typedef void (*gcm_encrypt_fn)(unsigned char *key,
+                               unsigned char *nonce, size_t nlen,
+                               unsigned char *aad, size_t alen,
+                               unsigned char *p, size_t plen,
+                               unsigned char *m, size_t mlen);
+typedef int (*gcm_decrypt_fn)(unsigned char *key,
+                              unsigned char *nonce, size_t nlen,
+                              unsigned char *aad, size_t alen,
+                              unsigned char *p, size_t plen,
+                              unsigned char *m, size_t mlen);
+
+static size_t from_hex(const char *s, unsigned char *buf)
+{
+        size_t len = 0;
+        unsigned int b;
+
+        while (*s) {
+                if (sscanf(s, "%2x", &b) != 1) {
+                        break;
+                }
+                buf[len++] = (unsigned char)b;
+                s += 2;
+        }
+        return len;
+}
+
+static int test_vector(int i, struct gcm_vector *v)
+{
+        unsigned char key[32], iv[12], aad[64], p[64], c[64], tag[16];
+        unsigned char buf[64], m[16];
+        size_t klen, alen, plen;
+        gcm_encrypt_fn encrypt;
+        gcm_decrypt_fn decrypt;
+
+        klen = from_hex(v->key, key);
+        encrypt = klen == 32 ? aes256gcm_encrypt : aes128gcm_encrypt;
+        decrypt = klen == 32 ? aes256gcm_decrypt : aes128gcm_decrypt;
+        from_hex(v->iv, iv);
+        alen = from_hex(v->aad, aad);
+        plen = from_hex(v->p, p);
+        from_hex(v->c, c);
+        from_hex(v->tag, tag);
+
+        memcpy(buf, p, plen);
+        encrypt(key, iv, 12, aad, alen, buf, plen, m, 16);
+        if (memcmp(buf, c, plen)) {
+                printf("Vector %d: wrong ciphertext\n", i);
+                return -1;
+        }
+        if (memcmp(m, tag, 16)) {
+                printf("Vector %d: wrong tag\n", i);
+                return -1;
+        }
+        if (decrypt(key, iv, 12, aad, alen, buf, plen, m, 16)) {
+                printf("Vector %d: decrypt failed\n", i);
+                return -1;
+        }
+        if (memcmp(buf, p, plen)) {
+                printf("Vector %d: wrong plaintext\n", i);
+                return -1;
+        }
+        return 0;
+}
+
+static int test_ccm256_vector(int i, struct gcm_vector *v)
+{
+        unsigned char key[32], nonce[13], aad[64], p[64], c[64], tag[16];
+        unsigned char buf[64], m[16];
+        size_t nlen, alen, plen, mlen;
+
+        from_hex(v->key, key);
+        nlen = from_hex(v->iv, nonce);
+        alen = from_hex(v->aad, aad);
+        plen = from_hex(v->p, p);
+        from_hex(v->c, c);
+        mlen = from_hex(v->tag, tag);
+
+        memcpy(buf, p, plen);
+        aes256ccm_encrypt(key, nonce, nlen, aad, alen, buf, plen, m, mlen);
+        if (memcmp(buf, c, plen)) {
+                printf("CCM vector %d: wrong ciphertext\n", i);
+                return -1;
+        }
+        if (memcmp(m, tag, mlen)) {
+                printf("CCM vector %d: wrong tag\n", i);
+                return -1;
+        }
+        if (aes256ccm_decrypt(key, nonce, nlen, aad, alen, buf, plen,
+                              m, mlen)) {
+                printf("CCM vector %d: decrypt failed\n", i);
+                return -1;
+        }
+        if (memcmp(buf, p, plen)) {
+                printf("CCM vector %d: wrong plaintext\n", i);
+                return -1;
+        }
+        return 0;
+}
+
+static int test_round_trip(gcm_encrypt_fn encrypt, gcm_decrypt_fn decrypt)
+{
+        unsigned char key[32], iv[12], aad[32], p[200], buf[200], m[16];
+        size_t i, len;
+
+        for (i = 0; i < sizeof(key); i++) {
+                key[i] = (unsigned char)(i * 13);
+        }
+        for (i = 0; i < sizeof(iv); i++) {
+                iv[i] = (unsigned char)(i * 7);
+        }
+        for (i = 0; i < sizeof(aad); i++) {
+                aad[i] = (unsigned char)i;
+        }
+        for (i = 0; i < sizeof(p); i++) {
+                p[i] = (unsigned char)(i * 31);
+        }
+
+        for (len = 0; len <= sizeof(p); len++) {
+                memcpy(buf, p, len);
+                encrypt(key, iv, 12, aad, sizeof(aad), buf, len, m, 16);
+                if (decrypt(key, iv, 12, aad, sizeof(aad), buf, len, m, 16) ||
+                    memcmp(buf, p, len)) {
+                        printf("Round trip of %d bytes failed\n", (int)len);
+                        return -1;
+                }
+
+                /* a modified ciphertext must be rejected */
+                encrypt(key, iv, 12, aad, sizeof(aad), buf, len, m, 16);
+                if (len) {
+                        buf[len / 2] ^= 0x01;
+                } else {
+                        m[0] ^= 0x01;
+                }
+                if (!decrypt(key, iv, 12, aad, sizeof(aad), buf, len, m, 16)) {
+                        printf("Modified %d bytes were accepted\n", (int)len);
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+static int test_gmac(void)
+{
+        unsigned char key[16], iv[12], aad[200], dummy[16];
+        unsigned char m[16], tag[16];
+        struct aes_gmac_ctx ctx;
+        struct aes_key ks;
+        size_t i, len, chunk, pos, l;
+
+        for (i = 0; i < sizeof(key); i++) {
+                key[i] = (unsigned char)(i * 11);
+        }
+        for (i = 0; i < sizeof(iv); i++) {
+                iv[i] = (unsigned char)(i * 5);
+        }
+        for (i = 0; i < sizeof(aad); i++) {
+                aad[i] = (unsigned char)(i * 17);
+        }
+        AES_init_key(&ks, key, 16);
+
+        for (len = 0; len <= sizeof(aad); len++) {
+                aes128gcm_encrypt(key, iv, 12, aad, len, dummy, 0, m, 16);
+                for (chunk = 1; chunk <= 70; chunk++) {
+                        aes_gmac_init(&ctx, &ks, iv);
+                        for (pos = 0; pos < len; pos += l) {
+                                l = len - pos < chunk ? len - pos : chunk;
+                                aes_gmac_update(&ctx, &aad[pos], l);
+                        }
+                        aes_gmac_final(&ctx, tag);
+                        if (memcmp(m, tag, 16)) {
+                                printf("GMAC of %d bytes in %d byte pieces "
+                                       "failed\n", (int)len, (int)chunk);
+                                return -1;
+                        }
+                }
+        }
+        return 0;
+}
+
+/* Encrypt from one buffer into another, a few bytes at a time. */
+static int test_streaming(void)
+{
+        unsigned char key[16], iv[12], aad[32], p[200], c[200], buf[200];
+        unsigned char m[16], tag[16];
+        struct aes_gcm_ctx ctx;
+        struct aes_key ks;
+        size_t i, chunk, pos, l;
+
+        for (i = 0; i < sizeof(key); i++) {
+                key[i] = (unsigned char)(i * 3);
+        }
+        for (i = 0; i < sizeof(iv); i++) {
+                iv[i] = (unsigned char)(i * 9);
+        }
+        for (i = 0; i < sizeof(aad); i++) {
+                aad[i] = (unsigned char)(i * 21);
+        }
+        for (i = 0; i < sizeof(p); i++) {
+                p[i] = (unsigned char)(i * 29);
+        }
+        AES_init_key(&ks, key, 16);
+        memcpy(buf, p, sizeof(p));
+        aes128gcm_encrypt(key, iv, 12, aad, sizeof(aad), buf, sizeof(buf),
+                          m, 16);
+
+        for (chunk = 1; chunk <= 70; chunk++) {
+                aes_gcm_init(&ctx, &ks, iv, aad, sizeof(aad), 1);
+                for (pos = 0; pos < sizeof(p); pos += l) {
+                        l = sizeof(p) - pos < chunk ? sizeof(p) - pos : chunk;
+                        aes_gcm_update(&ctx, &p[pos], &c[pos], l);
+                }
+                aes_gcm_final(&ctx, tag);
+                if (memcmp(c, buf, sizeof(c)) || memcmp(m, tag, 16)) {
+                        printf("GCM in %d byte pieces failed\n", (int)chunk);
+                        return -1;
+                }
+        }
+        return 0;
+}
+
+int main(int argc, char *argv[])
+{
+        int i;
+
+        for (i = 0; i < (int)(sizeof(vectors) / sizeof(vectors[0])); i++) {
+                if (test_vector(i, &vectors[i])) {
+                        exit(10);
+                }
+        }
+        for (i = 0; i < (int)(sizeof(ccm256_vectors) /
+                              sizeof(ccm256_vectors[0])); i++) {
+                if (test_ccm256_vector(i, &ccm256_vectors[i])) {
+                        exit(10);
+                }
+        }
+        if (test_round_trip(aes128gcm_encrypt, aes128gcm_decrypt)) {
+                exit(10);
+        }
+        if (test_round_trip(aes256gcm_encrypt, aes256gcm_decrypt)) {
+                exit(10);
+        }
+        if (test_round_trip(aes256ccm_encrypt, aes256ccm_decrypt)) {
+                exit(10);
+        }
+        if (test_streaming()) {
+                exit(10);
+        }
+        if (test_gmac()) {
+                exit(10);
+        }
+        printf("All AES-GCM and AES-256-CCM tests passed\n");
+        return 0;
+}
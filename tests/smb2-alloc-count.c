@@ -0,0 +1,218 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Counts the allocations libsmb2 makes for each operation by installing
+ * a counting allocator, both globally and on the context.
+ * Without a URL only local operations are done, with a URL the file is
+ * also opened, read, stat'ed and closed on the server.
+ * Fails if any memory is left allocated once the context is destroyed.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "smb2.h"
+#include "libsmb2.h"
+#include "libsmb2-raw.h"
+
+struct counting_allocator {
+        uint64_t allocs;
+        uint64_t frees;
+};
+
+static struct counting_allocator global_count = { 0, 0 };
+static struct counting_allocator context_count = { 0, 0 };
+
+static void *count_malloc(size_t size, void *opaque)
+{
+        struct counting_allocator *c = opaque;
+
+        c->allocs++;
+        return malloc(size);
+}
+
+static void *count_calloc(size_t nmemb, size_t size, void *opaque)
+{
+        struct counting_allocator *c = opaque;
+
+        c->allocs++;
+        return calloc(nmemb, size);
+}
+
+static void count_free(void *ptr, void *opaque)
+{
+        struct counting_allocator *c = opaque;
+
+        c->frees++;
+        free(ptr);
+}
+
+static struct smb2_allocator global_allocator = {
+        count_malloc, count_calloc, count_free, &global_count
+};
+
+static struct smb2_allocator context_allocator = {
+        count_malloc, count_calloc, count_free, &context_count
+};
+
+static uint64_t last_global, last_context;
+
+static void report(const char *op)
+{
+        printf("%-24s %6" PRIu64 " global %6" PRIu64 " context allocations\n",
+               op, global_count.allocs - last_global,
+               context_count.allocs - last_context);
+        last_global = global_count.allocs;
+        last_context = context_count.allocs;
+}
+
+static void echo_cb(struct smb2_context *smb2, int status,
+                    void *command_data, void *private_data)
+{
+}
+
+int usage(void)
+{
+        fprintf(stderr, "Usage:\n"
+                "smb2-alloc-count [<smb2-url>]\n\n"
+                "URL format: "
+                "smb://[<domain;][<username>@]<host>[:<port>]/<share>/<path>\n");
+        exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+        struct smb2_context *smb2;
+        struct smb2_url *url = NULL;
+        struct smb2_close_request req;
+        struct smb2_pdu *pdu;
+        struct smb2_stat_64 st;
+        struct smb2fh *fh;
+        uint8_t buf[4096];
+        int ret = 0;
+
+        if (argc > 2) {
+                usage();
+        }
+
+        if (smb2_set_allocator(NULL, &global_allocator) < 0) {
+                fprintf(stderr, "Failed to set the global allocator\n");
+                exit(10);
+        }
+
+        smb2 = smb2_init_context();
+        if (smb2 == NULL) {
+                fprintf(stderr, "Failed to init context\n");
+                exit(10);
+        }
+        report("init_context");
+
+        if (smb2_set_allocator(smb2, &context_allocator) < 0) {
+                fprintf(stderr, "Failed to set the context allocator. %s\n",
+                        smb2_get_error(smb2));
+                exit(10);
+        }
+        report("set_allocator");
+
+        smb2_set_password(smb2, "password");
+        report("set_password");
+
+        pdu = smb2_cmd_echo_async(smb2, echo_cb, NULL);
+        if (pdu == NULL) {
+                fprintf(stderr, "Failed to create echo pdu\n");
+                exit(10);
+        }
+        smb2_free_pdu(smb2, pdu);
+        report("echo pdu");
+
+        memset(&req, 0, sizeof(req));
+        pdu = smb2_cmd_close_async(smb2, &req, echo_cb, NULL);
+        if (pdu == NULL) {
+                fprintf(stderr, "Failed to create close pdu\n");
+                exit(10);
+        }
+        smb2_free_pdu(smb2, pdu);
+        report("close pdu (cached)");
+
+        if (argc == 2) {
+                url = smb2_parse_url(smb2, argv[1]);
+                if (url == NULL) {
+                        fprintf(stderr, "Failed to parse url: %s\n",
+                                smb2_get_error(smb2));
+                        exit(10);
+                }
+                report("parse_url");
+
+                smb2_set_security_mode(smb2, SMB2_NEGOTIATE_SIGNING_ENABLED);
+                if (smb2_connect_share(smb2, url->server, url->share,
+                                       url->user) < 0) {
+                        printf("smb2_connect_share failed. %s\n",
+                               smb2_get_error(smb2));
+                        exit(10);
+                }
+                report("connect_share");
+
+                fh = smb2_open(smb2, url->path, O_RDONLY);
+                if (fh == NULL) {
+                        printf("smb2_open failed. %s\n", smb2_get_error(smb2));
+                        exit(10);
+                }
+                report("open");
+
+                if (smb2_pread(smb2, fh, buf, sizeof(buf), 0) < 0) {
+                        printf("smb2_pread failed. %s\n", smb2_get_error(smb2));
+                        exit(10);
+                }
+                report("pread");
+
+                if (smb2_fstat(smb2, fh, &st) < 0) {
+                        printf("smb2_fstat failed. %s\n", smb2_get_error(smb2));
+                        exit(10);
+                }
+                report("fstat");
+
+                smb2_close(smb2, fh);
+                report("close");
+
+                smb2_disconnect_share(smb2);
+                report("disconnect_share");
+
+                smb2_destroy_url(url);
+                report("destroy_url");
+        }
+
+        smb2_destroy_context(smb2);
+        report("destroy_context");
+
+        if (global_count.allocs != global_count.frees) {
+                fprintf(stderr, "%" PRIu64 " global allocations leaked\n",
+                        global_count.allocs - global_count.frees);
+                ret = 1;
+        }
+        if (context_count.allocs != context_count.frees) {
+                fprintf(stderr, "%" PRIu64 " context allocations leaked\n",
+                        context_count.allocs - context_count.frees);
+                ret = 1;
+        }
+
+        return ret;
+}
@@ -0,0 +1,434 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+   This program is free software; you can redistribute it and/or modify
+   it under the terms of the GNU Lesser General Public License as published by
+   the Free Software Foundation; either version 2.1 of the License, or
+   (at your option) any later version.
+
+   This program is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public License
+   along with this program; if not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Micro-benchmark for the crypto that libsmb2 does: sealing with
+ * AES-CCM and AES-GCM, signing with AES-CMAC, AES-GMAC and HMAC-SHA256,
+ * the SHA-512 preauth hash and the MD4 and HMAC-MD5 hashes of NTLM.
+ * Every operation is timed for message sizes from 64 bytes to 8 MB, once
+ * for each crypto provider, so that the built in code can be compared
+ * with the OpenSSL one. The aes-ecb rows compare the reference AES with
+ * the one that uses the AES instructions of the cpu.
+ *
+ * The results are printed as CSV or JSON, one row per operation and
+ * size. cycles_per_byte is counted with the time stamp counter and is
+ * only reported on x86.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <x86intrin.h>
+#define HAVE_RDTSC 1
+#endif
+
+#include "smb2.h"
+#include "libsmb2.h"
+#include "crypto.h"
+#include "aes_reference.h"
+
+#define MIN_SIZE 64
+#define MAX_SIZE (8 * 1024 * 1024)
+#define DEFAULT_MIN_MS 100
+
+struct bench {
+        const struct smb2_crypto_provider *p;
+        struct smb2_key ks128;
+        struct smb2_key ks256;
+        uint8_t *in;
+        uint8_t *ct;
+        uint8_t *out;
+        size_t len;
+        uint8_t tag[16];
+        uint8_t digest[64];
+};
+
+struct bench_case {
+        const char *name;
+        /* optional, run once per size before the timing */
+        void (*setup)(struct bench *b);
+        void (*run)(struct bench *b);
+        /* only timed for the built in provider */
+        int builtin_only;
+};
+
+static const uint8_t key[32] = {
+        0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+        0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f,
+        0x10, 0x11, 0x12, 0x13, 0x14, 0x15, 0x16, 0x17,
+        0x18, 0x19, 0x1a, 0x1b, 0x1c, 0x1d, 0x1e, 0x1f
+};
+
+static const uint8_t nonce[12] = {
+        0xca, 0xfe, 0xba, 0xbe, 0xfa, 0xce, 0xdb, 0xad,
+        0xde, 0xca, 0xf8, 0x88
+};
+
+/* the transform header that is authenticated when sealing */
+static const uint8_t aad[32];
+
+int usage(void)
+{
+        fprintf(stderr, "Usage:\n"
+                "smb2-crypto-bench [-f csv|json] [-p builtin|openssl] "
+                "[-m <ms>] [-s <max-size>]\n\n"
+                "  -f  output format, csv by default\n"
+                "  -p  only time this crypto provider, by default all "
+                "that are built\n"
+                "  -m  time each operation and size for at least this "
+                "many milliseconds,\n"
+                "      %d by default\n"
+                "  -s  largest message size, %d by default\n\n",
+                DEFAULT_MIN_MS, MAX_SIZE);
+        exit(1);
+}
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint64_t cycles(void)
+{
+#ifdef HAVE_RDTSC
+        return __rdtsc();
+#else
+        return 0;
+#endif
+}
+
+static void aead_run(struct bench *b, uint16_t cipher,
+                     const struct smb2_key *ks, int encrypt)
+{
+        struct smb2_aead_ctx ctx;
+
+        smb2_aead_init(&ctx, b->p, cipher, ks, nonce, aad, sizeof(aad),
+                       b->len, encrypt);
+        if (encrypt) {
+                smb2_aead_update(&ctx, b->in, b->ct, b->len);
+                smb2_aead_final(&ctx, b->tag);
+                return;
+        }
+        smb2_aead_update(&ctx, b->ct, b->out, b->len);
+        if (smb2_aead_final(&ctx, b->tag) < 0) {
+                fprintf(stderr, "Tag mismatch for %d byte messages\n",
+                        (int)b->len);
+                exit(10);
+        }
+}
+
+static void ccm128_encrypt(struct bench *b)
+{
+        aead_run(b, SMB2_ENCRYPTION_AES_128_CCM, &b->ks128, 1);
+}
+
+static void ccm128_decrypt(struct bench *b)
+{
+        aead_run(b, SMB2_ENCRYPTION_AES_128_CCM, &b->ks128, 0);
+}
+
+static void gcm128_encrypt(struct bench *b)
+{
+        aead_run(b, SMB2_ENCRYPTION_AES_128_GCM, &b->ks128, 1);
+}
+
+static void gcm128_decrypt(struct bench *b)
+{
+        aead_run(b, SMB2_ENCRYPTION_AES_128_GCM, &b->ks128, 0);
+}
+
+static void ccm256_encrypt(struct bench *b)
+{
+        aead_run(b, SMB2_ENCRYPTION_AES_256_CCM, &b->ks256, 1);
+}
+
+static void ccm256_decrypt(struct bench *b)
+{
+        aead_run(b, SMB2_ENCRYPTION_AES_256_CCM, &b->ks256, 0);
+}
+
+static void gcm256_encrypt(struct bench *b)
+{
+        aead_run(b, SMB2_ENCRYPTION_AES_256_GCM, &b->ks256, 1);
+}
+
+static void gcm256_decrypt(struct bench *b)
+{
+        aead_run(b, SMB2_ENCRYPTION_AES_256_GCM, &b->ks256, 0);
+}
+
+static void aes_cmac(struct bench *b)
+{
+        struct smb2_hash_ctx ctx;
+
+        smb2_aes_mac_init(&ctx, b->p, SMB2_CRYPTO_AES_CMAC, &b->ks128, NULL);
+        smb2_hash_update(&ctx, b->in, b->len);
+        smb2_hash_final(&ctx, b->digest);
+}
+
+static void aes_gmac(struct bench *b)
+{
+        struct smb2_hash_ctx ctx;
+
+        smb2_aes_mac_init(&ctx, b->p, SMB2_CRYPTO_AES_GMAC, &b->ks128,
+                          nonce);
+        smb2_hash_update(&ctx, b->in, b->len);
+        smb2_hash_final(&ctx, b->digest);
+}
+
+static void hmac_sha256(struct bench *b)
+{
+        struct smb2_hash_ctx ctx;
+
+        smb2_hash_init(&ctx, b->p, SMB2_CRYPTO_HMAC_SHA256, key, 16);
+        smb2_hash_update(&ctx, b->in, b->len);
+        smb2_hash_final(&ctx, b->digest);
+}
+
+static void sha512(struct bench *b)
+{
+        struct smb2_hash_ctx ctx;
+
+        smb2_hash_init(&ctx, b->p, SMB2_CRYPTO_SHA512, NULL, 0);
+        smb2_hash_update(&ctx, b->in, b->len);
+        smb2_hash_final(&ctx, b->digest);
+}
+
+static void md4(struct bench *b)
+{
+        smb2_md4(b->p, b->in, b->len, b->digest);
+}
+
+static void hmac_md5(struct bench *b)
+{
+        smb2_hmac_md5_digest(b->p, b->in, b->len, key, 16, b->digest);
+}
+
+static void aes_ecb(struct bench *b)
+{
+        AES_ECB_encrypt_blocks(&b->ks128.ks, b->in, b->out, b->len / 16);
+}
+
+static void aes_ecb_reference(struct bench *b)
+{
+        AES_ECB_encrypt_blocks_reference(b->ks128.ks.round_keys,
+                                         b->ks128.ks.rounds, b->in, b->out,
+                                         b->len / 16);
+}
+
+static struct bench_case cases[] = {
+        { "aes-128-ccm-encrypt", NULL, ccm128_encrypt, 0 },
+        { "aes-128-ccm-decrypt", ccm128_encrypt, ccm128_decrypt, 0 },
+        { "aes-128-gcm-encrypt", NULL, gcm128_encrypt, 0 },
+        { "aes-128-gcm-decrypt", gcm128_encrypt, gcm128_decrypt, 0 },
+        { "aes-256-ccm-encrypt", NULL, ccm256_encrypt, 0 },
+        { "aes-256-ccm-decrypt", ccm256_encrypt, ccm256_decrypt, 0 },
+        { "aes-256-gcm-encrypt", NULL, gcm256_encrypt, 0 },
+        { "aes-256-gcm-decrypt", gcm256_encrypt, gcm256_decrypt, 0 },
+        { "aes-128-cmac", NULL, aes_cmac, 0 },
+        { "aes-128-gmac", NULL, aes_gmac, 0 },
+        { "hmac-sha256", NULL, hmac_sha256, 0 },
+        { "sha512", NULL, sha512, 0 },
+        { "md4", NULL, md4, 0 },
+        { "hmac-md5", NULL, hmac_md5, 0 },
+        { "aes-128-ecb", NULL, aes_ecb, 1 },
+        { "aes-128-ecb-reference", NULL, aes_ecb_reference, 1 },
+        { NULL, NULL, NULL, 0 }
+};
+
+static int json;
+static int rows;
+
+static void report(const char *provider, const char *name, size_t len,
+                   long iterations, double secs, uint64_t ncycles)
+{
+        double bytes = (double)len * iterations;
+        double mbps = bytes / secs / 1e6;
+        char cpb[32];
+
+        if (ncycles) {
+                snprintf(cpb, sizeof(cpb), "%.2f", ncycles / bytes);
+        } else {
+                strcpy(cpb, json ? "null" : "");
+        }
+
+        if (json) {
+                printf("%s\n  {\"provider\": \"%s\", \"operation\": \"%s\", "
+                       "\"size\": %d, \"iterations\": %ld, "
+                       "\"seconds\": %.6f, \"mb_per_s\": %.2f, "
+                       "\"cycles_per_byte\": %s}",
+                       rows ? "," : "[", provider, name, (int)len,
+                       iterations, secs, mbps, cpb);
+        } else {
+                if (rows == 0) {
+                        printf("provider,operation,size,iterations,"
+                               "seconds,mb_per_s,cycles_per_byte\n");
+                }
+                printf("%s,%s,%d,%ld,%.6f,%.2f,%s\n", provider, name,
+                       (int)len, iterations, secs, mbps, cpb);
+        }
+        rows++;
+}
+
+static void run_case(struct bench *b, const char *provider,
+                     struct bench_case *bc, double min_secs)
+{
+        long iterations = 0;
+        uint64_t c0, c1;
+        double t0, t1;
+
+        if (bc->setup) {
+                bc->setup(b);
+        }
+        /* warm up the caches and the provider */
+        bc->run(b);
+
+        c0 = cycles();
+        t0 = now();
+        do {
+                bc->run(b);
+                iterations++;
+                t1 = now();
+        } while (t1 - t0 < min_secs);
+        c1 = cycles();
+
+        report(provider, bc->name, b->len, iterations, t1 - t0, c1 - c0);
+}
+
+int main(int argc, char *argv[])
+{
+        const struct smb2_crypto_provider *providers[2];
+        const char *names[2];
+        struct bench b;
+        struct bench_case *bc;
+        size_t max_size = MAX_SIZE;
+        int c, i, num_providers, min_ms = DEFAULT_MIN_MS;
+        const char *only = NULL;
+
+        while ((c = getopt(argc, argv, "f:p:m:s:")) != -1) {
+                switch (c) {
+                case 'f':
+                        if (!strcmp(optarg, "json")) {
+                                json = 1;
+                        } else if (strcmp(optarg, "csv")) {
+                                usage();
+                        }
+                        break;
+                case 'p':
+                        if (strcmp(optarg, "builtin") &&
+                            strcmp(optarg, "openssl")) {
+                                usage();
+                        }
+                        only = optarg;
+                        break;
+                case 'm':
+                        min_ms = atoi(optarg);
+                        if (min_ms < 0) {
+                                usage();
+                        }
+                        break;
+                case 's':
+                        max_size = strtoul(optarg, NULL, 0);
+                        if (max_size < MIN_SIZE || max_size > MAX_SIZE) {
+                                usage();
+                        }
+                        break;
+                default:
+                        usage();
+                }
+        }
+        if (optind != argc) {
+                usage();
+        }
+
+        num_providers = 0;
+        if (only == NULL || !strcmp(only, "builtin")) {
+                names[num_providers] = "builtin";
+                providers[num_providers++] = NULL;
+        }
+        if (only == NULL || !strcmp(only, "openssl")) {
+                if (smb2_openssl_crypto_provider() != NULL) {
+                        names[num_providers] = "openssl";
+                        providers[num_providers++] =
+                                smb2_openssl_crypto_provider();
+                } else if (only) {
+                        fprintf(stderr, "libsmb2 was built without "
+                                "OpenSSL\n");
+                        exit(77);
+                }
+        }
+
+        memset(&b, 0, sizeof(b));
+        b.in = malloc(max_size);
+        b.ct = malloc(max_size);
+        b.out = malloc(max_size);
+        if (b.in == NULL || b.ct == NULL || b.out == NULL) {
+                fprintf(stderr, "Failed to allocate buffers\n");
+                exit(10);
+        }
+        for (i = 0; i < (int)max_size; i++) {
+                b.in[i] = (uint8_t)(i * 7 + (i >> 12));
+        }
+
+        for (i = 0; i < num_providers; i++) {
+                b.p = providers[i];
+                /* set up the keys once, like a session does */
+                smb2_key_init(&b.ks128, b.p, key, 16);
+                smb2_key_init(&b.ks256, b.p, key, 32);
+                for (bc = cases; bc->name; bc++) {
+                        if (bc->builtin_only && b.p) {
+                                continue;
+                        }
+                        for (b.len = MIN_SIZE; b.len <= max_size;
+                             b.len *= 4) {
+                                run_case(&b, names[i], bc, min_ms / 1e3);
+                                if (b.len < max_size &&
+                                    b.len * 4 > max_size) {
+                                        /* always end with the largest */
+                                        b.len = max_size / 4;
+                                }
+                        }
+                }
+                smb2_key_free(&b.ks128);
+                smb2_key_free(&b.ks256);
+        }
+        if (json) {
+                printf("%s]\n", rows ? "\n" : "[");
+        }
+
+        free(b.in);
+        free(b.ct);
+        free(b.out);
+        return 0;
+}
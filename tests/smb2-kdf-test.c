@@ -0,0 +1,182 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Known answer tests for the derivation of the signing and encryption
+ * keys from the session key, for each dialect and cipher key size.
+ * The session key is 32 bytes, like the ones Kerberos hands out. With
+ * 3.1.1 and a 256 bit cipher all keys are derived from all of it,
+ * otherwise from the first 16 bytes only.
+ * The expected keys were computed with an independent SP800-108 counter
+ * mode HMAC-SHA256 implementation. Every case is run with the built in
+ * crypto and, if it is available, the OpenSSL provider.
+ */
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "compat.h"
+
+#include "slist.h"
+#include "smb2.h"
+#include "libsmb2.h"
+#include "libsmb2-private.h"
+
+struct kdf_vector {
+        const char *name;
+        uint16_t dialect;
+        int session_key_size;
+        int cipher_key_size;
+        const char *signing_key;
+        const char *serverin_key;
+        const char *serverout_key;
+};
+
+static struct kdf_vector vectors[] = {
+        {
+                "3.1.1 AES-256, 32 byte session key",
+                SMB2_VERSION_0311, 32, 32,
+                "1d6e64505ab4b5694fd0ba3f0f14fc46",
+                "67d69111791e4fa4a443ad5895109a1a"
+                "e6d8a3264394438db7f7babb75f1be27",
+                "4c650652071020e55a88bd87888b8a99"
+                "831c4fcfc4fec99daea9f6d9a25d518b"
+        },
+        {
+                "3.1.1 AES-256, 16 byte session key",
+                SMB2_VERSION_0311, 16, 32,
+                "6a2f0a555741644961fd9e146e498ede",
+                "22c1aa9bd5286c6a3a1ff63276b69935"
+                "ae89b4c1fb427a4ebb17f03289205e02",
+                "31603eebffb9a12ca68e5267f8f8b5aa"
+                "c33613dff534a94353700bf79d94f67f"
+        },
+        {
+                "3.1.1 AES-128, 32 byte session key",
+                SMB2_VERSION_0311, 32, 16,
+                "6a2f0a555741644961fd9e146e498ede",
+                "b56fdaf1933f68e8bfd7377725dce83a",
+                "3ec53028ddd7ef9ac6955f05c28afe4a"
+        },
+        {
+                "3.0, 32 byte session key",
+                SMB2_VERSION_0300, 32, 16,
+                "6234814cbb8ea9227440ebfeb5eacbe1",
+                "8e21f3cae16d07d84c03d74467f57878",
+                "95d8b55c852cd25349994b3842fa4105"
+        },
+        {
+                "2.1, 32 byte session key",
+                SMB2_VERSION_0210, 32, 16,
+                "000102030405060708090a0b0c0d0e0f",
+                "",
+                ""
+        },
+};
+
+static size_t from_hex(const char *s, uint8_t *buf)
+{
+        size_t len = 0;
+        unsigned int b;
+
+        while (*s) {
+                if (sscanf(s, "%2x", &b) != 1) {
+                        break;
+                }
+                buf[len++] = (uint8_t)b;
+                s += 2;
+        }
+        return len;
+}
+
+static int check_key(struct kdf_vector *v, const char *provider,
+                     const char *name, const uint8_t *key,
+                     const char *expected)
+{
+        uint8_t buf[SMB2_MAX_KEY_SIZE];
+        size_t len;
+
+        len = from_hex(expected, buf);
+        if (memcmp(key, buf, len)) {
+                printf("%s with %s: wrong %s\n", v->name, provider, name);
+                return -1;
+        }
+        return 0;
+}
+
+static int test_vector(struct kdf_vector *v,
+                       const struct smb2_crypto_provider *p,
+                       const char *provider)
+{
+        struct smb2_context *smb2;
+        uint8_t session_key[32];
+        int i, ret = 0;
+
+        smb2 = calloc(1, sizeof(struct smb2_context));
+        if (smb2 == NULL) {
+                printf("Failed to allocate context\n");
+                return -1;
+        }
+        for (i = 0; i < (int)sizeof(session_key); i++) {
+                session_key[i] = (uint8_t)i;
+        }
+        for (i = 0; i < SMB2_PREAUTH_HASH_SIZE; i++) {
+                smb2->preauthhash[i] = (uint8_t)(0x80 + i);
+        }
+        smb2->crypto = p;
+        smb2->dialect = v->dialect;
+        smb2->session_key = session_key;
+        smb2->session_key_size = (uint8_t)v->session_key_size;
+
+        smb2_derive_session_keys(smb2, v->cipher_key_size);
+        if (check_key(v, provider, "signing key", smb2->signing_key,
+                      v->signing_key) ||
+            check_key(v, provider, "server in key", smb2->serverin_key,
+                      v->serverin_key) ||
+            check_key(v, provider, "server out key", smb2->serverout_key,
+                      v->serverout_key)) {
+                ret = -1;
+        }
+
+        free(smb2);
+        return ret;
+}
+
+int main(int argc, char *argv[])
+{
+        const struct smb2_crypto_provider *openssl;
+        int i;
+
+        openssl = smb2_openssl_crypto_provider();
+        for (i = 0; i < (int)(sizeof(vectors) / sizeof(vectors[0])); i++) {
+                if (test_vector(&vectors[i], NULL, "builtin")) {
+                        exit(10);
+                }
+                if (openssl && test_vector(&vectors[i], openssl,
+                                           "openssl")) {
+                        exit(10);
+                }
+        }
+        printf("All key derivation tests passed\n");
+        return 0;
+}
@@ -0,0 +1,688 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Benchmark of the client and server protocol stacks without any
+ * networking. A client context is connected to
+ * smb2_serve_memory_transport() through the in-process memory transport,
+ * both run in this thread.
+ * The client sends a number of ECHOs and READs, keeping several of them
+ * in flight, and the time per operation is printed.
+ * The data that is read is checked so this also works as a test.
+ * With -s the session is sealed, which measures the cost of encryption.
+ * -c selects the cipher used for sealing.
+ * With -l each read is a single smb2_pread_async() that is split into
+ * PDUs by the library, and -w writes instead of reads.
+ * With -r the reads are issued one at a time and served from the
+ * library's read-ahead, with -b the writes are issued one at a time and
+ * buffered by the library.
+ * With -v each read or write is a single smb2_preadv_async() or
+ * smb2_pwritev_async() on a buffer cut into several iovecs of
+ * different sizes.
+ * With -x each operation is a server side copy of read-size bytes with
+ * smb2_copy_range_async().
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "smb2.h"
+#include "libsmb2.h"
+#include "libsmb2-raw.h"
+
+#define DEFAULT_NUM_OPS 10000
+#define DEFAULT_READ_SIZE (64 * 1024)
+#define MAX_IN_FLIGHT 16
+#define MAX_SPLIT_READ_SIZE (64 * 1024 * 1024)
+#define READ_AHEAD_SIZE (8 * 1024 * 1024)
+#define WRITE_BEHIND_SIZE (8 * 1024 * 1024)
+#define NUM_IOV 7
+/* the copies go this far into the file */
+#define COPY_SHIFT (3 * 4096 + 1)
+
+struct read_slot {
+        uint8_t *buf;
+        uint64_t offset;
+};
+
+static struct smb2_memory_transport *mt;
+static struct smb2fh *fh;
+static struct read_slot slots[MAX_IN_FLIGHT];
+static int num_ops = DEFAULT_NUM_OPS;
+static int seal;
+static uint16_t cipher;
+static int crypto_threads;
+static int split_io;
+static int do_write;
+static int read_ahead;
+static int write_behind;
+static int vectored;
+static int copy;
+static uint64_t copy_next;
+static uint8_t resume_key[SMB2_RESUME_KEY_SIZE] = "smb2-memory-bench";
+static uint64_t bytes_written;
+static int max_in_flight = MAX_IN_FLIGHT;
+static const struct smb2_crypto_provider *provider;
+static uint32_t read_size = DEFAULT_READ_SIZE;
+static int sent, done, failed;
+static double t0, t_echo, t_read;
+
+int usage(void)
+{
+        fprintf(stderr, "Usage:\n"
+                "smb2-memory-bench [-s] [-c <cipher>] [-t <threads>] "
+                "[-p <provider>] [-l] [-w] [-r] [-b] [-v] [-x]\n"
+                "                  [<num-ops> [<read-size>]]\n\n"
+                "  -s  seal the session, using SMB 3.1.1\n"
+                "  -c  seal with this cipher: aes128ccm, aes128gcm, "
+                "aes256ccm or aes256gcm\n"
+                "  -t  seal and unseal large PDUs on this many crypto "
+                "threads,\n"
+                "      on both the client and the server\n"
+                "  -p  crypto provider for the client and the server: "
+                "builtin or openssl\n"
+                "  -l  issue one read at a time and let the library split "
+                "it into PDUs,\n"
+                "      read-size can then be up to 64MB\n"
+                "  -w  write instead of read\n"
+                "  -r  issue one read at a time and let the library read "
+                "ahead\n"
+                "  -b  write, one write at a time, and let the library "
+                "buffer the writes\n"
+                "  -v  issue one read or write at a time as a preadv or "
+                "pwritev of\n"
+                "      %d iovecs, read-size can then be up to 64MB\n"
+                "  -x  copy on the server instead, one copy at a time, "
+                "read-size can\n"
+                "      then be up to 64MB\n\n",
+                NUM_IOV);
+        exit(1);
+}
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint8_t pattern(uint64_t offset)
+{
+        return (uint8_t)(offset * 7 + (offset >> 12));
+}
+
+static int authorize_handler(struct smb2_server *srvr,
+                             struct smb2_context *smb2,
+                             const char *user, const char *domain,
+                             const char *workstation)
+{
+        if (user) {
+                smb2_set_user(smb2, user);
+                smb2_set_password(smb2, "password");
+                return 0;
+        }
+        return -1;
+}
+
+static int session_handler(struct smb2_server *srvr, struct smb2_context *smb2)
+{
+        smb2_set_crypto_provider(smb2, provider);
+        if (crypto_threads &&
+            smb2_set_crypto_threads(smb2, crypto_threads) < 0) {
+                fprintf(stderr, "Failed to start server crypto threads: %s\n",
+                        smb2_get_error(smb2));
+                return -1;
+        }
+        return 0;
+}
+
+static int tree_connect_handler(struct smb2_server *srvr,
+                                struct smb2_context *smb2,
+                                struct smb2_tree_connect_request *req,
+                                struct smb2_tree_connect_reply *rep)
+{
+        rep->share_type = SMB2_SHARE_TYPE_DISK;
+        rep->maximal_access = 0x101f01ff;
+        return 0;
+}
+
+static int create_handler(struct smb2_server *srvr, struct smb2_context *smb2,
+                          struct smb2_create_request *req,
+                          struct smb2_create_reply *rep)
+{
+        rep->file_attributes = SMB2_FILE_ATTRIBUTE_NORMAL;
+        return 0;
+}
+
+static int close_handler(struct smb2_server *srvr, struct smb2_context *smb2,
+                         struct smb2_close_request *req,
+                         struct smb2_close_reply *rep)
+{
+        memset(rep, 0, sizeof(*rep));
+        return 0;
+}
+
+static int read_handler(struct smb2_server *srvr, struct smb2_context *smb2,
+                        struct smb2_read_request *req,
+                        struct smb2_read_reply *rep)
+{
+        uint32_t i;
+
+        rep->data_length = req->length;
+        rep->data_remaining = 0;
+        rep->data = malloc(rep->data_length);
+        if (rep->data == NULL) {
+                return -ENOMEM;
+        }
+        for (i = 0; i < rep->data_length; i++) {
+                rep->data[i] = pattern(req->offset + i);
+        }
+        return 0;
+}
+
+static int write_handler(struct smb2_server *srvr, struct smb2_context *smb2,
+                         struct smb2_write_request *req,
+                         struct smb2_write_reply *rep)
+{
+        uint32_t i;
+
+        for (i = 0; i < req->length; i++) {
+                if (req->buf[i] != pattern(req->offset + i)) {
+                        fprintf(stderr, "Write data mismatch at offset "
+                                "%llu\n",
+                                (unsigned long long)(req->offset + i));
+                        return -EIO;
+                }
+        }
+        bytes_written += req->length;
+        rep->count = req->length;
+        rep->remaining = 0;
+        return 0;
+}
+
+static int ioctl_handler(struct smb2_server *srvr, struct smb2_context *smb2,
+                         struct smb2_ioctl_request *req,
+                         struct smb2_ioctl_reply *rep)
+{
+        static struct smb2_srv_request_resume_key key;
+        static struct smb2_srv_copychunk_response response;
+        struct smb2_srv_copychunk_copy *cc = req->input;
+        uint32_t i, total = 0;
+
+        switch (req->ctl_code) {
+        case SMB2_FSCTL_SRV_REQUEST_RESUME_KEY:
+                memcpy(key.resume_key, resume_key, SMB2_RESUME_KEY_SIZE);
+                rep->output = (uint8_t *)&key;
+                rep->output_count = sizeof(key);
+                return 0;
+        case SMB2_FSCTL_SRV_COPYCHUNK_WRITE:
+                if (cc == NULL ||
+                    memcmp(cc->source_key, resume_key, SMB2_RESUME_KEY_SIZE) ||
+                    cc->chunk_count > 256) {
+                        fprintf(stderr, "Bad copychunk request\n");
+                        return -EINVAL;
+                }
+                /* the chunks must cover the file in order */
+                for (i = 0; i < cc->chunk_count; i++) {
+                        if (cc->chunks[i].source_offset != copy_next ||
+                            cc->chunks[i].target_offset !=
+                            copy_next + COPY_SHIFT ||
+                            cc->chunks[i].length > 1024 * 1024) {
+                                fprintf(stderr, "Bad chunk at offset %llu\n",
+                                        (unsigned long long)copy_next);
+                                return -EINVAL;
+                        }
+                        copy_next += cc->chunks[i].length;
+                        total += cc->chunks[i].length;
+                }
+                if (total > 16 * 1024 * 1024) {
+                        fprintf(stderr, "Copychunk request too large\n");
+                        return -EINVAL;
+                }
+                bytes_written += total;
+                response.chunks_written = cc->chunk_count;
+                response.chunk_bytes_written = 0;
+                response.total_bytes_written = total;
+                rep->output = (uint8_t *)&response;
+                rep->output_count = sizeof(response);
+                return 0;
+        }
+        return -EINVAL;
+}
+
+static int flush_handler(struct smb2_server *srvr, struct smb2_context *smb2,
+                         struct smb2_flush_request *req)
+{
+        return 0;
+}
+
+static int echo_handler(struct smb2_server *srvr, struct smb2_context *smb2)
+{
+        return 0;
+}
+
+static struct smb2_server_request_handlers handlers = {
+        .authorize_user = authorize_handler,
+        .session_established = session_handler,
+        .tree_connect_cmd = tree_connect_handler,
+        .create_cmd = create_handler,
+        .close_cmd = close_handler,
+        .read_cmd = read_handler,
+        .write_cmd = write_handler,
+        .flush_cmd = flush_handler,
+        .ioctl_cmd = ioctl_handler,
+        .echo_cmd = echo_handler,
+};
+
+static void finish(struct smb2_context *smb2, const char *error)
+{
+        if (error) {
+                fprintf(stderr, "%s: %s\n", error, smb2_get_error(smb2));
+                failed = 1;
+        }
+        /* makes smb2_serve_memory_transport() return */
+        smb2_memory_transport_shutdown(mt);
+}
+
+static void send_reads(struct smb2_context *smb2);
+
+static void fsync_cb(struct smb2_context *smb2, int status,
+                     void *command_data, void *private_data)
+{
+        if (status) {
+                finish(smb2, "fsync failed");
+                return;
+        }
+        t_read = now() - t0;
+        finish(smb2, NULL);
+}
+
+static void read_cb(struct smb2_context *smb2, int status,
+                    void *command_data, void *private_data)
+{
+        struct read_slot *slot = private_data;
+        struct smb2_copy_range_cb_data *cr = command_data;
+        uint32_t i;
+
+        if (copy) {
+                if (status || cr->count != read_size) {
+                        finish(smb2, "copy failed");
+                        return;
+                }
+        } else if (status != (int)read_size) {
+                finish(smb2, do_write ? "pwrite failed" : "pread failed");
+                return;
+        }
+        for (i = 0; i < read_size && !do_write; i++) {
+                if (slot->buf[i] != pattern(slot->offset + i)) {
+                        fprintf(stderr, "Data mismatch at offset %llu\n",
+                                (unsigned long long)(slot->offset + i));
+                        finish(smb2, "pread returned wrong data");
+                        return;
+                }
+        }
+
+        if (++done == num_ops) {
+                if (write_behind) {
+                        /* time until the buffered writes are done */
+                        if (smb2_fsync_async(smb2, fh, fsync_cb, NULL) < 0) {
+                                finish(smb2, "smb2_fsync_async failed");
+                        }
+                        return;
+                }
+                t_read = now() - t0;
+                finish(smb2, NULL);
+                return;
+        }
+        send_reads(smb2);
+}
+
+/* cuts the buffer of the slot into pieces of different sizes */
+static int slot_iov(struct read_slot *slot, struct iovec *iov)
+{
+        uint32_t off = 0, len;
+        int n = 0;
+
+        while (off < read_size && n < NUM_IOV) {
+                len = n == NUM_IOV - 1 ? read_size - off :
+                        (read_size >> (n + 1)) + n * 13;
+                if (len > read_size - off) {
+                        len = read_size - off;
+                }
+                iov[n].iov_base = slot->buf + off;
+                iov[n].iov_len = len;
+                off += len;
+                n++;
+        }
+        return n;
+}
+
+static int send_io(struct smb2_context *smb2, struct read_slot *slot)
+{
+        struct iovec iov[NUM_IOV];
+        int iovcnt;
+
+        if (copy) {
+                return smb2_copy_range_async(smb2, fh, slot->offset, fh,
+                                             slot->offset + COPY_SHIFT,
+                                             read_size, read_cb, slot);
+        }
+        if (vectored) {
+                iovcnt = slot_iov(slot, iov);
+                if (do_write) {
+                        return smb2_pwritev_async(smb2, fh, iov, iovcnt,
+                                                  slot->offset, read_cb,
+                                                  slot);
+                }
+                return smb2_preadv_async(smb2, fh, iov, iovcnt,
+                                         slot->offset, read_cb, slot);
+        }
+        if (do_write) {
+                return smb2_pwrite_async(smb2, fh, slot->buf, read_size,
+                                         slot->offset, read_cb, slot);
+        }
+        return smb2_pread_async(smb2, fh, slot->buf, read_size,
+                                slot->offset, read_cb, slot);
+}
+
+static void send_reads(struct smb2_context *smb2)
+{
+        static int sending;
+        struct read_slot *slot;
+        uint32_t i;
+
+        /* with read-ahead and write-behind the callback can be invoked
+         * before the read or write returns, the loop below then goes on
+         */
+        if (sending) {
+                return;
+        }
+        sending = 1;
+        while (sent < num_ops && sent - done < max_in_flight) {
+                slot = &slots[sent % max_in_flight];
+                slot->offset = (uint64_t)sent * read_size;
+                sent++;
+                if (do_write && !copy) {
+                        for (i = 0; i < read_size; i++) {
+                                slot->buf[i] = pattern(slot->offset + i);
+                        }
+                }
+                if (send_io(smb2, slot) < 0) {
+                        finish(smb2, do_write ? "write failed to send" :
+                               "read failed to send");
+                        break;
+                }
+        }
+        sending = 0;
+}
+
+static void open_cb(struct smb2_context *smb2, int status,
+                    void *command_data, void *private_data)
+{
+        if (status != SMB2_STATUS_SUCCESS) {
+                finish(smb2, "open failed");
+                return;
+        }
+        fh = command_data;
+        if (read_ahead &&
+            smb2_set_read_ahead(smb2, fh, READ_AHEAD_SIZE) < 0) {
+                finish(smb2, "smb2_set_read_ahead failed");
+                return;
+        }
+        if (write_behind &&
+            smb2_set_write_behind(smb2, fh, WRITE_BEHIND_SIZE, 0) < 0) {
+                finish(smb2, "smb2_set_write_behind failed");
+                return;
+        }
+        sent = done = 0;
+        t0 = now();
+        send_reads(smb2);
+}
+
+static void send_echos(struct smb2_context *smb2);
+
+static void echo_cb(struct smb2_context *smb2, int status,
+                    void *command_data, void *private_data)
+{
+        if (status != SMB2_STATUS_SUCCESS) {
+                finish(smb2, "echo failed");
+                return;
+        }
+        if (++done == num_ops) {
+                t_echo = now() - t0;
+                if (smb2_open_async(smb2, "file",
+                                    do_write ? O_RDWR : O_RDONLY,
+                                    open_cb, NULL) < 0) {
+                        finish(smb2, "smb2_open_async failed");
+                }
+                return;
+        }
+        send_echos(smb2);
+}
+
+static void send_echos(struct smb2_context *smb2)
+{
+        while (sent < num_ops && sent - done < MAX_IN_FLIGHT) {
+                if (smb2_echo_async(smb2, echo_cb, NULL) < 0) {
+                        finish(smb2, "smb2_echo_async failed");
+                        return;
+                }
+                sent++;
+        }
+}
+
+static void connect_cb(struct smb2_context *smb2, int status,
+                       void *command_data, void *private_data)
+{
+        if (status != SMB2_STATUS_SUCCESS) {
+                finish(smb2, "connect failed");
+                return;
+        }
+        t0 = now();
+        send_echos(smb2);
+}
+
+int main(int argc, char *argv[])
+{
+        struct smb2_server server;
+        struct smb2_context *smb2;
+        int c, i, err;
+
+        while ((c = getopt(argc, argv, "sc:t:p:lwrbvx")) != -1) {
+                switch (c) {
+                case 's':
+                        seal = 1;
+                        break;
+                case 'c':
+                        seal = 1;
+                        if (!strcmp(optarg, "aes128ccm")) {
+                                cipher = SMB2_ENCRYPTION_AES_128_CCM;
+                        } else if (!strcmp(optarg, "aes128gcm")) {
+                                cipher = SMB2_ENCRYPTION_AES_128_GCM;
+                        } else if (!strcmp(optarg, "aes256ccm")) {
+                                cipher = SMB2_ENCRYPTION_AES_256_CCM;
+                        } else if (!strcmp(optarg, "aes256gcm")) {
+                                cipher = SMB2_ENCRYPTION_AES_256_GCM;
+                        } else {
+                                usage();
+                        }
+                        break;
+                case 't':
+                        crypto_threads = atoi(optarg);
+                        if (crypto_threads < 1) {
+                                usage();
+                        }
+                        break;
+                case 'p':
+                        if (!strcmp(optarg, "builtin")) {
+                                provider = NULL;
+                        } else if (!strcmp(optarg, "openssl")) {
+                                provider = smb2_openssl_crypto_provider();
+                                if (provider == NULL) {
+                                        fprintf(stderr, "libsmb2 was built "
+                                                "without OpenSSL\n");
+                                        exit(77);
+                                }
+                        } else {
+                                usage();
+                        }
+                        break;
+                case 'l':
+                        split_io = 1;
+                        max_in_flight = 1;
+                        break;
+                case 'w':
+                        do_write = 1;
+                        break;
+                case 'r':
+                        read_ahead = 1;
+                        max_in_flight = 1;
+                        break;
+                case 'b':
+                        write_behind = 1;
+                        do_write = 1;
+                        max_in_flight = 1;
+                        break;
+                case 'v':
+                        vectored = 1;
+                        max_in_flight = 1;
+                        break;
+                case 'x':
+                        copy = 1;
+                        do_write = 1;
+                        max_in_flight = 1;
+                        break;
+                default:
+                        usage();
+                }
+        }
+        argc -= optind;
+        argv += optind;
+
+        if (argc > 2) {
+                usage();
+        }
+        if (argc > 0) {
+                num_ops = atoi(argv[0]);
+                if (num_ops < 1) {
+                        usage();
+                }
+        }
+        if (argc > 1) {
+                read_size = strtoul(argv[1], NULL, 0);
+                if (read_size < 1 ||
+                    read_size > (split_io || vectored || copy ?
+                                 MAX_SPLIT_READ_SIZE :
+                                 1024 * 1024)) {
+                        usage();
+                }
+        }
+
+        for (i = 0; i < max_in_flight; i++) {
+                slots[i].buf = malloc(read_size);
+                if (slots[i].buf == NULL) {
+                        fprintf(stderr, "Failed to allocate buffer\n");
+                        exit(10);
+                }
+        }
+
+        mt = smb2_memory_transport_init();
+        if (mt == NULL) {
+                fprintf(stderr, "Failed to create memory transport: %s\n",
+                        strerror(errno));
+                exit(errno == ENOSYS ? 77 : 10);
+        }
+
+        memset(&server, 0, sizeof(server));
+        server.handlers = &handlers;
+        /* 3.1.1 always signs the session setup */
+        server.signing_enabled = seal;
+
+        smb2 = smb2_init_context();
+        if (smb2 == NULL) {
+                fprintf(stderr, "Failed to init context\n");
+                exit(10);
+        }
+        smb2_set_memory_transport(smb2, mt);
+        smb2_set_crypto_provider(smb2, provider);
+        smb2_set_split_io(smb2, split_io);
+        if (seal) {
+                smb2_set_version(smb2, SMB2_VERSION_0311);
+                smb2_set_seal(smb2, 1);
+                smb2_set_cipher(smb2, cipher);
+        } else {
+                smb2_set_version(smb2, SMB2_VERSION_0302);
+        }
+        smb2_set_password(smb2, "password");
+        if (crypto_threads) {
+                err = smb2_set_crypto_threads(smb2, crypto_threads);
+                if (err < 0) {
+                        fprintf(stderr, "Failed to start crypto threads: "
+                                "%s\n", smb2_get_error(smb2));
+                        exit(err == -ENOSYS ? 77 : 10);
+                }
+        }
+        if (smb2_connect_share_async(smb2, "memory", "share", "bench",
+                                     connect_cb, NULL) < 0) {
+                fprintf(stderr, "smb2_connect_share_async failed. %s\n",
+                        smb2_get_error(smb2));
+                exit(10);
+        }
+
+        /* Services both the server and the client context. Once the
+         * transport is shut down it returns and destroys all contexts.
+         */
+        err = smb2_serve_memory_transport(&server, mt, NULL, NULL);
+        if (err != -ESHUTDOWN) {
+                fprintf(stderr, "smb2_serve_memory_transport failed %d\n",
+                        err);
+                failed = 1;
+        }
+        smb2_memory_transport_destroy(mt);
+
+        for (i = 0; i < max_in_flight; i++) {
+                free(slots[i].buf);
+        }
+
+        if (failed || done != num_ops || t_read == 0) {
+                fprintf(stderr, "Benchmark did not complete\n");
+                return 1;
+        }
+        if (do_write && bytes_written != (uint64_t)num_ops * read_size) {
+                fprintf(stderr, "The server got %llu bytes written\n",
+                        (unsigned long long)bytes_written);
+                return 1;
+        }
+
+        printf("%d echos                %8.3f s %8.2f us/op\n",
+               num_ops, t_echo, t_echo * 1e6 / num_ops);
+        printf("%d %s of %u bytes %8.3f s %8.2f us/op %8.1f MB/s\n",
+               num_ops, copy ? "copies" : do_write ? "writes" : "reads",
+               read_size, t_read,
+               t_read * 1e6 / num_ops,
+               (double)num_ops * read_size / t_read / (1024 * 1024));
+
+        return 0;
+}
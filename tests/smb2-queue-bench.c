@@ -0,0 +1,493 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Micro-benchmark for the PDU queues.
+ * Queues a large number of PDUs, cancels every other one, sends them
+ * to a fake server that answers each with an error and then tears the
+ * context down, timing each phase.
+ * With O(1) queue and dequeue and hashed message id lookups the time per
+ * PDU should stay flat no matter how many PDUs are queued or waiting for
+ * a reply. This is checked by timing num-pdus / 10 PDUs too, the run
+ * fails if the time per PDU grows more than MAX_SCALING times.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "smb2.h"
+#include "libsmb2.h"
+#include "libsmb2-raw.h"
+
+#define DEFAULT_NUM_PDUS 10000
+/* the scaling check compares num-pdus with num-pdus / 10 */
+#define MIN_SCALING_PDUS 100
+#define SCALING_RUNS 5
+#define MAX_SCALING 4
+/* A few PDUs per waitqueue hash bucket at most */
+#define MAX_IN_FLIGHT 4096
+
+/* Every request is answered with this status */
+#define REPLY_STATUS SMB2_STATUS_INVALID_PARAMETER
+
+int num_shutdown;
+int num_replies;
+
+/*
+ * A transport that stands in for the server. Everything the client
+ * writes is kept in out, and the client reads the replies in from in.
+ */
+struct bench_transport {
+        uint8_t *out;
+        size_t out_len;
+        size_t out_size;
+        uint8_t *in;
+        size_t in_size;
+        size_t in_len;
+        size_t in_pos;
+};
+
+static struct bench_transport bt;
+
+static void *grow(void *buf, size_t *size, size_t needed)
+{
+        if (needed <= *size) {
+                return buf;
+        }
+        while (*size < needed) {
+                *size = *size ? *size * 2 : 65536;
+        }
+        buf = realloc(buf, *size);
+        if (buf == NULL) {
+                fprintf(stderr, "Failed to grow transport buffer\n");
+                exit(10);
+        }
+        return buf;
+}
+
+static int bt_connect(struct smb2_context *smb2, const char *server,
+                      t_socket *fd, void *opaque)
+{
+        *fd = open("/dev/null", O_RDONLY);
+        return *fd < 0 ? -errno : 0;
+}
+
+static ssize_t bt_readv(struct smb2_context *smb2, const struct iovec *iov,
+                        int iovcnt, void *opaque)
+{
+        ssize_t count = 0;
+        size_t n;
+        int i;
+
+        for (i = 0; i < iovcnt && bt.in_pos < bt.in_len; i++) {
+                n = bt.in_len - bt.in_pos;
+                if (n > iov[i].iov_len) {
+                        n = iov[i].iov_len;
+                }
+                memcpy(iov[i].iov_base, &bt.in[bt.in_pos], n);
+                bt.in_pos += n;
+                count += n;
+        }
+        if (count == 0) {
+                errno = EAGAIN;
+                return -1;
+        }
+        return count;
+}
+
+static ssize_t bt_writev(struct smb2_context *smb2, const struct iovec *iov,
+                         int iovcnt, void *opaque)
+{
+        ssize_t count = 0;
+        int i;
+
+        for (i = 0; i < iovcnt; i++) {
+                bt.out = grow(bt.out, &bt.out_size,
+                              bt.out_len + iov[i].iov_len);
+                memcpy(&bt.out[bt.out_len], iov[i].iov_base,
+                       iov[i].iov_len);
+                bt.out_len += iov[i].iov_len;
+                count += iov[i].iov_len;
+        }
+        return count;
+}
+
+static void bt_close(struct smb2_context *smb2, t_socket fd, void *opaque)
+{
+        close(fd);
+}
+
+static const struct smb2_transport bench_transport = {
+        bt_connect,
+        bt_readv,
+        bt_writev,
+        bt_close
+};
+
+/*
+ * Returns the message ids of the requests written so far, in the order
+ * they were sent, and forgets about them.
+ */
+static int sent_message_ids(uint64_t *mids, int max)
+{
+        size_t pos = 0, len;
+        int i, n = 0;
+
+        while (pos + 4 + 64 <= bt.out_len) {
+                len = ((size_t)bt.out[pos + 1] << 16) |
+                        ((size_t)bt.out[pos + 2] << 8) | bt.out[pos + 3];
+                if (n == max) {
+                        fprintf(stderr, "More requests were sent than "
+                                "queued\n");
+                        exit(10);
+                }
+                mids[n] = 0;
+                for (i = 7; i >= 0; i--) {
+                        mids[n] = (mids[n] << 8) | bt.out[pos + 4 + 24 + i];
+                }
+                n++;
+                pos += 4 + len;
+        }
+        bt.out_len = 0;
+        return n;
+}
+
+/* An error reply, which every command accepts, that grants credits */
+static void add_reply(uint64_t mid, uint16_t credits)
+{
+        uint8_t *r;
+        int i;
+
+        bt.in = grow(bt.in, &bt.in_size, bt.in_len + 4 + 64 + 9);
+        r = &bt.in[bt.in_len];
+        memset(r, 0, 4 + 64 + 9);
+        r[3] = 64 + 9;
+        r += 4;
+        r[0] = 0xfe; r[1] = 'S'; r[2] = 'M'; r[3] = 'B';
+        r[4] = 64;
+        for (i = 0; i < 4; i++) {
+                r[8 + i] = (uint8_t)(REPLY_STATUS >> (8 * i));
+        }
+        r[14] = (uint8_t)credits;
+        r[15] = (uint8_t)(credits >> 8);
+        r[16] = SMB2_FLAGS_SERVER_TO_REDIR;
+        for (i = 0; i < 8; i++) {
+                r[24 + i] = (uint8_t)(mid >> (8 * i));
+        }
+        r[64] = 9;
+        bt.in_len += 4 + 64 + 9;
+}
+
+static void service(struct smb2_context *smb2, int revents)
+{
+        if (smb2_service(smb2, revents) < 0) {
+                fprintf(stderr, "smb2_service failed. %s\n",
+                        smb2_get_error(smb2));
+                exit(10);
+        }
+}
+
+int usage(void)
+{
+        fprintf(stderr, "Usage:\n"
+                "smb2-queue-bench [<num-pdus>]\n\n");
+        exit(1);
+}
+
+static double now(void)
+{
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+void echo_cb(struct smb2_context *smb2, int status,
+             void *command_data, void *private_data)
+{
+        if (status == SMB2_STATUS_SHUTDOWN) {
+                num_shutdown++;
+        }
+        if (status == REPLY_STATUS) {
+                num_replies++;
+        }
+}
+
+void connect_cb(struct smb2_context *smb2, int status,
+                void *command_data, void *private_data)
+{
+        if (status) {
+                fprintf(stderr, "Failed to connect the bench transport\n");
+                exit(10);
+        }
+}
+
+/*
+ * Connects the context to the bench transport and gets enough credits
+ * for window requests to be in flight at once.
+ */
+static struct smb2_context *connect_context(int window)
+{
+        struct smb2_context *smb2;
+        struct smb2_negotiate_request req;
+        struct smb2_pdu *pdu;
+        uint64_t mid;
+
+        smb2 = smb2_init_context();
+        if (smb2 == NULL) {
+                fprintf(stderr, "Failed to init context\n");
+                exit(10);
+        }
+        if (smb2_set_transport(smb2, &bench_transport, NULL) ||
+            smb2_connect_async(smb2, "bench", connect_cb, NULL)) {
+                fprintf(stderr, "Failed to connect. %s\n",
+                        smb2_get_error(smb2));
+                exit(10);
+        }
+        service(smb2, POLLOUT);
+
+        /* A NEGOTIATE is the only request that needs no credits */
+        memset(&req, 0, sizeof(req));
+        req.dialect_count = 1;
+        req.dialects[0] = SMB2_VERSION_0210;
+        pdu = smb2_cmd_negotiate_async(smb2, &req, echo_cb, NULL);
+        if (pdu == NULL) {
+                fprintf(stderr, "Failed to create negotiate pdu. %s\n",
+                        smb2_get_error(smb2));
+                exit(10);
+        }
+        smb2_queue_pdu(smb2, pdu);
+        service(smb2, POLLOUT);
+        if (sent_message_ids(&mid, 1) != 1) {
+                fprintf(stderr, "Negotiate was not sent\n");
+                exit(10);
+        }
+        /* each request costs two credits before a dialect is agreed */
+        add_reply(mid, 2 * window);
+        service(smb2, POLLIN);
+        bt.in_len = bt.in_pos = 0;
+        num_replies = 0;
+
+        return smb2;
+}
+
+/*
+ * Queues num_pdus PDUs, cancels half of them from the middle of the
+ * outqueue and queues new ones in their place. They are then sent,
+ * window at a time as the credits allow, which moves them to the
+ * waitqueue. Each window is answered newest first so that every reply
+ * is looked up by its message id far from the head of the waitqueue.
+ */
+static double run(int num_pdus, int window, int verbose)
+{
+        struct smb2_context *smb2;
+        struct smb2_pdu **pdus;
+        struct smb2_close_request req;
+        struct smb2_pdu_cache_stats stats;
+        uint64_t *mids;
+        int i, n, nmids;
+        double t0, t1, t2, t3, t4, t5;
+
+        pdus = calloc(num_pdus, sizeof(struct smb2_pdu *));
+        mids = calloc(num_pdus, sizeof(uint64_t));
+        if (pdus == NULL || mids == NULL) {
+                fprintf(stderr, "Failed to allocate pdu array\n");
+                exit(10);
+        }
+
+        smb2 = connect_context(window);
+        num_shutdown = 0;
+
+        t0 = now();
+        for (i = 0; i < num_pdus; i++) {
+                pdus[i] = smb2_cmd_echo_async(smb2, echo_cb, NULL);
+                if (pdus[i] == NULL) {
+                        fprintf(stderr, "Failed to create echo pdu %d. %s\n",
+                                i, smb2_get_error(smb2));
+                        exit(10);
+                }
+                smb2_queue_pdu(smb2, pdus[i]);
+        }
+        t1 = now();
+
+        /* Cancel every other PDU so we remove from the middle of the queue */
+        for (i = 1; i < num_pdus; i += 2) {
+                smb2_free_pdu(smb2, pdus[i]);
+        }
+        t2 = now();
+
+        /* Queue CLOSE requests in their place, these should reuse the
+         * PDUs we just cancelled.
+         */
+        memset(&req, 0, sizeof(req));
+        for (i = 1; i < num_pdus; i += 2) {
+                pdus[i] = smb2_cmd_close_async(smb2, &req, echo_cb, NULL);
+                if (pdus[i] == NULL) {
+                        fprintf(stderr, "Failed to create close pdu %d. %s\n",
+                                i, smb2_get_error(smb2));
+                        exit(10);
+                }
+                smb2_queue_pdu(smb2, pdus[i]);
+        }
+        t3 = now();
+
+        nmids = 0;
+        while (nmids < num_pdus) {
+                /* Send a window, they then wait for their replies */
+                for (i = 0; i < window &&
+                             smb2_which_events(smb2) & POLLOUT; i++) {
+                        service(smb2, POLLOUT);
+                }
+                n = sent_message_ids(&mids[nmids], num_pdus - nmids);
+                if (n == 0) {
+                        break;
+                }
+                bt.in_len = bt.in_pos = 0;
+                for (i = nmids + n - 1; i >= nmids; i--) {
+                        /* and give the credits back */
+                        add_reply(mids[i], 2);
+                }
+                nmids += n;
+                while (bt.in_pos < bt.in_len) {
+                        service(smb2, POLLIN);
+                }
+        }
+        t4 = now();
+        smb2_get_pdu_cache_stats(smb2, &stats);
+
+        smb2_destroy_context(smb2);
+        t5 = now();
+        bt.in_len = bt.in_pos = 0;
+
+        if (verbose) {
+                printf("queued    %d PDUs in %8.3f ms (%6.1f ns/PDU)\n",
+                       num_pdus, (t1 - t0) * 1e3,
+                       (t1 - t0) * 1e9 / num_pdus);
+                printf("cancelled %d PDUs in %8.3f ms (%6.1f ns/PDU)\n",
+                       num_pdus / 2, (t2 - t1) * 1e3,
+                       (t2 - t1) * 1e9 / (num_pdus / 2));
+                printf("requeued  %d PDUs in %8.3f ms (%6.1f ns/PDU)\n",
+                       num_pdus / 2, (t3 - t2) * 1e3,
+                       (t3 - t2) * 1e9 / (num_pdus / 2));
+                printf("sent and replied to %d PDUs, %d at a time, in "
+                       "%8.3f ms (%6.1f ns/PDU)\n",
+                       num_replies, window, (t4 - t3) * 1e3,
+                       (t4 - t3) * 1e9 / num_pdus);
+                printf("destroyed context in %8.3f ms\n", (t5 - t4) * 1e3);
+                printf("pdu cache: %llu hits %llu misses, "
+                       "request buffers: %llu hits %llu misses\n",
+                       (unsigned long long)stats.pdu_hits,
+                       (unsigned long long)stats.pdu_misses,
+                       (unsigned long long)stats.buf_hits,
+                       (unsigned long long)stats.buf_misses);
+        }
+
+        free(pdus);
+        free(mids);
+
+        if (nmids != num_pdus) {
+                fprintf(stderr, "Expected %d PDUs to be sent but got %d\n",
+                        num_pdus, nmids);
+                return -1;
+        }
+        if (num_replies != num_pdus || num_shutdown != 0) {
+                fprintf(stderr, "Expected %d replies but got %d, and %d "
+                        "PDUs shut down\n", num_pdus, num_replies,
+                        num_shutdown);
+                return -1;
+        }
+        if (stats.pdu_hits == 0 || stats.buf_misses != 0) {
+                fprintf(stderr, "PDU cache was not used\n");
+                return -1;
+        }
+
+        return t5 - t0;
+}
+
+static double best_of(int num_pdus, int window, int runs)
+{
+        double t, best = -1;
+
+        while (runs--) {
+                t = run(num_pdus, window, 0);
+                if (t < 0) {
+                        return -1;
+                }
+                if (best < 0 || t < best) {
+                        best = t;
+                }
+        }
+        return best;
+}
+
+int main(int argc, char *argv[])
+{
+        int num_pdus = DEFAULT_NUM_PDUS;
+        int window;
+        double t_small, t_large;
+
+        if (argc > 2) {
+                usage();
+        }
+        if (argc == 2) {
+                num_pdus = atoi(argv[1]);
+                if (num_pdus < 2) {
+                        usage();
+                }
+        }
+        window = num_pdus / 4;
+        if (window > MAX_IN_FLIGHT) {
+                window = MAX_IN_FLIGHT;
+        }
+        if (window < 1) {
+                window = 1;
+        }
+
+        if (run(num_pdus, window, 1) < 0) {
+                return 1;
+        }
+
+        /* With O(1) queue operations and message id lookups 10 times
+         * the PDUs take about 10 times as long, even with 10 times as
+         * many of them waiting for a reply. A queue that is walked on
+         * every operation makes it 100 times.
+         */
+        if (num_pdus < 10 * MIN_SCALING_PDUS) {
+                return 0;
+        }
+        t_small = best_of(num_pdus / 10, window / 10, SCALING_RUNS);
+        t_large = best_of(num_pdus, window, SCALING_RUNS);
+        if (t_small < 0 || t_large < 0) {
+                return 1;
+        }
+        printf("%d PDUs took %.1f times as long as %d PDUs\n",
+               num_pdus, t_large / t_small, num_pdus / 10);
+        if (t_large > MAX_SCALING * 10 * t_small) {
+                fprintf(stderr, "Queue operations do not scale linearly\n");
+                return 1;
+        }
+
+        return 0;
+}
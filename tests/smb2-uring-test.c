@@ -0,0 +1,248 @@
+/* -*-  mode:c; tab-width:8; c-basic-offset:8; indent-tabs-mode:nil;  -*- */
+/*
+   Copyright (C) 2026 by Ronnie Sahlberg <ronniesahlberg@gmail.com>
+
+Redistribution and use in source and binary forms, with or without modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this list of conditions and the following disclaimer.
+
+2. Redistributions in binary form must reproduce the above copyright notice, this list of conditions and the following disclaimer in the documentation and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+*/
+
+/*
+ * Test for the io_uring backend.
+ * A number of contexts are attached to one ring and connect to a fake
+ * server on the loopback interface. Once they have all sent their
+ * NEGOTIATE the server answers every one of them with garbage at the same
+ * time, so the receives of all contexts complete together.
+ * Every context that fails destroys another one that still has its
+ * receive in flight. Cancelling that receive reaps the completions of
+ * the other contexts, which the ring has to keep for later. The test
+ * fails unless every context is either failed or destroyed.
+ *
+ * Exits with 77 if the kernel does not allow io_uring or libsmb2 was
+ * built without it.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+
+#include "smb2.h"
+#include "libsmb2.h"
+
+#define NUM_CONTEXTS 8
+#define RING_ENTRIES 16
+#define MAX_LOOPS 100
+
+struct client {
+        struct smb2_context *smb2;
+        int failed;
+        /* the server end of the connection */
+        int fd;
+        int negotiated;
+};
+
+struct client clients[NUM_CONTEXTS];
+int num_failed;
+int num_destroyed;
+
+static void failed(struct smb2_context *smb2)
+{
+        int i, j;
+
+        for (i = 0; i < NUM_CONTEXTS; i++) {
+                if (clients[i].smb2 == smb2) {
+                        break;
+                }
+        }
+        if (i == NUM_CONTEXTS || clients[i].failed) {
+                return;
+        }
+        clients[i].failed = 1;
+        num_failed++;
+
+        /* Destroy the next context that is still waiting for its reply.
+         * Its PDUs are cancelled with STATUS_SHUTDOWN, which we do not
+         * count as a failure.
+         */
+        for (j = (i + 1) % NUM_CONTEXTS; j != i; j = (j + 1) % NUM_CONTEXTS) {
+                if (clients[j].smb2 && !clients[j].failed) {
+                        smb2 = clients[j].smb2;
+                        clients[j].smb2 = NULL;
+                        smb2_destroy_context(smb2);
+                        num_destroyed++;
+                        break;
+                }
+        }
+}
+
+static void uring_cb(struct smb2_context *smb2, int status,
+                     void *command_data, void *private_data)
+{
+        failed(smb2);
+}
+
+static void connect_cb(struct smb2_context *smb2, int status,
+                       void *command_data, void *private_data)
+{
+        if (status == 0) {
+                fprintf(stderr, "Connected to the fake server\n");
+                exit(10);
+        }
+        failed(smb2);
+}
+
+/* Accepts the connections and reads the NEGOTIATE requests */
+static void serve(int listener)
+{
+        char buf[1024];
+        int i, fd;
+        ssize_t count;
+
+        for (i = 0; i < NUM_CONTEXTS; i++) {
+                if (clients[i].fd >= 0) {
+                        continue;
+                }
+                fd = accept(listener, NULL, NULL);
+                if (fd < 0) {
+                        break;
+                }
+                fcntl(fd, F_SETFL, O_NONBLOCK);
+                clients[i].fd = fd;
+        }
+        for (i = 0; i < NUM_CONTEXTS; i++) {
+                if (clients[i].fd < 0) {
+                        continue;
+                }
+                count = read(clients[i].fd, buf, sizeof(buf));
+                if (count > 0) {
+                        clients[i].negotiated = 1;
+                }
+        }
+}
+
+int main(int argc, char *argv[])
+{
+        struct smb2_uring *ring;
+        struct sockaddr_in sin;
+        socklen_t sin_len = sizeof(sin);
+        /* A NetBIOS header followed by something that is not SMB2 */
+        unsigned char garbage[4 + 64];
+        char server[64];
+        int listener, i, loops, replied = 0;
+
+        ring = smb2_uring_init(RING_ENTRIES);
+        if (ring == NULL) {
+                printf("io_uring is not available: %s\n", strerror(errno));
+                return 77;
+        }
+
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        if (listener < 0) {
+                fprintf(stderr, "Failed to create socket\n");
+                return 10;
+        }
+        memset(&sin, 0, sizeof(sin));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(listener, (struct sockaddr *)&sin, sizeof(sin)) < 0 ||
+            listen(listener, NUM_CONTEXTS) < 0 ||
+            getsockname(listener, (struct sockaddr *)&sin, &sin_len) < 0) {
+                fprintf(stderr, "Failed to listen on the loopback "
+                        "interface\n");
+                return 10;
+        }
+        fcntl(listener, F_SETFL, O_NONBLOCK);
+        snprintf(server, sizeof(server), "127.0.0.1:%d",
+                 ntohs(sin.sin_port));
+
+        for (i = 0; i < NUM_CONTEXTS; i++) {
+                clients[i].fd = -1;
+                clients[i].smb2 = smb2_init_context();
+                if (clients[i].smb2 == NULL) {
+                        fprintf(stderr, "Failed to init context\n");
+                        return 10;
+                }
+                if (smb2_uring_add_context(ring, clients[i].smb2,
+                                           uring_cb, NULL) < 0) {
+                        fprintf(stderr, "Failed to attach context. %s\n",
+                                smb2_get_error(clients[i].smb2));
+                        return 10;
+                }
+                if (smb2_connect_share_async(clients[i].smb2, server,
+                                             "share", "user",
+                                             connect_cb, NULL) != 0) {
+                        fprintf(stderr, "Failed to connect. %s\n",
+                                smb2_get_error(clients[i].smb2));
+                        return 10;
+                }
+        }
+
+        memset(garbage, 0xff, sizeof(garbage));
+        garbage[0] = 0;
+        garbage[1] = 0;
+        garbage[2] = 0;
+        garbage[3] = 64;
+
+        for (loops = 0; loops < MAX_LOOPS &&
+                     num_failed + num_destroyed < NUM_CONTEXTS; loops++) {
+                if (smb2_service_uring(ring, 100) < 0) {
+                        fprintf(stderr, "smb2_service_uring failed\n");
+                        return 10;
+                }
+                if (replied) {
+                        continue;
+                }
+                serve(listener);
+                for (i = 0; i < NUM_CONTEXTS; i++) {
+                        if (!clients[i].negotiated) {
+                                break;
+                        }
+                }
+                if (i < NUM_CONTEXTS) {
+                        continue;
+                }
+                for (i = 0; i < NUM_CONTEXTS; i++) {
+                        if (write(clients[i].fd, garbage,
+                                  sizeof(garbage)) != sizeof(garbage)) {
+                                fprintf(stderr, "Failed to write reply\n");
+                                return 10;
+                        }
+                }
+                replied = 1;
+        }
+
+        printf("%d contexts failed and %d were destroyed in %d loops\n",
+               num_failed, num_destroyed, loops);
+        if (!replied || num_failed + num_destroyed != NUM_CONTEXTS) {
+                fprintf(stderr, "Not every context completed\n");
+                return 1;
+        }
+
+        for (i = 0; i < NUM_CONTEXTS; i++) {
+                if (clients[i].smb2) {
+                        smb2_destroy_context(clients[i].smb2);
+                }
+                if (clients[i].fd >= 0) {
+                        close(clients[i].fd);
+                }
+        }
+        smb2_uring_destroy(ring);
+        close(listener);
+
+        return 0;
+}
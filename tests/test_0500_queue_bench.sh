@@ -0,0 +1,11 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "PDU queue micro-benchmark"
+
+echo -n "Queueing, cancelling and replying to 10000 PDUs ... "
+./smb2-queue-bench 10000 > /dev/null || failure
+success
+
+exit 0
@@ -0,0 +1,17 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "count allocations with a custom allocator"
+
+echo -n "Counting allocations for local operations ... "
+./smb2-alloc-count > /dev/null || failure
+success
+
+../utils/smb2-cp ./smb2-alloc-count.c "${TESTURL}/ALLOC"
+
+echo -n "Counting allocations for reading a file ... "
+./smb2-alloc-count "${TESTURL}/ALLOC" > /dev/null || failure
+success
+
+exit 0
@@ -0,0 +1,107 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "client and server over the in-process memory transport"
+
+echo -n "Echo and read 1000 times over the memory transport ... "
+./smb2-memory-bench 1000 > /dev/null || failure
+success
+
+echo -n "Echo and read 1000 times over a sealed session ... "
+./smb2-memory-bench -s 1000 > /dev/null || failure
+success
+
+for CIPHER in aes128ccm aes256ccm aes256gcm; do
+    echo -n "Echo and read 100 times sealed with $CIPHER ... "
+    ./smb2-memory-bench -c $CIPHER 100 > /dev/null || failure
+    success
+done
+
+echo -n "Echo and write 100 times over the memory transport ... "
+./smb2-memory-bench -w 100 > /dev/null || failure
+success
+
+echo -n "Read 8MB 10 times, split into PDUs by the library ... "
+./smb2-memory-bench -l 10 8388608 > /dev/null || failure
+success
+
+echo -n "Write 3000001 bytes 10 times sealed, split into PDUs ... "
+./smb2-memory-bench -l -w -s 10 3000001 > /dev/null || failure
+success
+
+echo -n "Read 1000000 bytes 100 times through the read-ahead ... "
+./smb2-memory-bench -r 100 1000000 > /dev/null || failure
+success
+
+echo -n "Read 4096 bytes 1000 times sealed through the read-ahead ... "
+./smb2-memory-bench -r -s 1000 4096 > /dev/null || failure
+success
+
+echo -n "Write 4096 bytes 1000 times through the write-behind ... "
+./smb2-memory-bench -b 1000 4096 > /dev/null || failure
+success
+
+echo -n "Write 16384 bytes 300 times sealed through the write-behind ... "
+./smb2-memory-bench -b -s 300 16384 > /dev/null || failure
+success
+
+echo -n "Read 3000001 bytes 10 times into 7 iovecs ... "
+./smb2-memory-bench -v 10 3000001 > /dev/null || failure
+success
+
+echo -n "Write 1000000 bytes 10 times sealed from 7 iovecs ... "
+./smb2-memory-bench -v -w -s 10 1000000 > /dev/null || failure
+success
+
+echo -n "Write 16384 bytes 300 times from 7 iovecs through the write-behind ... "
+./smb2-memory-bench -v -b 300 16384 > /dev/null || failure
+success
+
+echo -n "Read 16MB 5 times into 7 iovecs larger than a PDU through the read-ahead ... "
+./smb2-memory-bench -v -r 5 16777216 > /dev/null || failure
+success
+
+echo -n "Copy 64MB 10 times on the server ... "
+./smb2-memory-bench -x 10 67108864 > /dev/null || failure
+success
+
+echo -n "Copy 1000001 bytes 100 times on the server, sealed ... "
+./smb2-memory-bench -x -s 100 1000001 > /dev/null || failure
+success
+
+echo -n "Echo and read 100 times sealed on 4 crypto threads ... "
+./smb2-memory-bench -s -t 4 100 > /dev/null
+case $? in
+    0) success ;;
+    77) echo "[SKIPPED]" ;;
+    *) failure ;;
+esac
+
+for PROVIDER in builtin openssl; do
+    for CIPHER in aes128ccm aes128gcm; do
+        echo -n "Echo and read 100 times with the $PROVIDER provider and $CIPHER ... "
+        ./smb2-memory-bench -p $PROVIDER -c $CIPHER 100 > /dev/null
+        case $? in
+            0) success ;;
+            77) echo "[SKIPPED]" ;;
+            *) failure ;;
+        esac
+    done
+    echo -n "Read ahead 1000000 bytes 50 times with the $PROVIDER provider on 4 crypto threads ... "
+    ./smb2-memory-bench -p $PROVIDER -c aes256gcm -t 4 -r 50 1000000 > /dev/null
+    case $? in
+        0) success ;;
+        77) echo "[SKIPPED]" ;;
+        *) failure ;;
+    esac
+    echo -n "Echo and read 100 times over SMB 3.0.2 with the $PROVIDER provider ... "
+    ./smb2-memory-bench -p $PROVIDER 100 > /dev/null
+    case $? in
+        0) success ;;
+        77) echo "[SKIPPED]" ;;
+        *) failure ;;
+    esac
+done
+
+exit 0
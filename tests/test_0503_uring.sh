@@ -0,0 +1,15 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "io_uring backend"
+
+echo -n "Fail and destroy 8 contexts on one ring while their replies arrive ... "
+./smb2-uring-test > /dev/null
+case $? in
+    0) success ;;
+    77) echo "[SKIPPED]" ;;
+    *) failure ;;
+esac
+
+exit 0
@@ -0,0 +1,11 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "AES-GCM and AES-256-CCM test vectors"
+
+echo -n "Encrypt and decrypt the GCM and CCM test vectors ... "
+./aes128gcm-test > /dev/null || failure
+success
+
+exit 0
@@ -0,0 +1,15 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "crypto micro-benchmark"
+
+echo -n "Time all crypto operations up to 64 KiB ... "
+./smb2-crypto-bench -m 1 -s 65536 > /dev/null || failure
+success
+
+echo -n "Time all crypto operations with JSON output ... "
+./smb2-crypto-bench -f json -m 1 -s 4096 > /dev/null || failure
+success
+
+exit 0
@@ -0,0 +1,11 @@
+#!/bin/sh
+
+. ./functions.sh
+
+echo "SMB2/3 key derivation"
+
+echo -n "Derive the signing and encryption keys from a 32 byte session key ... "
+./smb2-kdf-test > /dev/null || failure
+success
+
+exit 0
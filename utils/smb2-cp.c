@@ -45,6 +45,7 @@ struct file_context {
 	int is_smb2;
 	int fd;
 	struct smb2_context *smb2;
+	int shares_smb2;
 	struct smb2fh *smb2fh;
 	struct smb2_url *url;
 };
@@ -66,7 +67,7 @@ free_file_context(struct file_context *file_context)
 	if (file_context->smb2fh != NULL) {
 		smb2_close(file_context->smb2, file_context->smb2fh);
 	}
-	if (file_context->smb2 != NULL) {
+	if (file_context->smb2 != NULL && !file_context->shares_smb2) {
 		smb2_destroy_context(file_context->smb2);
 	}
 	smb2_destroy_url(file_context->url);
@@ -124,8 +125,48 @@ file_pwrite(struct file_context *fc, uint8_t *buf, size_t count, off_t off)
 	}
 }
 
+static int
+same_str(const char *a, const char *b)
+{
+	if (a == NULL || b == NULL) {
+		return a == b;
+	}
+	return !strcmp(a, b);
+}
+
+/*
+ * If url is on the same share as the already open file other, as the
+ * same user, the file is opened on the connection of other. The server
+ * can then copy between the two files.
+ */
+static int
+open_on_same_share(struct file_context *file_context, const char *url,
+		   struct file_context *other)
+{
+	if (other == NULL || !other->is_smb2 || strncmp(url, "smb://", 6)) {
+		return -1;
+	}
+	file_context->url = smb2_parse_url(other->smb2, url);
+	if (file_context->url == NULL) {
+		return -1;
+	}
+	if (!same_str(file_context->url->server, other->url->server) ||
+	    !same_str(file_context->url->share, other->url->share) ||
+	    !same_str(file_context->url->domain, other->url->domain) ||
+	    !same_str(file_context->url->user, other->url->user)) {
+		smb2_destroy_url(file_context->url);
+		file_context->url = NULL;
+		return -1;
+	}
+
+	file_context->is_smb2 = 1;
+	file_context->smb2 = other->smb2;
+	file_context->shares_smb2 = 1;
+	return 0;
+}
+
 static struct file_context *
-open_file(const char *url, int flags)
+open_file(const char *url, int flags, struct file_context *other)
 {
 	struct file_context *file_context;
 
@@ -137,9 +178,14 @@ open_file(const char *url, int flags)
 	file_context->is_smb2 = 0;
 	file_context->fd     = -1;
 	file_context->smb2    = NULL;
+	file_context->shares_smb2 = 0;
 	file_context->smb2fh  = NULL;
 	file_context->url    = NULL;
 
+	if (open_on_same_share(file_context, url, other) == 0) {
+		goto open;
+	}
+
 	if (strncmp(url, "smb://", 6)) {
 		file_context->is_smb2 = 0;
 		file_context->fd = open(url, flags, 0660);
@@ -176,6 +222,7 @@ open_file(const char *url, int flags)
 		return NULL;
 	}
 
+ open:
 	file_context->smb2fh = smb2_open(file_context->smb2, file_context->url->path, flags);
 	if (file_context->smb2fh == NULL) {
 		fprintf(stderr, "Failed to open file %s: %s\n",
@@ -197,6 +244,7 @@ int main(int argc, char *argv[])
 	struct file_context *dst;
 	off_t off;
 	ssize_t count;
+	int64_t copied;
 	
 #ifdef WIN32
 	if (WSAStartup(MAKEWORD(2,2), &wsaData) != 0) {
@@ -213,13 +261,13 @@ int main(int argc, char *argv[])
 		usage();
 	}
 
-	src = open_file(argv[1], O_RDONLY);
+	src = open_file(argv[1], O_RDONLY, NULL);
 	if (src == NULL) {
 		fprintf(stderr, "Failed to open %s\n", argv[1]);
 		return 10;
 	}
 
-	dst = open_file(argv[2], O_WRONLY|O_CREAT|O_TRUNC);
+	dst = open_file(argv[2], O_WRONLY|O_CREAT|O_TRUNC, src);
 	if (dst == NULL) {
 		fprintf(stderr, "Failed to open %s\n", argv[2]);
 		free_file_context(src);
@@ -228,12 +276,22 @@ int main(int argc, char *argv[])
 
 	if (fstat_file(src, &st) != 0) {
 		fprintf(stderr, "Failed to fstat source file\n");
-		free_file_context(src);
 		free_file_context(dst);
+		free_file_context(src);
 		return 10;
 	}
 
 	off = 0;
+	/* both files are on the same share, let the server copy the data */
+	while (dst->shares_smb2 && off < st.st_size) {
+		copied = smb2_copy_range(src->smb2, src->smb2fh, off,
+					 dst->smb2fh, off, st.st_size - off);
+		if (copied <= 0) {
+			/* copy the rest through the client */
+			break;
+		}
+		off += copied;
+	}
 	while (off < st.st_size) {
 		count = (size_t)(st.st_size - off);
 		if (count > BUFSIZE) {
@@ -242,15 +300,15 @@ int main(int argc, char *argv[])
 		count = file_pread(src, buf, count, off);
 		if (count < 0) {
 			fprintf(stderr, "Failed to read from source file\n");
-			free_file_context(src);
 			free_file_context(dst);
+			free_file_context(src);
 			return 10;
 		}
 		count = file_pwrite(dst, buf, count, off);
 		if (count < 0) {
 			fprintf(stderr, "Failed to write to dest file\n");
-			free_file_context(src);
 			free_file_context(dst);
+			free_file_context(src);
 			return 10;
 		}
 
@@ -258,8 +316,8 @@ int main(int argc, char *argv[])
 	}
 	printf("copied %d bytes\n", (int)off);
 
-	free_file_context(src);
 	free_file_context(dst);
+	free_file_context(src);
 
 	return 0;
 }